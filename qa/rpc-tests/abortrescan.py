@@ -0,0 +1,69 @@
+#!/usr/bin/env python2
+# Copyright (c) 2015 The Joulecoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test stopping an import's rescan with abortrescan
+#
+
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import AuthServiceProxy, JSONRPCException
+from util import *
+
+import threading
+
+class ImportThread(threading.Thread):
+    def __init__(self, url, script):
+        threading.Thread.__init__(self)
+        # Own connection, the test keeps using the node's
+        self.node = AuthServiceProxy(url)
+        self.script = script
+        self.error = None
+
+    def run(self):
+        try:
+            self.node.importaddress(self.script, "", True)
+        except JSONRPCException as e:
+            self.error = e.error
+
+class AbortRescanTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        self.nodes = [ start_node(0, self.options.tmpdir) ]
+        self.is_network_split = False
+
+    def run_test(self):
+        node = self.nodes[0]
+
+        # Nothing to stop
+        assert_equal(node.abortrescan(), False)
+
+        node.setgenerate(True, 3000)
+
+        # Rescans of a few thousand blocks are quick, so the abort may take
+        # a few tries to catch one running
+        aborted = False
+        for i in range(20):
+            importer = ImportThread(node.url, "6a04%08x" % i)
+            importer.start()
+            while importer.is_alive() and not aborted:
+                aborted = node.abortrescan()
+            importer.join()
+            if aborted:
+                break
+            assert_equal(importer.error, None)
+        assert(aborted)
+        assert_equal(importer.error['code'], -1)
+        assert_equal(importer.error['message'], "Rescan aborted by user.")
+
+        # The stopped rescan doesn't stop the next one
+        assert_equal(node.abortrescan(), False)
+        node.importaddress("6a04ffffffff", "", True)
+
+if __name__ == '__main__':
+    AbortRescanTest().main()
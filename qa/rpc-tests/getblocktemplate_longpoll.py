@@ -87,6 +87,21 @@ class GetBlockTemplateLPTest(BitcoinTestFramework):
         thr.join(60 + 20)
         assert(not thr.is_alive())
 
+        # Test 5: long polls beyond -rpcthreads - 1 are turned away rather than answered at once
+        thrs = [LongpollThread(self.nodes[0]) for i in range(3)]
+        for thr in thrs:
+            thr.start()
+        time.sleep(2)
+        try:
+            self.nodes[0].getblocktemplate({'longpollid':thrs[0].longpollid})
+            raise AssertionError("long poll over the limit was answered")
+        except JSONRPCException as e:
+            assert_equal(e.error['code'], -1)
+        self.nodes[1].setgenerate(True, 1)
+        for thr in thrs:
+            thr.join(5)
+            assert(not thr.is_alive())
+
 if __name__ == '__main__':
     GetBlockTemplateLPTest().main()
 
@@ -10,6 +10,11 @@
 from test_framework import BitcoinTestFramework
 from util import *
 import base64
+import decimal
+import json
+import os
+import socket
+import subprocess
 
 try:
     import http.client as httplib
@@ -22,7 +27,7 @@ except ImportError:
 
 class HTTPBasicsTest (BitcoinTestFramework):        
     def setup_nodes(self):
-        return start_nodes(4, self.options.tmpdir, extra_args=[['-rpckeepalive=1'], ['-rpckeepalive=0'], [], []])
+        return start_nodes(4, self.options.tmpdir, extra_args=[['-rpckeepalive=1'], ['-rpckeepalive=0'], [], ['-rpcbatchsize=100']])
 
     def run_test(self):        
         
@@ -64,6 +69,17 @@ class HTTPBasicsTest (BitcoinTestFramework):
         assert_equal(conn.sock!=None, True) #according to http/1.1 connection must still be open!
         conn.close()
         
+        #a failed call doesn't close the connection either
+        conn = httplib.HTTPConnection(url.hostname, url.port)
+        conn.request('POST', '/', '{"method": "getblockhash", "params": [-1]}', headers)
+        resp = conn.getresponse()
+        assert_equal(resp.status, 500)
+        assert_equal(json.loads(resp.read())['error']['code'], -8)
+        assert_equal(conn.sock!=None, True)
+        conn.request('POST', '/', '{"method": "getblockcount"}', headers)
+        assert_equal(json.loads(conn.getresponse().read())['result'], self.nodes[0].getblockcount())
+        conn.close()
+
         #now do the same with "Connection: close"
         headers = {"Authorization": "Basic " + base64.b64encode(authpair), "Connection":"close"}
         
@@ -97,6 +113,140 @@ class HTTPBasicsTest (BitcoinTestFramework):
         out1 = conn.getresponse().read();
         assert_equal('"error":null' in out1, True)
         assert_equal(conn.sock!=None, True) #connection must be closed because bitcoind should use keep-alive by default
-        
+
+        ###########################################################
+        # idle keep-alive connections must not tie up rpc threads #
+        ###########################################################
+        idle = []
+        for i in range(20):
+            c = httplib.HTTPConnection(urlNode2.hostname, urlNode2.port)
+            c.connect()
+            c.request('POST', '/', '{"method": "getblockcount"}', headers)
+            assert_equal('"error":null' in c.getresponse().read(), True)
+            idle.append(c)
+
+        #far more open connections than the default 4 rpc threads, a new one is still served
+        stats = self.nodes[2].getrpcstats()
+        assert(stats['connections'] >= len(idle))
+        assert_equal(stats['workqueue']['threads'], 4)
+        assert_equal(stats['workqueue']['rejected'], 0)
+
+        #and the idle ones can go on where they left off
+        for c in idle:
+            c.request('POST', '/', '{"method": "getbestblockhash"}', headers)
+            assert_equal('"error":null' in c.getresponse().read(), True)
+            c.close()
+
+        #pipelined requests on one connection are answered in order
+        s = socket.create_connection((urlNode2.hostname, urlNode2.port))
+        request = ''
+        for i, method in enumerate(['getblockcount', 'getbestblockhash']):
+            msg = json.dumps({'method': method, 'id': i + 1})
+            request += 'POST / HTTP/1.1\r\nAuthorization: %s\r\nContent-Length: %d\r\n\r\n%s' % (headers['Authorization'], len(msg), msg)
+        s.sendall(request)
+        f = s.makefile('r')
+        for i in range(2):
+            resp = httplib.HTTPResponse(s)
+            resp.fp = f
+            resp.begin()
+            #read the body off the shared file, resp.read() would close it
+            body = f.read(int(resp.getheader('content-length')))
+            assert_equal(json.loads(body)['id'], i + 1)
+        s.close()
+
+        #lock hold times are recorded per method and lock
+        locks = self.nodes[2].getrpcstats()['locks']
+        assert(locks['getbestblockhash']['cs_main']['count'] >= len(idle))
+        assert_equal(sum(locks['getblockcount']['cs_main']['holdtimes'].values()), locks['getblockcount']['cs_main']['count'])
+
+        #so are calls, errors and traffic per method
+        try:
+            self.nodes[2].getblockhash(-1)
+        except JSONRPCException:
+            pass
+        methods = self.nodes[2].getrpcstats()['methods']
+        assert(methods['getbestblockhash']['calls'] >= len(idle))
+        assert_equal(sum(methods['getblockcount']['times'].values()), methods['getblockcount']['calls'])
+        assert_equal(methods['getblockhash']['errors'], 1)
+        assert(methods['getblockcount']['bytesin'] > 0)
+        assert(methods['getblockcount']['bytesout'] > 0)
+
+        #and served to Prometheus, to the same users as the RPC interface
+        conn = httplib.HTTPConnection(urlNode2.hostname, urlNode2.port)
+        conn.request('GET', '/metrics', '', headers)
+        resp = conn.getresponse()
+        assert_equal(resp.status, 200)
+        metrics = resp.read()
+        assert('joulecoin_rpc_calls_total{method="getblockhash"} 1\n' in metrics)
+        assert('joulecoin_rpc_errors_total{method="getblockhash"} 1\n' in metrics)
+        assert('joulecoin_rpc_duration_seconds_count{method="getblockhash"} 1\n' in metrics)
+        assert('joulecoin_rpc_duration_seconds_bucket{method="getblockhash",le="+Inf"} 1\n' in metrics)
+        conn.close()
+        conn = httplib.HTTPConnection(urlNode2.hostname, urlNode2.port)
+        conn.request('GET', '/metrics')
+        assert_equal(conn.getresponse().status, 401)
+        conn.close()
+        conn = httplib.HTTPConnection(urlNode2.hostname, urlNode2.port)
+        conn.request('GET', '/metrics', '', {"Authorization": "Basic " + base64.b64encode(urlNode2.username + ':wrong')})
+        assert_equal(conn.getresponse().status, 401)
+        conn.close()
+
+        #batches are answered in order, also around calls that take the wallet lock
+        urlNode3 = urlparse.urlparse(self.nodes[3].url)
+        authpair = urlNode3.username + ':' + urlNode3.password
+        headers = {"Authorization": "Basic " + base64.b64encode(authpair)}
+        batch = [{'method': 'getblockhash', 'params': [i % 10], 'id': i} for i in range(100)]
+        batch[50] = {'method': 'getinfo', 'id': 50}
+        methods = self.nodes[3].getrpcstats()['methods']
+        bytesin = dict((m, methods[m]['bytesin'] if m in methods else 0) for m in ['getblockhash', 'getinfo'])
+        conn = httplib.HTTPConnection(urlNode3.hostname, urlNode3.port)
+        conn.request('POST', '/', json.dumps(batch), headers)
+        replies = json.loads(conn.getresponse().read())
+        #each element is counted as its own text in the body received
+        methods = self.nodes[3].getrpcstats()['methods']
+        assert_equal(methods['getinfo']['bytesin'] - bytesin['getinfo'], len(json.dumps(batch[50])))
+        assert_equal(methods['getblockhash']['bytesin'] - bytesin['getblockhash'], sum(len(json.dumps(r)) for r in batch if r['id'] != 50))
+        assert_equal([r['id'] for r in replies], range(100))
+        assert_equal(replies[50]['result']['blocks'], self.nodes[3].getblockcount())
+        for i in range(100):
+            if i != 50:
+                assert_equal(replies[i]['result'], self.nodes[3].getblockhash(i % 10))
+
+        #and larger batches than -rpcbatchsize are refused
+        conn.request('POST', '/', json.dumps(batch + batch), headers)
+        resp = conn.getresponse()
+        assert_equal(json.loads(resp.read())['error']['code'], -32600)
+
+        #large results are streamed back chunked, on the same keep-alive connection
+        besthash = self.nodes[3].getbestblockhash()
+        conn.request('POST', '/', json.dumps({'method': 'getblock', 'params': [besthash], 'id': 1}), headers)
+        resp = conn.getresponse()
+        assert_equal(resp.getheader('transfer-encoding'), 'chunked')
+        reply = json.loads(resp.read(), parse_float=decimal.Decimal)
+        assert_equal(reply['id'], 1)
+        assert_equal(reply['error'], None)
+        assert_equal(reply['result'], self.nodes[3].getblock(besthash))
+        conn.request('POST', '/', json.dumps({'method': 'getblockcount', 'id': 2}), headers)
+        assert_equal(json.loads(conn.getresponse().read())['result'], self.nodes[3].getblockcount())
+        conn.close()
+
+        #the cli sends commands from stdin pipelined or batched, results come back in order
+        commands = ''.join('getblockhash %d\n' % (i % 10) for i in range(50)) + 'getblockhash -1\ngetblockcount\n'
+        expected = [self.nodes[0].getblockhash(i % 10) for i in range(50)] + [str(self.nodes[0].getblockcount())]
+        for batch in ['1', '7']:
+            cli = subprocess.Popen([os.getenv("BITCOINCLI", "bitcoin-cli"), "-datadir=" + os.path.join(self.options.tmpdir, "node0"),
+                                    "-stdin", "-stdinbatch=" + batch],
+                                   stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+            out, err = cli.communicate(commands)
+            assert_equal(out.split(), expected)
+            assert('"code":-8' in err)
+
+        #arguments quoted as in a shell keep their whitespace, unterminated quotes are reported
+        cli = subprocess.Popen([os.getenv("BITCOINCLI", "bitcoin-cli"), "-datadir=" + os.path.join(self.options.tmpdir, "node0"), "-stdin"],
+                               stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        out, err = cli.communicate('validateaddress "not an address"\nvalidateaddress not\\ one\\ either\ngetblockhash \'1\n')
+        assert_equal(out.count('"isvalid": false'), 2)
+        assert_equal(err.strip(), "error: unterminated ' quote")
+
 if __name__ == '__main__':
     HTTPBasicsTest ().main ()
@@ -0,0 +1,86 @@
+#!/usr/bin/env python2
+# Copyright (c) 2015 The Joulecoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the push notification publishers
+#
+
+from test_framework import BitcoinTestFramework
+from util import *
+
+from binascii import b2a_hex
+from hashlib import sha256
+from struct import unpack
+import socket
+
+def push_port(n):
+    return 14000 + n + os.getpid()%999
+
+def sha256d(data):
+    return sha256(sha256(data).digest()).digest()
+
+class Subscriber(object):
+    def __init__(self, port):
+        self.sock = socket.create_connection(('127.0.0.1', port), 30)
+        self.f = self.sock.makefile('rb')
+
+    def read_compact(self):
+        n = ord(self.f.read(1))
+        if n == 253:
+            return unpack('<H', self.f.read(2))[0]
+        if n == 254:
+            return unpack('<I', self.f.read(4))[0]
+        if n == 255:
+            return unpack('<Q', self.f.read(8))[0]
+        return n
+
+    def receive(self):
+        '''Returns topic, body and sequence number of the next message'''
+        topic = self.f.read(self.read_compact())
+        body = self.f.read(self.read_compact())
+        sequence = unpack('<I', self.f.read(4))[0]
+        return topic, body, sequence
+
+class PushNotifyTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        # Two topics share the first address, one gets its own
+        address = "127.0.0.1:%d" % push_port(0)
+        self.nodes = [ start_node(0, self.options.tmpdir, ["-pubhashblock="+address, "-pubrawtx="+address,
+                                                           "-pubhashtx=127.0.0.1:%d" % push_port(1)]) ]
+        self.is_network_split = False
+
+    def run_test(self):
+        node = self.nodes[0]
+        blocks = Subscriber(push_port(0))
+        txs = Subscriber(push_port(1))
+        # Give the publisher a moment to take on the subscribers
+        time.sleep(1)
+
+        # Every new tip and the transactions in it are published
+        hashes = node.setgenerate(True, 2)
+        for i in range(2):
+            # Transactions are connected before the tip moves on
+            topic, body, sequence = blocks.receive()
+            assert_equal(topic, 'rawtx')
+            assert_equal(b2a_hex(sha256d(body)[::-1]), node.getblock(hashes[i])['tx'][0])
+            assert_equal(sequence, i)
+
+            topic, body, sequence = blocks.receive()
+            assert_equal(topic, 'hashblock')
+            assert_equal(b2a_hex(body), hashes[i])
+            assert_equal(sequence, i)
+
+            topic, body, sequence = txs.receive()
+            assert_equal(topic, 'hashtx')
+            assert_equal(b2a_hex(body), node.getblock(hashes[i])['tx'][0])
+            assert_equal(sequence, i)
+
+if __name__ == '__main__':
+    PushNotifyTest().main()
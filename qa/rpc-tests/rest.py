@@ -9,6 +9,7 @@
 
 from test_framework import BitcoinTestFramework
 from util import *
+import binascii
 import json
 
 try:
@@ -58,6 +59,40 @@ class RESTTest (BitcoinTestFramework):
         assert_equal(response.status, 200)
         assert_greater_than(int(response.getheader('content-length')), 10)
         
+        # headers come back to back, 80 bytes each, starting with the given block
+        hash_at_1 = self.nodes[0].getblockhash(1)
+        response = http_get_call(url.hostname, url.port, '/rest/headers/5/'+hash_at_1+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response.status, 200)
+        headers = response.read()
+        assert_equal(len(headers), 5*80)
+        response = http_get_call(url.hostname, url.port, '/rest/block/'+hash_at_1+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response.read()[:80], headers[:80])
+        hex_string = http_get_call(url.hostname, url.port, '/rest/headers/5/'+hash_at_1+self.FORMAT_SEPARATOR+"hex")
+        assert_equal(hex_string.strip(), binascii.hexlify(headers))
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/headers/5/'+hash_at_1+self.FORMAT_SEPARATOR+"json"))
+        assert_equal([h['hash'] for h in json_obj], [self.nodes[0].getblockhash(i) for i in range(1, 6)])
+
+        # a count beyond the tip stops at the tip
+        response = http_get_call(url.hostname, url.port, '/rest/headers/2000/'+bb_hash+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(len(response.read()), 80)
+        response = http_get_call(url.hostname, url.port, '/rest/headers/2001/'+bb_hash+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response.status, 400)
+
+        # chain info
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/chaininfo'+self.FORMAT_SEPARATOR+"json"))
+        assert_equal(json_obj['bestblockhash'], bb_hash)
+        response = http_get_call(url.hostname, url.port, '/rest/chaininfo'+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response.status, 404)
+
+        # the coinbase of the tip is unspent, an output past its end is not
+        cb_txid = self.nodes[0].getblock(bb_hash)['tx'][0]
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/getutxos/'+cb_txid+'-0/'+cb_txid+'-9'+self.FORMAT_SEPARATOR+'json'))
+        assert_equal(json_obj['chaintipHash'], bb_hash)
+        assert_equal(json_obj['bitmap'], "10")
+        assert_equal(len(json_obj['utxos']), 1)
+        response = http_get_call(url.hostname, url.port, '/rest/getutxos/'+'/'.join([cb_txid+'-0']*501)+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 400)
+
         # check block tx details
         # let's make 3 tx and mine them on node 1
         txs = []
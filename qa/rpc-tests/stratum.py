@@ -0,0 +1,136 @@
+#!/usr/bin/env python2
+# Copyright (c) 2015 The Joulecoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the built-in Stratum mining server
+#
+
+from test_framework import BitcoinTestFramework
+from util import *
+
+from binascii import a2b_hex, b2a_hex
+from hashlib import sha256
+from struct import pack
+import json
+import socket
+
+def stratum_port(n):
+    return 13000 + n + os.getpid()%999
+
+def sha256d(data):
+    return sha256(sha256(data).digest()).digest()
+
+def compact_to_target(nbits):
+    return (nbits & 0xffffff) << (8 * ((nbits >> 24) - 3))
+
+class StratumClient(object):
+    def __init__(self, port):
+        self.sock = socket.create_connection(('127.0.0.1', port), 30)
+        self.f = self.sock.makefile('r')
+        self.nextid = 1
+        self.notifications = []
+
+    def request(self, method, params):
+        reqid = self.nextid
+        self.nextid += 1
+        self.sock.sendall(json.dumps({'id': reqid, 'method': method, 'params': params}) + '\n')
+        while True:
+            msg = json.loads(self.f.readline())
+            if msg['id'] == reqid:
+                return msg
+            self.notifications.append(msg)
+
+    def notification(self, method):
+        while True:
+            for i, msg in enumerate(self.notifications):
+                if msg['method'] == method:
+                    return self.notifications.pop(i)['params']
+            self.notifications.append(json.loads(self.f.readline()))
+
+def solve(job, extranonce1, extranonce2, ntime, want_block):
+    '''
+    Find a nonce for job whose header hash does (want_block) or does not
+    meet the block target.
+    '''
+    coinbase = a2b_hex(job[2] + extranonce1 + extranonce2 + job[3])
+    root = sha256d(coinbase)
+    for h in job[4]:
+        root = sha256d(root + a2b_hex(h))
+    prevhash = a2b_hex(job[1])
+    prevhash = ''.join(prevhash[i:i+4][::-1] for i in range(0, 32, 4))
+    nbits = int(job[6], 16)
+    target = compact_to_target(nbits)
+    header = pack('<I', int(job[5], 16)) + prevhash + root + pack('<II', ntime, nbits)
+    for nonce in xrange(1 << 16):
+        h = int(b2a_hex(sha256d(header + pack('<I', nonce))[::-1]), 16)
+        if (h <= target) == want_block:
+            return '%08x' % nonce
+    raise AssertionError("No nonce found")
+
+class StratumTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 1)
+
+    def setup_network(self):
+        self.nodes = [ start_node(0, self.options.tmpdir) ]
+        address = self.nodes[0].getnewaddress()
+        stop_node(self.nodes[0], 0)
+        wait_bitcoinds()
+        self.nodes = [ start_node(0, self.options.tmpdir, ["-stratum", "-stratumaddress="+address,
+                                                           "-stratumport=%d" % stratum_port(0)]) ]
+        self.is_network_split = False
+
+    def run_test(self):
+        node = self.nodes[0]
+        # Leave initial block download so that the server hands out work
+        node.setgenerate(True, 1)
+
+        miner = StratumClient(stratum_port(0))
+        result = miner.request('mining.subscribe', [])['result']
+        extranonce1 = result[1]
+        assert_equal(result[2], 4)
+        assert(miner.request('mining.authorize', ['worker', 'x'])['result'])
+        assert_equal(miner.notification('mining.set_difficulty'), [1.0])
+        job = miner.notification('mining.notify')
+        assert_equal(job[8], True)
+
+        # Every connection searches its own extranonce space
+        other = StratumClient(stratum_port(0))
+        assert(other.request('mining.subscribe', [])['result'][1] != extranonce1)
+
+        # Miners that haven't authorized can't submit
+        assert_equal(other.request('mining.submit', ['worker', job[0], '00000000', job[7], '00000000'])['error'][0], 24)
+
+        # A share that solves the block is accepted and extends the chain
+        ntime = int(job[7], 16)
+        nonce = solve(job, extranonce1, '00000001', ntime, True)
+        count = node.getblockcount()
+        submit = ['worker', job[0], '00000001', job[7], nonce]
+        assert_equal(miner.request('mining.submit', submit)['error'], None)
+        assert_equal(node.getblockcount(), count + 1)
+
+        # Once the new tip arrives the job is stale, but resubmitting is still a duplicate
+        stale = job[0]
+        job = miner.notification('mining.notify')
+        assert_equal(job[8], True)
+        assert_equal(miner.request('mining.submit', submit)['error'][0], 22)
+        assert_equal(miner.request('mining.submit', ['worker', stale, '00000002', job[7], nonce])['error'][0], 21)
+
+        # At a high share difficulty anything short of a block is rejected
+        assert(miner.request('mining.suggest_difficulty', [1000000])['result'])
+        assert_equal(miner.notification('mining.set_difficulty'), [1000000.0])
+        job = miner.notification('mining.notify')
+        ntime = int(job[7], 16)
+        nonce = solve(job, extranonce1, '00000003', ntime, False)
+        assert_equal(miner.request('mining.submit', ['worker', job[0], '00000003', job[7], nonce])['error'][0], 23)
+        assert_equal(node.getblockcount(), count + 1)
+
+        # Bad time is refused
+        assert_equal(miner.request('mining.submit', ['worker', job[0], '00000004', '00000001', nonce])['error'][0], 20)
+
+if __name__ == '__main__':
+    StratumTest().main()
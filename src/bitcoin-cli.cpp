@@ -10,14 +10,32 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <deque>
+
+#include <boost/algorithm/string.hpp>
 #include <boost/filesystem/operations.hpp>
+#include <boost/foreach.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #define _(x) std::string(x) /* Keep the _() around in case gettext or such will be used later to translate non-UI */
 
 using namespace std;
 using namespace boost;
 using namespace boost::asio;
-using namespace json_spirit;
+
+/** Requests sent ahead on one connection before waiting for the first reply */
+static const unsigned int CLI_PIPELINE_DEPTH = 16;
+/**
+ * Bytes of requests sent ahead. The server reads the next request only
+ * after answering the last, so this has to fit the socket buffers.
+ */
+static const size_t CLI_PIPELINE_BYTES = 32 * 1024;
 
 std::string HelpMessageCli()
 {
@@ -34,6 +52,8 @@ std::string HelpMessageCli()
     strUsage += "  -rpcwait               " + _("Wait for RPC server to start") + "\n";
     strUsage += "  -rpcuser=<user>        " + _("Username for JSON-RPC connections") + "\n";
     strUsage += "  -rpcpassword=<pw>      " + _("Password for JSON-RPC connections") + "\n";
+    strUsage += "  -stdin                 " + _("Read commands from standard input, one per line with arguments quoted as in a shell, and send them all over one connection") + "\n";
+    strUsage += "  -stdinbatch=<n>        " + _("With -stdin, send up to <n> commands in one JSON-RPC batch request (default: 1)") + "\n";
 
     strUsage += "\n" + _("SSL options: (see the Bitcoin Wiki for SSL setup instructions)") + "\n";
     strUsage += "  -rpcssl                " + _("Use OpenSSL (https) for JSON-RPC connections") + "\n";
@@ -72,7 +92,8 @@ static bool AppInitRPC(int argc, char* argv[])
             strUsage += "\n" + _("Usage:") + "\n" +
                   "  joulecoin-cli [options] <command> [params]  " + _("Send command to Joulecoin Core") + "\n" +
                   "  joulecoin-cli [options] help                " + _("List commands") + "\n" +
-                  "  joulecoin-cli [options] help <command>      " + _("Get help for a command") + "\n";
+                  "  joulecoin-cli [options] help <command>      " + _("Get help for a command") + "\n" +
+                  "  joulecoin-cli [options] -stdin < commands   " + _("Send the commands read from standard input") + "\n";
 
             strUsage += "\n" + HelpMessageCli();
         }
@@ -98,7 +119,31 @@ static bool AppInitRPC(int argc, char* argv[])
     return true;
 }
 
-Object CallRPC(const string& strMethod, const Array& params)
+/** An HTTP connection to the server, over which requests can be sent one after another */
+class CRPCClient
+{
+private:
+    asio::io_service io_service;
+    ssl::context context;
+    // Created once the context is set up
+    boost::scoped_ptr< asio::ssl::stream<asio::ip::tcp::socket> > sslStream;
+    boost::scoped_ptr< iostreams::stream< SSLIOStreamDevice<asio::ip::tcp> > > stream;
+    map<string, string> mapRequestHeaders;
+    bool fClosed;
+
+public:
+    CRPCClient();
+
+    void Send(const string& strRequest, bool fKeepAlive);
+    /** Read the next reply, a single object or the array answering a batch */
+    UniValue Receive();
+    /** Whether the server closed the connection after the last reply */
+    bool IsClosed() const { return fClosed; }
+};
+
+CRPCClient::CRPCClient() :
+    context(io_service, ssl::context::sslv23),
+    fClosed(false)
 {
     if (mapArgs["-rpcuser"] == "" && mapArgs["-rpcpassword"] == "")
         throw runtime_error(strprintf(
@@ -108,12 +153,10 @@ Object CallRPC(const string& strMethod, const Array& params)
 
     // Connect to localhost
     bool fUseSSL = GetBoolArg("-rpcssl", false);
-    asio::io_service io_service;
-    ssl::context context(io_service, ssl::context::sslv23);
     context.set_options(ssl::context::no_sslv2 | ssl::context::no_sslv3);
-    asio::ssl::stream<asio::ip::tcp::socket> sslStream(io_service, context);
-    SSLIOStreamDevice<asio::ip::tcp> d(sslStream, fUseSSL);
-    iostreams::stream< SSLIOStreamDevice<asio::ip::tcp> > stream(d);
+    sslStream.reset(new asio::ssl::stream<asio::ip::tcp::socket>(io_service, context));
+    SSLIOStreamDevice<asio::ip::tcp> d(*sslStream, fUseSSL);
+    stream.reset(new iostreams::stream< SSLIOStreamDevice<asio::ip::tcp> >(d));
 
     const bool fConnected = d.connect(GetArg("-rpcconnect", "127.0.0.1"), GetArg("-rpcport", itostr(BaseParams().RPCPort())));
     if (!fConnected)
@@ -121,22 +164,25 @@ Object CallRPC(const string& strMethod, const Array& params)
 
     // HTTP basic authentication
     string strUserPass64 = EncodeBase64(mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"]);
-    map<string, string> mapRequestHeaders;
     mapRequestHeaders["Authorization"] = string("Basic ") + strUserPass64;
+}
 
-    // Send request
-    string strRequest = JSONRPCRequest(strMethod, params, 1);
-    string strPost = HTTPPost(strRequest, mapRequestHeaders);
-    stream << strPost << std::flush;
+void CRPCClient::Send(const string& strRequest, bool fKeepAlive)
+{
+    *stream << HTTPPost(strRequest, mapRequestHeaders, fKeepAlive) << std::flush;
+}
 
+UniValue CRPCClient::Receive()
+{
     // Receive HTTP reply status
     int nProto = 0;
-    int nStatus = ReadHTTPStatus(stream, nProto);
+    int nStatus = ReadHTTPStatus(*stream, nProto);
 
     // Receive HTTP reply message headers and body
     map<string, string> mapHeaders;
     string strReply;
-    ReadHTTPMessage(stream, mapHeaders, strReply, nProto, std::numeric_limits<size_t>::max());
+    ReadHTTPMessage(*stream, mapHeaders, strReply, nProto, std::numeric_limits<size_t>::max());
+    fClosed = mapHeaders["connection"] != "keep-alive";
 
     if (nStatus == HTTP_UNAUTHORIZED)
         throw runtime_error("incorrect rpcuser or rpcpassword (authorization failed)");
@@ -146,21 +192,256 @@ Object CallRPC(const string& strMethod, const Array& params)
         throw runtime_error("no response from server");
 
     // Parse reply
-    Value valReply;
-    if (!read_string(strReply, valReply))
+    UniValue valReply;
+    if (!valReply.read(strReply))
         throw runtime_error("couldn't parse reply from server");
-    const Object& reply = valReply.get_obj();
+    return valReply;
+}
+
+UniValue CallRPC(const string& strMethod, const UniValue& params)
+{
+    CRPCClient client;
+
+    // Send request
+    client.Send(JSONRPCRequest(strMethod, params, 1), false);
+
+    const UniValue valReply = client.Receive();
+    const UniValue& reply = valReply.get_obj();
     if (reply.empty())
         throw runtime_error("expected reply to have result, error and id properties");
 
     return reply;
 }
 
+/** The text printed for the result of a command */
+static string FormatResult(const UniValue& result)
+{
+    if (result.type() == UniValue::VNULL)
+        return "";
+    else if (result.type() == UniValue::VSTR)
+        return result.get_str();
+    return result.write(4);
+}
+
+/**
+ * Requests pipelined over one keep-alive connection. Until the server has
+ * shown it keeps connections open, requests are sent one at a time; a
+ * server that closes them gets a new connection for every request.
+ */
+class CRPCPipeline
+{
+private:
+    boost::scoped_ptr<CRPCClient> client;
+    std::deque<size_t> queueSent;
+    size_t nBytesSent;
+    bool fKeepAlive;
+    int nRet;
+
+    /** Print every reply to one request, in order */
+    void Print(const UniValue& valReply)
+    {
+        std::vector<UniValue> vReply;
+        if (valReply.type() == UniValue::VARR)
+            vReply = valReply.getValues();
+        else
+            vReply.push_back(valReply);
+
+        BOOST_FOREACH(const UniValue& reply, vReply)
+        {
+            const UniValue& result = find_value(reply, "result");
+            const UniValue& error  = find_value(reply, "error");
+            if (error.type() != UniValue::VNULL) {
+                fprintf(stderr, "error: %s\n", error.write().c_str());
+                nRet = abs(find_value(error, "code").get_int());
+            } else {
+                string strPrint = FormatResult(result);
+                if (strPrint != "")
+                    fprintf(stdout, "%s\n", strPrint.c_str());
+            }
+        }
+        // Results show up as they arrive, also when written to a pipe
+        fflush(stdout);
+    }
+
+public:
+    CRPCPipeline() : nBytesSent(0), fKeepAlive(false), nRet(0) {}
+
+    /** Send a request, first waiting for replies if too many are outstanding */
+    void Send(const string& strRequest)
+    {
+        while (!queueSent.empty() &&
+               (!fKeepAlive || queueSent.size() >= CLI_PIPELINE_DEPTH || nBytesSent + strRequest.size() > CLI_PIPELINE_BYTES))
+            ReceiveOne();
+
+        while (!client)
+        {
+            try {
+                client.reset(new CRPCClient());
+            }
+            catch (const CConnectionFailed& e) {
+                if (!GetBoolArg("-rpcwait", false))
+                    throw;
+                MilliSleep(1000);
+            }
+        }
+        client->Send(strRequest, true);
+        queueSent.push_back(strRequest.size());
+        nBytesSent += strRequest.size();
+    }
+
+    void ReceiveOne()
+    {
+        UniValue valReply = client->Receive();
+        nBytesSent -= queueSent.front();
+        queueSent.pop_front();
+        Print(valReply);
+
+        fKeepAlive = !client->IsClosed();
+        if (!fKeepAlive)
+        {
+            if (!queueSent.empty())
+                throw runtime_error("server closed the connection");
+            client.reset();
+        }
+    }
+
+    /** Wait for the replies to all requests sent */
+    void Flush()
+    {
+        while (!queueSent.empty())
+            ReceiveOne();
+    }
+
+    /** Report a command that could not be sent, after the replies to those before it */
+    void Fail(const string& strError)
+    {
+        Flush();
+        fprintf(stderr, "error: %s\n", strError.c_str());
+        nRet = EXIT_FAILURE;
+    }
+
+    /** The error code of the last command that failed, or 0 */
+    int GetResult() const { return nRet; }
+};
+
+static bool StdinIsTerminal()
+{
+#ifdef WIN32
+    return _isatty(_fileno(stdin));
+#else
+    return isatty(fileno(stdin));
+#endif
+}
+
+/**
+ * Split a line read from stdin into arguments at whitespace, the way a shell
+ * would: single or double quotes keep whitespace in an argument and may
+ * make an empty one, and outside single quotes a backslash takes the next
+ * character as it is.
+ */
+static std::vector<std::string> SplitCommandLine(const std::string& strLine)
+{
+    std::vector<std::string> vArgs;
+    std::string strArg;
+    bool fInArg = false;
+    char chQuote = 0;
+    for (std::string::const_iterator it = strLine.begin(); it != strLine.end(); ++it)
+    {
+        char ch = *it;
+        if (chQuote == 0 && (ch == ' ' || ch == '\t'))
+        {
+            if (fInArg)
+                vArgs.push_back(strArg);
+            strArg.clear();
+            fInArg = false;
+            continue;
+        }
+        fInArg = true;
+        if (ch == '\\' && chQuote != '\'')
+        {
+            if (++it == strLine.end())
+                throw runtime_error("backslash at end of line");
+            strArg += *it;
+        }
+        else if (chQuote == 0 && (ch == '\'' || ch == '"'))
+            chQuote = ch;
+        else if (ch == chQuote)
+            chQuote = 0;
+        else
+            strArg += ch;
+    }
+    if (chQuote != 0)
+        throw runtime_error(strprintf("unterminated %c quote", chQuote));
+    if (fInArg)
+        vArgs.push_back(strArg);
+    return vArgs;
+}
+
+/**
+ * Send the commands read from stdin, one per line with the method and its
+ * parameters separated by whitespace and quoted as in a shell. Results and errors are printed in
+ * the order of the commands, as separate invocations would print them.
+ */
+static int StdinRPC()
+{
+    const size_t nBatchSize = std::max(GetArg("-stdinbatch", 1), (int64_t)1);
+    // Someone typing commands wants each answered before writing the next
+    const bool fInteractive = StdinIsTerminal();
+
+    CRPCPipeline pipeline;
+    UniValue batch(UniValue::VARR);
+    int nId = 0;
+    string strLine;
+    while (std::getline(std::cin, strLine))
+    {
+        boost::trim(strLine);
+        if (strLine.empty() || strLine[0] == '#')
+            continue;
+        string strMethod;
+        UniValue params;
+        try {
+            std::vector<std::string> vArgs = SplitCommandLine(strLine);
+            if (vArgs.empty())
+                throw runtime_error("no method given");
+            strMethod = vArgs[0];
+            params = RPCConvertValues(strMethod, std::vector<std::string>(vArgs.begin() + 1, vArgs.end()));
+        }
+        catch (std::exception& e) {
+            if (!batch.empty())
+                pipeline.Send(batch.write());
+            batch = UniValue(UniValue::VARR);
+            pipeline.Fail(e.what());
+            continue;
+        }
+
+        if (nBatchSize == 1)
+            pipeline.Send(JSONRPCRequest(strMethod, params, ++nId));
+        else
+        {
+            batch.push_back(JSONRPCRequestObj(strMethod, params, ++nId));
+            if (batch.size() >= nBatchSize || fInteractive)
+            {
+                pipeline.Send(batch.write());
+                batch = UniValue(UniValue::VARR);
+            }
+        }
+        if (fInteractive)
+            pipeline.Flush();
+    }
+    if (!batch.empty())
+        pipeline.Send(batch.write());
+    pipeline.Flush();
+    return pipeline.GetResult();
+}
+
 int CommandLineRPC(int argc, char *argv[])
 {
     string strPrint;
     int nRet = 0;
     try {
+        if (GetBoolArg("-stdin", false))
+            return StdinRPC();
+
         // Skip switches
         while (argc > 1 && IsSwitchChar(argv[1][0])) {
             argc--;
@@ -174,33 +455,28 @@ int CommandLineRPC(int argc, char *argv[])
 
         // Parameters default to strings
         std::vector<std::string> strParams(&argv[2], &argv[argc]);
-        Array params = RPCConvertValues(strMethod, strParams);
+        UniValue params = RPCConvertValues(strMethod, strParams);
 
         // Execute and handle connection failures with -rpcwait
         const bool fWait = GetBoolArg("-rpcwait", false);
         do {
             try {
-                const Object reply = CallRPC(strMethod, params);
+                const UniValue reply = CallRPC(strMethod, params);
 
                 // Parse reply
-                const Value& result = find_value(reply, "result");
-                const Value& error  = find_value(reply, "error");
+                const UniValue& result = find_value(reply, "result");
+                const UniValue& error  = find_value(reply, "error");
 
-                if (error.type() != null_type) {
+                if (error.type() != UniValue::VNULL) {
                     // Error
                     const int code = find_value(error.get_obj(), "code").get_int();
                     if (fWait && code == RPC_IN_WARMUP)
                         throw CConnectionFailed("server in warmup");
-                    strPrint = "error: " + write_string(error, false);
+                    strPrint = "error: " + error.write();
                     nRet = abs(code);
                 } else {
                     // Result
-                    if (result.type() == null_type)
-                        strPrint = "";
-                    else if (result.type() == str_type)
-                        strPrint = result.get_str();
-                    else
-                        strPrint = write_string(result, true);
+                    strPrint = FormatResult(result);
                 }
 
                 // Connection succeeded, no need to retry.
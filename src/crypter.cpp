@@ -4,6 +4,7 @@
 
 #include "crypter.h"
 
+#include "crypto/sha512.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "util.h"
@@ -21,8 +22,18 @@ bool CCrypter::SetKeyFromPassphrase(const SecureString& strKeyData, const std::v
 
     int i = 0;
     if (nDerivationMethod == 0)
-        i = EVP_BytesToKey(EVP_aes_256_cbc(), EVP_sha512(), &chSalt[0],
-                          (unsigned char *)&strKeyData[0], strKeyData.size(), nRounds, chKey, chIV);
+    {
+        // What EVP_BytesToKey(EVP_aes_256_cbc(), EVP_sha512(), ...) derives:
+        // the key and IV both come out of the first digest, so that is all
+        // there is to it, and each further round rehashes a lone digest
+        unsigned char buf[CSHA512::OUTPUT_SIZE];
+        CSHA512().Write((const unsigned char*)&strKeyData[0], strKeyData.size()).Write(&chSalt[0], chSalt.size()).Finalize(buf);
+        SHA512Rehash(buf, nRounds - 1);
+        memcpy(chKey, buf, WALLET_CRYPTO_KEY_SIZE);
+        memcpy(chIV, buf + WALLET_CRYPTO_KEY_SIZE, AES_BLOCK_SIZE);
+        OPENSSL_cleanse(buf, sizeof(buf));
+        i = WALLET_CRYPTO_KEY_SIZE;
+    }
 
     if (i != (int)WALLET_CRYPTO_KEY_SIZE)
     {
@@ -197,6 +208,16 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
     return true;
 }
 
+bool CCryptoKeyStore::EncryptKey(const CKey& key, const CPubKey& pubkey, std::vector<unsigned char>& vchCryptedSecret) const
+{
+    LOCK(cs_KeyStore);
+    if (IsLocked())
+        return false;
+
+    CKeyingMaterial vchSecret(key.begin(), key.end());
+    return EncryptSecret(vMasterKey, vchSecret, pubkey.GetHash(), vchCryptedSecret);
+}
+
 bool CCryptoKeyStore::AddKeyPubKey(const CKey& key, const CPubKey &pubkey)
 {
     {
@@ -204,12 +225,8 @@ bool CCryptoKeyStore::AddKeyPubKey(const CKey& key, const CPubKey &pubkey)
         if (!IsCrypted())
             return CBasicKeyStore::AddKeyPubKey(key, pubkey);
 
-        if (IsLocked())
-            return false;
-
         std::vector<unsigned char> vchCryptedSecret;
-        CKeyingMaterial vchSecret(key.begin(), key.end());
-        if (!EncryptSecret(vMasterKey, vchSecret, pubkey.GetHash(), vchCryptedSecret))
+        if (!EncryptKey(key, pubkey, vchCryptedSecret))
             return false;
 
         if (!AddCryptedKey(pubkey, vchCryptedSecret))
@@ -227,6 +244,7 @@ bool CCryptoKeyStore::AddCryptedKey(const CPubKey &vchPubKey, const std::vector<
             return false;
 
         mapCryptedKeys[vchPubKey.GetID()] = make_pair(vchPubKey, vchCryptedSecret);
+        filter.AddID(vchPubKey.GetID());
     }
     return true;
 }
@@ -133,6 +133,9 @@ private:
 protected:
     bool SetCrypted();
 
+    //! Encrypt a key's secret with the master key; fails when locked
+    bool EncryptKey(const CKey& key, const CPubKey& pubkey, std::vector<unsigned char>& vchCryptedSecret) const;
+
     //! will encrypt previously unencrypted keys
     bool EncryptKeys(CKeyingMaterial& vMasterKeyIn);
 
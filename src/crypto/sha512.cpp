@@ -146,6 +146,14 @@ void Transform(uint64_t* s, const unsigned char* chunk)
 
 } // namespace sha512
 
+/** Zero memory through a volatile pointer, so the stores can't be dropped as dead. */
+void Cleanse(void* ptr, size_t len)
+{
+    volatile unsigned char* p = (volatile unsigned char*)ptr;
+    while (len--)
+        *p++ = 0;
+}
+
 } // namespace
 
 
@@ -205,3 +213,21 @@ CSHA512& CSHA512::Reset()
     sha512::Initialize(s);
     return *this;
 }
+
+void SHA512Rehash(unsigned char hash[CSHA512::OUTPUT_SIZE], unsigned int nRounds)
+{
+    unsigned char chunk[128] = {0x00};
+    memcpy(chunk, hash, CSHA512::OUTPUT_SIZE);
+    chunk[64] = 0x80;
+    WriteBE64(chunk + 120, CSHA512::OUTPUT_SIZE << 3);
+    uint64_t s[8];
+    for (unsigned int i = 0; i < nRounds; i++) {
+        sha512::Initialize(s);
+        sha512::Transform(s, chunk);
+        for (int j = 0; j < 8; j++)
+            WriteBE64(chunk + 8 * j, s[j]);
+    }
+    memcpy(hash, chunk, CSHA512::OUTPUT_SIZE);
+    Cleanse(chunk, sizeof(chunk));
+    Cleanse(s, sizeof(s));
+}
@@ -25,4 +25,11 @@ public:
     CSHA512& Reset();
 };
 
+/**
+ * Replace hash by the SHA-512 of itself, nRounds times over. A 64-byte
+ * message and its padding fill exactly one block, so each round is a single
+ * transformation of a block prepared once.
+ */
+void SHA512Rehash(unsigned char hash[CSHA512::OUTPUT_SIZE], unsigned int nRounds);
+
 #endif // BITCOIN_CRYPTO_SHA512_H
@@ -29,6 +29,9 @@ using namespace boost;
 
 unsigned int nWalletDBUpdated;
 
+//! The outermost batch of each file the current thread has one on
+static boost::thread_specific_ptr<std::map<std::string, CDBBatch*> > ptsBatches;
+
 
 //
 // CDB
@@ -218,7 +221,7 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode) : pdb(NULL), activeTxn(NULL)
+CDB::CDB(const std::string& strFilename, const char* pszMode) : pdb(NULL), activeTxn(NULL), pbatch(NULL)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -274,11 +277,20 @@ CDB::CDB(const std::string& strFilename, const char* pszMode) : pdb(NULL), activ
             bitdb.mapDb[strFile] = pdb;
         }
     }
+
+    if (ptsBatches.get()) {
+        map<string, CDBBatch*>::iterator it = ptsBatches->find(strFile);
+        if (it != ptsBatches->end()) {
+            pbatch = it->second;
+            activeTxn = pbatch->ptxn;
+        }
+    }
 }
 
 void CDB::Flush()
 {
-    if (activeTxn)
+    // Batches are flushed once they commit
+    if (activeTxn || pbatch)
         return;
 
     // Flush database activity from memory pool to disk log
@@ -293,12 +305,13 @@ void CDB::Close()
 {
     if (!pdb)
         return;
-    if (activeTxn)
+    if (activeTxn && (!pbatch || activeTxn != pbatch->ptxn))
         activeTxn->abort();
     activeTxn = NULL;
     pdb = NULL;
 
     Flush();
+    pbatch = NULL;
 
     {
         LOCK(bitdb.cs_db);
@@ -306,6 +319,59 @@ void CDB::Close()
     }
 }
 
+CDBBatch::CDBBatch(const std::string& strFilename) : strFile(strFilename), ptxn(NULL), nWrites(0)
+{
+    if (strFile.empty())
+        return;
+    if (!ptsBatches.get())
+        ptsBatches.reset(new map<string, CDBBatch*>());
+    if (ptsBatches->count(strFile))
+        return;
+
+    {
+        LOCK(bitdb.cs_db);
+        if (!bitdb.Open(GetDataDir()))
+            throw runtime_error("CDBBatch : Failed to open database environment.");
+        ptxn = bitdb.TxnBegin();
+        // Without a transaction the writes go through one by one, as unbatched
+        if (!ptxn) {
+            LogPrintf("CDBBatch : Failed to begin transaction on %s\n", strFile);
+            return;
+        }
+        ++bitdb.mapFileUseCount[strFile];
+    }
+    (*ptsBatches)[strFile] = this;
+}
+
+CDBBatch::~CDBBatch()
+{
+    // Callers that can act on a failure commit explicitly; here it can only be reported
+    if (!Commit())
+        LogPrintf("CDBBatch : Failed to commit %u writes to %s\n", nWrites, strFile);
+}
+
+/** Commit the batch; any CDB opened in it must have been closed by now */
+bool CDBBatch::Commit()
+{
+    if (!ptxn)
+        return true;
+
+    int ret = ptxn->commit(DB_TXN_SYNC);
+    ptxn = NULL;
+    ptsBatches->erase(strFile);
+    {
+        LOCK(bitdb.cs_db);
+        --bitdb.mapFileUseCount[strFile];
+    }
+    if (nWrites == 0)
+        return (ret == 0);
+
+    // One checkpoint for the batch, where each CDB closing in it would have made its own
+    bitdb.dbenv.txn_checkpoint(0, 0, 0);
+    LogPrint("db", "CDBBatch : Committed %u writes to %s\n", nWrites, strFile);
+    return (ret == 0);
+}
+
 void CDBEnv::CloseDb(const string& strFile)
 {
     {
@@ -78,10 +78,10 @@ public:
     void CloseDb(const std::string& strFile);
     bool RemoveDb(const std::string& strFile);
 
-    DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC)
+    DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC, DbTxn* parent = NULL)
     {
         DbTxn* ptxn = NULL;
-        int ret = dbenv.txn_begin(NULL, &ptxn, flags);
+        int ret = dbenv.txn_begin(parent, &ptxn, flags);
         if (!ptxn || ret != 0)
             return NULL;
         return ptxn;
@@ -91,6 +91,36 @@ public:
 extern CDBEnv bitdb;
 
 
+/**
+ * Groups the writes one thread makes to a database file into a single
+ * transaction, synced to the log once. While a batch is in scope, every CDB
+ * its thread opens on the file joins the transaction (and TxnBegin on those
+ * nests in it), so callers making many small writes need no changes. Batches
+ * nested on the same file join the outermost one. The batch commits on Commit
+ * or when it goes out of scope, and keeps the file in use meanwhile so
+ * ThreadFlushWalletDB leaves it alone.
+ */
+class CDBBatch
+{
+private:
+    std::string strFile;
+    //! NULL if this batch joined an outer one
+    DbTxn* ptxn;
+    unsigned int nWrites;
+
+    friend class CDB;
+
+    CDBBatch(const CDBBatch&);
+    void operator=(const CDBBatch&);
+
+public:
+    explicit CDBBatch(const std::string& strFilename);
+    ~CDBBatch();
+
+    bool Commit();
+};
+
+
 /** RAII class that provides access to a Berkeley database */
 class CDB
 {
@@ -98,6 +128,8 @@ protected:
     Db* pdb;
     std::string strFile;
     DbTxn* activeTxn;
+    //! Batch of the opening thread the writes join, if any
+    CDBBatch* pbatch;
     bool fReadOnly;
 
     explicit CDB(const std::string& strFilename, const char* pszMode = "r+");
@@ -168,6 +200,8 @@ protected:
 
         // Write
         int ret = pdb->put(activeTxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
+        if (pbatch)
+            pbatch->nWrites++;
 
         // Clear memory in case it was a private key
         memset(datKey.get_data(), 0, datKey.get_size());
@@ -191,6 +225,8 @@ protected:
 
         // Erase
         int ret = pdb->del(activeTxn, &datKey, 0);
+        if (pbatch)
+            pbatch->nWrites++;
 
         // Clear memory
         memset(datKey.get_data(), 0, datKey.get_size());
@@ -222,7 +258,7 @@ protected:
         if (!pdb)
             return NULL;
         Dbc* pcursor = NULL;
-        int ret = pdb->cursor(NULL, &pcursor, 0);
+        int ret = pdb->cursor(activeTxn, &pcursor, 0);
         if (ret != 0)
             return NULL;
         return pcursor;
@@ -268,9 +304,10 @@ protected:
 public:
     bool TxnBegin()
     {
-        if (!pdb || activeTxn)
+        DbTxn* batchTxn = pbatch ? pbatch->ptxn : NULL;
+        if (!pdb || activeTxn != batchTxn)
             return false;
-        DbTxn* ptxn = bitdb.TxnBegin();
+        DbTxn* ptxn = bitdb.TxnBegin(DB_TXN_WRITE_NOSYNC, batchTxn);
         if (!ptxn)
             return false;
         activeTxn = ptxn;
@@ -279,19 +316,21 @@ public:
 
     bool TxnCommit()
     {
-        if (!pdb || !activeTxn)
+        DbTxn* batchTxn = pbatch ? pbatch->ptxn : NULL;
+        if (!pdb || activeTxn == batchTxn)
             return false;
         int ret = activeTxn->commit(0);
-        activeTxn = NULL;
+        activeTxn = batchTxn;
         return (ret == 0);
     }
 
     bool TxnAbort()
     {
-        if (!pdb || !activeTxn)
+        DbTxn* batchTxn = pbatch ? pbatch->ptxn : NULL;
+        if (!pdb || activeTxn == batchTxn)
             return false;
         int ret = activeTxn->abort();
-        activeTxn = NULL;
+        activeTxn = batchTxn;
         return (ret == 0);
     }
 
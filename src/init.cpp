@@ -19,6 +19,8 @@
 #include "net.h"
 #include "rpcserver.h"
 #include "script/standard.h"
+#include "pushnotify.h"
+#include "stratum.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -155,6 +157,8 @@ void Shutdown()
         bitdb.Flush(false);
     GenerateBitcoins(false, NULL, 0);
 #endif
+    StopStratumServer();
+    StopPushNotifications();
     StopNode();
     UnregisterNodeSignals(GetNodeSignals());
 
@@ -301,8 +305,10 @@ std::string HelpMessage(HelpMessageMode mode)
 
 #ifdef ENABLE_WALLET
     strUsage += "\n" + _("Wallet options:") + "\n";
+    strUsage += "  -deferkeycheck         " + _("Check keys stored without a checksum by old versions in the background after loading the wallet, not while loading it") + "\n";
     strUsage += "  -disablewallet         " + _("Do not load the wallet and disable wallet RPC calls") + "\n";
     strUsage += "  -keypool=<n>           " + strprintf(_("Set key pool size to <n> (default: %u)"), 100) + "\n";
+    strUsage += "  -keypoolmin=<n>        " + strprintf(_("Keep at least <n> keys in the key pool while the rest are generated in the background (default: %u)"), DEFAULT_KEYPOOL_MIN) + "\n";
     if (GetBoolArg("-help-debug", false))
         strUsage += "  -mintxfee=<amt>        " + strprintf(_("Fees (in BTC/Kb) smaller than this are considered zero fee for transaction creation (default: %s)"), FormatMoney(CWallet::minTxFee.GetFeePerK())) + "\n";
     strUsage += "  -paytxfee=<amt>        " + strprintf(_("Fee (in BTC/kB) to add to transactions you send (default: %s)"), FormatMoney(payTxFee.GetFeePerK())) + "\n";
@@ -312,6 +318,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -spendzeroconfchange   " + strprintf(_("Spend unconfirmed change when sending transactions (default: %u)"), 1) + "\n";
     strUsage += "  -txconfirmtarget=<n>   " + strprintf(_("If paytxfee is not set, include enough fee so transactions begin confirmation on average within n blocks (default: %u)"), 1) + "\n";
     strUsage += "  -maxtxfee=<amt>        " + strprintf(_("Maximum total fees to use in a single wallet transaction, setting too low may abort large transactions (default: %s)"), FormatMoney(maxTxFee)) + "\n";
+    strUsage += "  -unlockcachetime=<n>   " + strprintf(_("Keep the master key of a verified unlock for <n> seconds, also while locked, so that unlocking with the same passphrase again derives no keys (default: %d)"), DEFAULT_UNLOCK_CACHE_TIME) + "\n";
     strUsage += "  -upgradewallet         " + _("Upgrade wallet to latest format") + " " + _("on startup") + "\n";
     strUsage += "  -wallet=<file>         " + _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), "wallet.dat") + "\n";
     strUsage += "  -walletnotify=<cmd>    " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n";
@@ -334,7 +341,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -debug=<category>      " + strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + "\n";
     strUsage += "                         " + _("If <category> is not supplied, output all debugging information.") + "\n";
     strUsage += "                         " + _("<category> can be:");
-    strUsage +=                                 " addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, mempool, net"; // Don't translate these and qt below
+    strUsage +=                                 " addrman, alert, bench, coindb, db, lock, rand, pow, rpc, selectcoins, mempool, net, pushnotify, stratum"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         strUsage += ", qt";
     strUsage += ".\n";
@@ -373,6 +380,19 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -blockmaxsize=<n>      " + strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE) + "\n";
     strUsage += "  -blockprioritysize=<n> " + strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE) + "\n";
 
+    strUsage += "\n" + _("Mining server options:") + "\n";
+    strUsage += "  -stratum               " + strprintf(_("Serve work to miners over the Stratum protocol (default: %u)"), 0) + "\n";
+    strUsage += "  -stratumaddress=<addr> " + _("Pay blocks found through the Stratum server to <addr> (required with -stratum)") + "\n";
+    strUsage += "  -stratumbind=<addr>    " + strprintf(_("Bind the Stratum server to the given address (default: %s)"), "127.0.0.1") + "\n";
+    strUsage += "  -stratumport=<port>    " + strprintf(_("Listen for Stratum connections on <port> (default: %u)"), DEFAULT_STRATUM_PORT) + "\n";
+    strUsage += "  -stratumdifficulty=<n> " + strprintf(_("Share difficulty handed to new Stratum miners (default: %g)"), DEFAULT_STRATUM_DIFFICULTY) + "\n";
+
+    strUsage += "\n" + _("Push notification options:") + "\n";
+    strUsage += "  -pubhashblock=<addr>   " + _("Publish the hash of each new best block to subscribers connecting to <addr>, given as <ip>:<port>") + "\n";
+    strUsage += "  -pubhashtx=<addr>      " + _("Publish the hash of each new transaction to subscribers connecting to <addr>") + "\n";
+    strUsage += "  -pubrawblock=<addr>    " + _("Publish each new best block to subscribers connecting to <addr>") + "\n";
+    strUsage += "  -pubrawtx=<addr>       " + _("Publish each new transaction to subscribers connecting to <addr>") + "\n";
+
     strUsage += "\n" + _("RPC server options:") + "\n";
     strUsage += "  -server                " + _("Accept command line and JSON-RPC commands") + "\n";
     strUsage += "  -rest                  " + strprintf(_("Accept public REST requests (default: %u)"), 0) + "\n";
@@ -382,7 +402,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += "  -rpcport=<port>        " + strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), 8332, 18332) + "\n";
     strUsage += "  -rpcallowip=<ip>       " + _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times") + "\n";
     strUsage += "  -rpcthreads=<n>        " + strprintf(_("Set the number of threads to service RPC calls (default: %d)"), 4) + "\n";
+    strUsage += "  -rpcworkqueue=<n>      " + strprintf(_("Set the number of RPC calls that may wait for a thread before new ones are refused (default: %d)"), DEFAULT_RPC_WORKQUEUE) + "\n";
+    strUsage += "  -rpcbatchsize=<n>      " + strprintf(_("Refuse JSON-RPC batches of more than <n> requests, 0 for no limit (default: %d)"), DEFAULT_RPC_BATCH_SIZE) + "\n";
+    strUsage += "  -rpcbatchtimeout=<n>   " + strprintf(_("Answer the requests of a JSON-RPC batch not started within <n> seconds with an error, 0 for no limit (default: %d)"), DEFAULT_RPC_BATCH_TIMEOUT) + "\n";
     strUsage += "  -rpckeepalive          " + strprintf(_("RPC support for HTTP persistent connections (default: %d)"), 1) + "\n";
+    strUsage += "  -longpolltimeout=<n>   " + strprintf(_("Answer getblocktemplate long polls after at most <n> seconds, 0 to wait for a change (default: %d)"), DEFAULT_LONGPOLL_TIMEOUT) + "\n";
+    strUsage += "  -longpolltxthreshold=<n> " + strprintf(_("Answer getblocktemplate long polls once <n> memory pool updates have happened, 0 to only check once a minute (default: %d)"), DEFAULT_LONGPOLL_TX_THRESHOLD) + "\n";
 
     strUsage += "\n" + _("RPC SSL options: (see the Bitcoin Wiki for SSL setup instructions)") + "\n";
     strUsage += "  -rpcssl                                  " + _("Use OpenSSL (https) for JSON-RPC connections") + "\n";
@@ -745,6 +770,7 @@ bool AppInit2(boost::thread_group& threadGroup)
 #endif // ENABLE_WALLET
 
     fIsBareMultisigStd = GetArg("-permitbaremultisig", true) != 0;
+    nLongPollTxThreshold = std::max(0, (int)GetArg("-longpolltxthreshold", DEFAULT_LONGPOLL_TX_THRESHOLD));
     nMaxDatacarrierBytes = GetArg("-datacarriersize", nMaxDatacarrierBytes);
 
     fAlerts = GetBoolArg("-alerts", DEFAULT_ALERTS);
@@ -1228,6 +1254,10 @@ bool AppInit2(boost::thread_group& threadGroup)
                         copyTo->WriteToDisk();
                     }
                 }
+                // The restored order positions put the activity log out of order
+                LOCK(pwalletMain->cs_wallet);
+                CWalletDB walletdb(strWalletFile);
+                pwalletMain->ReindexOrderedTxItems(walletdb);
             }
         }
     } // (!fDisableWallet)
@@ -1278,6 +1308,14 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     StartNode(threadGroup);
 
+    std::string strPushError;
+    if (!StartPushNotifications(strPushError))
+        return InitError(strPushError);
+
+    std::string strStratumError;
+    if (!StartStratumServer(strStratumError))
+        return InitError(strStratumError);
+
 #ifdef ENABLE_WALLET
     // Generate coins in the background
     if (pwalletMain)
@@ -1296,6 +1334,18 @@ bool AppInit2(boost::thread_group& threadGroup)
 
         // Run a thread to flush wallet periodically
         threadGroup.create_thread(boost::bind(&ThreadFlushWalletDB, boost::ref(pwalletMain->strWalletFile)));
+
+        // Run a thread to keep the key pool filled
+        threadGroup.create_thread(boost::bind(&CWallet::ThreadKeyPoolFiller, pwalletMain));
+
+        // Run a thread to wipe the master key kept by -unlockcachetime when it expires,
+        // however the wallet was unlocked
+        if (GetArg("-unlockcachetime", DEFAULT_UNLOCK_CACHE_TIME) > 0)
+            threadGroup.create_thread(boost::bind(&CWallet::ThreadUnlockCacheExpiry, pwalletMain));
+
+        // Run a thread to check the keys loaded unchecked with -deferkeycheck
+        if (!pwalletMain->vDeferredKeyChecks.empty())
+            threadGroup.create_thread(boost::bind(&CWallet::CheckDeferredKeys, pwalletMain));
     }
 #endif
 
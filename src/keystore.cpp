@@ -6,6 +6,7 @@
 #include "keystore.h"
 
 #include "crypter.h"
+#include "hash.h"
 #include "key.h"
 #include "script/script.h"
 #include "script/standard.h"
@@ -15,6 +16,36 @@
 
 #include <boost/foreach.hpp>
 
+void CKeyStoreFilter::AddWatchOnly(const CScript& script)
+{
+    setWatchOnly.insert(script);
+}
+
+void CKeyStoreFilter::RemoveWatchOnly(const CScript& script)
+{
+    setWatchOnly.erase(script);
+}
+
+bool CKeyStoreFilter::IsRelevant(const CScript& scriptPubKey) const
+{
+    if (!setWatchOnly.empty() && setWatchOnly.count(scriptPubKey))
+        return true;
+
+    // Key hashes and script hashes are pushed as 20 bytes, public keys as
+    // 33 or 65 (see Solver)
+    CScript::const_iterator pc = scriptPubKey.begin();
+    opcodetype opcode;
+    std::vector<unsigned char> vch;
+    while (scriptPubKey.GetOp(pc, opcode, vch))
+    {
+        if (vch.size() == 20 && setIDs.count(uint160(vch)))
+            return true;
+        if ((vch.size() == 33 || vch.size() == 65) && setIDs.count(Hash160(vch)))
+            return true;
+    }
+    return false;
+}
+
 bool CKeyStore::GetPubKey(const CKeyID &address, CPubKey &vchPubKeyOut) const
 {
     CKey key;
@@ -32,6 +63,7 @@ bool CBasicKeyStore::AddKeyPubKey(const CKey& key, const CPubKey &pubkey)
 {
     LOCK(cs_KeyStore);
     mapKeys[pubkey.GetID()] = key;
+    filter.AddID(pubkey.GetID());
     return true;
 }
 
@@ -42,6 +74,7 @@ bool CBasicKeyStore::AddCScript(const CScript& redeemScript)
 
     LOCK(cs_KeyStore);
     mapScripts[CScriptID(redeemScript)] = redeemScript;
+    filter.AddID(CScriptID(redeemScript));
     return true;
 }
 
@@ -67,6 +100,7 @@ bool CBasicKeyStore::AddWatchOnly(const CScript &dest)
 {
     LOCK(cs_KeyStore);
     setWatchOnly.insert(dest);
+    filter.AddWatchOnly(dest);
     return true;
 }
 
@@ -74,6 +108,7 @@ bool CBasicKeyStore::RemoveWatchOnly(const CScript &dest)
 {
     LOCK(cs_KeyStore);
     setWatchOnly.erase(dest);
+    filter.RemoveWatchOnly(dest);
     return true;
 }
 
@@ -11,6 +11,7 @@
 #include "sync.h"
 
 #include <boost/signals2/signal.hpp>
+#include <boost/unordered_set.hpp>
 #include <boost/variant.hpp>
 
 class CScript;
@@ -45,12 +46,39 @@ public:
     virtual bool RemoveWatchOnly(const CScript &dest) =0;
     virtual bool HaveWatchOnly(const CScript &dest) const =0;
     virtual bool HaveWatchOnly() const =0;
+
+    //! False if scriptPubKey can't involve any key, script or watch-only address in the store
+    virtual bool IsRelevant(const CScript& scriptPubKey) const =0;
 };
 
 typedef std::map<CKeyID, CKey> KeyMap;
 typedef std::map<CScriptID, CScript > ScriptMap;
 typedef std::set<CScript> WatchOnlySet;
 
+/**
+ * Hash index of what a script involving a key store has to contain: the
+ * ID of one of its keys or redeem scripts, pushed as is or as a public key
+ * hashing to it. Watch-only scripts only match as a whole. This rules out
+ * unrelated scripts without solving them.
+ */
+class CKeyStoreFilter
+{
+private:
+    struct CIDHasher
+    {
+        size_t operator()(const uint160& id) const { return id.GetLow64(); }
+    };
+
+    boost::unordered_set<uint160, CIDHasher> setIDs;
+    WatchOnlySet setWatchOnly;
+
+public:
+    void AddID(const uint160& id) { setIDs.insert(id); }
+    void AddWatchOnly(const CScript& script);
+    void RemoveWatchOnly(const CScript& script);
+    bool IsRelevant(const CScript& scriptPubKey) const;
+};
+
 /** Basic key store, that keeps keys in an address->secret map */
 class CBasicKeyStore : public CKeyStore
 {
@@ -58,6 +86,8 @@ protected:
     KeyMap mapKeys;
     ScriptMap mapScripts;
     WatchOnlySet setWatchOnly;
+    //! Kept up to date by all the Add methods; keys and scripts are never removed
+    CKeyStoreFilter filter;
 
 public:
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
@@ -104,6 +134,18 @@ public:
     virtual bool RemoveWatchOnly(const CScript &dest);
     virtual bool HaveWatchOnly(const CScript &dest) const;
     virtual bool HaveWatchOnly() const;
+
+    bool IsRelevant(const CScript& scriptPubKey) const
+    {
+        LOCK(cs_KeyStore);
+        return filter.IsRelevant(scriptPubKey);
+    }
+    //! Copy of the filter, for use without the lock
+    CKeyStoreFilter GetFilter() const
+    {
+        LOCK(cs_KeyStore);
+        return filter;
+    }
 };
 
 typedef std::vector<unsigned char, secure_allocator<unsigned char> > CKeyingMaterial;
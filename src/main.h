@@ -125,6 +125,10 @@ extern const std::string strMessageMagic;
 extern int64_t nTimeBestReceived;
 extern CWaitableCriticalSection csBestBlock;
 extern CConditionVariable cvBlockChange;
+/** -longpolltxthreshold, memory pool updates that answer a getblocktemplate long poll (0 = disabled) */
+extern unsigned int nLongPollTxThreshold;
+/** Memory pool update counts at which waiting long polls are answered, guarded by csBestBlock */
+extern std::multiset<unsigned int> setLongPollTxTargets;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
@@ -149,6 +153,8 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 void UnregisterAllValidationInterfaces();
 /** Push an updated transaction to all registered wallets */
 void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL);
+/** Push the transactions of a block, connected or (pblock NULL) disconnected, to all registered wallets */
+void SyncWithWallets(const std::vector<CTransaction>& vtx, const CBlock* pblock);
 
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
@@ -557,9 +563,16 @@ struct CBlockTemplate
 
 class CValidationInterface {
 protected:
+    virtual ~CValidationInterface() {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock) {};
+    /** All the transactions of a block at once, by default one by one through SyncTransaction */
+    virtual void SyncTransactions(const std::vector<CTransaction> &vtx, const CBlock *pblock) {
+        for (unsigned int i = 0; i < vtx.size(); i++)
+            SyncTransaction(vtx[i], pblock);
+    };
     virtual void EraseFromWallet(const uint256 &hash) {};
     virtual void SetBestChain(const CBlockLocator &locator) {};
+    virtual void UpdatedBlockTip(const CBlockIndex *pindex) {};
     virtual void UpdatedTransaction(const uint256 &hash) {};
     virtual void Inventory(const uint256 &hash) {};
     virtual void ResendWalletTransactions() {};
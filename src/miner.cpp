@@ -8,6 +8,7 @@
 #include "amount.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "crypto/common.h"
 #include "hash.h"
 #include "main.h"
 #include "net.h"
@@ -19,6 +20,7 @@
 #include "wallet.h"
 #endif
 
+#include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 
@@ -79,6 +81,16 @@ public:
     }
 };
 
+// Transactions appended to a cached template are taken by fee rate alone:
+class TxFeeRateCompare
+{
+public:
+    bool operator()(const pair<CFeeRate, const CTransaction*>& a, const pair<CFeeRate, const CTransaction*>& b)
+    {
+        return a.first > b.first;
+    }
+};
+
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
     pblock->nTime = std::max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
@@ -88,6 +100,13 @@ void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
         pblock->nBits = GetNextWorkRequired(pindexPrev, pblock);
 }
 
+static unsigned int GetBlockMaxSize()
+{
+    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
+    return std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
+}
+
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
 {
     // Create new block
@@ -114,9 +133,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
     pblocktemplate->vTxSigOps.push_back(-1); // updated at end
 
     // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
-    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
+    unsigned int nBlockMaxSize = GetBlockMaxSize();
 
     // How much of the block should be dedicated to high-priority transactions,
     // included regardless of the fees they pay
@@ -340,6 +357,180 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
     return pblocktemplate.release();
 }
 
+CBlockTemplateManager::CBlockTemplateManager(const CScript& scriptPubKeyIn) :
+    scriptPubKey(scriptPubKeyIn), pblocktemplate(NULL), pview(NULL), pindexPrev(NULL),
+    nTransactionsUpdatedLast(0), nTemplateId(0), nBlockSize(0), nBlockSigOps(0), nFees(0)
+{
+}
+
+CBlockTemplateManager::~CBlockTemplateManager()
+{
+    Clear();
+}
+
+void CBlockTemplateManager::Clear()
+{
+    delete pview;
+    pview = NULL;
+    delete pblocktemplate;
+    pblocktemplate = NULL;
+    pindexPrev = NULL;
+    setBlockTx.clear();
+}
+
+void CBlockTemplateManager::Rebuild()
+{
+    // Clear first so a failure below forces a rebuild on the next call
+    Clear();
+
+    // Store the counter before CreateNewBlock, to avoid races
+    nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+    CBlockIndex* pindexPrevNew = chainActive.Tip();
+
+    auto_ptr<CBlockTemplate> pblocktemplateNew(CreateNewBlock(scriptPubKey));
+    if (!pblocktemplateNew.get())
+        return;
+    const CBlock& block = pblocktemplateNew->block;
+
+    // Replay the template onto a view of the tip so that appended
+    // transactions can be checked against it without redoing the block.
+    auto_ptr<CCoinsViewCache> pviewNew(new CCoinsViewCache(pcoinsTip));
+    nBlockSize = 1000;
+    nBlockSigOps = 100;
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+    {
+        const CTransaction& tx = block.vtx[i];
+        CValidationState state;
+        CTxUndo txundo;
+        UpdateCoins(tx, state, *pviewNew, txundo, pindexPrevNew->nHeight + 1);
+        setBlockTx.insert(tx.GetHash());
+        nBlockSize += ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        nBlockSigOps += pblocktemplateNew->vTxSigOps[i];
+    }
+    nFees = -pblocktemplateNew->vTxFees[0];
+
+    pblocktemplate = pblocktemplateNew.release();
+    pview = pviewNew.release();
+    pindexPrev = pindexPrevNew;
+    ++nTemplateId;
+}
+
+unsigned int CBlockTemplateManager::AppendNewTransactions()
+{
+    AssertLockHeld(mempool.cs);
+    CBlock* pblock = &pblocktemplate->block;
+    const int nHeight = pindexPrev->nHeight + 1;
+    unsigned int nBlockMaxSize = GetBlockMaxSize();
+
+    // Only fee-paying transactions are appended; free and priority
+    // transactions have to wait for the rebuild on the next block.
+    vector<pair<CFeeRate, const CTransaction*> > vecCandidates;
+    for (map<uint256, CTxMemPoolEntry>::const_iterator mi = mempool.mapTx.begin();
+         mi != mempool.mapTx.end(); ++mi)
+    {
+        const CTransaction& tx = mi->second.GetTx();
+        if (setBlockTx.count(mi->first) || tx.IsCoinBase() || !IsFinalTx(tx, nHeight))
+            continue;
+
+        double dPriorityDelta = 0;
+        CAmount nFeeDelta = 0;
+        mempool.ApplyDeltas(mi->first, dPriorityDelta, nFeeDelta);
+        CFeeRate feeRate(mi->second.GetFee() + nFeeDelta, mi->second.GetTxSize());
+        if (feeRate < ::minRelayTxFee)
+            continue;
+        vecCandidates.push_back(make_pair(feeRate, &tx));
+    }
+    sort(vecCandidates.begin(), vecCandidates.end(), TxFeeRateCompare());
+
+    // A child may sort ahead of its parent, so sweep the candidates until
+    // a pass adds nothing.
+    unsigned int nAdded = 0;
+    bool fProgress = true;
+    while (fProgress)
+    {
+        fProgress = false;
+        BOOST_FOREACH(PAIRTYPE(CFeeRate, const CTransaction*)& candidate, vecCandidates)
+        {
+            if (candidate.second == NULL)
+                continue;
+            const CTransaction& tx = *candidate.second;
+
+            // Inputs not in the chain or the template yet
+            if (!pview->HaveInputs(tx))
+                continue;
+
+            // From here on the candidate is either added or dropped for good
+            candidate.second = NULL;
+
+            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+            if (nBlockSize + nTxSize >= nBlockMaxSize)
+                continue;
+
+            unsigned int nTxSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, *pview);
+            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+                continue;
+
+            CValidationState state;
+            if (!CheckInputs(tx, state, *pview, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+                continue;
+
+            CAmount nTxFees = pview->GetValueIn(tx)-tx.GetValueOut();
+            CTxUndo txundo;
+            UpdateCoins(tx, state, *pview, txundo, nHeight);
+
+            pblock->vtx.push_back(tx);
+            pblocktemplate->vTxFees.push_back(nTxFees);
+            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
+            setBlockTx.insert(tx.GetHash());
+            nBlockSize += nTxSize;
+            nBlockSigOps += nTxSigOps;
+            nFees += nTxFees;
+            ++nAdded;
+            fProgress = true;
+        }
+    }
+
+    if (nAdded > 0)
+    {
+        CMutableTransaction txCoinbase(pblock->vtx[0]);
+        txCoinbase.vout[0].nValue = GetBlockValue(nHeight, nFees);
+        pblock->vtx[0] = txCoinbase;
+        pblocktemplate->vTxFees[0] = -nFees;
+
+        nLastBlockTx = pblock->vtx.size() - 1;
+        nLastBlockSize = nBlockSize;
+        LogPrint("miner", "CBlockTemplateManager: appended %u transactions, total size %u\n", nAdded, nBlockSize);
+    }
+    return nAdded;
+}
+
+CBlockTemplate* CBlockTemplateManager::GetTemplate()
+{
+    AssertLockHeld(cs_main);
+    if (pblocktemplate == NULL || pindexPrev != chainActive.Tip())
+    {
+        Rebuild();
+    }
+    else if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast)
+    {
+        LOCK(mempool.cs);
+        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+        AppendNewTransactions();
+    }
+    return pblocktemplate;
+}
+
+static void SetCoinbaseExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, const CScript& scriptExtraNonce)
+{
+    unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
+    CMutableTransaction txCoinbase(pblock->vtx[0]);
+    txCoinbase.vin[0].scriptSig = (CScript() << nHeight) + scriptExtraNonce + COINBASE_FLAGS;
+    assert(txCoinbase.vin[0].scriptSig.size() <= 100);
+
+    pblock->vtx[0] = txCoinbase;
+    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+}
+
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -350,13 +541,20 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
         hashPrevBlock = pblock->hashPrevBlock;
     }
     ++nExtraNonce;
-    unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
-    CMutableTransaction txCoinbase(pblock->vtx[0]);
-    txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
-    assert(txCoinbase.vin[0].scriptSig.size() <= 100);
+    SetCoinbaseExtraNonce(pblock, pindexPrev, CScript() << CScriptNum(nExtraNonce));
+}
 
-    pblock->vtx[0] = txCoinbase;
-    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+void SetExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, const std::vector<unsigned char>& vchExtraNonce)
+{
+    SetCoinbaseExtraNonce(pblock, pindexPrev, CScript() << vchExtraNonce);
+}
+
+unsigned int GetExtraNonceOffset(const CBlockIndex* pindexPrev)
+{
+    // nVersion, vin count, prevout and the scriptSig length, followed by the
+    // height push and the push opcode of the extranonce itself
+    unsigned int nHeight = pindexPrev->nHeight+1;
+    return 4 + 1 + 36 + 1 + (CScript() << nHeight).size() + 1;
 }
 
 #ifdef ENABLE_WALLET
@@ -367,6 +565,25 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
 double dHashesPerSec = 0.0;
 int64_t nHPSTimerStart = 0;
 
+/**
+ * Block handed out by the miner coordinator. It is never modified once
+ * published; each thread mines its own copy with its own extranonces.
+ */
+struct CMinerWork
+{
+    CBlock block;
+    const CBlockIndex* pindexPrev;
+    int64_t nTimeCreated;
+};
+
+static CCriticalSection cs_miner;
+static boost::shared_ptr<const CMinerWork> pMinerWork;
+//! Bumped whenever pMinerWork changes, so that threads can tell their work is stale
+static unsigned int nMinerWorkId = 0;
+static CReserveKey* pMinerReserveKey = NULL;
+static bool fMinerKeyUsed = false;
+static std::vector<CMinerThreadStats> vMinerThreadStats;
+
 //
 // ScanHash scans nonces looking for a hash with at least some zero bits.
 // The nonce is usually preserved between calls, but periodically or if the
@@ -412,7 +629,7 @@ CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey)
     return CreateNewBlock(scriptPubKey);
 }
 
-bool ProcessBlockFound(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey)
+bool ProcessBlockFound(CBlock* pblock, CWallet& wallet)
 {
     LogPrintf("%s\n", pblock->ToString());
     LogPrintf("generated %s\n", FormatMoney(pblock->vtx[0].vout[0].nValue));
@@ -424,8 +641,13 @@ bool ProcessBlockFound(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey)
             return error("BitcoinMiner : generated block is stale");
     }
 
-    // Remove key from key pool
-    reservekey.KeepKey();
+    // Remove key from key pool, the coordinator reserves a new one for the next block
+    {
+        LOCK(cs_miner);
+        if (pMinerReserveKey)
+            pMinerReserveKey->KeepKey();
+        fMinerKeyUsed = true;
+    }
 
     // Track how many getdata requests this block gets
     {
@@ -441,47 +663,189 @@ bool ProcessBlockFound(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey)
     return true;
 }
 
-void static BitcoinMiner(CWallet *pwallet)
+/** Publish new work to the miner threads, or withdraw it when pwork is NULL */
+void static SetMinerWork(const boost::shared_ptr<const CMinerWork>& pwork)
 {
-    LogPrintf("BitcoinMiner started\n");
-    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-    RenameThread("bitcoin-miner");
+    LOCK(cs_miner);
+    pMinerWork = pwork;
+    nMinerWorkId++;
+}
+
+/**
+ * Build one block for all miner threads whenever the tip changes, and
+ * refresh it once a minute while the memory pool keeps changing, instead
+ * of every thread assembling its own block under cs_main.
+ */
+void static ThreadMinerCoordinator(CWallet* pwallet)
+{
+    RenameThread("bitcoin-coord");
 
-    // Each thread has its own key and counter
     CReserveKey reservekey(pwallet);
-    unsigned int nExtraNonce = 0;
+    {
+        LOCK(cs_miner);
+        pMinerReserveKey = &reservekey;
+        fMinerKeyUsed = true;
+    }
+    auto_ptr<CBlockTemplateManager> ptemplatemanager;
+    const CBlockIndex* pindexLast = NULL;
+    unsigned int nTransactionsUpdatedLast = 0;
+    int64_t nLastWork = 0;
 
     try {
         while (true) {
+            {
+                boost::unique_lock<boost::mutex> lock(csBestBlock);
+                cvBlockChange.timed_wait(lock, boost::posix_time::seconds(1));
+            }
+            boost::this_thread::interruption_point();
+
             if (Params().MiningRequiresPeers()) {
-                // Busy-wait for the network to come online so we don't waste time mining
-                // on an obsolete chain. In regtest mode we expect to fly solo.
-                do {
-                    bool fvNodesEmpty;
-                    {
-                        LOCK(cs_vNodes);
-                        fvNodesEmpty = vNodes.empty();
+                // Don't waste time mining on an obsolete chain. In regtest
+                // mode we expect to fly solo.
+                bool fvNodesEmpty;
+                {
+                    LOCK(cs_vNodes);
+                    fvNodesEmpty = vNodes.empty();
+                }
+                if (fvNodesEmpty || IsInitialBlockDownload()) {
+                    if (pindexLast != NULL)
+                        SetMinerWork(boost::shared_ptr<const CMinerWork>());
+                    pindexLast = NULL;
+                    continue;
+                }
+            }
+
+            {
+                LOCK(cs_miner);
+                if (fMinerKeyUsed) {
+                    CPubKey pubkey;
+                    if (!reservekey.GetReservedKey(pubkey)) {
+                        LogPrintf("Error in BitcoinMiner: Keypool ran out, please call keypoolrefill before restarting the mining thread\n");
+                        pMinerWork.reset();
+                        nMinerWorkId++;
+                        pMinerReserveKey = NULL;
+                        return;
                     }
-                    if (!fvNodesEmpty && !IsInitialBlockDownload())
-                        break;
-                    MilliSleep(1000);
-                } while (true);
+                    ptemplatemanager.reset(new CBlockTemplateManager(CScript() << ToByteVector(pubkey) << OP_CHECKSIG));
+                    fMinerKeyUsed = false;
+                    pindexLast = NULL;
+                }
+            }
+
+            boost::shared_ptr<CMinerWork> pwork(new CMinerWork());
+            {
+                LOCK(cs_main);
+                const CBlockIndex* pindexPrev = chainActive.Tip();
+                if (pindexPrev == pindexLast && (mempool.GetTransactionsUpdated() == nTransactionsUpdatedLast ||
+                                                 GetTime() - nLastWork <= 60))
+                    continue;
+
+                CBlockTemplate* pblocktemplate = ptemplatemanager->GetTemplate();
+                if (!pblocktemplate)
+                    continue;
+                pwork->block = pblocktemplate->block;
+                pwork->pindexPrev = pindexPrev;
+                pindexLast = pindexPrev;
+                nTransactionsUpdatedLast = ptemplatemanager->GetTransactionsUpdatedLast();
             }
+            nLastWork = pwork->nTimeCreated = GetTime();
+            SetMinerWork(pwork);
+        }
+    }
+    catch (boost::thread_interrupted)
+    {
+        LOCK(cs_miner);
+        pMinerReserveKey = NULL;
+        throw;
+    }
+    catch (const std::runtime_error &e)
+    {
+        LogPrintf("BitcoinMiner runtime error: %s\n", e.what());
+        LOCK(cs_miner);
+        pMinerWork.reset();
+        nMinerWorkId++;
+        pMinerReserveKey = NULL;
+        return;
+    }
+}
+
+/** Give each thread its own extranonce range by leading with the thread number */
+void static SetMinerExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int nThread, uint32_t nExtraNonce)
+{
+    std::vector<unsigned char> vchExtraNonce(8);
+    WriteBE32(&vchExtraNonce[0], nThread);
+    WriteBE32(&vchExtraNonce[4], nExtraNonce);
+    SetExtraNonce(pblock, pindexPrev, vchExtraNonce);
+}
+
+/** Account for a batch of hashes and refresh the thread's hash rate every few seconds */
+void static UpdateMinerStats(unsigned int nThread, uint32_t nHashesDone, bool fStale, int64_t& nMeterStart, uint64_t& nMeterHashes)
+{
+    int64_t nNow = GetTimeMillis();
+    nMeterHashes += nHashesDone;
+
+    LOCK(cs_miner);
+    CMinerThreadStats& stats = vMinerThreadStats[nThread];
+    stats.nHashes += nHashesDone;
+    if (fStale)
+        stats.nStaleHashes += nHashesDone;
+    if (nNow - nMeterStart <= 4000)
+        return;
+
+    stats.dHashesPerSec = 1000.0 * nMeterHashes / (nNow - nMeterStart);
+    nMeterStart = nNow;
+    nMeterHashes = 0;
 
+    dHashesPerSec = 0;
+    BOOST_FOREACH(const CMinerThreadStats& threadstats, vMinerThreadStats)
+        dHashesPerSec += threadstats.dHashesPerSec;
+    nHPSTimerStart = nNow;
+    static int64_t nLogTime;
+    if (GetTime() - nLogTime > 30 * 60)
+    {
+        nLogTime = GetTime();
+        LogPrintf("hashmeter %6.0f khash/s\n", dHashesPerSec/1000.0);
+    }
+}
+
+void static BitcoinMiner(CWallet *pwallet, unsigned int nThread)
+{
+    LogPrintf("BitcoinMiner started\n");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("bitcoin-miner");
+
+    int64_t nMeterStart = GetTimeMillis();
+    uint64_t nMeterHashes = 0;
+    unsigned int nWorkIdLast = 0;
+    uint32_t nExtraNonce = 0;
+
+    try {
+        while (true) {
             //
-            // Create new block
+            // Wait for work from the coordinator
             //
-            unsigned int nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-            CBlockIndex* pindexPrev = chainActive.Tip();
-
-            auto_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey));
-            if (!pblocktemplate.get())
-            {
-                LogPrintf("Error in BitcoinMiner: Keypool ran out, please call keypoolrefill before restarting the mining thread\n");
-                return;
+            boost::shared_ptr<const CMinerWork> pwork;
+            unsigned int nWorkId;
+            while (true) {
+                {
+                    LOCK(cs_miner);
+                    pwork = pMinerWork;
+                    nWorkId = nMinerWorkId;
+                }
+                if (pwork)
+                    break;
+                MilliSleep(100);
             }
-            CBlock *pblock = &pblocktemplate->block;
-            IncrementExtraNonce(pblock, pindexPrev, nExtraNonce);
+
+            // Carry on with the next extranonce when the work hasn't changed
+            // since this thread found a block, instead of finding it again
+            nExtraNonce = (nWorkId == nWorkIdLast ? nExtraNonce + 1 : 0);
+            nWorkIdLast = nWorkId;
+
+            CBlock block(pwork->block);
+            CBlock *pblock = &block;
+            const CBlockIndex* pindexPrev = pwork->pindexPrev;
+            SetMinerExtraNonce(pblock, pindexPrev, nThread, nExtraNonce);
 
             LogPrintf("Running BitcoinMiner with %u transactions in block (%u bytes)\n", pblock->vtx.size(),
                 ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
@@ -489,7 +853,6 @@ void static BitcoinMiner(CWallet *pwallet)
             //
             // Search
             //
-            int64_t nStart = GetTime();
             uint256 hashTarget = uint256().SetCompact(pblock->nBits);
             uint256 hash;
             uint32_t nNonce = 0;
@@ -499,6 +862,9 @@ void static BitcoinMiner(CWallet *pwallet)
                 uint32_t nHashesDone = nNonce - nOldNonce;
                 nOldNonce = nNonce;
 
+                // Meter hashes/sec, counting work on a superseded tip as stale
+                UpdateMinerStats(nThread, nHashesDone, pindexPrev != chainActive.Tip(), nMeterStart, nMeterHashes);
+
                 // Check if something found
                 if (fFound)
                 {
@@ -511,8 +877,15 @@ void static BitcoinMiner(CWallet *pwallet)
                         SetThreadPriority(THREAD_PRIORITY_NORMAL);
                         LogPrintf("BitcoinMiner:\n");
                         LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", hash.GetHex(), hashTarget.GetHex());
-                        ProcessBlockFound(pblock, *pwallet, reservekey);
+                        bool fAccepted = ProcessBlockFound(pblock, *pwallet);
                         SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                        {
+                            LOCK(cs_miner);
+                            if (fAccepted)
+                                vMinerThreadStats[nThread].nBlocks++;
+                            else
+                                vMinerThreadStats[nThread].nStaleBlocks++;
+                        }
 
                         // In regression test mode, stop mining after a block is found.
                         if (Params().MineBlocksOnDemand())
@@ -522,47 +895,21 @@ void static BitcoinMiner(CWallet *pwallet)
                     }
                 }
 
-                // Meter hashes/sec
-                static int64_t nHashCounter;
-                if (nHPSTimerStart == 0)
+                // Check for stop or if block needs to be rebuilt
+                boost::this_thread::interruption_point();
                 {
-                    nHPSTimerStart = GetTimeMillis();
-                    nHashCounter = 0;
+                    LOCK(cs_miner);
+                    if (nMinerWorkId != nWorkId)
+                        break;
                 }
-                else
-                    nHashCounter += nHashesDone;
-                if (GetTimeMillis() - nHPSTimerStart > 4000)
+                if (nNonce >= 0xffff0000)
                 {
-                    static CCriticalSection cs;
-                    {
-                        LOCK(cs);
-                        if (GetTimeMillis() - nHPSTimerStart > 4000)
-                        {
-                            dHashesPerSec = 1000.0 * nHashCounter / (GetTimeMillis() - nHPSTimerStart);
-                            nHPSTimerStart = GetTimeMillis();
-                            nHashCounter = 0;
-                            static int64_t nLogTime;
-                            if (GetTime() - nLogTime > 30 * 60)
-                            {
-                                nLogTime = GetTime();
-                                LogPrintf("hashmeter %6.0f khash/s\n", dHashesPerSec/1000.0);
-                            }
-                        }
-                    }
+                    // Move on to the next extranonce in this thread's range
+                    SetMinerExtraNonce(pblock, pindexPrev, nThread, ++nExtraNonce);
+                    nNonce = 0;
+                    nOldNonce = 0;
                 }
 
-                // Check for stop or if block needs to be rebuilt
-                boost::this_thread::interruption_point();
-                // Regtest mode doesn't require peers
-                if (vNodes.empty() && Params().MiningRequiresPeers())
-                    break;
-                if (nNonce >= 0xffff0000)
-                    break;
-                if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
-                    break;
-                if (pindexPrev != chainActive.Tip())
-                    break;
-
                 // Update nTime every few seconds
                 UpdateTime(pblock, pindexPrev);
                 if (Params().AllowMinDifficultyBlocks())
@@ -599,17 +946,39 @@ void GenerateBitcoins(bool fGenerate, CWallet* pwallet, int nThreads)
 
     if (minerThreads != NULL)
     {
+        // Wait for the threads so that none of them touches the shared state below
         minerThreads->interrupt_all();
+        minerThreads->join_all();
         delete minerThreads;
         minerThreads = NULL;
     }
 
+    {
+        LOCK(cs_miner);
+        pMinerWork.reset();
+        nMinerWorkId++;
+        vMinerThreadStats.clear();
+        dHashesPerSec = 0;
+    }
+
     if (nThreads == 0 || !fGenerate)
         return;
 
+    {
+        LOCK(cs_miner);
+        vMinerThreadStats.resize(nThreads);
+    }
     minerThreads = new boost::thread_group();
+    minerThreads->create_thread(boost::bind(&ThreadMinerCoordinator, pwallet));
     for (int i = 0; i < nThreads; i++)
-        minerThreads->create_thread(boost::bind(&BitcoinMiner, pwallet));
+        minerThreads->create_thread(boost::bind(&BitcoinMiner, pwallet, i));
+}
+
+void GetMinerStats(std::vector<CMinerThreadStats>& vStats, int64_t& nTemplateAge)
+{
+    LOCK(cs_miner);
+    vStats = vMinerThreadStats;
+    nTemplateAge = pMinerWork ? GetTime() - pMinerWork->nTimeCreated : -1;
 }
 
 #endif // ENABLE_WALLET
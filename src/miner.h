@@ -6,13 +6,19 @@
 #ifndef BITCOIN_MINER_H
 #define BITCOIN_MINER_H
 
+#include "amount.h"
+#include "script/script.h"
+#include "uint256.h"
+
+#include <set>
 #include <stdint.h>
+#include <vector>
 
 class CBlock;
 class CBlockHeader;
 class CBlockIndex;
+class CCoinsViewCache;
 class CReserveKey;
-class CScript;
 class CWallet;
 
 struct CBlockTemplate;
@@ -24,10 +30,72 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey);
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
-/** Check mined block */
-bool CheckWork(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey);
+/** Set the extranonce in a block to the given bytes, so that callers can hand out disjoint ranges */
+void SetExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, const std::vector<unsigned char>& vchExtraNonce);
+/** Byte offset of the extranonce set by SetExtraNonce within the serialized coinbase transaction */
+unsigned int GetExtraNonceOffset(const CBlockIndex* pindexPrev);
 void UpdateTime(CBlockHeader* block, const CBlockIndex* pindexPrev);
 
+/**
+ * Keeps the block template for the current tip between requests. A new tip
+ * causes a full CreateNewBlock; transactions accepted to the memory pool
+ * since the previous request are appended to the existing template instead,
+ * so polling callers do not pay for a complete rebuild each time.
+ */
+class CBlockTemplateManager
+{
+private:
+    CScript scriptPubKey;
+    CBlockTemplate* pblocktemplate;
+    //! pcoinsTip with the template's transactions applied
+    CCoinsViewCache* pview;
+    const CBlockIndex* pindexPrev;
+    std::set<uint256> setBlockTx;
+    unsigned int nTransactionsUpdatedLast;
+    unsigned int nTemplateId;
+    uint64_t nBlockSize;
+    int64_t nBlockSigOps;
+    CAmount nFees;
+
+    void Clear();
+    void Rebuild();
+    unsigned int AppendNewTransactions();
+
+public:
+    CBlockTemplateManager(const CScript& scriptPubKeyIn);
+    ~CBlockTemplateManager();
+
+    /**
+     * Return the template for the current tip, bringing it up to date first.
+     * The template stays owned by the manager and is valid until the next
+     * call. Requires cs_main.
+     */
+    CBlockTemplate* GetTemplate();
+    /** Changes every time the template is rebuilt rather than appended to */
+    unsigned int GetTemplateId() const { return nTemplateId; }
+    /** Memory pool update counter the template reflects */
+    unsigned int GetTransactionsUpdatedLast() const { return nTransactionsUpdatedLast; }
+};
+
+/** Work done by one internal miner thread */
+struct CMinerThreadStats
+{
+    double dHashesPerSec;
+    uint64_t nHashes;
+    //! Hashes spent on a block whose parent was no longer the tip
+    uint64_t nStaleHashes;
+    unsigned int nBlocks;
+    unsigned int nStaleBlocks;
+
+    CMinerThreadStats() : dHashesPerSec(0), nHashes(0), nStaleHashes(0), nBlocks(0), nStaleBlocks(0) {}
+};
+
+/**
+ * Per-thread statistics of the internal miner, and the age in seconds of
+ * the block its threads are working on (-1 when there is none).
+ */
+void GetMinerStats(std::vector<CMinerThreadStats>& vStats, int64_t& nTemplateAge);
+
 extern double dHashesPerSec;
 extern int64_t nHPSTimerStart;
 
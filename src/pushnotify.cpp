@@ -0,0 +1,325 @@
+// Copyright (c) 2015 The Joulecoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pushnotify.h"
+
+#include "main.h"
+#include "netbase.h"
+#include "streams.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "version.h"
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+
+#include <boost/algorithm/string/join.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+using namespace boost::asio;
+using namespace std;
+
+static const char* const pszPushTopics[] = { "hashblock", "hashtx", "rawblock", "rawtx" };
+
+class CPushSubscriber;
+typedef boost::shared_ptr<CPushSubscriber> PushSubscriberPtr;
+typedef boost::shared_ptr<const std::string> PushMessagePtr;
+
+/** A listening socket and the topics published to everyone connected to it */
+struct CPushPublisher
+{
+    ip::tcp::acceptor acceptor;
+    std::set<std::string> setTopics;
+    //! Only touched from the io_service thread
+    std::set<PushSubscriberPtr> setSubscribers;
+
+    CPushPublisher(io_service& ios) : acceptor(ios) {}
+};
+typedef boost::shared_ptr<CPushPublisher> PushPublisherPtr;
+
+/** Feeds the publishers from block and transaction validation */
+class CPushNotifier : public CValidationInterface
+{
+protected:
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void UpdatedBlockTip(const CBlockIndex* pindex);
+};
+
+static io_service* push_io_service = NULL;
+static boost::thread* push_thread = NULL;
+static std::vector<PushPublisherPtr> vPushPublishers;
+static std::set<std::string> setPushTopics;
+static CPushNotifier* pPushNotifier = NULL;
+
+// Only touched from the io_service thread
+static std::map<std::string, uint32_t> mapPushSequence;
+
+class CPushSubscriber : public boost::enable_shared_from_this<CPushSubscriber>
+{
+private:
+    ip::tcp::socket socket;
+    CPushPublisher& publisher;
+    std::deque<PushMessagePtr> queueSend;
+    //! Subscribers have nothing to say, reading only notices them going away
+    char buf[256];
+    unsigned int nDropped;
+
+    void Read();
+    void HandleRead(const boost::system::error_code& error);
+    void Write();
+    void HandleWrite(const boost::system::error_code& error);
+
+public:
+    ip::tcp::endpoint peer;
+
+    CPushSubscriber(io_service& ios, CPushPublisher& publisherIn) :
+        socket(ios), publisher(publisherIn), nDropped(0) {}
+
+    ip::tcp::socket& GetSocket() { return socket; }
+    void Start() { Read(); }
+    void Close();
+    void Send(const PushMessagePtr& pmsg);
+};
+
+void CPushSubscriber::Read()
+{
+    socket.async_read_some(buffer(buf),
+            boost::bind(&CPushSubscriber::HandleRead, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void CPushSubscriber::HandleRead(const boost::system::error_code& error)
+{
+    if (error)
+    {
+        if (error != boost::asio::error::operation_aborted)
+            LogPrint("pushnotify", "Push: disconnecting %s: %s\n", peer.address().to_string(), error.message());
+        Close();
+        return;
+    }
+    Read();
+}
+
+void CPushSubscriber::Write()
+{
+    async_write(socket, buffer(*queueSend.front()),
+            boost::bind(&CPushSubscriber::HandleWrite, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void CPushSubscriber::HandleWrite(const boost::system::error_code& error)
+{
+    if (error)
+    {
+        Close();
+        return;
+    }
+    queueSend.pop_front();
+    if (!queueSend.empty())
+        Write();
+}
+
+void CPushSubscriber::Close()
+{
+    boost::system::error_code ec;
+    socket.close(ec);
+    publisher.setSubscribers.erase(shared_from_this());
+}
+
+void CPushSubscriber::Send(const PushMessagePtr& pmsg)
+{
+    // Rather than let a stalled subscriber hold memory without bound, drop
+    // what it can't keep up with; the sequence numbers show the gap
+    if (queueSend.size() >= PUSH_HIGH_WATER_MARK)
+    {
+        if (nDropped++ == 0)
+            LogPrint("pushnotify", "Push: %s is not keeping up, dropping messages\n", peer.address().to_string());
+        return;
+    }
+    nDropped = 0;
+    queueSend.push_back(pmsg);
+    if (queueSend.size() == 1)
+        Write();
+}
+
+/** Number and send a message to everyone subscribed to its topic */
+static void PushMessage(const std::string& strTopic, const std::vector<unsigned char>& vchBody)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << strTopic << vchBody << mapPushSequence[strTopic]++;
+    // Serialized once and shared by all subscribers
+    PushMessagePtr pmsg(new std::string(ss.begin(), ss.end()));
+
+    BOOST_FOREACH(const PushPublisherPtr& publisher, vPushPublishers)
+    {
+        if (publisher->setTopics.count(strTopic))
+        {
+            BOOST_FOREACH(const PushSubscriberPtr& subscriber, publisher->setSubscribers)
+                subscriber->Send(pmsg);
+        }
+    }
+}
+
+/** Hand a message to the io_service thread, which numbers it in the order received */
+static void Publish(const std::string& strTopic, const std::vector<unsigned char>& vchBody)
+{
+    push_io_service->post(boost::bind(&PushMessage, strTopic, vchBody));
+}
+
+/** Hashes go out in the byte order they are displayed in */
+static std::vector<unsigned char> HashBytes(const uint256& hash)
+{
+    std::vector<unsigned char> vch(hash.begin(), hash.end());
+    std::reverse(vch.begin(), vch.end());
+    return vch;
+}
+
+void CPushNotifier::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    if (setPushTopics.count("hashtx"))
+        Publish("hashtx", HashBytes(tx.GetHash()));
+    if (setPushTopics.count("rawtx"))
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << tx;
+        Publish("rawtx", std::vector<unsigned char>(ss.begin(), ss.end()));
+    }
+}
+
+void CPushNotifier::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    if (setPushTopics.count("hashblock"))
+        Publish("hashblock", HashBytes(pindex->GetBlockHash()));
+    if (setPushTopics.count("rawblock"))
+    {
+        CBlock block;
+        {
+            LOCK(cs_main);
+            if (!ReadBlockFromDisk(block, pindex))
+            {
+                LogPrintf("%s: Can't read block %s from disk\n", __func__, pindex->GetBlockHash().ToString());
+                return;
+            }
+        }
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << block;
+        Publish("rawblock", std::vector<unsigned char>(ss.begin(), ss.end()));
+    }
+}
+
+static void PushAcceptHandler(PushPublisherPtr publisher, PushSubscriberPtr subscriber, const boost::system::error_code& error);
+
+static void PushListen(PushPublisherPtr publisher)
+{
+    PushSubscriberPtr subscriber(new CPushSubscriber(*push_io_service, *publisher));
+    publisher->acceptor.async_accept(subscriber->GetSocket(), subscriber->peer,
+            boost::bind(&PushAcceptHandler, publisher, subscriber, boost::asio::placeholders::error));
+}
+
+static void PushAcceptHandler(PushPublisherPtr publisher, PushSubscriberPtr subscriber, const boost::system::error_code& error)
+{
+    if (error == boost::asio::error::operation_aborted || !publisher->acceptor.is_open())
+        return;
+    PushListen(publisher);
+
+    if (error)
+    {
+        LogPrintf("%s: Error: %s\n", __func__, error.message());
+        return;
+    }
+    LogPrint("pushnotify", "Push: accepted subscriber %s\n", subscriber->peer.address().to_string());
+    publisher->setSubscribers.insert(subscriber);
+    subscriber->Start();
+}
+
+static void ThreadPushIO()
+{
+    RenameThread("joulecoin-pushio");
+    push_io_service->run();
+}
+
+bool StartPushNotifications(std::string& strError)
+{
+    // Topics given the same address share one listening socket
+    std::map<std::string, std::set<std::string> > mapAddressTopics;
+    for (unsigned int i = 0; i < ARRAYLEN(pszPushTopics); i++)
+    {
+        std::string strArg = std::string("-pub") + pszPushTopics[i];
+        if (mapArgs.count(strArg))
+            mapAddressTopics[mapArgs[strArg]].insert(pszPushTopics[i]);
+    }
+    if (mapAddressTopics.empty())
+        return true;
+
+    assert(push_io_service == NULL);
+    push_io_service = new io_service();
+    for (std::map<std::string, std::set<std::string> >::const_iterator it = mapAddressTopics.begin(); it != mapAddressTopics.end(); ++it)
+    {
+        CService addrBind;
+        if (!LookupNumeric(it->first.c_str(), addrBind, 0) || addrBind.GetPort() == 0)
+        {
+            strError = strprintf(_("Cannot resolve push notification address: '%s'"), it->first);
+            break;
+        }
+
+        PushPublisherPtr publisher(new CPushPublisher(*push_io_service));
+        publisher->setTopics = it->second;
+        ip::tcp::endpoint endpoint(ip::address::from_string(addrBind.ToStringIP()), addrBind.GetPort());
+        try {
+            publisher->acceptor.open(endpoint.protocol());
+            publisher->acceptor.set_option(ip::tcp::acceptor::reuse_address(true));
+            publisher->acceptor.bind(endpoint);
+            publisher->acceptor.listen(socket_base::max_connections);
+        }
+        catch (const boost::system::system_error& e)
+        {
+            strError = strprintf(_("Unable to bind push notifications to %s: %s"), addrBind.ToString(), e.what());
+            break;
+        }
+        vPushPublishers.push_back(publisher);
+        setPushTopics.insert(it->second.begin(), it->second.end());
+        LogPrintf("Publishing %s on %s\n", boost::algorithm::join(it->second, ", "), addrBind.ToString());
+    }
+    if (!strError.empty())
+    {
+        vPushPublishers.clear();
+        setPushTopics.clear();
+        delete push_io_service; push_io_service = NULL;
+        return false;
+    }
+
+    BOOST_FOREACH(const PushPublisherPtr& publisher, vPushPublishers)
+        PushListen(publisher);
+    push_thread = new boost::thread(&ThreadPushIO);
+
+    pPushNotifier = new CPushNotifier();
+    RegisterValidationInterface(pPushNotifier);
+    return true;
+}
+
+void StopPushNotifications()
+{
+    if (push_io_service == NULL)
+        return;
+
+    UnregisterValidationInterface(pPushNotifier);
+    delete pPushNotifier; pPushNotifier = NULL;
+
+    boost::system::error_code ec;
+    BOOST_FOREACH(const PushPublisherPtr& publisher, vPushPublishers)
+        publisher->acceptor.close(ec);
+    push_io_service->stop();
+    push_thread->join();
+    delete push_thread; push_thread = NULL;
+
+    vPushPublishers.clear();
+    setPushTopics.clear();
+    mapPushSequence.clear();
+    delete push_io_service; push_io_service = NULL;
+}
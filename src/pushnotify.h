@@ -0,0 +1,25 @@
+// Copyright (c) 2015 The Joulecoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PUSHNOTIFY_H
+#define BITCOIN_PUSHNOTIFY_H
+
+#include <string>
+
+/** Messages queued for a slow subscriber before further ones are dropped */
+static const unsigned int PUSH_HIGH_WATER_MARK = 1000;
+
+/**
+ * Start publishing new blocks and transactions to subscribers connected
+ * to the addresses given with -pubhashblock, -pubhashtx, -pubrawblock and
+ * -pubrawtx. Every message is the serialized topic name, payload and a
+ * per-topic sequence number, so subscribers can tell when they missed
+ * one. Returns false and sets strError when a publisher could not be
+ * started.
+ */
+bool StartPushNotifications(std::string& strError);
+/** Stop publishing and disconnect all subscribers */
+void StopPushNotifications();
+
+#endif // BITCOIN_PUSHNOTIFY_H
@@ -15,7 +15,7 @@
 #include "rpcclient.h"
 #include "util.h"
 
-#include "json/json_spirit_value.h"
+#include "univalue/univalue.h"
 
 #include <openssl/crypto.h>
 
@@ -166,21 +166,21 @@ void RPCExecutor::request(const QString &command)
         std::string strPrint;
         // Convert argument list to JSON objects in method-dependent way,
         // and pass it along with the method name to the dispatcher.
-        json_spirit::Value result = tableRPC.execute(
+        UniValue result = tableRPC.execute(
             args[0],
             RPCConvertValues(args[0], std::vector<std::string>(args.begin() + 1, args.end())));
 
         // Format result reply
-        if (result.type() == json_spirit::null_type)
+        if (result.type() == UniValue::VNULL)
             strPrint = "";
-        else if (result.type() == json_spirit::str_type)
+        else if (result.type() == UniValue::VSTR)
             strPrint = result.get_str();
         else
-            strPrint = write_string(result, true);
+            strPrint = result.write(4);
 
         emit reply(RPCConsole::CMD_REPLY, QString::fromStdString(strPrint));
     }
-    catch (json_spirit::Object& objError)
+    catch (UniValue& objError)
     {
         try // Nice formatting for standard-format error
         {
@@ -190,7 +190,7 @@ void RPCExecutor::request(const QString &command)
         }
         catch(std::runtime_error &) // raised when converting to invalid type, i.e. missing code or message
         {   // Show raw JSON object
-            emit reply(RPCConsole::CMD_ERROR, QString::fromStdString(write_string(json_spirit::Value(objError), false)));
+            emit reply(RPCConsole::CMD_ERROR, QString::fromStdString(objError.write()));
         }
     }
     catch (std::exception& e)
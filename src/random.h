@@ -46,4 +46,29 @@ static inline uint32_t insecure_rand(void)
     return (insecure_rand_Rw << 16) + insecure_rand_Rz;
 }
 
+/**
+ * The same generator as insecure_rand with state of its own, for callers
+ * that want a fast sequence without racing other threads on the shared one
+ * or reseeding it under them. Not thread-safe; keep one per caller.
+ */
+class FastRandomContext
+{
+private:
+    uint32_t Rz;
+    uint32_t Rw;
+
+public:
+    explicit FastRandomContext(bool fDeterministic = false);
+
+    uint32_t rand32()
+    {
+        Rz = 36969 * (Rz & 65535) + (Rz >> 16);
+        Rw = 18000 * (Rw & 65535) + (Rw >> 16);
+        return (Rw << 16) + Rz;
+    }
+
+    /** A value below nMax, as std::random_shuffle asks its generator for */
+    int operator()(int nMax) { return rand32() % nMax; }
+};
+
 #endif // BITCOIN_RANDOM_H
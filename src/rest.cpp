@@ -9,13 +9,18 @@
 #include "rpcserver.h"
 #include "streams.h"
 #include "sync.h"
+#include "txmempool.h"
 #include "utilstrencodings.h"
+#include "utiltime.h"
 #include "version.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/foreach.hpp>
 
 using namespace std;
-using namespace json_spirit;
+
+static const int MAX_REST_HEADERS_RESULTS = 2000;
+static const size_t MAX_GETUTXOS_OUTPOINTS = 500; //allow a max of 500 outpoints to be queried at once
 
 enum RetFormat {
     RF_UNDEF,
@@ -41,8 +46,26 @@ public:
     string message;
 };
 
-extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry);
-extern Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+struct CCoin {
+    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside ADD_SERIALIZE_METHODS
+    uint32_t nHeight;
+    CTxOut out;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nTxVer);
+        READWRITE(nHeight);
+        READWRITE(out);
+    }
+};
+
+extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
+extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
+extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 
 static RestErr RESTERR(enum HTTPStatusCode status, string message)
 {
@@ -89,6 +112,91 @@ static bool ParseHashStr(const string& strReq, uint256& v)
     return true;
 }
 
+/**
+ * Send serialized data as is, straight from the stream's buffer without
+ * copying it into a string first.
+ */
+static void WriteBinaryReply(AcceptedConnection* conn, bool fRun, const CDataStream& ss)
+{
+    conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, ss.size(), "application/octet-stream");
+    if (!ss.empty())
+        conn->stream().write(&ss[0], ss.size());
+    conn->stream() << std::flush;
+}
+
+static bool rest_headers(AcceptedConnection* conn,
+                         string& strReq,
+                         const string& strRequest,
+                         map<string, string>& mapHeaders,
+                         bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        throw RESTERR(HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash>.<ext>.");
+
+    int32_t count;
+    if (!ParseInt32(path[0], &count) || count < 1 || count > MAX_REST_HEADERS_RESULTS)
+        throw RESTERR(HTTP_BAD_REQUEST, strprintf("Header count out of range: %s", path[0]));
+
+    string hashStr = path[1];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    // Headers come straight from the block index, no block is read from disk.
+    // Walking the active chain needs cs_main, so everything is serialized
+    // under it; that is at most a few hundred kilobytes.
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    UniValue jsonHeaders(UniValue::VARR);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex* pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
+        if (pindex == NULL)
+            throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
+
+        if (rf != RF_JSON)
+            ssHeader.reserve(count * 80);
+        for (int i = 0; i < count && pindex != NULL && chainActive.Contains(pindex); i++) {
+            if (rf == RF_JSON)
+                jsonHeaders.push_back(blockheaderToJSON(pindex));
+            else
+                ssHeader << pindex->GetBlockHeader();
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    switch (rf) {
+    case RF_BINARY: {
+        WriteBinaryReply(conn, fRun, ssHeader);
+        return true;
+    }
+
+    case RF_HEX: {
+        string strHex = HexStr(ssHeader.begin(), ssHeader.end()) + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        return true;
+    }
+
+    case RF_JSON: {
+        string strJSON = jsonHeaders.write() + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_block(AcceptedConnection* conn,
                        string& strReq,
                        map<string, string>& mapHeaders,
@@ -120,8 +228,7 @@ static bool rest_block(AcceptedConnection* conn,
 
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
-        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryBlock.size(), "application/octet-stream") << binaryBlock << std::flush;
+        WriteBinaryReply(conn, fRun, ssBlock);
         return true;
     }
 
@@ -132,8 +239,8 @@ static bool rest_block(AcceptedConnection* conn,
     }
 
     case RF_JSON: {
-        Object objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        string strJSON = write_string(Value(objBlock), false) + "\n";
+        UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
+        string strJSON = objBlock.write() + "\n";
         conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
         return true;
     }
@@ -149,6 +256,7 @@ static bool rest_block(AcceptedConnection* conn,
 
 static bool rest_block_extended(AcceptedConnection* conn,
                        string& strReq,
+                       const string& strRequest,
                        map<string, string>& mapHeaders,
                        bool fRun)
 {
@@ -157,6 +265,7 @@ static bool rest_block_extended(AcceptedConnection* conn,
 
 static bool rest_block_notxdetails(AcceptedConnection* conn,
                        string& strReq,
+                       const string& strRequest,
                        map<string, string>& mapHeaders,
                        bool fRun)
 {
@@ -165,6 +274,7 @@ static bool rest_block_notxdetails(AcceptedConnection* conn,
 
 static bool rest_tx(AcceptedConnection* conn,
                     string& strReq,
+                    const string& strRequest,
                     map<string, string>& mapHeaders,
                     bool fRun)
 {
@@ -186,8 +296,7 @@ static bool rest_tx(AcceptedConnection* conn,
 
     switch (rf) {
     case RF_BINARY: {
-        string binaryTx = ssTx.str();
-        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryTx.size(), "application/octet-stream") << binaryTx << std::flush;
+        WriteBinaryReply(conn, fRun, ssTx);
         return true;
     }
 
@@ -198,18 +307,210 @@ static bool rest_tx(AcceptedConnection* conn,
     }
 
     case RF_JSON: {
-        Object objTx;
+        UniValue objTx(UniValue::VOBJ);
         TxToJSON(tx, hashBlock, objTx);
-        string strJSON = write_string(Value(objTx), false) + "\n";
+        string strJSON = objTx.write() + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_chaininfo(AcceptedConnection* conn,
+                           string& strReq,
+                           const string& strRequest,
+                           map<string, string>& mapHeaders,
+                           bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    // The chain state has no serialized form, so this one is JSON only
+    switch (rf) {
+    case RF_JSON: {
+        UniValue rpcParams(UniValue::VARR);
+        UniValue chainInfoObject = getblockchaininfo(rpcParams, false);
+        string strJSON = chainInfoObject.write() + "\n";
         conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
         return true;
     }
 
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_getutxos(AcceptedConnection* conn,
+                          string& strReq,
+                          const string& strRequest,
+                          map<string, string>& mapHeaders,
+                          bool fRun)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    vector<string> uriParts;
+    if (params[0].length() > 1) {
+        string strUriParams = params[0].substr(1);
+        boost::split(uriParts, strUriParams, boost::is_any_of("/"));
+    }
+
+    bool fCheckMemPool = false;
+    vector<COutPoint> vOutPoints;
+
+    // Outpoints come either in the URI (/rest/getutxos/checkmempool/txid-n/txid-n/...)
+    // or, for .bin and .hex, serialized in the POST body as (fCheckMemPool, vector<COutPoint>)
+    if (uriParts.size() > 0) {
+        if (uriParts[0] == "checkmempool")
+            fCheckMemPool = true;
+
+        for (size_t i = fCheckMemPool ? 1 : 0; i < uriParts.size(); i++) {
+            size_t nSep = uriParts[i].find('-');
+            uint256 txid;
+            int32_t nOutput;
+            if (nSep == string::npos || !ParseHashStr(uriParts[i].substr(0, nSep), txid) ||
+                !ParseInt32(uriParts[i].substr(nSep + 1), &nOutput) || nOutput < 0)
+                throw RESTERR(HTTP_BAD_REQUEST, "Parse error");
+
+            vOutPoints.push_back(COutPoint(txid, (uint32_t)nOutput));
+        }
+
+        if (vOutPoints.empty())
+            throw RESTERR(HTTP_BAD_REQUEST, "Error: empty request");
+    }
+
+    switch (rf) {
+    case RF_HEX:
+    case RF_BINARY: {
+        if (strRequest.empty())
+            break;
+        if (!vOutPoints.empty())
+            throw RESTERR(HTTP_BAD_REQUEST, "Combination of URI scheme inputs and raw post data is not allowed");
+
+        try {
+            CDataStream ssRequest(SER_NETWORK, PROTOCOL_VERSION);
+            if (rf == RF_HEX) {
+                if (!IsHex(strRequest))
+                    throw RESTERR(HTTP_BAD_REQUEST, "Parse error");
+                vector<unsigned char> vRequest = ParseHex(strRequest);
+                ssRequest.write((const char*)begin_ptr(vRequest), vRequest.size());
+            } else
+                ssRequest.write(strRequest.data(), strRequest.size());
+            ssRequest >> fCheckMemPool;
+            ssRequest >> vOutPoints;
+        } catch (const std::ios_base::failure&) {
+            // abort in case of unreadable binary data
+            throw RESTERR(HTTP_BAD_REQUEST, "Parse error");
+        }
+        break;
+    }
+
+    case RF_JSON:
+        break;
+
     default: {
         throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
     }
     }
 
+    if (vOutPoints.empty())
+        throw RESTERR(HTTP_BAD_REQUEST, "Error: empty request");
+    if (vOutPoints.size() > MAX_GETUTXOS_OUTPOINTS)
+        throw RESTERR(HTTP_BAD_REQUEST, strprintf("Error: max outpoints exceeded (max: %d, tried: %d)", MAX_GETUTXOS_OUTPOINTS, vOutPoints.size()));
+
+    // One short hold of cs_main for the whole batch instead of one per
+    // gettxout call; everything else happens outside the locks.
+    vector<unsigned char> bitmap((vOutPoints.size() + 7) / 8);
+    string bitmapStringRepresentation;
+    vector<CCoin> outs;
+    int nHeight;
+    uint256 hashTip;
+    {
+        LOCK2(cs_main, mempool.cs);
+
+        CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
+        CCoinsView& view = fCheckMemPool ? (CCoinsView&)viewMempool : *pcoinsTip;
+
+        for (size_t i = 0; i < vOutPoints.size(); i++) {
+            const COutPoint& outpoint = vOutPoints[i];
+            bool fHit = false;
+            CCoins coins;
+            if (view.GetCoins(outpoint.hash, coins)) {
+                if (fCheckMemPool)
+                    mempool.pruneSpent(outpoint.hash, coins);
+                if (coins.IsAvailable(outpoint.n)) {
+                    fHit = true;
+                    CCoin coin;
+                    coin.nTxVer = coins.nVersion;
+                    coin.nHeight = coins.nHeight;
+                    coin.out = coins.vout[outpoint.n];
+                    outs.push_back(coin);
+                }
+            }
+
+            if (fHit)
+                bitmap[i / 8] |= 1 << (i % 8);
+            bitmapStringRepresentation.append(fHit ? "1" : "0"); // human-readable form for json output
+        }
+        nHeight = chainActive.Height();
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        // Same layout as the getutxos P2P message proposal (BIP 64)
+        CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
+        ssGetUTXOResponse << nHeight << hashTip << bitmap << outs;
+        if (rf == RF_BINARY)
+            WriteBinaryReply(conn, fRun, ssGetUTXOResponse);
+        else {
+            string strHex = HexStr(ssGetUTXOResponse.begin(), ssGetUTXOResponse.end()) + "\n";
+            conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
+        }
+        return true;
+    }
+
+    case RF_JSON: {
+        UniValue objGetUTXOResponse(UniValue::VOBJ);
+        objGetUTXOResponse.push_back(Pair("chainHeight", nHeight));
+        objGetUTXOResponse.push_back(Pair("chaintipHash", hashTip.GetHex()));
+        objGetUTXOResponse.push_back(Pair("bitmap", bitmapStringRepresentation));
+
+        UniValue utxos(UniValue::VARR);
+        BOOST_FOREACH(const CCoin& coin, outs) {
+            UniValue utxo(UniValue::VOBJ);
+            utxo.push_back(Pair("txvers", (int32_t)coin.nTxVer));
+            utxo.push_back(Pair("height", (int32_t)coin.nHeight));
+            utxo.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
+
+            UniValue o(UniValue::VOBJ);
+            ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
+            utxo.push_back(Pair("scriptPubKey", o));
+            utxos.push_back(utxo);
+        }
+        objGetUTXOResponse.push_back(Pair("utxos", utxos));
+
+        string strJSON = objGetUTXOResponse.write() + "\n";
+        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return true;
+    }
+
+    default:
+        break;
+    }
+
     // not reached
     return true; // continue to process further HTTP reqs on this cxn
 }
@@ -218,16 +519,21 @@ static const struct {
     const char* prefix;
     bool (*handler)(AcceptedConnection* conn,
                     string& strURI,
+                    const string& strRequest,
                     map<string, string>& mapHeaders,
                     bool fRun);
 } uri_prefixes[] = {
       {"/rest/tx/", rest_tx},
       {"/rest/block/notxdetails/", rest_block_notxdetails},
       {"/rest/block/", rest_block_extended},
+      {"/rest/headers/", rest_headers},
+      {"/rest/chaininfo", rest_chaininfo},
+      {"/rest/getutxos", rest_getutxos},
 };
 
 bool HTTPReq_REST(AcceptedConnection* conn,
                   string& strURI,
+                  const string& strRequest,
                   map<string, string>& mapHeaders,
                   bool fRun)
 {
@@ -240,7 +546,23 @@ bool HTTPReq_REST(AcceptedConnection* conn,
             unsigned int plen = strlen(uri_prefixes[i].prefix);
             if (strURI.substr(0, plen) == uri_prefixes[i].prefix) {
                 string strReq = strURI.substr(plen);
-                return uri_prefixes[i].handler(conn, strReq, mapHeaders, fRun);
+                // Statistics go by endpoint, e.g. "/rest/tx"
+                string strName(uri_prefixes[i].prefix);
+                if (strName[strName.size() - 1] == '/')
+                    strName.erase(strName.size() - 1);
+                uint64_t nWrittenStart = conn->bytes_written();
+                int64_t nTimeStart = GetTimeMicros();
+                bool fRunNext = false;
+                bool fError = false;
+                try {
+                    fRunNext = uri_prefixes[i].handler(conn, strReq, strRequest, mapHeaders, fRun);
+                } catch (RestErr& re) {
+                    conn->stream() << HTTPReply(re.status, re.message + "\r\n", false, false, "text/plain") << std::flush;
+                    fError = true;
+                }
+                RecordRPCCall(strName, GetTimeMicros() - nTimeStart, fError);
+                RecordRPCTraffic(strName, strRequest.size(), conn->bytes_written() - nWrittenStart);
+                return fRunNext;
             }
         }
     } catch (RestErr& re) {
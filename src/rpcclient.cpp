@@ -13,7 +13,6 @@
 #include <stdint.h>
 
 using namespace std;
-using namespace json_spirit;
 
 class CRPCConvertParam
 {
@@ -117,9 +116,9 @@ CRPCConvertTable::CRPCConvertTable()
 static CRPCConvertTable rpcCvtTable;
 
 /** Convert strings to command-specific RPC representation */
-Array RPCConvertValues(const std::string &strMethod, const std::vector<std::string> &strParams)
+UniValue RPCConvertValues(const std::string &strMethod, const std::vector<std::string> &strParams)
 {
-    Array params;
+    UniValue params(UniValue::VARR);
 
     for (unsigned int idx = 0; idx < strParams.size(); idx++) {
         const std::string& strVal = strParams[idx];
@@ -131,8 +130,8 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
 
         // parse string as JSON, insert bool/number/object/etc. value
         else {
-            Value jVal;
-            if (!read_string(strVal, jVal))
+            UniValue jVal;
+            if (!jVal.read(strVal))
                 throw runtime_error(string("Error parsing JSON:")+strVal);
             params.push_back(jVal);
         }
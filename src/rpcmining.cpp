@@ -22,10 +22,8 @@
 
 #include <boost/assign/list_of.hpp>
 
-#include "json/json_spirit_utils.h"
-#include "json/json_spirit_value.h"
+#include "univalue/univalue.h"
 
-using namespace json_spirit;
 using namespace std;
 
 /**
@@ -33,7 +31,7 @@ using namespace std;
  * or from the last difficulty change if 'lookup' is nonpositive.
  * If 'height' is nonnegative, compute the estimate at the time when a given block was found.
  */
-Value GetNetworkHashPS(int lookup, int height) {
+UniValue GetNetworkHashPS(int lookup, int height) {
     CBlockIndex *pb = chainActive.Tip();
 
     if (height >= 0 && height < chainActive.Height())
@@ -70,7 +68,7 @@ Value GetNetworkHashPS(int lookup, int height) {
     return (int64_t)(workDiff.getdouble() / timeDiff);
 }
 
-Value getnetworkhashps(const Array& params, bool fHelp)
+UniValue getnetworkhashps(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 2)
         throw runtime_error(
@@ -88,11 +86,12 @@ Value getnetworkhashps(const Array& params, bool fHelp)
             + HelpExampleRpc("getnetworkhashps", "")
        );
 
+    RPC_LOCK(cs_main);
     return GetNetworkHashPS(params.size() > 0 ? params[0].get_int() : 120, params.size() > 1 ? params[1].get_int() : -1);
 }
 
 #ifdef ENABLE_WALLET
-Value getgenerate(const Array& params, bool fHelp)
+UniValue getgenerate(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
         throw runtime_error(
@@ -111,7 +110,7 @@ Value getgenerate(const Array& params, bool fHelp)
 }
 
 
-Value setgenerate(const Array& params, bool fHelp)
+UniValue setgenerate(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
@@ -167,7 +166,7 @@ Value setgenerate(const Array& params, bool fHelp)
             nHeightEnd = nHeightStart+nGenerate;
         }
         unsigned int nExtraNonce = 0;
-        Array blockHashes;
+        UniValue blockHashes(UniValue::VARR);
         while (nHeight < nHeightEnd)
         {
             auto_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey));
@@ -198,10 +197,10 @@ Value setgenerate(const Array& params, bool fHelp)
         GenerateBitcoins(fGenerate, pwalletMain, nGenProcLimit);
     }
 
-    return Value::null;
+    return NullUniValue;
 }
 
-Value gethashespersec(const Array& params, bool fHelp)
+UniValue gethashespersec(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
         throw runtime_error(
@@ -222,7 +221,7 @@ Value gethashespersec(const Array& params, bool fHelp)
 #endif
 
 
-Value getmininginfo(const Array& params, bool fHelp)
+UniValue getmininginfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
         throw runtime_error(
@@ -238,6 +237,18 @@ Value getmininginfo(const Array& params, bool fHelp)
             "  \"generate\": true|false     (boolean) If the generation is on or off (see getgenerate or setgenerate calls)\n"
             "  \"genproclimit\": n          (numeric) The processor limit for generation. -1 if no generation. (see getgenerate or setgenerate calls)\n"
             "  \"hashespersec\": n          (numeric) The hashes per second of the generation, or 0 if no generation.\n"
+            "  \"templateage\": n           (numeric) Seconds since the block being generated was built, -1 if there is none\n"
+            "  \"staleworkratio\": x.xxx    (numeric) Fraction of hashes spent on blocks whose parent was no longer the tip\n"
+            "  \"threads\": [               (array) One entry per generation thread\n"
+            "    {\n"
+            "      \"hashespersec\": n      (numeric) The hashes per second of this thread\n"
+            "      \"hashes\": n            (numeric) Hashes done by this thread\n"
+            "      \"staleworkratio\": x.xxx (numeric) Fraction of this thread's hashes that were stale\n"
+            "      \"blocks\": n            (numeric) Blocks found by this thread\n"
+            "      \"staleblocks\": n       (numeric) Blocks found by this thread after the tip had moved on\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
             "  \"pooledtx\": n              (numeric) The size of the mem pool\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "  \"chain\": \"xxxx\",         (string) current network name as defined in BIP70 (main, test, regtest)\n"
@@ -247,27 +258,52 @@ Value getmininginfo(const Array& params, bool fHelp)
             + HelpExampleRpc("getmininginfo", "")
         );
 
-    Object obj;
-    obj.push_back(Pair("blocks",           (int)chainActive.Height()));
-    obj.push_back(Pair("currentblocksize", (uint64_t)nLastBlockSize));
-    obj.push_back(Pair("currentblocktx",   (uint64_t)nLastBlockTx));
-    obj.push_back(Pair("difficulty",       (double)GetDifficulty()));
-    obj.push_back(Pair("errors",           GetWarnings("statusbar")));
-    obj.push_back(Pair("genproclimit",     (int)GetArg("-genproclimit", -1)));
-    obj.push_back(Pair("networkhashps",    getnetworkhashps(params, false)));
-    obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
+    UniValue obj(UniValue::VOBJ);
+    {
+        RPC_LOCK(cs_main);
+        obj.push_back(Pair("blocks",           (int)chainActive.Height()));
+        obj.push_back(Pair("currentblocksize", (uint64_t)nLastBlockSize));
+        obj.push_back(Pair("currentblocktx",   (uint64_t)nLastBlockTx));
+        obj.push_back(Pair("difficulty",       (double)GetDifficulty()));
+        obj.push_back(Pair("errors",           GetWarnings("statusbar")));
+        obj.push_back(Pair("genproclimit",     (int)GetArg("-genproclimit", -1)));
+        obj.push_back(Pair("networkhashps",    getnetworkhashps(params, false)));
+        obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
+    }
     obj.push_back(Pair("testnet",          Params().TestnetToBeDeprecatedFieldRPC()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
 #ifdef ENABLE_WALLET
     obj.push_back(Pair("generate",         getgenerate(params, false)));
     obj.push_back(Pair("hashespersec",     gethashespersec(params, false)));
+
+    std::vector<CMinerThreadStats> vStats;
+    int64_t nTemplateAge;
+    GetMinerStats(vStats, nTemplateAge);
+    uint64_t nHashes = 0;
+    uint64_t nStaleHashes = 0;
+    UniValue threads(UniValue::VARR);
+    BOOST_FOREACH(const CMinerThreadStats& stats, vStats)
+    {
+        UniValue thread(UniValue::VOBJ);
+        thread.push_back(Pair("hashespersec",   (int64_t)stats.dHashesPerSec));
+        thread.push_back(Pair("hashes",         stats.nHashes));
+        thread.push_back(Pair("staleworkratio", stats.nHashes ? (double)stats.nStaleHashes / stats.nHashes : 0.0));
+        thread.push_back(Pair("blocks",         (int)stats.nBlocks));
+        thread.push_back(Pair("staleblocks",    (int)stats.nStaleBlocks));
+        threads.push_back(thread);
+        nHashes += stats.nHashes;
+        nStaleHashes += stats.nStaleHashes;
+    }
+    obj.push_back(Pair("templateage",      nTemplateAge));
+    obj.push_back(Pair("staleworkratio",   nHashes ? (double)nStaleHashes / nHashes : 0.0));
+    obj.push_back(Pair("threads",          threads));
 #endif
     return obj;
 }
 
 
 // NOTE: Unlike wallet RPC (which use BTC values), mining RPCs follow GBT (BIP 22) in using satoshi amounts
-Value prioritisetransaction(const Array& params, bool fHelp)
+UniValue prioritisetransaction(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 3)
         throw runtime_error(
@@ -297,11 +333,39 @@ Value prioritisetransaction(const Array& params, bool fHelp)
 }
 
 
+/**
+ * Counts a long poll as waiting while in scope, and with -longpolltxthreshold
+ * registers the memory pool update count that answers it, so that leaving by
+ * exception frees both. Lives under csBestBlock.
+ */
+class CLongPollWaiter
+{
+private:
+    int& nWaiters;
+    bool fTxTarget;
+    std::multiset<unsigned int>::iterator itTxTarget;
+
+public:
+    CLongPollWaiter(int& nWaitersIn, unsigned int nTxTarget) : nWaiters(nWaitersIn), fTxTarget(nLongPollTxThreshold > 0)
+    {
+        ++nWaiters;
+        if (fTxTarget)
+            itTxTarget = setLongPollTxTargets.insert(nTxTarget);
+    }
+
+    ~CLongPollWaiter()
+    {
+        --nWaiters;
+        if (fTxTarget)
+            setLongPollTxTargets.erase(itTxTarget);
+    }
+};
+
 // NOTE: Assumes a conclusive result; if result is inconclusive, it must be handled by caller
-static Value BIP22ValidationResult(const CValidationState& state)
+static UniValue BIP22ValidationResult(const CValidationState& state)
 {
     if (state.IsValid())
-        return Value::null;
+        return NullUniValue;
 
     std::string strRejectReason = state.GetRejectReason();
     if (state.IsError())
@@ -316,7 +380,7 @@ static Value BIP22ValidationResult(const CValidationState& state)
     return "valid?";
 }
 
-Value getblocktemplate(const Array& params, bool fHelp)
+UniValue getblocktemplate(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
         throw runtime_error(
@@ -332,7 +396,8 @@ Value getblocktemplate(const Array& params, bool fHelp)
             "       \"capabilities\":[       (array, optional) A list of strings\n"
             "           \"support\"           (string) client side supported feature, 'longpoll', 'coinbasetxn', 'coinbasevalue', 'proposal', 'serverlist', 'workid'\n"
             "           ,...\n"
-            "         ]\n"
+            "         ],\n"
+            "       \"longpollid\":\"id\"  (string, optional) wait until the template identified by 'id' is outdated, see -longpolltimeout and -longpolltxthreshold\n"
             "     }\n"
             "\n"
 
@@ -379,14 +444,14 @@ Value getblocktemplate(const Array& params, bool fHelp)
          );
 
     std::string strMode = "template";
-    Value lpval = Value::null;
+    UniValue lpval = NullUniValue;
     if (params.size() > 0)
     {
-        const Object& oparam = params[0].get_obj();
-        const Value& modeval = find_value(oparam, "mode");
-        if (modeval.type() == str_type)
+        const UniValue& oparam = params[0].get_obj();
+        const UniValue& modeval = find_value(oparam, "mode");
+        if (modeval.type() == UniValue::VSTR)
             strMode = modeval.get_str();
-        else if (modeval.type() == null_type)
+        else if (modeval.type() == UniValue::VNULL)
         {
             /* Do nothing */
         }
@@ -396,14 +461,15 @@ Value getblocktemplate(const Array& params, bool fHelp)
 
         if (strMode == "proposal")
         {
-            const Value& dataval = find_value(oparam, "data");
-            if (dataval.type() != str_type)
+            const UniValue& dataval = find_value(oparam, "data");
+            if (dataval.type() != UniValue::VSTR)
                 throw JSONRPCError(RPC_TYPE_ERROR, "Missing data String key for proposal");
 
             CBlock block;
             if (!DecodeHexBlk(block, dataval.get_str()))
                 throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Block decode failed");
 
+            RPC_LOCK(cs_main);
             uint256 hash = block.GetHash();
             BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end()) {
@@ -428,22 +494,26 @@ Value getblocktemplate(const Array& params, bool fHelp)
     if (strMode != "template")
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid mode");
 
-    if (vNodes.empty())
-        throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Joulecoin is not connected!");
+    {
+        RPC_LOCK(cs_main);
+        if (vNodes.empty())
+            throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Joulecoin is not connected!");
 
-    if (IsInitialBlockDownload())
-        throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Joulecoin is downloading blocks...");
+        if (IsInitialBlockDownload())
+            throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "Joulecoin is downloading blocks...");
+    }
 
     static unsigned int nTransactionsUpdatedLast;
 
-    if (lpval.type() != null_type)
+    if (lpval.type() != UniValue::VNULL)
     {
-        // Wait to respond until either the best block changes, OR a minute has passed and there are more transactions
+        // Wait to respond until either the best block changes, OR enough transactions have entered the
+        // memory pool, OR a minute has passed and there are more transactions
         uint256 hashWatchedChain;
         boost::system_time checktxtime;
         unsigned int nTransactionsUpdatedLastLP;
 
-        if (lpval.type() == str_type)
+        if (lpval.type() == UniValue::VSTR)
         {
             // Format: <hashBestChain><nTransactionsUpdatedLast>
             std::string lpstr = lpval.get_str();
@@ -454,23 +524,38 @@ Value getblocktemplate(const Array& params, bool fHelp)
         else
         {
             // NOTE: Spec does not specify behaviour for non-string longpollid, but this makes testing easier
+            RPC_LOCK(cs_main);
             hashWatchedChain = chainActive.Tip()->GetBlockHash();
             nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
         }
 
-        // Release the wallet and main lock while waiting
-#ifdef ENABLE_WALLET
-        if(pwalletMain)
-            LEAVE_CRITICAL_SECTION(pwalletMain->cs_wallet);
-#endif
-        LEAVE_CRITICAL_SECTION(cs_main);
+        // Wait without holding cs_main
         {
+            static int nLongPollWaiters = 0; // guarded by csBestBlock
+            // Keep one RPC thread free for other calls; polls beyond that are turned away
+            const int nMaxWaiters = GetArg("-rpcthreads", 4) - 1;
+            const unsigned int nTxThreshold = nLongPollTxThreshold;
+            const int64_t nTimeout = GetArg("-longpolltimeout", DEFAULT_LONGPOLL_TIMEOUT);
+            boost::system_time deadline = boost::posix_time::pos_infin;
+            if (nTimeout > 0)
+                deadline = boost::get_system_time() + boost::posix_time::seconds(nTimeout);
             checktxtime = boost::get_system_time() + boost::posix_time::minutes(1);
 
             boost::unique_lock<boost::mutex> lock(csBestBlock);
+            // Answering right away would only have the client poll again at once
+            if (nLongPollWaiters >= nMaxWaiters)
+                throw JSONRPCError(RPC_MISC_ERROR, "Too many long polls waiting, try again later");
+            CLongPollWaiter waiter(nLongPollWaiters, nTransactionsUpdatedLastLP + nTxThreshold);
             while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning())
             {
-                if (!cvBlockChange.timed_wait(lock, checktxtime))
+                // Woken by UpdateTip, by AcceptToMemoryPool or by the timeout
+                unsigned int nUpdates = mempool.GetTransactionsUpdated() - nTransactionsUpdatedLastLP;
+                if (nTxThreshold > 0 && nUpdates >= nTxThreshold)
+                    break;
+                if (boost::get_system_time() >= deadline)
+                    break;
+                if (!cvBlockChange.timed_wait(lock, std::min(checktxtime, deadline)) &&
+                    boost::get_system_time() >= checktxtime)
                 {
                     // Timeout: Check transactions for update
                     if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP)
@@ -479,72 +564,59 @@ Value getblocktemplate(const Array& params, bool fHelp)
                 }
             }
         }
-        ENTER_CRITICAL_SECTION(cs_main);
-#ifdef ENABLE_WALLET
-        if(pwalletMain)
-            ENTER_CRITICAL_SECTION(pwalletMain->cs_wallet);
-#endif
 
         if (!IsRPCRunning())
             throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
         // TODO: Maybe recheck connections/IBD and (if something wrong) send an expires-immediately template to stop miners?
     }
 
-    // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
-    {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
-
-        // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-
-        // Create new block
-        if(pblocktemplate)
-        {
-            delete pblocktemplate;
-            pblocktemplate = NULL;
-        }
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = CreateNewBlock(scriptDummy);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
-    }
+    RPC_LOCK(cs_main);
+
+    // Update block: a new tip rebuilds the template, new transactions are appended to it
+    static CBlockTemplateManager* ptemplatemanager;
+    if (!ptemplatemanager)
+        ptemplatemanager = new CBlockTemplateManager(CScript() << OP_TRUE);
+    CBlockTemplate* pblocktemplate = ptemplatemanager->GetTemplate();
+    if (!pblocktemplate)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+    nTransactionsUpdatedLast = ptemplatemanager->GetTransactionsUpdatedLast();
+    CBlockIndex* pindexPrev = chainActive.Tip();
     CBlock* pblock = &pblocktemplate->block; // pointer for convenience
 
     // Update nTime
     UpdateTime(pblock, pindexPrev);
     pblock->nNonce = 0;
 
-    static const Array aCaps = boost::assign::list_of("proposal");
+    UniValue aCaps(UniValue::VARR);
+    aCaps.push_back("proposal");
 
-    Array transactions;
-    map<uint256, int64_t> setTxIndex;
-    int i = 0;
-    BOOST_FOREACH (CTransaction& tx, pblock->vtx)
+    // Transactions already encoded for this template are served from the
+    // cache; only transactions appended since the last call are encoded.
+    static UniValue transactions(UniValue::VARR);
+    static map<uint256, int64_t> setTxIndex;
+    static unsigned int nTemplateIdCached;
+    if (nTemplateIdCached != ptemplatemanager->GetTemplateId())
+    {
+        transactions.clear();
+        setTxIndex.clear();
+        nTemplateIdCached = ptemplatemanager->GetTemplateId();
+    }
+    for (unsigned int i = setTxIndex.size(); i < pblock->vtx.size(); i++)
     {
+        const CTransaction& tx = pblock->vtx[i];
         uint256 txHash = tx.GetHash();
-        setTxIndex[txHash] = i++;
+        setTxIndex[txHash] = i;
 
         if (tx.IsCoinBase())
             continue;
 
-        Object entry;
+        UniValue entry(UniValue::VOBJ);
 
         entry.push_back(Pair("data", EncodeHexTx(tx)));
 
         entry.push_back(Pair("hash", txHash.GetHex()));
 
-        Array deps;
+        UniValue deps(UniValue::VARR);
         BOOST_FOREACH (const CTxIn &in, tx.vin)
         {
             if (setTxIndex.count(in.prevout.hash))
@@ -552,19 +624,18 @@ Value getblocktemplate(const Array& params, bool fHelp)
         }
         entry.push_back(Pair("depends", deps));
 
-        int index_in_template = i - 1;
-        entry.push_back(Pair("fee", pblocktemplate->vTxFees[index_in_template]));
-        entry.push_back(Pair("sigops", pblocktemplate->vTxSigOps[index_in_template]));
+        entry.push_back(Pair("fee", pblocktemplate->vTxFees[i]));
+        entry.push_back(Pair("sigops", pblocktemplate->vTxSigOps[i]));
 
         transactions.push_back(entry);
     }
 
-    Object aux;
+    UniValue aux(UniValue::VOBJ);
     aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
 
     uint256 hashTarget = uint256().SetCompact(pblock->nBits);
 
-    static Array aMutable;
+    static UniValue aMutable(UniValue::VARR);
     if (aMutable.empty())
     {
         aMutable.push_back("time");
@@ -572,7 +643,7 @@ Value getblocktemplate(const Array& params, bool fHelp)
         aMutable.push_back("prevblock");
     }
 
-    Object result;
+    UniValue result(UniValue::VOBJ);
     result.push_back(Pair("capabilities", aCaps));
     result.push_back(Pair("version", pblock->nVersion));
     result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
@@ -611,7 +682,7 @@ protected:
     };
 };
 
-Value submitblock(const Array& params, bool fHelp)
+UniValue submitblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
@@ -672,7 +743,7 @@ Value submitblock(const Array& params, bool fHelp)
     return BIP22ValidationResult(state);
 }
 
-Value estimatefee(const Array& params, bool fHelp)
+UniValue estimatefee(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
         throw runtime_error(
@@ -691,7 +762,7 @@ Value estimatefee(const Array& params, bool fHelp)
             + HelpExampleCli("estimatefee", "6")
             );
 
-    RPCTypeCheck(params, boost::assign::list_of(int_type));
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM));
 
     int nBlocks = params[0].get_int();
     if (nBlocks < 1)
@@ -704,7 +775,7 @@ Value estimatefee(const Array& params, bool fHelp)
     return ValueFromAmount(feeRate.GetFeePerK());
 }
 
-Value estimatepriority(const Array& params, bool fHelp)
+UniValue estimatepriority(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
         throw runtime_error(
@@ -723,7 +794,7 @@ Value estimatepriority(const Array& params, bool fHelp)
             + HelpExampleCli("estimatepriority", "6")
             );
 
-    RPCTypeCheck(params, boost::assign::list_of(int_type));
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM));
 
     int nBlocks = params[0].get_int();
     if (nBlocks < 1)
@@ -14,23 +14,30 @@
 #include "wallet.h"
 #endif
 
+#include <deque>
+
 #include <boost/algorithm/string.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
 #include <boost/iostreams/concepts.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
-#include "json/json_spirit_writer_template.h"
+#include "univalue/univalue.h"
 
 using namespace boost;
 using namespace boost::asio;
-using namespace json_spirit;
 using namespace std;
 
+//! Largest request line plus headers accepted from a client
+static const size_t MAX_HTTP_HEADERS_SIZE = 64 * 1024;
+//! Bytes of request body to allocate and read at most at once
+static const size_t HTTP_READ_CHUNK_SIZE = 256 * 1024;
+
 static std::string strRPCUserColonPass;
 
 static bool fRPCRunning = false;
@@ -47,41 +54,41 @@ static boost::asio::io_service::work *rpc_dummy_work = NULL;
 static std::vector<CSubNet> rpc_allow_subnets; //!< List of subnets to allow RPC connections from
 static std::vector< boost::shared_ptr<ip::tcp::acceptor> > rpc_acceptors;
 
-void RPCTypeCheck(const Array& params,
-                  const list<Value_type>& typesExpected,
+void RPCTypeCheck(const UniValue& params,
+                  const list<UniValue::VType>& typesExpected,
                   bool fAllowNull)
 {
     unsigned int i = 0;
-    BOOST_FOREACH(Value_type t, typesExpected)
+    BOOST_FOREACH(UniValue::VType t, typesExpected)
     {
         if (params.size() <= i)
             break;
 
-        const Value& v = params[i];
-        if (!((v.type() == t) || (fAllowNull && (v.type() == null_type))))
+        const UniValue& v = params[i];
+        if (!((v.type() == t) || (fAllowNull && (v.type() == UniValue::VNULL))))
         {
             string err = strprintf("Expected type %s, got %s",
-                                   Value_type_name[t], Value_type_name[v.type()]);
+                                   uvTypeName(t), uvTypeName(v.type()));
             throw JSONRPCError(RPC_TYPE_ERROR, err);
         }
         i++;
     }
 }
 
-void RPCTypeCheck(const Object& o,
-                  const map<string, Value_type>& typesExpected,
-                  bool fAllowNull)
+void RPCTypeCheckObj(const UniValue& o,
+                     const map<string, UniValue::VType>& typesExpected,
+                     bool fAllowNull)
 {
-    BOOST_FOREACH(const PAIRTYPE(string, Value_type)& t, typesExpected)
+    BOOST_FOREACH(const PAIRTYPE(string, UniValue::VType)& t, typesExpected)
     {
-        const Value& v = find_value(o, t.first);
-        if (!fAllowNull && v.type() == null_type)
+        const UniValue& v = find_value(o, t.first);
+        if (!fAllowNull && v.type() == UniValue::VNULL)
             throw JSONRPCError(RPC_TYPE_ERROR, strprintf("Missing %s", t.first));
 
-        if (!((v.type() == t.second) || (fAllowNull && (v.type() == null_type))))
+        if (!((v.type() == t.second) || (fAllowNull && (v.type() == UniValue::VNULL))))
         {
             string err = strprintf("Expected type %s for %s, got %s",
-                                   Value_type_name[t.second], t.first, Value_type_name[v.type()]);
+                                   uvTypeName(t.second), t.first, uvTypeName(v.type()));
             throw JSONRPCError(RPC_TYPE_ERROR, err);
         }
     }
@@ -92,7 +99,7 @@ static inline int64_t roundint64(double d)
     return (int64_t)(d > 0 ? d + 0.5 : d - 0.5);
 }
 
-CAmount AmountFromValue(const Value& value)
+CAmount AmountFromValue(const UniValue& value)
 {
     double dAmount = value.get_real();
     if (dAmount <= 0.0 || dAmount > 21000000.0)
@@ -103,15 +110,21 @@ CAmount AmountFromValue(const Value& value)
     return nAmount;
 }
 
-Value ValueFromAmount(const CAmount& amount)
+UniValue ValueFromAmount(const CAmount& amount)
 {
-    return (double)amount / (double)COIN;
+    // Written out exactly rather than going through a double
+    bool fSign = amount < 0;
+    int64_t n_abs = (fSign ? -amount : amount);
+    int64_t quotient = n_abs / COIN;
+    int64_t remainder = n_abs % COIN;
+    return UniValue(UniValue::VNUM,
+            strprintf("%s%d.%08d", fSign ? "-" : "", quotient, remainder));
 }
 
-uint256 ParseHashV(const Value& v, string strName)
+uint256 ParseHashV(const UniValue& v, string strName)
 {
     string strHex;
-    if (v.type() == str_type)
+    if (v.type() == UniValue::VSTR)
         strHex = v.get_str();
     if (!IsHex(strHex)) // Note: IsHex("") is false
         throw JSONRPCError(RPC_INVALID_PARAMETER, strName+" must be hexadecimal string (not '"+strHex+"')");
@@ -119,20 +132,20 @@ uint256 ParseHashV(const Value& v, string strName)
     result.SetHex(strHex);
     return result;
 }
-uint256 ParseHashO(const Object& o, string strKey)
+uint256 ParseHashO(const UniValue& o, string strKey)
 {
     return ParseHashV(find_value(o, strKey), strKey);
 }
-vector<unsigned char> ParseHexV(const Value& v, string strName)
+vector<unsigned char> ParseHexV(const UniValue& v, string strName)
 {
     string strHex;
-    if (v.type() == str_type)
+    if (v.type() == UniValue::VSTR)
         strHex = v.get_str();
     if (!IsHex(strHex))
         throw JSONRPCError(RPC_INVALID_PARAMETER, strName+" must be hexadecimal string (not '"+strHex+"')");
     return ParseHex(strHex);
 }
-vector<unsigned char> ParseHexO(const Object& o, string strKey)
+vector<unsigned char> ParseHexO(const UniValue& o, string strKey)
 {
     return ParseHexV(find_value(o, strKey), strKey);
 }
@@ -169,7 +182,7 @@ string CRPCTable::help(string strCommand) const
 
         try
         {
-            Array params;
+            UniValue params(UniValue::VARR);
             rpcfn_type pfn = pcmd->actor;
             if (setDone.insert(pfn).second)
                 (*pfn)(params, true);
@@ -202,7 +215,7 @@ string CRPCTable::help(string strCommand) const
     return strRet;
 }
 
-Value help(const Array& params, bool fHelp)
+UniValue help(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
         throw runtime_error(
@@ -222,7 +235,7 @@ Value help(const Array& params, bool fHelp)
 }
 
 
-Value stop(const Array& params, bool fHelp)
+UniValue stop(const UniValue& params, bool fHelp)
 {
     // Accept the deprecated and ignored 'detach' boolean argument
     if (fHelp || params.size() > 1)
@@ -234,6 +247,69 @@ Value stop(const Array& params, bool fHelp)
     return "Joulecoin server stopping";
 }
 
+static UniValue GetRPCServerStats();
+
+UniValue getrpcstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcstats\n"
+            "\nReturns statistics about the RPC server.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"connections\": n,      (numeric) Open HTTP connections\n"
+            "  \"workqueue\": {         (json object) Requests waiting for and handled by the -rpcthreads workers\n"
+            "    \"threads\": n,        (numeric) Worker threads\n"
+            "    \"active\": n,         (numeric) Requests being handled right now\n"
+            "    \"depth\": n,          (numeric) Requests waiting for a worker\n"
+            "    \"peakdepth\": n,      (numeric) Most requests that have waited at once\n"
+            "    \"maxdepth\": n,       (numeric) Requests that may wait before new ones are refused (-rpcworkqueue)\n"
+            "    \"processed\": n,      (numeric) Requests handled\n"
+            "    \"rejected\": n,       (numeric) Requests refused because the queue was full\n"
+            "    \"avgwaitms\": x.xxx,  (numeric) Average milliseconds a request waited for a worker\n"
+            "    \"maxwaitms\": x.xxx,  (numeric) Longest wait for a worker in milliseconds\n"
+            "    \"avgexecms\": x.xxx,  (numeric) Average milliseconds spent handling a request\n"
+            "    \"maxexecms\": x.xxx   (numeric) Longest time spent handling a request in milliseconds\n"
+            "  },\n"
+            "  \"methods\": {           (json object) Calls to each RPC method and REST endpoint\n"
+            "    \"method\": {          (json object) The method name, or the REST endpoint such as /rest/tx\n"
+            "      \"calls\": n,        (numeric) Times the method was called\n"
+            "      \"errors\": n,       (numeric) Calls that returned an error\n"
+            "      \"avgms\": x.xxx,    (numeric) Average milliseconds spent executing a call\n"
+            "      \"maxms\": x.xxx,    (numeric) Longest call in milliseconds\n"
+            "      \"times\": {         (json object) Calls that took <0.1ms, <1ms, <10ms, <100ms, <1s and >=1s\n"
+            "        \"<0.1ms\": n,\n"
+            "        ...\n"
+            "      },\n"
+            "      \"bytesin\": n,      (numeric) Bytes of requests received\n"
+            "      \"bytesout\": n      (numeric) Bytes of replies sent\n"
+            "    }\n"
+            "  },\n"
+            "  \"locks\": {             (json object) Locks taken by each RPC method\n"
+            "    \"method\": {          (json object) The method name\n"
+            "      \"lock\": {          (json object) The lock name, such as cs_main or cs_wallet\n"
+            "        \"count\": n,      (numeric) Times the lock was taken\n"
+            "        \"avgwaitms\": x.xxx, (numeric) Average milliseconds spent waiting for the lock\n"
+            "        \"maxwaitms\": x.xxx, (numeric) Longest wait for the lock in milliseconds\n"
+            "        \"avgholdms\": x.xxx, (numeric) Average milliseconds the lock was held\n"
+            "        \"maxholdms\": x.xxx, (numeric) Longest time the lock was held in milliseconds\n"
+            "        \"holdtimes\": {   (json object) Times the lock was held for <0.1ms, <1ms, <10ms, <100ms, <1s and >=1s\n"
+            "          \"<0.1ms\": n,\n"
+            "          ...\n"
+            "        }\n"
+            "      }\n"
+            "    }\n"
+            "  }\n"
+            "}\n"
+            "\nThe same statistics are served in the Prometheus text format at /metrics on the RPC port.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcstats", "")
+            + HelpExampleRpc("getrpcstats", "")
+        );
+
+    return GetRPCServerStats();
+}
+
 
 
 /**
@@ -245,59 +321,60 @@ static const CRPCCommand vRPCCommands[] =
     /* Overall control/query calls */
     { "control",            "getinfo",                &getinfo,                true,      false,      false }, /* uses wallet if enabled */
     { "control",            "help",                   &help,                   true,      true,       false },
+    { "control",            "getrpcstats",            &getrpcstats,            true,      true,       false },
     { "control",            "stop",                   &stop,                   true,      true,       false },
 
     /* P2P networking */
-    { "network",            "getnetworkinfo",         &getnetworkinfo,         true,      false,      false },
+    { "network",            "getnetworkinfo",         &getnetworkinfo,         true,      true,       false },
     { "network",            "addnode",                &addnode,                true,      true,       false },
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,      true,       false },
-    { "network",            "getconnectioncount",     &getconnectioncount,     true,      false,      false },
+    { "network",            "getconnectioncount",     &getconnectioncount,     true,      true,       false },
     { "network",            "getnettotals",           &getnettotals,           true,      true,       false },
-    { "network",            "getpeerinfo",            &getpeerinfo,            true,      false,      false },
-    { "network",            "ping",                   &ping,                   true,      false,      false },
+    { "network",            "getpeerinfo",            &getpeerinfo,            true,      true,       false },
+    { "network",            "ping",                   &ping,                   true,      true,       false },
 
     /* Block chain and UTXO */
-    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      false,      false },
-    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      false,      false },
-    { "blockchain",         "getblockcount",          &getblockcount,          true,      false,      false },
-    { "blockchain",         "getblock",               &getblock,               true,      false,      false },
-    { "blockchain",         "getblockhash",           &getblockhash,           true,      false,      false },
-    { "blockchain",         "getchaintips",           &getchaintips,           true,      false,      false },
-    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      false,      false },
+    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      true,       false },
+    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      true,       false },
+    { "blockchain",         "getblockcount",          &getblockcount,          true,      true,       false },
+    { "blockchain",         "getblock",               &getblock,               true,      true,       false },
+    { "blockchain",         "getblockhash",           &getblockhash,           true,      true,       false },
+    { "blockchain",         "getchaintips",           &getchaintips,           true,      true,       false },
+    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      true,       false },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      true,       false },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true,      false,      false },
-    { "blockchain",         "gettxout",               &gettxout,               true,      false,      false },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false,      false },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          true,      true,       false },
+    { "blockchain",         "gettxout",               &gettxout,               true,      true,       false },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      true,       false },
     { "blockchain",         "verifychain",            &verifychain,            true,      false,      false },
     { "blockchain",         "invalidateblock",        &invalidateblock,        true,      true,       false },
     { "blockchain",         "reconsiderblock",        &reconsiderblock,        true,      true,       false },
 
     /* Mining */
-    { "mining",             "getblocktemplate",       &getblocktemplate,       true,      false,      false },
-    { "mining",             "getmininginfo",          &getmininginfo,          true,      false,      false },
-    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,      false,      false },
-    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,      false,      false },
+    { "mining",             "getblocktemplate",       &getblocktemplate,       true,      true,       false },
+    { "mining",             "getmininginfo",          &getmininginfo,          true,      true,       false },
+    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,      true,       false },
+    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,      true,       false },
     { "mining",             "submitblock",            &submitblock,            true,      true,       false },
 
 #ifdef ENABLE_WALLET
     /* Coin generation */
-    { "generating",         "getgenerate",            &getgenerate,            true,      false,      false },
-    { "generating",         "gethashespersec",        &gethashespersec,        true,      false,      false },
+    { "generating",         "getgenerate",            &getgenerate,            true,      true,       false },
+    { "generating",         "gethashespersec",        &gethashespersec,        true,      true,       false },
     { "generating",         "setgenerate",            &setgenerate,            true,      true,       false },
 #endif
 
     /* Raw transactions */
-    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true,      false,      false },
-    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,      false,      false },
-    { "rawtransactions",    "decodescript",           &decodescript,           true,      false,      false },
-    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,      false,      false },
+    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true,      true,       false },
+    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,      true,       false },
+    { "rawtransactions",    "decodescript",           &decodescript,           true,      true,       false },
+    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,      true,       false },
     { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false,     false,      false },
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false,     false,      false }, /* uses wallet if enabled */
 
     /* Utility functions */
-    { "util",               "createmultisig",         &createmultisig,         true,      true ,      false },
-    { "util",               "validateaddress",        &validateaddress,        true,      false,      false }, /* uses wallet if enabled */
-    { "util",               "verifymessage",          &verifymessage,          true,      false,      false },
+    { "util",               "createmultisig",         &createmultisig,         true,      true,       false },
+    { "util",               "validateaddress",        &validateaddress,        true,      true,       false }, /* uses wallet if enabled */
+    { "util",               "verifymessage",          &verifymessage,          true,      true,       false },
     { "util",               "estimatefee",            &estimatefee,            true,      true,       false },
     { "util",               "estimatepriority",       &estimatepriority,       true,      true,       false },
 
@@ -308,6 +385,7 @@ static const CRPCCommand vRPCCommands[] =
 
 #ifdef ENABLE_WALLET
     /* Wallet */
+    { "wallet",             "abortrescan",            &abortrescan,            true,      true,       true },
     { "wallet",             "addmultisigaddress",     &addmultisigaddress,     true,      false,      true },
     { "wallet",             "backupwallet",           &backupwallet,           true,      false,      true },
     { "wallet",             "dumpprivkey",            &dumpprivkey,            true,      false,      true },
@@ -317,8 +395,8 @@ static const CRPCCommand vRPCCommands[] =
     { "wallet",             "getaccount",             &getaccount,             true,      false,      true },
     { "wallet",             "getaddressesbyaccount",  &getaddressesbyaccount,  true,      false,      true },
     { "wallet",             "getbalance",             &getbalance,             false,     false,      true },
-    { "wallet",             "getnewaddress",          &getnewaddress,          true,      false,      true },
-    { "wallet",             "getrawchangeaddress",    &getrawchangeaddress,    true,      false,      true },
+    { "wallet",             "getnewaddress",          &getnewaddress,          true,      true,       true },
+    { "wallet",             "getrawchangeaddress",    &getrawchangeaddress,    true,      true,       true },
     { "wallet",             "getreceivedbyaccount",   &getreceivedbyaccount,   false,     false,      true },
     { "wallet",             "getreceivedbyaddress",   &getreceivedbyaddress,   false,     false,      true },
     { "wallet",             "gettransaction",         &gettransaction,         false,     false,      true },
@@ -327,7 +405,7 @@ static const CRPCCommand vRPCCommands[] =
     { "wallet",             "importprivkey",          &importprivkey,          true,      false,      true },
     { "wallet",             "importwallet",           &importwallet,           true,      false,      true },
     { "wallet",             "importaddress",          &importaddress,          true,      false,      true },
-    { "wallet",             "keypoolrefill",          &keypoolrefill,          true,      false,      true },
+    { "wallet",             "keypoolrefill",          &keypoolrefill,          true,      true,       true },
     { "wallet",             "listaccounts",           &listaccounts,           false,     false,      true },
     { "wallet",             "listaddressgroupings",   &listaddressgroupings,   false,     false,      true },
     { "wallet",             "listlockunspent",        &listlockunspent,        false,     false,      true },
@@ -335,7 +413,7 @@ static const CRPCCommand vRPCCommands[] =
     { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false,      true },
     { "wallet",             "listsinceblock",         &listsinceblock,         false,     false,      true },
     { "wallet",             "listtransactions",       &listtransactions,       false,     false,      true },
-    { "wallet",             "listunspent",            &listunspent,            false,     false,      true },
+    { "wallet",             "listunspent",            &listunspent,            false,     true,       true },
     { "wallet",             "lockunspent",            &lockunspent,            true,      false,      true },
     { "wallet",             "move",                   &movecmd,                false,     false,      true },
     { "wallet",             "sendfrom",               &sendfrom,               false,     false,      true },
@@ -381,15 +459,15 @@ bool HTTPAuthorized(map<string, string>& mapHeaders)
     return TimingResistantEqual(strUserPass, strRPCUserColonPass);
 }
 
-void ErrorReply(std::ostream& stream, const Object& objError, const Value& id)
+static void ErrorReply(std::ostream& stream, const UniValue& objError, const UniValue& id, bool fRun)
 {
     // Send error reply from json-rpc error object
     int nStatus = HTTP_INTERNAL_SERVER_ERROR;
     int code = find_value(objError, "code").get_int();
     if (code == RPC_INVALID_REQUEST) nStatus = HTTP_BAD_REQUEST;
     else if (code == RPC_METHOD_NOT_FOUND) nStatus = HTTP_NOT_FOUND;
-    string strReply = JSONRPCReply(Value::null, objError, id);
-    stream << HTTPReply(nStatus, strReply, false) << std::flush;
+    string strReply = JSONRPCReply(NullUniValue, objError, id);
+    stream << HTTPReply(nStatus, strReply, fRun) << std::flush;
 }
 
 CNetAddr BoostAsioToCNetAddr(boost::asio::ip::address address)
@@ -423,20 +501,639 @@ bool ClientAllowed(const boost::asio::ip::address& address)
     return false;
 }
 
+/**
+ * Bounded queue of requests waiting for an RPC worker. Connections are read
+ * asynchronously on rpc_io_service and only occupy a worker while a complete
+ * request is being handled, so idle keep-alive connections cost nothing but
+ * a socket.
+ */
+class CRPCWorkQueue
+{
+private:
+    struct CWorkItem
+    {
+        boost::function<void()> func;
+        int64_t nTimeQueued;
+    };
+
+    boost::mutex cs;
+    boost::condition_variable cond;
+    std::deque<CWorkItem> queue;
+    const size_t nMaxDepth;
+    bool fRunning;
+
+    // Statistics, times in microseconds
+    int nWorkers;
+    int nActive;
+    size_t nPeakDepth;
+    uint64_t nProcessed;
+    uint64_t nRejected;
+    int64_t nWaitTotal;
+    int64_t nWaitMax;
+    int64_t nExecTotal;
+    int64_t nExecMax;
+
+public:
+    CRPCWorkQueue(size_t nMaxDepthIn) : nMaxDepth(nMaxDepthIn), fRunning(true),
+        nWorkers(0), nActive(0), nPeakDepth(0), nProcessed(0), nRejected(0),
+        nWaitTotal(0), nWaitMax(0), nExecTotal(0), nExecMax(0) {}
+
+    /** Queue func for a worker. Returns false if the queue is full. */
+    bool Enqueue(const boost::function<void()>& func)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (queue.size() >= nMaxDepth)
+        {
+            nRejected++;
+            return false;
+        }
+        CWorkItem item;
+        item.func = func;
+        item.nTimeQueued = GetTimeMicros();
+        queue.push_back(item);
+        nPeakDepth = std::max(nPeakDepth, queue.size());
+        cond.notify_one();
+        return true;
+    }
+
+    /** Worker thread: handle queued requests until interrupted */
+    void Run()
+    {
+        RenameThread("joulecoin-rpcwork");
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            nWorkers++;
+        }
+        while (true)
+        {
+            CWorkItem item;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                while (fRunning && queue.empty())
+                    cond.wait(lock);
+                if (!fRunning)
+                    break;
+                item = queue.front();
+                queue.pop_front();
+                nActive++;
+            }
+
+            int64_t nTimeStart = GetTimeMicros();
+            try {
+                item.func();
+            }
+            catch (std::exception& e) {
+                LogPrint("rpc", "ThreadRPCServer connection error: %s\n", e.what());
+            }
+            int64_t nTimeEnd = GetTimeMicros();
+
+            boost::unique_lock<boost::mutex> lock(cs);
+            nActive--;
+            nProcessed++;
+            nWaitTotal += nTimeStart - item.nTimeQueued;
+            nWaitMax = std::max(nWaitMax, nTimeStart - item.nTimeQueued);
+            nExecTotal += nTimeEnd - nTimeStart;
+            nExecMax = std::max(nExecMax, nTimeEnd - nTimeStart);
+        }
+        boost::unique_lock<boost::mutex> lock(cs);
+        nWorkers--;
+    }
+
+    /** Make all workers return, dropping requests still queued */
+    void Interrupt()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fRunning = false;
+        queue.clear();
+        cond.notify_all();
+    }
+
+    UniValue GetStats()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("threads", nWorkers));
+        obj.push_back(Pair("active", nActive));
+        obj.push_back(Pair("depth", (uint64_t)queue.size()));
+        obj.push_back(Pair("peakdepth", (uint64_t)nPeakDepth));
+        obj.push_back(Pair("maxdepth", (uint64_t)nMaxDepth));
+        obj.push_back(Pair("processed", nProcessed));
+        obj.push_back(Pair("rejected", nRejected));
+        obj.push_back(Pair("avgwaitms", nProcessed ? nWaitTotal * 0.001 / nProcessed : 0.0));
+        obj.push_back(Pair("maxwaitms", nWaitMax * 0.001));
+        obj.push_back(Pair("avgexecms", nProcessed ? nExecTotal * 0.001 / nProcessed : 0.0));
+        obj.push_back(Pair("maxexecms", nExecMax * 0.001));
+        return obj;
+    }
+};
+
+static CRPCWorkQueue* rpc_work_queue = NULL;
+static CCriticalSection cs_rpcConnections;
+static int nRPCConnections = 0;
+
+/** Upper bounds of the call and lock hold time buckets in microseconds; the last bucket has none */
+static const int64_t nRPCTimeBucketLimits[] = { 100, 1000, 10000, 100000, 1000000 };
+static const char* const pszRPCTimeBuckets[] = { "<0.1ms", "<1ms", "<10ms", "<100ms", "<1s", ">=1s" };
+static const unsigned int RPC_TIME_BUCKETS = sizeof(pszRPCTimeBuckets) / sizeof(pszRPCTimeBuckets[0]);
+
+static unsigned int RPCTimeBucket(int64_t nTime)
+{
+    unsigned int nBucket = 0;
+    while (nBucket < RPC_TIME_BUCKETS - 1 && nTime >= nRPCTimeBucketLimits[nBucket])
+        nBucket++;
+    return nBucket;
+}
+
+/** Calls to one RPC method or REST endpoint, times in microseconds */
+struct CRPCMethodStats
+{
+    uint64_t nCalls;
+    uint64_t nErrors;
+    int64_t nTimeTotal;
+    int64_t nTimeMax;
+    uint64_t vTimeBuckets[RPC_TIME_BUCKETS];
+    uint64_t nBytesIn;
+    uint64_t nBytesOut;
+
+    CRPCMethodStats() : nCalls(0), nErrors(0), nTimeTotal(0), nTimeMax(0), nBytesIn(0), nBytesOut(0)
+    {
+        std::fill(vTimeBuckets, vTimeBuckets + RPC_TIME_BUCKETS, 0);
+    }
+};
+
+/** How long one RPC method waited for and held one lock, times in microseconds */
+struct CRPCLockStats
+{
+    uint64_t nCount;
+    int64_t nWaitTotal;
+    int64_t nWaitMax;
+    int64_t nHoldTotal;
+    int64_t nHoldMax;
+    uint64_t vHoldBuckets[RPC_TIME_BUCKETS];
+
+    CRPCLockStats() : nCount(0), nWaitTotal(0), nWaitMax(0), nHoldTotal(0), nHoldMax(0)
+    {
+        std::fill(vHoldBuckets, vHoldBuckets + RPC_TIME_BUCKETS, 0);
+    }
+};
+
+static boost::mutex cs_rpcStats;
+static std::map<std::string, CRPCMethodStats> mapRPCMethodStats;
+static std::map<std::string, std::map<std::string, CRPCLockStats> > mapRPCLockStats;
+
+void RecordRPCCall(const std::string& strName, int64_t nTime, bool fError)
+{
+    unsigned int nBucket = RPCTimeBucket(nTime);
+    boost::unique_lock<boost::mutex> statslock(cs_rpcStats);
+    CRPCMethodStats& stats = mapRPCMethodStats[strName];
+    stats.nCalls++;
+    if (fError)
+        stats.nErrors++;
+    stats.nTimeTotal += nTime;
+    stats.nTimeMax = std::max(stats.nTimeMax, nTime);
+    stats.vTimeBuckets[nBucket]++;
+}
+
+void RecordRPCTraffic(const std::string& strName, uint64_t nBytesIn, uint64_t nBytesOut)
+{
+    boost::unique_lock<boost::mutex> statslock(cs_rpcStats);
+    CRPCMethodStats& stats = mapRPCMethodStats[strName];
+    stats.nBytesIn += nBytesIn;
+    stats.nBytesOut += nBytesOut;
+}
+
+/** Method being executed on this thread, which RPC_LOCK attributes its locks to */
+static boost::thread_specific_ptr<std::string> pstrRPCMethodCurrent;
+
+/** Attributes the locks taken on this thread to a method while it executes */
+class CRPCMethodScope
+{
+public:
+    CRPCMethodScope(const std::string& strMethod)
+    {
+        if (pstrRPCMethodCurrent.get() == NULL)
+            pstrRPCMethodCurrent.reset(new std::string());
+        *pstrRPCMethodCurrent = strMethod;
+    }
+    ~CRPCMethodScope() { pstrRPCMethodCurrent->clear(); }
+};
+
+CRPCCriticalBlock::CRPCCriticalBlock(CCriticalSection& cs, const char* pszNameIn, const char* pszFile, int nLine) :
+    pszName(pszNameIn), nTimeStart(GetTimeMicros()), lock(cs, pszNameIn, pszFile, nLine), nTimeLocked(GetTimeMicros())
+{
+}
+
+CRPCCriticalBlock::~CRPCCriticalBlock()
+{
+    const std::string* pstrMethod = pstrRPCMethodCurrent.get();
+    if (pstrMethod == NULL || pstrMethod->empty())
+        return;
+    int64_t nWait = nTimeLocked - nTimeStart;
+    int64_t nHold = GetTimeMicros() - nTimeLocked;
+
+    // Report "pwalletMain->cs_wallet" and "mempool.cs" the way they are known
+    std::string strName(pszName);
+    size_t nPos = strName.rfind("->");
+    if (nPos != std::string::npos)
+        strName.erase(0, nPos + 2);
+
+    unsigned int nBucket = RPCTimeBucket(nHold);
+    boost::unique_lock<boost::mutex> statslock(cs_rpcStats);
+    CRPCLockStats& stats = mapRPCLockStats[*pstrMethod][strName];
+    stats.nCount++;
+    stats.nWaitTotal += nWait;
+    stats.nWaitMax = std::max(stats.nWaitMax, nWait);
+    stats.nHoldTotal += nHold;
+    stats.nHoldMax = std::max(stats.nHoldMax, nHold);
+    stats.vHoldBuckets[nBucket]++;
+}
+
+/** Bytes of a streamed result collected before they are sent as one chunk */
+static const size_t RPC_STREAM_CHUNK_SIZE = 64 * 1024;
+
+/** Connection that the result of the single request being executed on this thread may be streamed to */
+struct CRPCReplyTarget
+{
+    AcceptedConnection* conn;
+    bool fKeepAlive;
+    std::string strId;
+    bool fClaimed;
+    bool fStarted;
+
+    CRPCReplyTarget(AcceptedConnection* connIn, bool fKeepAliveIn, const UniValue& id) :
+        conn(connIn), fKeepAlive(fKeepAliveIn), strId(id.write()), fClaimed(false), fStarted(false) {}
+};
+
+static boost::thread_specific_ptr<CRPCReplyTarget> pRPCReplyTarget;
+
+CRPCResultWriter::CRPCResultWriter(bool fAllowStream) : ptarget(NULL)
+{
+    if (fAllowStream && pRPCReplyTarget.get() != NULL && !pRPCReplyTarget->fClaimed)
+    {
+        ptarget = pRPCReplyTarget.get();
+        ptarget->fClaimed = true;
+    }
+}
+
+void CRPCResultWriter::Write(const std::string& str)
+{
+    if (!ptarget->fStarted)
+    {
+        ptarget->conn->stream() << HTTPReplyChunkedHeader(HTTP_OK, ptarget->fKeepAlive);
+        strBuffer = "{\"result\":";
+        ptarget->fStarted = true;
+    }
+    strBuffer += str;
+    if (strBuffer.size() >= RPC_STREAM_CHUNK_SIZE)
+    {
+        ptarget->conn->stream() << HTTPChunk(strBuffer) << std::flush;
+        strBuffer.clear();
+    }
+}
+
+void CRPCResultWriter::WriteKey(const std::string* pstrKey)
+{
+    assert(!vFrames.empty() && vFrames.back().fObject == (pstrKey != NULL));
+    std::string str = vFrames.back().fEmpty ? "" : ",";
+    if (pstrKey != NULL)
+        str += UniValue(*pstrKey).write() + ":";
+    vFrames.back().fEmpty = false;
+    Write(str);
+}
+
+void CRPCResultWriter::Begin(bool fObject, const std::string* pstrKey)
+{
+    if (ptarget != NULL)
+    {
+        if (!vFrames.empty())
+            WriteKey(pstrKey);
+        Write(fObject ? "{" : "[");
+    }
+    vFrames.push_back(CFrame());
+    CFrame& frame = vFrames.back();
+    frame.fObject = fObject;
+    frame.fEmpty = true;
+    if (pstrKey != NULL)
+        frame.strKey = *pstrKey;
+    if (ptarget == NULL)
+    {
+        if (fObject)
+            frame.value.setObject();
+        else
+            frame.value.setArray();
+    }
+}
+
+void CRPCResultWriter::End()
+{
+    assert(!vFrames.empty());
+    if (ptarget != NULL)
+    {
+        Write(vFrames.back().fObject ? "}" : "]");
+        vFrames.pop_back();
+        return;
+    }
+
+    CFrame frame;
+    std::swap(frame, vFrames.back());
+    vFrames.pop_back();
+    if (vFrames.empty())
+        result.swap(frame.value);
+    else
+        Add(vFrames.back().fObject ? &frame.strKey : NULL, frame.value);
+}
+
+void CRPCResultWriter::Add(const std::string* pstrKey, const UniValue& value)
+{
+    if (ptarget != NULL)
+    {
+        WriteKey(pstrKey);
+        Write(value.write());
+        return;
+    }
+
+    assert(!vFrames.empty() && vFrames.back().fObject == (pstrKey != NULL));
+    if (pstrKey != NULL)
+        vFrames.back().value.pushKV(*pstrKey, value);
+    else
+        vFrames.back().value.push_back(value);
+}
+
+UniValue CRPCResultWriter::Finish()
+{
+    assert(vFrames.empty());
+    if (ptarget == NULL)
+        return result;
+
+    Write(",\"error\":null,\"id\":" + ptarget->strId + "}\n");
+    ptarget->conn->stream() << HTTPChunk(strBuffer) << HTTPChunk("") << std::flush;
+    strBuffer.clear();
+    return NullUniValue;
+}
+
+/** Stop offering the connection to result writers; returns whether the reply was streamed */
+static bool EndRPCReplyStream()
+{
+    bool fStarted = pRPCReplyTarget.get() != NULL && pRPCReplyTarget->fStarted;
+    pRPCReplyTarget.reset();
+    return fStarted;
+}
+
+static UniValue GetRPCMethodStats()
+{
+    boost::unique_lock<boost::mutex> lock(cs_rpcStats);
+    UniValue obj(UniValue::VOBJ);
+    for (std::map<std::string, CRPCMethodStats>::const_iterator it = mapRPCMethodStats.begin(); it != mapRPCMethodStats.end(); ++it)
+    {
+        const CRPCMethodStats& stats = it->second;
+        UniValue histogram(UniValue::VOBJ);
+        for (unsigned int i = 0; i < RPC_TIME_BUCKETS; i++)
+            histogram.push_back(Pair(pszRPCTimeBuckets[i], stats.vTimeBuckets[i]));
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("calls", stats.nCalls));
+        entry.push_back(Pair("errors", stats.nErrors));
+        entry.push_back(Pair("avgms", stats.nCalls ? stats.nTimeTotal * 0.001 / stats.nCalls : 0.0));
+        entry.push_back(Pair("maxms", stats.nTimeMax * 0.001));
+        entry.push_back(Pair("times", histogram));
+        entry.push_back(Pair("bytesin", stats.nBytesIn));
+        entry.push_back(Pair("bytesout", stats.nBytesOut));
+        obj.push_back(Pair(it->first, entry));
+    }
+    return obj;
+}
+
+static UniValue GetRPCLockStats()
+{
+    boost::unique_lock<boost::mutex> lock(cs_rpcStats);
+    UniValue obj(UniValue::VOBJ);
+    for (std::map<std::string, std::map<std::string, CRPCLockStats> >::const_iterator it = mapRPCLockStats.begin(); it != mapRPCLockStats.end(); ++it)
+    {
+        UniValue method(UniValue::VOBJ);
+        for (std::map<std::string, CRPCLockStats>::const_iterator mi = it->second.begin(); mi != it->second.end(); ++mi)
+        {
+            const CRPCLockStats& stats = mi->second;
+            UniValue histogram(UniValue::VOBJ);
+            for (unsigned int i = 0; i < RPC_TIME_BUCKETS; i++)
+                histogram.push_back(Pair(pszRPCTimeBuckets[i], stats.vHoldBuckets[i]));
+            UniValue entry(UniValue::VOBJ);
+            entry.push_back(Pair("count", stats.nCount));
+            entry.push_back(Pair("avgwaitms", stats.nWaitTotal * 0.001 / stats.nCount));
+            entry.push_back(Pair("maxwaitms", stats.nWaitMax * 0.001));
+            entry.push_back(Pair("avgholdms", stats.nHoldTotal * 0.001 / stats.nCount));
+            entry.push_back(Pair("maxholdms", stats.nHoldMax * 0.001));
+            entry.push_back(Pair("holdtimes", histogram));
+            method.push_back(Pair(mi->first, entry));
+        }
+        obj.push_back(Pair(it->first, method));
+    }
+    return obj;
+}
+
+static UniValue GetRPCServerStats()
+{
+    UniValue obj(UniValue::VOBJ);
+    {
+        LOCK(cs_rpcConnections);
+        obj.push_back(Pair("connections", nRPCConnections));
+    }
+    if (rpc_work_queue != NULL)
+        obj.push_back(Pair("workqueue", rpc_work_queue->GetStats()));
+    obj.push_back(Pair("methods", GetRPCMethodStats()));
+    obj.push_back(Pair("locks", GetRPCLockStats()));
+    return obj;
+}
+
+/** Escape a label value for the Prometheus text format */
+static std::string PrometheusLabel(const std::string& str)
+{
+    std::string strOut;
+    BOOST_FOREACH(char ch, str)
+    {
+        if (ch == '\\' || ch == '"')
+            strOut += '\\';
+        if (ch == '\n')
+            strOut += "\\n";
+        else
+            strOut += ch;
+    }
+    return strOut;
+}
+
+/** The server, method and lock statistics in the Prometheus text exposition format */
+static std::string GetRPCMetricsText()
+{
+    std::string str;
+    {
+        LOCK(cs_rpcConnections);
+        str += "# HELP joulecoin_rpc_connections Open HTTP connections\n";
+        str += "# TYPE joulecoin_rpc_connections gauge\n";
+        str += strprintf("joulecoin_rpc_connections %d\n", nRPCConnections);
+    }
+    if (rpc_work_queue != NULL)
+    {
+        UniValue workqueue = rpc_work_queue->GetStats();
+        str += "# HELP joulecoin_rpc_workqueue_depth Requests waiting for a worker\n";
+        str += "# TYPE joulecoin_rpc_workqueue_depth gauge\n";
+        str += strprintf("joulecoin_rpc_workqueue_depth %d\n", find_value(workqueue, "depth").get_int64());
+        str += "# HELP joulecoin_rpc_workqueue_active Requests being handled\n";
+        str += "# TYPE joulecoin_rpc_workqueue_active gauge\n";
+        str += strprintf("joulecoin_rpc_workqueue_active %d\n", find_value(workqueue, "active").get_int64());
+        str += "# HELP joulecoin_rpc_workqueue_rejected_total Requests refused because the queue was full\n";
+        str += "# TYPE joulecoin_rpc_workqueue_rejected_total counter\n";
+        str += strprintf("joulecoin_rpc_workqueue_rejected_total %d\n", find_value(workqueue, "rejected").get_int64());
+    }
+
+    boost::unique_lock<boost::mutex> lock(cs_rpcStats);
+    str += "# HELP joulecoin_rpc_calls_total Calls by RPC method or REST endpoint\n";
+    str += "# TYPE joulecoin_rpc_calls_total counter\n";
+    for (std::map<std::string, CRPCMethodStats>::const_iterator it = mapRPCMethodStats.begin(); it != mapRPCMethodStats.end(); ++it)
+        str += strprintf("joulecoin_rpc_calls_total{method=\"%s\"} %u\n", PrometheusLabel(it->first), it->second.nCalls);
+    str += "# HELP joulecoin_rpc_errors_total Calls that returned an error\n";
+    str += "# TYPE joulecoin_rpc_errors_total counter\n";
+    for (std::map<std::string, CRPCMethodStats>::const_iterator it = mapRPCMethodStats.begin(); it != mapRPCMethodStats.end(); ++it)
+        str += strprintf("joulecoin_rpc_errors_total{method=\"%s\"} %u\n", PrometheusLabel(it->first), it->second.nErrors);
+    str += "# HELP joulecoin_rpc_duration_seconds Time spent executing calls\n";
+    str += "# TYPE joulecoin_rpc_duration_seconds histogram\n";
+    for (std::map<std::string, CRPCMethodStats>::const_iterator it = mapRPCMethodStats.begin(); it != mapRPCMethodStats.end(); ++it)
+    {
+        const CRPCMethodStats& stats = it->second;
+        std::string strLabel = PrometheusLabel(it->first);
+        uint64_t nCumulative = 0;
+        for (unsigned int i = 0; i < RPC_TIME_BUCKETS; i++)
+        {
+            nCumulative += stats.vTimeBuckets[i];
+            std::string strLimit = i < RPC_TIME_BUCKETS - 1 ? strprintf("%g", nRPCTimeBucketLimits[i] * 0.000001) : "+Inf";
+            str += strprintf("joulecoin_rpc_duration_seconds_bucket{method=\"%s\",le=\"%s\"} %u\n", strLabel, strLimit, nCumulative);
+        }
+        str += strprintf("joulecoin_rpc_duration_seconds_sum{method=\"%s\"} %.6f\n", strLabel, stats.nTimeTotal * 0.000001);
+        str += strprintf("joulecoin_rpc_duration_seconds_count{method=\"%s\"} %u\n", strLabel, stats.nCalls);
+    }
+    str += "# HELP joulecoin_rpc_request_bytes_total Bytes of request bodies received\n";
+    str += "# TYPE joulecoin_rpc_request_bytes_total counter\n";
+    for (std::map<std::string, CRPCMethodStats>::const_iterator it = mapRPCMethodStats.begin(); it != mapRPCMethodStats.end(); ++it)
+        str += strprintf("joulecoin_rpc_request_bytes_total{method=\"%s\"} %u\n", PrometheusLabel(it->first), it->second.nBytesIn);
+    str += "# HELP joulecoin_rpc_response_bytes_total Bytes of replies sent\n";
+    str += "# TYPE joulecoin_rpc_response_bytes_total counter\n";
+    for (std::map<std::string, CRPCMethodStats>::const_iterator it = mapRPCMethodStats.begin(); it != mapRPCMethodStats.end(); ++it)
+        str += strprintf("joulecoin_rpc_response_bytes_total{method=\"%s\"} %u\n", PrometheusLabel(it->first), it->second.nBytesOut);
+
+    str += "# HELP joulecoin_rpc_lock_acquisitions_total Times RPC methods took a lock\n";
+    str += "# TYPE joulecoin_rpc_lock_acquisitions_total counter\n";
+    for (std::map<std::string, std::map<std::string, CRPCLockStats> >::const_iterator it = mapRPCLockStats.begin(); it != mapRPCLockStats.end(); ++it)
+        for (std::map<std::string, CRPCLockStats>::const_iterator mi = it->second.begin(); mi != it->second.end(); ++mi)
+            str += strprintf("joulecoin_rpc_lock_acquisitions_total{method=\"%s\",lock=\"%s\"} %u\n",
+                             PrometheusLabel(it->first), PrometheusLabel(mi->first), mi->second.nCount);
+    str += "# HELP joulecoin_rpc_lock_wait_seconds_total Time RPC methods spent waiting for a lock\n";
+    str += "# TYPE joulecoin_rpc_lock_wait_seconds_total counter\n";
+    for (std::map<std::string, std::map<std::string, CRPCLockStats> >::const_iterator it = mapRPCLockStats.begin(); it != mapRPCLockStats.end(); ++it)
+        for (std::map<std::string, CRPCLockStats>::const_iterator mi = it->second.begin(); mi != it->second.end(); ++mi)
+            str += strprintf("joulecoin_rpc_lock_wait_seconds_total{method=\"%s\",lock=\"%s\"} %.6f\n",
+                             PrometheusLabel(it->first), PrometheusLabel(mi->first), mi->second.nWaitTotal * 0.000001);
+    str += "# HELP joulecoin_rpc_lock_hold_seconds_total Time RPC methods spent holding a lock\n";
+    str += "# TYPE joulecoin_rpc_lock_hold_seconds_total counter\n";
+    for (std::map<std::string, std::map<std::string, CRPCLockStats> >::const_iterator it = mapRPCLockStats.begin(); it != mapRPCLockStats.end(); ++it)
+        for (std::map<std::string, CRPCLockStats>::const_iterator mi = it->second.begin(); mi != it->second.end(); ++mi)
+            str += strprintf("joulecoin_rpc_lock_hold_seconds_total{method=\"%s\",lock=\"%s\"} %.6f\n",
+                             PrometheusLabel(it->first), PrometheusLabel(mi->first), mi->second.nHoldTotal * 0.000001);
+    return str;
+}
+
+typedef asio::buffers_iterator<asio::streambuf::const_buffers_type> HTTPBufferIterator;
+
+/**
+ * Match condition for the blank line that ends the request headers, with or
+ * without carriage returns. An incomplete match resumes at the start of the
+ * current line, so that slow clients don't make us rescan the whole buffer.
+ */
+static std::pair<HTTPBufferIterator, bool> MatchHTTPHeadersEnd(HTTPBufferIterator begin, HTTPBufferIterator end)
+{
+    HTTPBufferIterator itLine = begin;
+    bool fBlank = false;
+    for (HTTPBufferIterator it = begin; it != end; ++it)
+    {
+        if (*it == '\n')
+        {
+            if (fBlank)
+                return std::make_pair(it + 1, true);
+            fBlank = true;
+            itLine = it;
+        }
+        else if (*it != '\r')
+            fBlank = false;
+    }
+    return std::make_pair(itLine, false);
+}
+
+/**
+ * IOStream device for replies. Requests are read asynchronously, so the
+ * stream handed to handlers only ever writes.
+ */
+template <typename Protocol>
+class HTTPReplyDevice : public iostreams::device<iostreams::bidirectional>
+{
+public:
+    HTTPReplyDevice(asio::ssl::stream<typename Protocol::socket> &streamIn, bool fUseSSLIn) :
+        stream(streamIn), fUseSSL(fUseSSLIn), nBytesWritten(0) {}
+
+    std::streamsize read(char* s, std::streamsize n)
+    {
+        return -1;
+    }
+    std::streamsize write(const char* s, std::streamsize n)
+    {
+        std::streamsize nWritten;
+        if (fUseSSL)
+            nWritten = asio::write(stream, asio::buffer(s, n));
+        else
+            nWritten = asio::write(stream.next_layer(), asio::buffer(s, n));
+        nBytesWritten += nWritten;
+        return nWritten;
+    }
+    uint64_t bytes_written() const { return nBytesWritten; }
+
+private:
+    asio::ssl::stream<typename Protocol::socket>& stream;
+    bool fUseSSL;
+    uint64_t nBytesWritten;
+};
+
+static bool ServiceRequest(AcceptedConnection *conn, int nProto, string& strURI,
+                           map<string, string>& mapHeaders, string& strRequest);
+
+/**
+ * A client connection. Requests are read and parsed on the io_service
+ * without blocking; each complete request is then queued for a worker,
+ * which writes the reply and resumes reading.
+ */
 template <typename Protocol>
-class AcceptedConnectionImpl : public AcceptedConnection
+class AcceptedConnectionImpl : public AcceptedConnection,
+                               public boost::enable_shared_from_this< AcceptedConnectionImpl<Protocol> >
 {
 public:
     AcceptedConnectionImpl(
             asio::io_service& io_service,
             ssl::context &context,
-            bool fUseSSL) :
+            bool fUseSSLIn) :
         sslStream(io_service, context),
-        _d(sslStream, fUseSSL),
-        _stream(_d)
+        fUseSSL(fUseSSLIn),
+        readBuf(MAX_HTTP_HEADERS_SIZE),
+        _d(sslStream, fUseSSLIn),
+        _stream(_d),
+        fStarted(false),
+        nProto(0),
+        nContentLength(0)
     {
     }
 
+    virtual ~AcceptedConnectionImpl()
+    {
+        if (fStarted)
+        {
+            LOCK(cs_rpcConnections);
+            nRPCConnections--;
+        }
+    }
+
     virtual std::iostream& stream()
     {
         return _stream;
@@ -447,27 +1144,162 @@ public:
         return peer.address().to_string();
     }
 
+    virtual uint64_t bytes_written()
+    {
+        // The stream works on its own copy of the device
+        return _stream->bytes_written();
+    }
+
     virtual void close()
     {
+        boost::system::error_code ec;
         _stream.close();
+        sslStream.lowest_layer().close(ec);
+    }
+
+    /** Start reading requests, after the handshake when using SSL */
+    void Start()
+    {
+        {
+            LOCK(cs_rpcConnections);
+            nRPCConnections++;
+        }
+        fStarted = true;
+        if (fUseSSL)
+            sslStream.async_handshake(ssl::stream_base::server,
+                    boost::bind(&AcceptedConnectionImpl::HandleHandshake, this->shared_from_this(), asio::placeholders::error));
+        else
+            ReadRequest();
     }
 
     typename Protocol::endpoint peer;
     asio::ssl::stream<typename Protocol::socket> sslStream;
 
 private:
-    SSLIOStreamDevice<Protocol> _d;
-    iostreams::stream< SSLIOStreamDevice<Protocol> > _stream;
-};
+    bool fUseSSL;
+    asio::streambuf readBuf;
+    HTTPReplyDevice<Protocol> _d;
+    iostreams::stream< HTTPReplyDevice<Protocol> > _stream;
+    bool fStarted;
+
+    // Request being read
+    int nProto;
+    string strURI;
+    map<string, string> mapHeaders;
+    size_t nContentLength;
+    string strRequest;
+
+    void HandleHandshake(const boost::system::error_code& error)
+    {
+        if (error)
+        {
+            LogPrint("rpc", "ThreadRPCServer SSL handshake with %s failed: %s\n", peer_address_to_string(), error.message());
+            close();
+            return;
+        }
+        ReadRequest();
+    }
+
+    void ReadRequest()
+    {
+        boost::function<void(const boost::system::error_code&, size_t)> handler =
+            boost::bind(&AcceptedConnectionImpl::HandleHeaders, this->shared_from_this(), asio::placeholders::error);
+        if (fUseSSL)
+            asio::async_read_until(sslStream, readBuf, MatchHTTPHeadersEnd, handler);
+        else
+            asio::async_read_until(sslStream.next_layer(), readBuf, MatchHTTPHeadersEnd, handler);
+    }
+
+    void HandleHeaders(const boost::system::error_code& error)
+    {
+        // Also hit when the headers don't fit in MAX_HTTP_HEADERS_SIZE
+        if (error)
+        {
+            close();
+            return;
+        }
+
+        std::istream is(&readBuf);
+        string strMethod;
+        if (!ReadHTTPRequestLine(is, nProto, strMethod, strURI))
+        {
+            close();
+            return;
+        }
+        mapHeaders.clear();
+        int nLen = ReadHTTPHeaders(is, mapHeaders);
+        if (nLen < 0 || (size_t)nLen > MAX_SIZE)
+        {
+            close();
+            return;
+        }
 
-void ServiceConnection(AcceptedConnection *conn);
+        // Part of the body may already be buffered behind the headers
+        nContentLength = nLen;
+        strRequest.resize(std::min(nContentLength, readBuf.size()));
+        if (!strRequest.empty())
+            is.read(&strRequest[0], strRequest.size());
+        ReadBody();
+    }
+
+    void ReadBody()
+    {
+        size_t nRead = strRequest.size();
+        if (nRead == nContentLength)
+        {
+            QueueRequest();
+            return;
+        }
+
+        // Grow the buffer as data arrives rather than trusting Content-Length up front
+        size_t nChunk = std::min(nContentLength - nRead, HTTP_READ_CHUNK_SIZE);
+        strRequest.resize(nRead + nChunk);
+        boost::function<void(const boost::system::error_code&, size_t)> handler =
+            boost::bind(&AcceptedConnectionImpl::HandleBody, this->shared_from_this(), asio::placeholders::error);
+        if (fUseSSL)
+            asio::async_read(sslStream, asio::buffer(&strRequest[nRead], nChunk), handler);
+        else
+            asio::async_read(sslStream.next_layer(), asio::buffer(&strRequest[nRead], nChunk), handler);
+    }
+
+    void HandleBody(const boost::system::error_code& error)
+    {
+        if (error)
+        {
+            close();
+            return;
+        }
+        ReadBody();
+    }
+
+    void QueueRequest()
+    {
+        if (!rpc_work_queue->Enqueue(boost::bind(&AcceptedConnectionImpl::HandleRequest, this->shared_from_this())))
+        {
+            LogPrintf("ThreadRPCServer work queue full, refusing request from %s\n", peer_address_to_string());
+            _stream << HTTPError(HTTP_SERVICE_UNAVAILABLE, false) << std::flush;
+            close();
+        }
+    }
+
+    /** Runs on a worker thread */
+    void HandleRequest()
+    {
+        bool fRun = ServiceRequest(this, nProto, strURI, mapHeaders, strRequest);
+        string().swap(strRequest);
+        if (fRun && !ShutdownRequested())
+            ReadRequest();
+        else
+            close();
+    }
+};
 
 //! Forward declaration required for RPCListen
 template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              bool fUseSSL,
-                             boost::shared_ptr< AcceptedConnection > conn,
+                             boost::shared_ptr< AcceptedConnectionImpl<Protocol> > conn,
                              const boost::system::error_code& error);
 
 /**
@@ -479,7 +1311,7 @@ static void RPCListen(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketA
                    const bool fUseSSL)
 {
     // Accept connection
-    boost::shared_ptr< AcceptedConnectionImpl<Protocol> > conn(new AcceptedConnectionImpl<Protocol>(acceptor->get_io_service(), context, fUseSSL));
+    boost::shared_ptr< AcceptedConnectionImpl<Protocol> > conn(new AcceptedConnectionImpl<Protocol>(*rpc_io_service, context, fUseSSL));
 
     acceptor->async_accept(
             conn->sslStream.lowest_layer(),
@@ -500,34 +1332,30 @@ template <typename Protocol, typename SocketAcceptorService>
 static void RPCAcceptHandler(boost::shared_ptr< basic_socket_acceptor<Protocol, SocketAcceptorService> > acceptor,
                              ssl::context& context,
                              const bool fUseSSL,
-                             boost::shared_ptr< AcceptedConnection > conn,
+                             boost::shared_ptr< AcceptedConnectionImpl<Protocol> > conn,
                              const boost::system::error_code& error)
 {
     // Immediately start accepting new connections, except when we're cancelled or our socket is closed.
     if (error != asio::error::operation_aborted && acceptor->is_open())
         RPCListen(acceptor, context, fUseSSL);
 
-    AcceptedConnectionImpl<ip::tcp>* tcp_conn = dynamic_cast< AcceptedConnectionImpl<ip::tcp>* >(conn.get());
-
     if (error)
     {
         // TODO: Actually handle errors
         LogPrintf("%s: Error: %s\n", __func__, error.message());
     }
     // Restrict callers by IP.  It is important to
-    // do this before starting client thread, to filter out
+    // do this before reading any request, to filter out
     // certain DoS and misbehaving clients.
-    else if (tcp_conn && !ClientAllowed(tcp_conn->peer.address()))
+    else if (!ClientAllowed(conn->peer.address()))
     {
         // Only send a 403 if we're not using SSL to prevent a DoS during the SSL handshake.
         if (!fUseSSL)
             conn->stream() << HTTPError(HTTP_FORBIDDEN, false) << std::flush;
         conn->close();
     }
-    else {
-        ServiceConnection(conn.get());
-        conn->close();
-    }
+    else
+        conn->Start();
 }
 
 static ip::tcp::endpoint ParseEndpoint(const std::string &strEndpoint, int defaultPort)
@@ -591,6 +1419,7 @@ void StartRPCThreads()
 
     assert(rpc_io_service == NULL);
     rpc_io_service = new asio::io_service();
+    rpc_work_queue = new CRPCWorkQueue(std::max((int)GetArg("-rpcworkqueue", DEFAULT_RPC_WORKQUEUE), 1));
     rpc_ssl_context = new ssl::context(*rpc_io_service, ssl::context::sslv23);
 
     const bool fUseSSL = GetBoolArg("-rpcssl", false);
@@ -691,9 +1520,11 @@ void StartRPCThreads()
         return;
     }
 
+    // A single thread does all socket I/O, the workers run the handlers
     rpc_worker_group = new boost::thread_group();
+    rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
     for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
-        rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
+        rpc_worker_group->create_thread(boost::bind(&CRPCWorkQueue::Run, rpc_work_queue));
     fRPCRunning = true;
 }
 
@@ -738,10 +1569,13 @@ void StopRPCThreads()
 
     rpc_io_service->stop();
     cvBlockChange.notify_all();
+    if (rpc_work_queue != NULL)
+        rpc_work_queue->Interrupt();
     if (rpc_worker_group != NULL)
         rpc_worker_group->join_all();
     delete rpc_dummy_work; rpc_dummy_work = NULL;
     delete rpc_worker_group; rpc_worker_group = NULL;
+    delete rpc_work_queue; rpc_work_queue = NULL;
     delete rpc_ssl_context; rpc_ssl_context = NULL;
     delete rpc_io_service; rpc_io_service = NULL;
 }
@@ -794,84 +1628,260 @@ void RPCRunLater(const std::string& name, boost::function<void(void)> func, int6
 class JSONRequest
 {
 public:
-    Value id;
+    UniValue id;
     string strMethod;
-    Array params;
+    UniValue params;
 
-    JSONRequest() { id = Value::null; }
-    void parse(const Value& valRequest);
+    JSONRequest() { id = NullUniValue; params.setArray(); }
+    void parse(const UniValue& valRequest);
 };
 
-void JSONRequest::parse(const Value& valRequest)
+void JSONRequest::parse(const UniValue& valRequest)
 {
     // Parse request
-    if (valRequest.type() != obj_type)
+    if (valRequest.type() != UniValue::VOBJ)
         throw JSONRPCError(RPC_INVALID_REQUEST, "Invalid Request object");
-    const Object& request = valRequest.get_obj();
+    const UniValue& request = valRequest.get_obj();
 
     // Parse id now so errors from here on will have the id
     id = find_value(request, "id");
 
     // Parse method
-    Value valMethod = find_value(request, "method");
-    if (valMethod.type() == null_type)
+    const UniValue& valMethod = find_value(request, "method");
+    if (valMethod.type() == UniValue::VNULL)
         throw JSONRPCError(RPC_INVALID_REQUEST, "Missing method");
-    if (valMethod.type() != str_type)
+    if (valMethod.type() != UniValue::VSTR)
         throw JSONRPCError(RPC_INVALID_REQUEST, "Method must be a string");
     strMethod = valMethod.get_str();
     if (strMethod != "getblocktemplate")
         LogPrint("rpc", "ThreadRPCServer method=%s\n", SanitizeString(strMethod));
 
     // Parse params
-    Value valParams = find_value(request, "params");
-    if (valParams.type() == array_type)
+    const UniValue& valParams = find_value(request, "params");
+    if (valParams.type() == UniValue::VARR)
         params = valParams.get_array();
-    else if (valParams.type() == null_type)
-        params = Array();
+    else if (valParams.type() == UniValue::VNULL)
+        params = UniValue(UniValue::VARR);
     else
         throw JSONRPCError(RPC_INVALID_REQUEST, "Params must be an array");
 }
 
 
-static Object JSONRPCExecOne(const Value& req)
+/** Count the bytes of a JSON-RPC call, unless the method doesn't exist */
+static void RecordJSONRPCTraffic(const std::string& strMethod, uint64_t nBytesIn, uint64_t nBytesOut)
+{
+    // Made-up method names would otherwise grow the statistics without bound
+    if (tableRPC[strMethod] != NULL)
+        RecordRPCTraffic(strMethod, nBytesIn, nBytesOut);
+}
+
+/**
+ * The size of each element of the JSON array strBody as it was received,
+ * found by following brackets and braces outside strings. Whitespace and
+ * commas between the elements count for none of them. Empty if strBody is
+ * not an array.
+ */
+static std::vector<uint64_t> JSONArrayElementSizes(const std::string& strBody)
+{
+    std::vector<uint64_t> vSizes;
+    size_t nPos = strBody.find_first_not_of(" \t\n\r");
+    if (nPos == std::string::npos || strBody[nPos] != '[')
+        return vSizes;
+
+    int nDepth = 0;
+    bool fInString = false, fEscape = false;
+    size_t nStart = std::string::npos, nLast = 0;
+    for (size_t i = nPos + 1; i < strBody.size(); i++)
+    {
+        char ch = strBody[i];
+        if (fInString)
+        {
+            if (fEscape)
+                fEscape = false;
+            else if (ch == '\\')
+                fEscape = true;
+            else if (ch == '"')
+                fInString = false;
+            nLast = i;
+            continue;
+        }
+        if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r')
+            continue;
+        if (nDepth == 0 && (ch == ',' || ch == ']'))
+        {
+            if (nStart != std::string::npos)
+                vSizes.push_back(nLast + 1 - nStart);
+            nStart = std::string::npos;
+            if (ch == ']')
+                break;
+            continue;
+        }
+        if (nStart == std::string::npos)
+            nStart = i;
+        nLast = i;
+        if (ch == '"')
+            fInString = true;
+        else if (ch == '{' || ch == '[')
+            nDepth++;
+        else if (ch == '}' || ch == ']')
+            nDepth--;
+    }
+    return vSizes;
+}
+
+/** Execute one element of a batch, returning its written reply; nBytesIn is its size as received */
+static string JSONRPCExecOne(const UniValue& req, uint64_t nBytesIn)
 {
-    Object rpc_result;
+    UniValue rpc_result(UniValue::VOBJ);
 
     JSONRequest jreq;
     try {
         jreq.parse(req);
 
-        Value result = tableRPC.execute(jreq.strMethod, jreq.params);
-        rpc_result = JSONRPCReplyObj(result, Value::null, jreq.id);
+        UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
+        rpc_result = JSONRPCReplyObj(result, NullUniValue, jreq.id);
     }
-    catch (Object& objError)
+    catch (UniValue& objError)
     {
-        rpc_result = JSONRPCReplyObj(Value::null, objError, jreq.id);
+        rpc_result = JSONRPCReplyObj(NullUniValue, objError, jreq.id);
     }
     catch (std::exception& e)
     {
-        rpc_result = JSONRPCReplyObj(Value::null,
+        rpc_result = JSONRPCReplyObj(NullUniValue,
                                      JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
     }
 
-    return rpc_result;
+    // Written by the worker that ran it, rather than all at once by the one that read the batch
+    string strReply = rpc_result.write();
+    if (!jreq.strMethod.empty())
+        RecordJSONRPCTraffic(jreq.strMethod, nBytesIn, strReply.size());
+    return strReply;
+}
+
+/** Whether a batch element may run alongside others, i.e. doesn't take the execute-level locks */
+static bool IsParallelRequest(const UniValue& req)
+{
+    if (req.type() != UniValue::VOBJ)
+        return true;
+    const UniValue& method = find_value(req.get_obj(), "method");
+    if (method.type() != UniValue::VSTR)
+        return true;
+    const CRPCCommand* pcmd = tableRPC[method.get_str()];
+    return pcmd == NULL || pcmd->threadSafe;
 }
 
-static string JSONRPCExecBatch(const Array& vReq)
+/**
+ * Elements of one batch request being worked through by several RPC
+ * workers. Elements are claimed in order, and the worker that read the
+ * batch claims them as well, so the batch completes even when no other
+ * worker is free to help.
+ */
+class CRPCBatch : public boost::enable_shared_from_this<CRPCBatch>
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    const UniValue& vReq;
+    std::vector<string>& vReply;
+    const int64_t nDeadline;
+    const std::vector<uint64_t>& vBytesIn;
+    size_t nNext;
+    size_t nEnd;
+    int nRunning;
+
+public:
+    CRPCBatch(const UniValue& vReqIn, std::vector<string>& vReplyIn, int64_t nDeadlineIn, const std::vector<uint64_t>& vBytesInIn) :
+        vReq(vReqIn), vReply(vReplyIn), nDeadline(nDeadlineIn), vBytesIn(vBytesInIn), nNext(0), nEnd(0), nRunning(0) {}
+
+    /** Execute elements until none are left to claim */
+    void Work()
+    {
+        while (true)
+        {
+            size_t nIdx;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                if (nNext >= nEnd)
+                    return;
+                nIdx = nNext++;
+                nRunning++;
+            }
+
+            string reply;
+            if (nDeadline != 0 && GetTimeMicros() > nDeadline)
+            {
+                const UniValue& id = vReq[nIdx].type() == UniValue::VOBJ ? find_value(vReq[nIdx].get_obj(), "id") : NullUniValue;
+                reply = JSONRPCReplyObj(NullUniValue, JSONRPCError(RPC_MISC_ERROR, "Batch time limit exceeded"), id).write();
+            }
+            else
+                reply = JSONRPCExecOne(vReq[nIdx], vBytesIn[nIdx]);
+
+            boost::unique_lock<boost::mutex> lock(cs);
+            vReply[nIdx].swap(reply);
+            if (--nRunning == 0 && nNext >= nEnd)
+                cond.notify_all();
+        }
+    }
+
+    /** Execute elements nBegin to nEndIn, with up to nHelpers other workers, and wait for them */
+    void Run(size_t nBegin, size_t nEndIn, int nHelpers)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            nNext = nBegin;
+            nEnd = nEndIn;
+        }
+        // Helpers that only get to run once everything is claimed return right away
+        for (int i = 0; i < nHelpers && rpc_work_queue != NULL; i++)
+            if (!rpc_work_queue->Enqueue(boost::bind(&CRPCBatch::Work, shared_from_this())))
+                break;
+        Work();
+
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nRunning > 0)
+            cond.wait(lock);
+    }
+};
+
+/**
+ * Execute a batch. Runs of elements whose commands lock for themselves are
+ * spread over the RPC workers; elements that need the execute-level locks
+ * run on their own, in order, so that a batch which changes the wallet
+ * still sees its own changes. Replies keep the order of the requests.
+ */
+static string JSONRPCExecBatch(const UniValue& vReq, const std::string& strBody)
 {
-    Array ret;
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    int nMaxSize = GetArg("-rpcbatchsize", DEFAULT_RPC_BATCH_SIZE);
+    if (nMaxSize > 0 && vReq.size() > (size_t)nMaxSize)
+        throw JSONRPCError(RPC_INVALID_REQUEST, strprintf("Batch of %u requests exceeds the limit of %d", vReq.size(), nMaxSize));
+    int64_t nTimeout = GetArg("-rpcbatchtimeout", DEFAULT_RPC_BATCH_TIMEOUT);
+    int64_t nDeadline = nTimeout > 0 ? GetTimeMicros() + nTimeout * 1000000 : 0;
+    int nHelpers = std::max((int)GetArg("-rpcthreads", 4) - 1, 0);
+
+    // The body parsed as this array, so the two can only disagree on a parser bug
+    std::vector<uint64_t> vBytesIn = JSONArrayElementSizes(strBody);
+    if (vBytesIn.size() != vReq.size())
+        vBytesIn.assign(vReq.size(), 0);
+
+    std::vector<string> vReply(vReq.size());
+    boost::shared_ptr<CRPCBatch> batch(new CRPCBatch(vReq, vReply, nDeadline, vBytesIn));
+    size_t nIdx = 0;
+    while (nIdx < vReq.size())
+    {
+        size_t nEnd = nIdx + 1;
+        if (IsParallelRequest(vReq[nIdx]))
+            while (nEnd < vReq.size() && IsParallelRequest(vReq[nEnd]))
+                nEnd++;
+        batch->Run(nIdx, nEnd, std::min(nHelpers, (int)(nEnd - nIdx) - 1));
+        nIdx = nEnd;
+    }
 
-    return write_string(Value(ret), false) + "\n";
+    return "[" + boost::algorithm::join(vReply, ",") + "]\n";
 }
 
-static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
-                            string& strRequest,
-                            map<string, string>& mapHeaders,
-                            bool fRun)
+/** Check a request's credentials, answering 401 when they are missing or wrong */
+static bool HTTPReq_Authorize(AcceptedConnection *conn, map<string, string>& mapHeaders)
 {
-    // Check authorization
     if (mapHeaders.count("authorization") == 0)
     {
         conn->stream() << HTTPError(HTTP_UNAUTHORIZED, false) << std::flush;
@@ -889,13 +1899,26 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
         conn->stream() << HTTPError(HTTP_UNAUTHORIZED, false) << std::flush;
         return false;
     }
+    return true;
+}
+
+static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
+                            int nProto,
+                            string& strRequest,
+                            map<string, string>& mapHeaders,
+                            bool fRun)
+{
+    // Check authorization
+    if (!HTTPReq_Authorize(conn, mapHeaders))
+        return false;
 
     JSONRequest jreq;
+    uint64_t nWrittenStart = conn->bytes_written();
     try
     {
         // Parse request
-        Value valRequest;
-        if (!read_string(strRequest, valRequest))
+        UniValue valRequest;
+        if (!valRequest.read(strRequest))
             throw JSONRPCError(RPC_PARSE_ERROR, "Parse error");
 
         // Return immediately if in warmup
@@ -908,73 +1931,90 @@ static bool HTTPReq_JSONRPC(AcceptedConnection *conn,
         string strReply;
 
         // singleton request
-        if (valRequest.type() == obj_type) {
+        if (valRequest.type() == UniValue::VOBJ) {
             jreq.parse(valRequest);
 
-            Value result = tableRPC.execute(jreq.strMethod, jreq.params);
+            // HTTP/1.1 clients may get large results streamed as they are produced
+            if (nProto >= 1)
+                pRPCReplyTarget.reset(new CRPCReplyTarget(conn, fRun, jreq.id));
+            UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
+            if (EndRPCReplyStream())
+            {
+                RecordJSONRPCTraffic(jreq.strMethod, strRequest.size(), conn->bytes_written() - nWrittenStart);
+                return true;
+            }
 
             // Send reply
-            strReply = JSONRPCReply(result, Value::null, jreq.id);
-
-        // array of requests
-        } else if (valRequest.type() == array_type)
-            strReply = JSONRPCExecBatch(valRequest.get_array());
-        else
+            strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, strReply.size()) << strReply << std::flush;
+            RecordJSONRPCTraffic(jreq.strMethod, strRequest.size(), conn->bytes_written() - nWrittenStart);
+
+        // array of requests, counted by element
+        } else if (valRequest.type() == UniValue::VARR) {
+            strReply = JSONRPCExecBatch(valRequest.get_array(), strRequest);
+            conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, strReply.size()) << strReply << std::flush;
+        } else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
-
-        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, strReply.size()) << strReply << std::flush;
     }
-    catch (Object& objError)
+    catch (UniValue& objError)
     {
-        ErrorReply(conn->stream(), objError, jreq.id);
-        return false;
+        // A reply that has started streaming is cut off by closing the connection
+        bool fStreamed = EndRPCReplyStream();
+        if (!fStreamed)
+            ErrorReply(conn->stream(), objError, jreq.id, fRun);
+        RecordJSONRPCTraffic(jreq.strMethod, strRequest.size(), conn->bytes_written() - nWrittenStart);
+        // Failed calls don't end the connection, so that requests pipelined after them still get answered
+        return !fStreamed;
     }
     catch (std::exception& e)
     {
-        ErrorReply(conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
-        return false;
+        bool fStreamed = EndRPCReplyStream();
+        if (!fStreamed)
+            ErrorReply(conn->stream(), JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id, fRun);
+        RecordJSONRPCTraffic(jreq.strMethod, strRequest.size(), conn->bytes_written() - nWrittenStart);
+        return !fStreamed;
     }
     return true;
 }
 
-void ServiceConnection(AcceptedConnection *conn)
+/**
+ * Handle one request that has been read in full. Returns whether the
+ * connection stays open for the next one.
+ */
+static bool ServiceRequest(AcceptedConnection *conn, int nProto, string& strURI,
+                           map<string, string>& mapHeaders, string& strRequest)
 {
-    bool fRun = true;
-    while (fRun && !ShutdownRequested())
-    {
-        int nProto = 0;
-        map<string, string> mapHeaders;
-        string strRequest, strMethod, strURI;
-
-        // Read HTTP request line
-        if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
-
-        // Read HTTP message headers and body
-        ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto, MAX_SIZE);
-
-        // HTTP Keep-Alive is false; close connection immediately
-        if ((mapHeaders["connection"] == "close") || (!GetBoolArg("-rpckeepalive", true)))
-            fRun = false;
-
-        // Process via JSON-RPC API
-        if (strURI == "/") {
-            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun))
-                break;
-
-        // Process via HTTP REST API
-        } else if (strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false)) {
-            if (!HTTPReq_REST(conn, strURI, mapHeaders, fRun))
-                break;
-
-        } else {
-            conn->stream() << HTTPError(HTTP_NOT_FOUND, false) << std::flush;
-            break;
-        }
+    // HTTP Keep-Alive is false; close connection after this request
+    // (HTTP/1.0 clients have to ask for keep-alive explicitly)
+    const string& strConnection = mapHeaders["connection"];
+    bool fRun = strConnection == "keep-alive" || (strConnection != "close" && nProto >= 1);
+    if (!GetBoolArg("-rpckeepalive", true))
+        fRun = false;
+
+    // Process via JSON-RPC API
+    if (strURI == "/") {
+        if (!HTTPReq_JSONRPC(conn, nProto, strRequest, mapHeaders, fRun))
+            return false;
+
+    // Statistics for Prometheus, behind the same authorization as JSON-RPC
+    } else if (strURI == "/metrics") {
+        if (!HTTPReq_Authorize(conn, mapHeaders))
+            return false;
+        conn->stream() << HTTPReply(HTTP_OK, GetRPCMetricsText(), fRun, false, "text/plain; version=0.0.4") << std::flush;
+
+    // Process via HTTP REST API
+    } else if (strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false)) {
+        if (!HTTPReq_REST(conn, strURI, strRequest, mapHeaders, fRun))
+            return false;
+
+    } else {
+        conn->stream() << HTTPError(HTTP_NOT_FOUND, false) << std::flush;
+        return false;
     }
+    return fRun;
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -991,32 +2031,41 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
+    int64_t nTimeStart = GetTimeMicros();
     try
     {
+        CRPCMethodScope scope(pcmd->name);
         // Execute
-        Value result;
+        UniValue result;
         {
             if (pcmd->threadSafe)
                 result = pcmd->actor(params, false);
 #ifdef ENABLE_WALLET
             else if (!pwalletMain) {
-                LOCK(cs_main);
+                RPC_LOCK(cs_main);
                 result = pcmd->actor(params, false);
             } else {
-                LOCK2(cs_main, pwalletMain->cs_wallet);
+                RPC_LOCK2(cs_main, pwalletMain->cs_wallet);
                 result = pcmd->actor(params, false);
             }
 #else // ENABLE_WALLET
             else {
-                LOCK(cs_main);
+                RPC_LOCK(cs_main);
                 result = pcmd->actor(params, false);
             }
 #endif // !ENABLE_WALLET
         }
+        RecordRPCCall(pcmd->name, GetTimeMicros() - nTimeStart, false);
         return result;
     }
+    catch (const UniValue& objError)
+    {
+        RecordRPCCall(pcmd->name, GetTimeMicros() - nTimeStart, true);
+        throw;
+    }
     catch (std::exception& e)
     {
+        RecordRPCCall(pcmd->name, GetTimeMicros() - nTimeStart, true);
         throw JSONRPCError(RPC_MISC_ERROR, e.what());
     }
 }
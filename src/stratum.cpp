@@ -0,0 +1,619 @@
+// Copyright (c) 2015 The Joulecoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "base58.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "miner.h"
+#include "netbase.h"
+#include "rpcprotocol.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "timedata.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utilstrencodings.h"
+#include "version.h"
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <map>
+#include <set>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "univalue/univalue.h"
+
+using namespace boost::asio;
+using namespace std;
+
+/** Error codes understood by Stratum miners */
+enum StratumErrorCode
+{
+    STRATUM_OTHER          = 20,
+    STRATUM_JOB_NOT_FOUND  = 21,
+    STRATUM_DUPLICATE      = 22,
+    STRATUM_LOW_DIFFICULTY = 23,
+    STRATUM_UNAUTHORIZED   = 24,
+    STRATUM_NOT_SUBSCRIBED = 25,
+};
+
+/** Bytes of extranonce assigned by the server and rolled by the miner */
+static const unsigned int STRATUM_EXTRANONCE1_SIZE = 4;
+static const unsigned int STRATUM_EXTRANONCE2_SIZE = 4;
+/** Jobs kept around to recognize late and duplicate shares */
+static const unsigned int MAX_STRATUM_JOBS = 16;
+static const double MIN_STRATUM_DIFFICULTY = 1.0 / 65536;
+static const double MAX_STRATUM_DIFFICULTY = 1e12;
+
+/**
+ * Work handed out to miners. The coinbase is serialized once with the
+ * extranonce left out, so that a share only costs one coinbase hash and a
+ * walk up the merkle branch to check.
+ */
+struct CStratumJob
+{
+    std::string strId;
+    CBlock block;
+    const CBlockIndex* pindexPrev;
+    //! Set when the job builds on a new tip and older jobs are stale
+    bool fClean;
+    bool fStale;
+    std::vector<unsigned char> vchCoinbase1;
+    std::vector<unsigned char> vchCoinbase2;
+    std::vector<uint256> vMerkleBranch;
+    //! Shares already accepted for this job
+    std::set<std::string> setShares;
+};
+typedef boost::shared_ptr<CStratumJob> StratumJobPtr;
+
+class CStratumConnection;
+typedef boost::shared_ptr<CStratumConnection> StratumConnectionPtr;
+
+static io_service* stratum_io_service = NULL;
+static boost::shared_ptr<ip::tcp::acceptor> stratum_acceptor;
+static boost::thread_group* stratum_threads = NULL;
+static double dStratumDifficulty = DEFAULT_STRATUM_DIFFICULTY;
+
+// Only touched from the io_service thread
+static std::map<std::string, StratumJobPtr> mapStratumJobs;
+static std::deque<std::string> vStratumJobIds;
+static StratumJobPtr pjobCurrent;
+static std::set<StratumConnectionPtr> setStratumConnections;
+static uint32_t nStratumExtraNonce1 = 0;
+
+static std::string HexUInt32(uint32_t n)
+{
+    return strprintf("%08x", n);
+}
+
+static bool ParseHexUInt32(const UniValue& value, uint32_t& n)
+{
+    if (value.type() != UniValue::VSTR || value.get_str().size() != 8 || !IsHex(value.get_str()))
+        return false;
+    n = strtoul(value.get_str().c_str(), NULL, 16);
+    return true;
+}
+
+/** Previous block hash in the word order Stratum miners expect */
+static std::string HexPrevHash(const uint256& hash)
+{
+    std::vector<unsigned char> vch(hash.begin(), hash.end());
+    for (unsigned int i = 0; i < vch.size(); i += 4)
+        std::reverse(vch.begin() + i, vch.begin() + i + 4);
+    return HexStr(vch);
+}
+
+/** Target a share must meet at the given difficulty, with difficulty 1 at nBits 0x1d00ffff */
+static uint256 GetShareTarget(double dDifficulty)
+{
+    uint256 target;
+    target.SetCompact(0x1d00ffff);
+    // Scale up first so that fractional difficulties keep their precision
+    target <<= 16;
+    target /= uint256(std::max((uint64_t)1, (uint64_t)(dDifficulty * 65536)));
+    return target;
+}
+
+class CStratumConnection : public boost::enable_shared_from_this<CStratumConnection>
+{
+private:
+    ip::tcp::socket socket;
+    boost::asio::streambuf buf;
+    std::deque<std::string> queueSend;
+    std::vector<unsigned char> vchExtraNonce1;
+    double dDifficulty;
+    bool fSubscribed;
+    bool fAuthorized;
+    bool fSendWork;
+
+    void Read();
+    void HandleRead(const boost::system::error_code& error);
+    void Write();
+    void HandleWrite(const boost::system::error_code& error);
+    void HandleLine(const std::string& strLine);
+    UniValue Dispatch(const std::string& strMethod, const UniValue& params);
+    UniValue Submit(const UniValue& params);
+    void Send(const UniValue& obj);
+    void SendDifficulty();
+
+public:
+    ip::tcp::endpoint peer;
+
+    CStratumConnection(io_service& ios, uint32_t nExtraNonce1) :
+        socket(ios), buf(MAX_STRATUM_LINE), dDifficulty(dStratumDifficulty),
+        fSubscribed(false), fAuthorized(false), fSendWork(false)
+    {
+        vchExtraNonce1.resize(STRATUM_EXTRANONCE1_SIZE);
+        WriteBE32(&vchExtraNonce1[0], nExtraNonce1);
+    }
+
+    ip::tcp::socket& GetSocket() { return socket; }
+    bool IsSubscribed() const { return fSubscribed; }
+    void Start() { Read(); }
+    void Close();
+    void SendJob(const CStratumJob& job, bool fClean);
+};
+
+void CStratumConnection::Read()
+{
+    async_read_until(socket, buf, '\n',
+            boost::bind(&CStratumConnection::HandleRead, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void CStratumConnection::HandleRead(const boost::system::error_code& error)
+{
+    if (error)
+    {
+        // Also hit when a miner sends a line longer than MAX_STRATUM_LINE
+        if (error != boost::asio::error::operation_aborted)
+            LogPrint("stratum", "Stratum: disconnecting %s: %s\n", peer.address().to_string(), error.message());
+        Close();
+        return;
+    }
+
+    std::istream is(&buf);
+    std::string strLine;
+    std::getline(is, strLine);
+    if (!strLine.empty())
+        HandleLine(strLine);
+    if (socket.is_open())
+        Read();
+}
+
+void CStratumConnection::Write()
+{
+    async_write(socket, buffer(queueSend.front()),
+            boost::bind(&CStratumConnection::HandleWrite, shared_from_this(), boost::asio::placeholders::error));
+}
+
+void CStratumConnection::HandleWrite(const boost::system::error_code& error)
+{
+    if (error)
+    {
+        Close();
+        return;
+    }
+    queueSend.pop_front();
+    if (!queueSend.empty())
+        Write();
+}
+
+void CStratumConnection::Close()
+{
+    boost::system::error_code ec;
+    socket.close(ec);
+    setStratumConnections.erase(shared_from_this());
+}
+
+void CStratumConnection::Send(const UniValue& obj)
+{
+    queueSend.push_back(obj.write() + "\n");
+    if (queueSend.size() == 1)
+        Write();
+}
+
+void CStratumConnection::SendDifficulty()
+{
+    UniValue notification(UniValue::VOBJ);
+    notification.push_back(Pair("id", NullUniValue));
+    notification.push_back(Pair("method", "mining.set_difficulty"));
+    UniValue params(UniValue::VARR);
+    params.push_back(dDifficulty);
+    notification.push_back(Pair("params", params));
+    Send(notification);
+}
+
+void CStratumConnection::SendJob(const CStratumJob& job, bool fClean)
+{
+    UniValue branch(UniValue::VARR);
+    BOOST_FOREACH(const uint256& hash, job.vMerkleBranch)
+        branch.push_back(HexStr(hash.begin(), hash.end()));
+
+    UniValue params(UniValue::VARR);
+    params.push_back(job.strId);
+    params.push_back(HexPrevHash(job.block.hashPrevBlock));
+    params.push_back(HexStr(job.vchCoinbase1));
+    params.push_back(HexStr(job.vchCoinbase2));
+    params.push_back(branch);
+    params.push_back(HexUInt32(job.block.nVersion));
+    params.push_back(HexUInt32(job.block.nBits));
+    params.push_back(HexUInt32(job.block.nTime));
+    params.push_back(fClean);
+
+    UniValue notification(UniValue::VOBJ);
+    notification.push_back(Pair("id", NullUniValue));
+    notification.push_back(Pair("method", "mining.notify"));
+    notification.push_back(Pair("params", params));
+    Send(notification);
+}
+
+void CStratumConnection::HandleLine(const std::string& strLine)
+{
+    UniValue valRequest;
+    if (!valRequest.read(strLine) || valRequest.type() != UniValue::VOBJ)
+    {
+        LogPrint("stratum", "Stratum: disconnecting %s: parse error\n", peer.address().to_string());
+        Close();
+        return;
+    }
+    const UniValue& request = valRequest.get_obj();
+    UniValue id = find_value(request, "id");
+    UniValue method = find_value(request, "method");
+    UniValue params = find_value(request, "params");
+
+    UniValue reply(UniValue::VOBJ);
+    reply.push_back(Pair("id", id));
+    try
+    {
+        if (method.type() != UniValue::VSTR)
+            throw JSONRPCError(STRATUM_OTHER, "Method not found");
+        reply.push_back(Pair("result", Dispatch(method.get_str(),
+                params.type() == UniValue::VARR ? params.get_array() : UniValue(UniValue::VARR))));
+        reply.push_back(Pair("error", NullUniValue));
+    }
+    catch (const UniValue& objError)
+    {
+        UniValue error(UniValue::VARR);
+        error.push_back(find_value(objError, "code"));
+        error.push_back(find_value(objError, "message"));
+        error.push_back(NullUniValue);
+        reply.push_back(Pair("result", NullUniValue));
+        reply.push_back(Pair("error", error));
+    }
+    catch (const std::exception& e)
+    {
+        UniValue error(UniValue::VARR);
+        error.push_back((int)STRATUM_OTHER);
+        error.push_back(e.what());
+        error.push_back(NullUniValue);
+        reply.push_back(Pair("result", NullUniValue));
+        reply.push_back(Pair("error", error));
+    }
+    Send(reply);
+
+    // Work follows the reply to the request that asked for it
+    if (fSendWork)
+    {
+        fSendWork = false;
+        SendDifficulty();
+        if (pjobCurrent)
+            SendJob(*pjobCurrent, true);
+    }
+}
+
+UniValue CStratumConnection::Dispatch(const std::string& strMethod, const UniValue& params)
+{
+    if (strMethod == "mining.subscribe")
+    {
+        fSubscribed = true;
+        fSendWork = true;
+        std::string strSubscription = HexStr(vchExtraNonce1);
+        UniValue subscriptions(UniValue::VARR);
+        UniValue difficultySubscription(UniValue::VARR);
+        difficultySubscription.push_back("mining.set_difficulty");
+        difficultySubscription.push_back(strSubscription);
+        subscriptions.push_back(difficultySubscription);
+        UniValue notifySubscription(UniValue::VARR);
+        notifySubscription.push_back("mining.notify");
+        notifySubscription.push_back(strSubscription);
+        subscriptions.push_back(notifySubscription);
+
+        UniValue result(UniValue::VARR);
+        result.push_back(subscriptions);
+        result.push_back(HexStr(vchExtraNonce1));
+        result.push_back((int)STRATUM_EXTRANONCE2_SIZE);
+        return result;
+    }
+    if (strMethod == "mining.authorize")
+    {
+        // Blocks all pay to -stratumaddress, so the worker name is only informational
+        if (params.size() > 0 && params[0].type() == UniValue::VSTR)
+            LogPrint("stratum", "Stratum: %s authorized as %s\n", peer.address().to_string(), params[0].get_str());
+        fAuthorized = true;
+        return true;
+    }
+    if (strMethod == "mining.extranonce.subscribe")
+    {
+        // Extranonce1 is fixed for the lifetime of a connection
+        return true;
+    }
+    if (strMethod == "mining.suggest_difficulty")
+    {
+        if (params.size() < 1 || !params[0].isNum())
+            throw JSONRPCError(STRATUM_OTHER, "Invalid difficulty");
+        dDifficulty = std::min(std::max(params[0].get_real(), MIN_STRATUM_DIFFICULTY), MAX_STRATUM_DIFFICULTY);
+        fSendWork = fSubscribed;
+        return true;
+    }
+    if (strMethod == "mining.submit")
+        return Submit(params);
+
+    throw JSONRPCError(STRATUM_OTHER, "Method not found");
+}
+
+UniValue CStratumConnection::Submit(const UniValue& params)
+{
+    if (!fSubscribed)
+        throw JSONRPCError(STRATUM_NOT_SUBSCRIBED, "Not subscribed");
+    if (!fAuthorized)
+        throw JSONRPCError(STRATUM_UNAUTHORIZED, "Unauthorized worker");
+    if (params.size() < 5 || params[1].type() != UniValue::VSTR || params[2].type() != UniValue::VSTR)
+        throw JSONRPCError(STRATUM_OTHER, "Invalid parameters");
+
+    std::map<std::string, StratumJobPtr>::iterator mi = mapStratumJobs.find(params[1].get_str());
+    if (mi == mapStratumJobs.end())
+        throw JSONRPCError(STRATUM_JOB_NOT_FOUND, "Job not found");
+    CStratumJob& job = *mi->second;
+
+    std::vector<unsigned char> vchExtraNonce2 = ParseHex(params[2].get_str());
+    uint32_t nTime, nNonce;
+    if (vchExtraNonce2.size() != STRATUM_EXTRANONCE2_SIZE || params[2].get_str().size() != 2 * STRATUM_EXTRANONCE2_SIZE ||
+        !ParseHexUInt32(params[3], nTime) || !ParseHexUInt32(params[4], nNonce))
+        throw JSONRPCError(STRATUM_OTHER, "Invalid parameters");
+    if (nTime <= job.pindexPrev->GetMedianTimePast() || nTime > GetAdjustedTime() + 2 * 60 * 60)
+        throw JSONRPCError(STRATUM_OTHER, "Time out of range");
+
+    std::string strShare = HexStr(vchExtraNonce1) + params[2].get_str() + params[3].get_str() + params[4].get_str();
+    if (job.setShares.count(strShare))
+        throw JSONRPCError(STRATUM_DUPLICATE, "Duplicate share");
+    if (job.fStale)
+        throw JSONRPCError(STRATUM_JOB_NOT_FOUND, "Stale job");
+
+    std::vector<unsigned char> vchExtraNonce(vchExtraNonce1);
+    vchExtraNonce.insert(vchExtraNonce.end(), vchExtraNonce2.begin(), vchExtraNonce2.end());
+
+    std::vector<unsigned char> vchCoinbase(job.vchCoinbase1);
+    vchCoinbase.insert(vchCoinbase.end(), vchExtraNonce.begin(), vchExtraNonce.end());
+    vchCoinbase.insert(vchCoinbase.end(), job.vchCoinbase2.begin(), job.vchCoinbase2.end());
+
+    CBlockHeader header = job.block.GetBlockHeader();
+    header.hashMerkleRoot = CBlock::CheckMerkleBranch(Hash(vchCoinbase.begin(), vchCoinbase.end()), job.vMerkleBranch, 0);
+    header.nTime = nTime;
+    header.nNonce = nNonce;
+    uint256 hash = header.GetHash();
+
+    uint256 hashTarget;
+    hashTarget.SetCompact(header.nBits);
+    if (hash <= hashTarget)
+    {
+        CBlock block(job.block);
+        SetExtraNonce(&block, job.pindexPrev, vchExtraNonce);
+        block.nTime = nTime;
+        block.nNonce = nNonce;
+        assert(block.GetHash() == hash);
+
+        LogPrintf("Stratum: %s found block %s\n", peer.address().to_string(), hash.GetHex());
+        CValidationState state;
+        if (!ProcessNewBlock(state, NULL, &block))
+            throw JSONRPCError(STRATUM_OTHER, "Block rejected: " + state.GetRejectReason());
+    }
+    else if (hash > GetShareTarget(dDifficulty))
+        throw JSONRPCError(STRATUM_LOW_DIFFICULTY, "Low difficulty share");
+
+    job.setShares.insert(strShare);
+    return true;
+}
+
+/** Make a job current and push it to all subscribed miners. Runs on the io_service thread. */
+static void SetStratumJob(StratumJobPtr pjob)
+{
+    if (pjob->fClean)
+    {
+        // Keep them around so that resubmitted shares are still told apart from stale ones
+        BOOST_FOREACH(PAIRTYPE(const std::string, StratumJobPtr)& item, mapStratumJobs)
+            item.second->fStale = true;
+    }
+    while (vStratumJobIds.size() >= MAX_STRATUM_JOBS)
+    {
+        mapStratumJobs.erase(vStratumJobIds.front());
+        vStratumJobIds.pop_front();
+    }
+    mapStratumJobs[pjob->strId] = pjob;
+    vStratumJobIds.push_back(pjob->strId);
+    pjobCurrent = pjob;
+
+    BOOST_FOREACH(const StratumConnectionPtr& conn, setStratumConnections)
+        if (conn->IsSubscribed())
+            conn->SendJob(*pjob, pjob->fClean);
+}
+
+/** Split the coinbase around a zeroed extranonce and precompute the merkle branch */
+static void PrepareStratumJob(CStratumJob& job)
+{
+    SetExtraNonce(&job.block, job.pindexPrev,
+            std::vector<unsigned char>(STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE, 0));
+    job.vMerkleBranch = job.block.GetMerkleBranch(0);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << job.block.vtx[0];
+    unsigned int nOffset = GetExtraNonceOffset(job.pindexPrev);
+    assert(ss[nOffset - 1] == STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE);
+    job.vchCoinbase1.assign(ss.begin(), ss.begin() + nOffset);
+    job.vchCoinbase2.assign(ss.begin() + nOffset + STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE, ss.end());
+}
+
+/**
+ * Build a job whenever the tip changes, and refresh it every
+ * STRATUM_JOB_REFRESH seconds while the memory pool keeps changing.
+ */
+static void ThreadStratumJobs(CScript scriptPubKey)
+{
+    RenameThread("joulecoin-stratum");
+    CBlockTemplateManager templatemanager(scriptPubKey);
+    uint256 hashBestLast;
+    unsigned int nTransactionsUpdatedLast = 0;
+    int64_t nLastJob = 0;
+    unsigned int nJobId = 0;
+
+    while (true)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(csBestBlock);
+            cvBlockChange.timed_wait(lock, boost::posix_time::seconds(1));
+        }
+        boost::this_thread::interruption_point();
+
+        StratumJobPtr pjob(new CStratumJob());
+        pjob->fStale = false;
+        {
+            LOCK(cs_main);
+            if (IsInitialBlockDownload())
+                continue;
+            const CBlockIndex* pindexPrev = chainActive.Tip();
+            pjob->fClean = pindexPrev->GetBlockHash() != hashBestLast;
+            if (!pjob->fClean && (mempool.GetTransactionsUpdated() == nTransactionsUpdatedLast ||
+                                  GetTime() - nLastJob < STRATUM_JOB_REFRESH))
+                continue;
+
+            CBlockTemplate* pblocktemplate = templatemanager.GetTemplate();
+            if (!pblocktemplate)
+                continue;
+            pjob->block = pblocktemplate->block;
+            pjob->pindexPrev = pindexPrev;
+            UpdateTime(&pjob->block, pindexPrev);
+            hashBestLast = pindexPrev->GetBlockHash();
+            nTransactionsUpdatedLast = templatemanager.GetTransactionsUpdatedLast();
+        }
+        nLastJob = GetTime();
+        pjob->strId = strprintf("%x", ++nJobId);
+        PrepareStratumJob(*pjob);
+        LogPrint("stratum", "Stratum: new job %s at height %d with %u transactions\n",
+                 pjob->strId, pjob->pindexPrev->nHeight + 1, pjob->block.vtx.size());
+        stratum_io_service->post(boost::bind(&SetStratumJob, pjob));
+    }
+}
+
+static void StratumAcceptHandler(StratumConnectionPtr conn, const boost::system::error_code& error);
+
+static void StratumListen()
+{
+    StratumConnectionPtr conn(new CStratumConnection(*stratum_io_service, nStratumExtraNonce1++));
+    stratum_acceptor->async_accept(conn->GetSocket(), conn->peer,
+            boost::bind(&StratumAcceptHandler, conn, boost::asio::placeholders::error));
+}
+
+static void StratumAcceptHandler(StratumConnectionPtr conn, const boost::system::error_code& error)
+{
+    if (error == boost::asio::error::operation_aborted || !stratum_acceptor->is_open())
+        return;
+    StratumListen();
+
+    if (error)
+    {
+        LogPrintf("%s: Error: %s\n", __func__, error.message());
+        return;
+    }
+    LogPrint("stratum", "Stratum: accepted miner %s\n", conn->peer.address().to_string());
+    setStratumConnections.insert(conn);
+    conn->Start();
+}
+
+static void ThreadStratumIO()
+{
+    RenameThread("joulecoin-stratumio");
+    stratum_io_service->run();
+}
+
+bool StartStratumServer(std::string& strError)
+{
+    if (!GetBoolArg("-stratum", false))
+        return true;
+
+    CBitcoinAddress address(GetArg("-stratumaddress", ""));
+    if (!address.IsValid())
+    {
+        strError = _("-stratum requires a valid -stratumaddress to pay mined blocks to");
+        return false;
+    }
+    if (mapArgs.count("-stratumdifficulty"))
+    {
+        dStratumDifficulty = atof(mapArgs["-stratumdifficulty"].c_str());
+        if (dStratumDifficulty < MIN_STRATUM_DIFFICULTY || dStratumDifficulty > MAX_STRATUM_DIFFICULTY)
+        {
+            strError = strprintf(_("Invalid amount for -stratumdifficulty=<difficulty>: '%s'"), mapArgs["-stratumdifficulty"]);
+            return false;
+        }
+    }
+    CService addrBind;
+    if (!LookupNumeric(GetArg("-stratumbind", "127.0.0.1").c_str(), addrBind, GetArg("-stratumport", DEFAULT_STRATUM_PORT)))
+    {
+        strError = strprintf(_("Cannot resolve -stratumbind address: '%s'"), GetArg("-stratumbind", ""));
+        return false;
+    }
+
+    assert(stratum_io_service == NULL);
+    stratum_io_service = new io_service();
+    nStratumExtraNonce1 = GetRand(std::numeric_limits<uint32_t>::max());
+    ip::tcp::endpoint endpoint(ip::address::from_string(addrBind.ToStringIP()), addrBind.GetPort());
+    try {
+        stratum_acceptor.reset(new ip::tcp::acceptor(*stratum_io_service));
+        stratum_acceptor->open(endpoint.protocol());
+        stratum_acceptor->set_option(ip::tcp::acceptor::reuse_address(true));
+        stratum_acceptor->bind(endpoint);
+        stratum_acceptor->listen(socket_base::max_connections);
+    }
+    catch (const boost::system::system_error& e)
+    {
+        strError = strprintf(_("Unable to bind Stratum server to %s: %s"), addrBind.ToString(), e.what());
+        stratum_acceptor.reset();
+        delete stratum_io_service; stratum_io_service = NULL;
+        return false;
+    }
+    StratumListen();
+
+    LogPrintf("Stratum server listening on %s, paying to %s\n", addrBind.ToString(), address.ToString());
+    stratum_threads = new boost::thread_group();
+    stratum_threads->create_thread(&ThreadStratumIO);
+    stratum_threads->create_thread(boost::bind(&ThreadStratumJobs, GetScriptForDestination(address.Get())));
+    return true;
+}
+
+void StopStratumServer()
+{
+    if (stratum_io_service == NULL)
+        return;
+
+    boost::system::error_code ec;
+    stratum_acceptor->close(ec);
+    stratum_threads->interrupt_all();
+    stratum_io_service->stop();
+    stratum_threads->join_all();
+    delete stratum_threads; stratum_threads = NULL;
+
+    setStratumConnections.clear();
+    mapStratumJobs.clear();
+    vStratumJobIds.clear();
+    pjobCurrent.reset();
+    stratum_acceptor.reset();
+    delete stratum_io_service; stratum_io_service = NULL;
+}
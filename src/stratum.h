@@ -0,0 +1,29 @@
+// Copyright (c) 2015 The Joulecoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_STRATUM_H
+#define BITCOIN_STRATUM_H
+
+#include <string>
+
+static const unsigned short DEFAULT_STRATUM_PORT = 3333;
+/** Default share difficulty handed to new miners */
+static const double DEFAULT_STRATUM_DIFFICULTY = 1.0;
+/** Seconds between jobs when only the memory pool has changed */
+static const int STRATUM_JOB_REFRESH = 30;
+/** Maximum length of a single line a miner may send */
+static const unsigned int MAX_STRATUM_LINE = 16 * 1024;
+
+/**
+ * Start the built-in Stratum mining server when -stratum is set. Miners
+ * connect over TCP and get work pushed to them as jobs, each connection
+ * rolling its own extranonce so that no two miners search the same space.
+ * Returns false and sets strError when the server was requested but could
+ * not be started.
+ */
+bool StartStratumServer(std::string& strError);
+/** Stop the Stratum server and disconnect all miners */
+void StopStratumServer();
+
+#endif // BITCOIN_STRATUM_H
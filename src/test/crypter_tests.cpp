@@ -0,0 +1,82 @@
+// Copyright (c) 2015 The Joulecoin Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypter.h"
+#include "random.h"
+#include "script/standard.h"
+#include "tinyformat.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <openssl/aes.h>
+#include <openssl/evp.h>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(crypter_tests)
+
+/**
+ * Check the key and IV SetKeyFromPassphrase derives are those
+ * EVP_BytesToKey(EVP_aes_256_cbc(), EVP_sha512(), ...) did: a crypter keyed
+ * with those has to encrypt and decrypt the same
+ */
+static void CheckPassphraseKey(const SecureString& strPassphrase, const vector<unsigned char>& vchSalt, unsigned int nRounds)
+{
+    unsigned char chKey[WALLET_CRYPTO_KEY_SIZE];
+    unsigned char chIV[WALLET_CRYPTO_KEY_SIZE] = {0};
+    int nKeySize = EVP_BytesToKey(EVP_aes_256_cbc(), EVP_sha512(), &vchSalt[0],
+                                  (const unsigned char*)strPassphrase.data(), strPassphrase.size(), nRounds, chKey, chIV);
+    BOOST_REQUIRE_EQUAL(nKeySize, (int)WALLET_CRYPTO_KEY_SIZE);
+
+    CCrypter crypterEVP;
+    BOOST_REQUIRE(crypterEVP.SetKey(CKeyingMaterial(chKey, chKey + sizeof(chKey)), vector<unsigned char>(chIV, chIV + sizeof(chIV))));
+    CCrypter crypter;
+    BOOST_REQUIRE(crypter.SetKeyFromPassphrase(strPassphrase, vchSalt, nRounds, 0));
+
+    // Several blocks, for the IV to show in the first and the key in all
+    CKeyingMaterial vchPlaintext(3 * AES_BLOCK_SIZE + 5);
+    GetRandBytes(&vchPlaintext[0], vchPlaintext.size());
+    vector<unsigned char> vchCiphertext, vchCiphertextEVP;
+    BOOST_REQUIRE(crypter.Encrypt(vchPlaintext, vchCiphertext));
+    BOOST_REQUIRE(crypterEVP.Encrypt(vchPlaintext, vchCiphertextEVP));
+    BOOST_CHECK_MESSAGE(vchCiphertext == vchCiphertextEVP,
+                        strprintf("passphrase of %u bytes, %u rounds", strPassphrase.size(), nRounds));
+
+    CKeyingMaterial vchDecrypted;
+    BOOST_CHECK(crypter.Decrypt(vchCiphertextEVP, vchDecrypted));
+    BOOST_CHECK(vchDecrypted == vchPlaintext);
+}
+
+BOOST_AUTO_TEST_CASE(passphrase_key_derivation)
+{
+    vector<SecureString> vPassphrases;
+    vPassphrases.push_back("");
+    vPassphrases.push_back("a");
+    vPassphrases.push_back("correct horse battery staple");
+    vPassphrases.push_back(SecureString("with\0nul", 8));
+    vPassphrases.push_back(SecureString(200, 'x'));
+
+    const unsigned int nRounds[] = { 1, 2, 3, 25000, 100000 };
+    vector<unsigned char> vchSalt(WALLET_CRYPTO_SALT_SIZE);
+    BOOST_FOREACH(const SecureString& strPassphrase, vPassphrases)
+    {
+        BOOST_FOREACH(unsigned int n, nRounds)
+        {
+            GetRandBytes(&vchSalt[0], vchSalt.size());
+            CheckPassphraseKey(strPassphrase, vchSalt, n);
+        }
+    }
+
+    // No rounds at all, or a salt of the wrong size, derive nothing
+    CCrypter crypter;
+    BOOST_CHECK(!crypter.SetKeyFromPassphrase("a", vchSalt, 0, 0));
+    BOOST_CHECK(!crypter.SetKeyFromPassphrase("a", vector<unsigned char>(4), 1, 0));
+    BOOST_CHECK(!crypter.SetKeyFromPassphrase("a", vchSalt, 1, 1));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -168,6 +168,21 @@ BOOST_AUTO_TEST_CASE(sha512_testvectors) {
                "37de8c3ef5459d76a52cedc02dc499a3c9ed9dedbfb3281afd9653b8a112fafc");
 }
 
+BOOST_AUTO_TEST_CASE(sha512_rehash) {
+    unsigned char hash[CSHA512::OUTPUT_SIZE];
+    unsigned char expected[CSHA512::OUTPUT_SIZE];
+    CSHA512().Write((const unsigned char*)"abc", 3).Finalize(hash);
+    memcpy(expected, hash, sizeof(hash));
+    for (unsigned int nRounds = 0; nRounds <= 1000; nRounds += 250) {
+        unsigned char rehashed[CSHA512::OUTPUT_SIZE];
+        memcpy(rehashed, hash, sizeof(hash));
+        SHA512Rehash(rehashed, nRounds);
+        BOOST_CHECK(memcmp(rehashed, expected, sizeof(expected)) == 0);
+        for (int i = 0; i < 250; i++)
+            CSHA512().Write(expected, sizeof(expected)).Finalize(expected);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(hmac_sha256_testvectors) {
     // test cases 1, 2, 3, 4, 6 and 7 of RFC 4231
     TestHMACSHA256("0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b0b",
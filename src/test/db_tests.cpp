@@ -0,0 +1,166 @@
+// Copyright (c) 2015 The Joulecoin Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "clientversion.h"
+#include "db.h"
+#include "streams.h"
+
+#include <set>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+/** Opens the test database, exposing the accessors CWalletDB wraps */
+class CTestDB : public CDB
+{
+public:
+    explicit CTestDB(const string& strFilename) : CDB(strFilename, "cr+") {}
+
+    bool Write(const string& strKey, int nValue) { return CDB::Write(strKey, nValue); }
+    bool Exists(const string& strKey) { return CDB::Exists(strKey); }
+
+    int Read(const string& strKey)
+    {
+        int nValue = -1;
+        CDB::Read(strKey, nValue);
+        return nValue;
+    }
+
+    //! The keys in the database, read with a cursor
+    set<string> Keys()
+    {
+        set<string> setKeys;
+        Dbc* pcursor = GetCursor();
+        BOOST_REQUIRE(pcursor);
+        while (true)
+        {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            if (ReadAtCursor(pcursor, ssKey, ssValue) != 0)
+                break;
+            string strKey;
+            ssKey >> strKey;
+            setKeys.insert(strKey);
+        }
+        pcursor->close();
+        return setKeys;
+    }
+};
+
+static unsigned int UseCount(const string& strFile)
+{
+    LOCK(bitdb.cs_db);
+    return bitdb.mapFileUseCount[strFile];
+}
+
+BOOST_AUTO_TEST_SUITE(db_tests)
+
+BOOST_AUTO_TEST_CASE(batch_txn)
+{
+    const string strFile = "db_tests_txn.dat";
+    {
+        CDBBatch batch(strFile);
+        CTestDB db(strFile);
+        BOOST_CHECK(db.Write("a", 1));
+
+        // Transactions nest in the batch's; an aborted one takes only its own writes along
+        BOOST_CHECK(db.TxnBegin());
+        BOOST_CHECK(!db.TxnBegin());
+        BOOST_CHECK(db.Write("b", 2));
+        BOOST_CHECK(db.Write("a", 3));
+        BOOST_CHECK(db.TxnAbort());
+        BOOST_CHECK_EQUAL(db.Read("a"), 1);
+        BOOST_CHECK(!db.Exists("b"));
+
+        BOOST_CHECK(db.TxnBegin());
+        BOOST_CHECK(db.Write("c", 4));
+        BOOST_CHECK(db.TxnCommit());
+        BOOST_CHECK_EQUAL(db.Read("c"), 4);
+
+        // Committing or aborting with none begun doesn't touch the batch's
+        BOOST_CHECK(!db.TxnCommit());
+        BOOST_CHECK(!db.TxnAbort());
+    }
+
+    CTestDB db(strFile);
+    BOOST_CHECK_EQUAL(db.Read("a"), 1);
+    BOOST_CHECK(!db.Exists("b"));
+    BOOST_CHECK_EQUAL(db.Read("c"), 4);
+}
+
+BOOST_AUTO_TEST_CASE(batch_cursor)
+{
+    const string strFile = "db_tests_cursor.dat";
+    set<string> setExpected;
+    {
+        CDBBatch batch(strFile);
+        {
+            CTestDB db(strFile);
+            BOOST_CHECK(db.Write("x", 1));
+            BOOST_CHECK(db.Write("y", 2));
+        }
+        setExpected.insert("x");
+        setExpected.insert("y");
+
+        // A cursor opened in the batch sees its writes, also those of handles already closed
+        CTestDB db(strFile);
+        BOOST_CHECK(db.Write("z", 3));
+        setExpected.insert("z");
+        set<string> setKeys = db.Keys();
+        setKeys.erase("version");
+        BOOST_CHECK(setKeys == setExpected);
+    }
+
+    CTestDB db(strFile);
+    set<string> setKeys = db.Keys();
+    setKeys.erase("version");
+    BOOST_CHECK(setKeys == setExpected);
+}
+
+BOOST_AUTO_TEST_CASE(batch_nested)
+{
+    const string strFile = "db_tests_nested.dat";
+    const string strOther = "db_tests_other.dat";
+    {
+        CDBBatch batch(strFile);
+        BOOST_CHECK_EQUAL(UseCount(strFile), 1U);
+        {
+            // An inner batch on the same file joins the outer one, and
+            // committing it leaves the outer one going
+            CDBBatch batchInner(strFile);
+            BOOST_CHECK_EQUAL(UseCount(strFile), 1U);
+            CTestDB db(strFile);
+            BOOST_CHECK(db.Write("inner", 1));
+            BOOST_CHECK(batchInner.Commit());
+
+            // One on another file is a batch of its own
+            CDBBatch batchOther(strOther);
+            BOOST_CHECK_EQUAL(UseCount(strOther), 1U);
+            CTestDB dbOther(strOther);
+            BOOST_CHECK(dbOther.Write("other", 2));
+        }
+        BOOST_CHECK_EQUAL(UseCount(strOther), 0U);
+
+        CTestDB db(strFile);
+        BOOST_CHECK_EQUAL(db.Read("inner"), 1);
+        BOOST_CHECK(db.TxnBegin());
+        BOOST_CHECK(db.Write("outer", 3));
+        BOOST_CHECK(db.TxnCommit());
+        db.Close();
+        BOOST_CHECK(batch.Commit());
+        BOOST_CHECK_EQUAL(UseCount(strFile), 0U);
+        // Committing again has nothing left to do
+        BOOST_CHECK(batch.Commit());
+    }
+
+    CTestDB db(strFile);
+    BOOST_CHECK_EQUAL(db.Read("inner"), 1);
+    BOOST_CHECK_EQUAL(db.Read("outer"), 3);
+    CTestDB dbOther(strOther);
+    BOOST_CHECK_EQUAL(dbOther.Read("other"), 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
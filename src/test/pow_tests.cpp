@@ -0,0 +1,80 @@
+// Copyright (c) 2015 The Joulecoin Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "pow.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+// Long enough to cover all three retarget eras (heights 32000 and 90000)
+#define POW_CHAIN_LENGTH 95000
+
+BOOST_AUTO_TEST_SUITE(pow_tests)
+
+/**
+ * Retarget as GetNextWorkRequired used to: walk pprev across the whole
+ * averaging window and divide with the general 256-bit division.
+ */
+static unsigned int ReferenceNextWorkRequired(const CBlockIndex* pindexLast)
+{
+    const uint256 bnLimit = Params().ProofOfWorkLimit();
+    int nHeight = pindexLast->nHeight + 1;
+    if (nHeight < 160)
+        return bnLimit.GetCompact();
+
+    int64_t nAveragingInterval = 8;
+    int64_t nMaxAdjustDown = 3;
+    if (nHeight < 32000) {
+        nAveragingInterval = 160;
+        nMaxAdjustDown = 10;
+    } else if (nHeight < 90000) {
+        nMaxAdjustDown = 1;
+    }
+    int64_t nAveragingTargetTimespan = nAveragingInterval * 45;
+
+    const CBlockIndex* pindexFirst = pindexLast;
+    for (int i = 0; i < nAveragingInterval-1; i++)
+        pindexFirst = pindexFirst->pprev;
+
+    int64_t nActualTimespan = pindexLast->GetBlockTime() - pindexFirst->GetBlockTime();
+    nActualTimespan = std::max(nActualTimespan, nAveragingTargetTimespan * 99 / 100);
+    nActualTimespan = std::min(nActualTimespan, nAveragingTargetTimespan * (100 + nMaxAdjustDown) / 100);
+
+    uint256 bnNew;
+    bnNew.SetCompact(pindexLast->nBits);
+    bnNew *= nActualTimespan;
+    bnNew /= uint256(nAveragingTargetTimespan);
+    if (bnNew > bnLimit)
+        bnNew = bnLimit;
+    return bnNew.GetCompact();
+}
+
+BOOST_AUTO_TEST_CASE(retarget_eras)
+{
+    std::vector<CBlockIndex> vIndex(POW_CHAIN_LENGTH);
+    CBlockHeader header;
+
+    // Blocks come in a little faster than the 45 second target on average,
+    // with enough jitter to hit both adjustment limits in every era.
+    for (int i = 0; i < POW_CHAIN_LENGTH; i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = i ? &vIndex[i - 1] : NULL;
+        vIndex[i].nTime = i ? vIndex[i - 1].nTime + 1 + insecure_rand() % 80 : 1356123600;
+        vIndex[i].nBits = i ? ReferenceNextWorkRequired(&vIndex[i - 1]) : Params().ProofOfWorkLimit().GetCompact();
+        vIndex[i].BuildSkip();
+    }
+
+    // Bit-exact against the full walk everywhere, including across the era boundaries
+    for (int i = 0; i < POW_CHAIN_LENGTH - 1; i++)
+        BOOST_CHECK_EQUAL(GetNextWorkRequired(&vIndex[i], &header), vIndex[i + 1].nBits);
+    BOOST_CHECK(vIndex[POW_CHAIN_LENGTH - 1].nBits != vIndex[0].nBits);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -6,16 +6,18 @@
 #include "rpcclient.h"
 
 #include "base58.h"
+#include "main.h"
+#include "random.h"
+#include "utiltime.h"
 #include "wallet.h"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/test/unit_test.hpp>
 
 using namespace std;
-using namespace json_spirit;
 
-extern Array createArgs(int nRequired, const char* address1 = NULL, const char* address2 = NULL);
-extern Value CallRPC(string args);
+extern UniValue createArgs(int nRequired, const char* address1 = NULL, const char* address2 = NULL);
+extern UniValue CallRPC(string args);
 
 extern CWallet* pwalletMain;
 
@@ -32,7 +34,7 @@ BOOST_AUTO_TEST_CASE(rpc_addmultisig)
     // new, compressed:
     const char address2Hex[] = "0388c2037017c62240b6b72ac1a2a5f94da790596ebd06177c8572752922165cb4";
 
-    Value v;
+    UniValue v;
     CBitcoinAddress address;
     BOOST_CHECK_NO_THROW(v = addmultisig(createArgs(1, address1Hex), false));
     address.SetString(v.get_str());
@@ -63,13 +65,13 @@ BOOST_AUTO_TEST_CASE(rpc_addmultisig)
 BOOST_AUTO_TEST_CASE(rpc_wallet)
 {
     // Test RPC calls for various wallet statistics
-    Value r;
+    UniValue r;
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
     CPubKey demoPubkey = pwalletMain->GenerateNewKey();
     CBitcoinAddress demoAddress = CBitcoinAddress(CTxDestination(demoPubkey.GetID()));
-    Value retValue;
+    UniValue retValue;
     string strAccount = "walletDemoAccount";
     string strPurpose = "receive";
     BOOST_CHECK_NO_THROW({ /*Initialize Wallet with an account */
@@ -174,10 +176,72 @@ BOOST_AUTO_TEST_CASE(rpc_wallet)
      *********************************/
     BOOST_CHECK_THROW(CallRPC("getaddressesbyaccount"), runtime_error);
     BOOST_CHECK_NO_THROW(retValue = CallRPC("getaddressesbyaccount " + strAccount));
-    Array arr = retValue.get_array();
+    UniValue arr = retValue.get_array();
     BOOST_CHECK(arr.size() > 0);
     BOOST_CHECK(CBitcoinAddress(arr[0].get_str()).Get() == demoAddress.Get());
 }
 
 
+BOOST_AUTO_TEST_CASE(rpc_listtransactions_moves)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    // Moves around a transaction to the wallet, all made after whatever the wallet already lists
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions * 1000 0"));
+    size_t nBefore = r.get_array().size();
+
+    BOOST_CHECK_NO_THROW(CallRPC("move pagingFrom pagingA 1"));
+    BOOST_CHECK_NO_THROW(CallRPC("move pagingA pagingB 0.5"));
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    tx.vout.push_back(CTxOut(COIN, GetScriptForDestination(pwalletMain->GenerateNewKey().GetID())));
+    // In the mempool, as it would be once sent, or it would list as conflicted
+    mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 0, GetTime(), 0.0, 1));
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, tx)));
+    BOOST_CHECK_NO_THROW(CallRPC("move pagingB pagingA 0.25"));
+
+    // Oldest first; each move lists as its debit then its credit
+    const char* categories[] = { "move", "move", "move", "move", "receive", "move", "move" };
+    const char* accounts[] = { "pagingFrom", "pagingA", "pagingA", "pagingB", "", "pagingB", "pagingA" };
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions * 1000 0"));
+    UniValue all = r.get_array();
+    BOOST_REQUIRE_EQUAL(all.size(), nBefore + 7);
+    for (size_t i = 0; i < 7; i++)
+    {
+        const UniValue& entry = all[nBefore + i];
+        BOOST_CHECK_EQUAL(find_value(entry.get_obj(), "category").get_str(), categories[i]);
+        BOOST_CHECK_EQUAL(find_value(entry.get_obj(), "account").get_str(), accounts[i]);
+    }
+
+    // Every page is the stretch of the full list that ends nFrom entries before its newest
+    for (int nCount = 1; nCount <= 8; nCount++)
+    {
+        for (int nFrom = 0; nFrom <= 8; nFrom++)
+        {
+            BOOST_CHECK_NO_THROW(r = CallRPC(strprintf("listtransactions * %d %d", nCount, nFrom)));
+            UniValue page = r.get_array();
+            int nEnd = std::max(0, (int)all.size() - nFrom);
+            int nBegin = std::max(0, nEnd - nCount);
+            BOOST_REQUIRE_EQUAL(page.size(), (size_t)(nEnd - nBegin));
+            for (int i = nBegin; i < nEnd; i++)
+                BOOST_CHECK_EQUAL(page[i - nBegin].write(), all[i].write());
+        }
+    }
+
+    // An account's list only holds its own entries
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions pagingB 2 0"));
+    UniValue page = r.get_array();
+    BOOST_REQUIRE_EQUAL(page.size(), 2U);
+    BOOST_CHECK_EQUAL(page[0].write(), all[nBefore + 3].write());
+    BOOST_CHECK_EQUAL(page[1].write(), all[nBefore + 5].write());
+    BOOST_CHECK_NO_THROW(r = CallRPC("listtransactions pagingA 1 1"));
+    page = r.get_array();
+    BOOST_REQUIRE_EQUAL(page.size(), 1U);
+    BOOST_CHECK_EQUAL(page[0].write(), all[nBefore + 2].write());
+
+    std::list<CTransaction> removed;
+    mempool.remove(tx, removed);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -550,6 +550,19 @@ BOOST_AUTO_TEST_CASE( divide )
     BOOST_CHECK(R2S / MaxS == ZeroS);
     BOOST_CHECK(MaxS / R2S == 1);
     BOOST_CHECK_THROW(R2S / ZeroS, uint_error);
+
+    // Dividing by a single limb must agree with the general division
+    BOOST_CHECK(R1L / 7200U == R1L / uint256(7200));
+    BOOST_CHECK(R2L / 0x87654321U == R2L / uint256(0x87654321U));
+    BOOST_CHECK(MaxL / 0xFFFFFFFFU == MaxL / uint256(0xFFFFFFFFU));
+    BOOST_CHECK(R1L / 1U == R1L);
+    BOOST_CHECK_THROW(R1L / 0U, uint_error);
+    BOOST_CHECK(R1S / 360U == R1S / uint160(360));
+    BOOST_CHECK(R2S / 0xFFFFFFFFU == R2S / uint160(0xFFFFFFFFU));
+    // Wider divisors are not narrowed
+    BOOST_CHECK(R1L / 0x100000000ULL == R1L / uint256(0x100000000ULL));
+    BOOST_CHECK(R2L / 0xFEDCBA9876543210ULL == R2L / uint256(0xFEDCBA9876543210ULL));
+    BOOST_CHECK(R1L / (int64_t)7200 == R1L / uint256(7200));
 }
 
 
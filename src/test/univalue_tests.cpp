@@ -271,5 +271,78 @@ BOOST_AUTO_TEST_CASE(univalue_readwrite)
     BOOST_CHECK_EQUAL(strJson1, v.write());
 }
 
+BOOST_AUTO_TEST_CASE(univalue_readerrors)
+{
+    UniValue v;
+
+    // Bare scalars are whole documents, as bitcoin-cli passes them
+    BOOST_CHECK(v.read("42"));
+    BOOST_CHECK_EQUAL(v.get_int(), 42);
+    BOOST_CHECK(v.read(" \"abc\" "));
+    BOOST_CHECK_EQUAL(v.get_str(), "abc");
+    BOOST_CHECK(v.read("true"));
+    BOOST_CHECK(v.get_bool());
+
+    BOOST_CHECK(!v.read(""));
+    BOOST_CHECK(!v.read("[1,]"));
+    BOOST_CHECK(!v.read("{\"a\":1,}"));
+    BOOST_CHECK(!v.read("{\"a\" 1}"));
+    BOOST_CHECK(!v.read("[1] [2]"));
+    BOOST_CHECK(!v.read("[1]]"));
+    BOOST_CHECK(!v.read("[01]"));
+    BOOST_CHECK(!v.read("[-]"));
+    BOOST_CHECK(!v.read("[1.]"));
+    BOOST_CHECK(!v.read("[\"abc]"));
+    BOOST_CHECK(!v.read("[\"\\u12\"]"));
+    BOOST_CHECK(!v.read("[nul]"));
+
+    // Escapes and multi-byte UTF-8 survive a round trip
+    BOOST_CHECK(v.read("[\"a\\\"b\\\\c\\n\\u00e9\\u20ac\xc3\xa9\"]"));
+    BOOST_CHECK_EQUAL(v[0].get_str(), "a\"b\\c\n\xc3\xa9\xe2\x82\xac\xc3\xa9");
+
+    BOOST_CHECK(v.read("[9223372036854775807,2147483648,1.5,\"1\"]"));
+    BOOST_CHECK_EQUAL(v[0].get_int64(), 9223372036854775807LL);
+    BOOST_CHECK_THROW(v[1].get_int(), std::runtime_error);
+    BOOST_CHECK_EQUAL(v[2].get_real(), 1.5);
+    BOOST_CHECK_THROW(v[3].get_int(), std::runtime_error);
+    BOOST_CHECK_THROW(v.get_obj(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(univalue_large_docs)
+{
+    // A getblock sized result and a batch request, the two large documents
+    // the RPC server sees most, have to survive a write/read round trip.
+    // Only behaviour is checked; timings vary too much from one machine to
+    // the next to be asserted on here.
+    UniValue block(UniValue::VOBJ);
+    block.push_back(Pair("hash", string(64, 'a')));
+    block.push_back(Pair("height", 100000));
+    block.push_back(Pair("difficulty", 1234.5678));
+    UniValue txs(UniValue::VARR);
+    for (int i = 0; i < 2000; i++)
+        txs.push_back(string(64, 'b'));
+    block.push_back(Pair("tx", txs));
+
+    UniValue batch(UniValue::VARR);
+    for (int i = 0; i < 1000; i++) {
+        UniValue req(UniValue::VOBJ);
+        UniValue params(UniValue::VARR);
+        params.push_back(i);
+        req.push_back(Pair("method", "getblockhash"));
+        req.push_back(Pair("params", params));
+        req.push_back(Pair("id", i));
+        batch.push_back(req);
+    }
+
+    const UniValue* docs[] = { &block, &batch };
+    for (unsigned int i = 0; i < 2; i++) {
+        string strJson = docs[i]->write();
+        UniValue v;
+        BOOST_CHECK(v.read(strJson));
+        BOOST_CHECK_EQUAL(v.write(), strJson);
+        BOOST_CHECK_EQUAL(docs[i]->write(4).size(), v.write(4).size());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -2,15 +2,21 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "main.h"
+#include "random.h"
+#include "util.h"
 #include "wallet.h"
 
+#include <algorithm>
 #include <set>
 #include <stdint.h>
 #include <utility>
 #include <vector>
 
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
 #define RUN_TESTS 100
@@ -267,7 +273,7 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
                 add_coin(COIN);
 
             // picking 50 from 100 coins doesn't depend on the shuffle,
-            // but does depend on randomness in the stochastic approximation code
+            // but does depend on the random order given to coins of the same value
             BOOST_CHECK(wallet.SelectCoinsMinConf(50 * COIN, 1, 6, vCoins, setCoinsRet , nValueRet));
             BOOST_CHECK(wallet.SelectCoinsMinConf(50 * COIN, 1, 6, vCoins, setCoinsRet2, nValueRet));
             BOOST_CHECK(!equal_sets(setCoinsRet, setCoinsRet2));
@@ -305,4 +311,981 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+static bool CompareCoinValueDescending(const COutput& a, const COutput& b)
+{
+    return a.tx->vout[a.i].nValue > b.tx->vout[b.i].nValue;
+}
+
+BOOST_AUTO_TEST_CASE(coin_selection_large_wallet)
+{
+    // A wallet that collected lots of small payments: selection has to keep
+    // finding totals close to the target, from coins sorted beforehand as
+    // SelectCoins does or not
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    empty_wallet();
+    seed_insecure_rand(true);
+    CAmount nTotal = 0;
+    for (int i = 0; i < 50000; i++)
+    {
+        CAmount nValue = (insecure_rand() % 100000 + 1) * 100; // up to 0.1 coins
+        add_coin(nValue);
+        nTotal += nValue;
+    }
+
+    vector<COutput> vSorted(vCoins);
+    stable_sort(vSorted.begin(), vSorted.end(), CompareCoinValueDescending);
+
+    const CAmount nTargets[] = { 7 * CENT, 12345 * COIN / 10000, 321 * COIN, nTotal - 1 * COIN };
+    for (unsigned int i = 0; i < 2 * sizeof(nTargets) / sizeof(nTargets[0]); i++)
+    {
+        bool fSorted = i % 2;
+        BOOST_CHECK(wallet.SelectCoinsMinConf(nTargets[i / 2], 1, 6, fSorted ? vSorted : vCoins, setCoinsRet, nValueRet, fSorted));
+
+        CAmount nSelected = 0;
+        BOOST_FOREACH(const CoinSet::value_type& coin, setCoinsRet)
+            nSelected += coin.first->vout[coin.second].nValue;
+        BOOST_CHECK_EQUAL(nSelected, nValueRet);
+        // With this many coins to choose from there is no need for change
+        BOOST_CHECK_EQUAL(nValueRet, nTargets[i / 2]);
+    }
+
+    // Asking for more than there is still fails
+    BOOST_CHECK(!wallet.SelectCoinsMinConf(nTotal + 1, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK(!wallet.SelectCoinsMinConf(nTotal + 1, 1, 6, vSorted, setCoinsRet, nValueRet, true));
+    empty_wallet();
+}
+
+/**
+ * Blocks made up for a wallet to see its transactions confirmed in,
+ * connected and disconnected the way the validation interface would.
+ * The chain goes back to where it was at the end of the test.
+ */
+class CWalletTestChain
+{
+private:
+    CBlockIndex* pindexBase;
+    std::vector<CBlockIndex*> vIndex;
+    std::vector<CBlock> vBlock;
+
+    void Sync(CWallet& wallet, const CBlock& block, bool fConnect)
+    {
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            wallet.SyncTransaction(tx, fConnect ? &block : NULL);
+    }
+
+public:
+    CWalletTestChain()
+    {
+        LOCK(cs_main);
+        pindexBase = chainActive.Tip();
+    }
+
+    ~CWalletTestChain()
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(pindexBase);
+        BOOST_FOREACH(CBlockIndex* pindex, vIndex)
+        {
+            mapBlockIndex.erase(pindex->GetBlockHash());
+            delete pindex;
+        }
+    }
+
+    /** Connect a new block holding vtx on top of the tip; returns its number for Reconnect */
+    unsigned int Connect(CWallet& wallet, const std::vector<CTransaction>& vtx)
+    {
+        LOCK(cs_main);
+        CBlock block;
+        block.hashPrevBlock = chainActive.Tip()->GetBlockHash();
+        block.nTime = chainActive.Tip()->nTime + 45;
+        block.nNonce = vBlock.size();
+        block.vtx = vtx;
+        block.hashMerkleRoot = block.BuildMerkleTree();
+
+        CBlockIndex* pindex = new CBlockIndex(block);
+        pindex->pprev = chainActive.Tip();
+        pindex->nHeight = pindex->pprev->nHeight + 1;
+        pindex->phashBlock = &mapBlockIndex.insert(std::make_pair(block.GetHash(), pindex)).first->first;
+        pindex->BuildSkip();
+        vIndex.push_back(pindex);
+        vBlock.push_back(block);
+
+        chainActive.SetTip(pindex);
+        Sync(wallet, block, true);
+        return vBlock.size() - 1;
+    }
+
+    unsigned int Connect(CWallet& wallet, const CTransaction& tx)
+    {
+        return Connect(wallet, std::vector<CTransaction>(1, tx));
+    }
+
+    /** Take the tip block off the chain */
+    void Disconnect(CWallet& wallet)
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindex = chainActive.Tip();
+        BOOST_REQUIRE(pindex != pindexBase);
+        chainActive.SetTip(pindex->pprev);
+        for (unsigned int i = 0; i < vIndex.size(); i++)
+            if (vIndex[i] == pindex)
+                Sync(wallet, vBlock[i], false);
+    }
+
+    /** Put a block made earlier back on the chain, on top of the tip it was built on */
+    void Reconnect(CWallet& wallet, unsigned int nBlock)
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE(vIndex[nBlock]->pprev == chainActive.Tip());
+        chainActive.SetTip(vIndex[nBlock]);
+        Sync(wallet, vBlock[nBlock], true);
+    }
+};
+
+/** A transaction paying nValue to script from an output that isn't the wallet's */
+static CMutableTransaction MakeTestTx(const CScript& script, const CAmount& nValue)
+{
+    CMutableTransaction tx;
+    tx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+    tx.vout.push_back(CTxOut(nValue, script));
+    return tx;
+}
+
+/** Check the wallet's balance and coins, and that they are what a walk over all of mapWallet finds */
+static void CheckUnspent(const CWallet& wallet, const CAmount& nExpected)
+{
+    LOCK2(cs_main, wallet.cs_wallet);
+    CAmount nWalked = 0;
+    set<COutPoint> setWalked;
+    for (map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it)
+    {
+        const CWalletTx& wtx = it->second;
+        if (!wtx.IsTrusted())
+            continue;
+        nWalked += wtx.GetAvailableCredit(false);
+        for (unsigned int i = 0; i < wtx.vout.size(); i++)
+            if (wallet.IsMine(wtx.vout[i]) != ISMINE_NO && !wallet.IsSpent(it->first, i))
+                setWalked.insert(COutPoint(it->first, i));
+    }
+    BOOST_CHECK_EQUAL(nWalked, nExpected);
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), nExpected);
+
+    vector<COutput> vAvailable;
+    wallet.AvailableCoins(vAvailable, true);
+    set<COutPoint> setAvailable;
+    BOOST_FOREACH(const COutput& out, vAvailable)
+        setAvailable.insert(COutPoint(out.tx->GetHash(), out.i));
+    BOOST_CHECK(setAvailable == setWalked);
+}
+
+BOOST_AUTO_TEST_CASE(unspent_index_reorg)
+{
+    CWallet wallet("wallet_unspent.dat");
+    bool fFirstRun;
+    BOOST_CHECK(wallet.LoadWallet(fFirstRun) == DB_LOAD_OK);
+    CScript scriptMine;
+    {
+        LOCK(wallet.cs_wallet);
+        scriptMine = GetScriptForDestination(wallet.GenerateNewKey().GetID());
+    }
+    CWalletTestChain chain;
+
+    CMutableTransaction txFund = MakeTestTx(scriptMine, 10 * COIN);
+    chain.Connect(wallet, txFund);
+    CheckUnspent(wallet, 10 * COIN);
+
+    // Spend it, keeping 3 as change
+    CMutableTransaction txSpend;
+    txSpend.vin.push_back(CTxIn(COutPoint(txFund.GetHash(), 0)));
+    txSpend.vout.push_back(CTxOut(3 * COIN, scriptMine));
+    txSpend.vout.push_back(CTxOut(7 * COIN, CScript() << OP_TRUE));
+    unsigned int nBlock = chain.Connect(wallet, txSpend);
+    CheckUnspent(wallet, 3 * COIN);
+
+    // The spend leaving the main chain gives the funding output back
+    chain.Disconnect(wallet);
+    CheckUnspent(wallet, 10 * COIN);
+
+    chain.Reconnect(wallet, nBlock);
+    CheckUnspent(wallet, 3 * COIN);
+
+    // Further blocks change nothing
+    chain.Connect(wallet, std::vector<CTransaction>());
+    CheckUnspent(wallet, 3 * COIN);
+}
+
+/** Check wtxOrdered holds exactly the transactions and accounting entries a rebuild from them would */
+static void CheckOrdered(const CWallet& wallet)
+{
+    LOCK(wallet.cs_wallet);
+    vector<pair<int64_t, CWallet::TxPair> > vIndexed(wallet.wtxOrdered.begin(), wallet.wtxOrdered.end());
+    vector<pair<int64_t, CWallet::TxPair> > vRebuilt;
+    for (map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it)
+        vRebuilt.push_back(make_pair(it->second.nOrderPos, CWallet::TxPair(const_cast<CWalletTx*>(&it->second), (CAccountingEntry*)0)));
+    BOOST_FOREACH(const CAccountingEntry& entry, wallet.laccentries)
+        vRebuilt.push_back(make_pair(entry.nOrderPos, CWallet::TxPair((CWalletTx*)0, const_cast<CAccountingEntry*>(&entry))));
+    sort(vIndexed.begin(), vIndexed.end());
+    sort(vRebuilt.begin(), vRebuilt.end());
+    BOOST_CHECK(vIndexed == vRebuilt);
+}
+
+/**
+ * Check that what listsinceblock picks for each block by way of
+ * GetTransactionsSince is what its old walk over all of mapWallet did
+ */
+static void CheckSinceBlock(const CWallet& wallet, int nHeightBase)
+{
+    LOCK2(cs_main, wallet.cs_wallet);
+    for (int nHeight = nHeightBase; nHeight <= chainActive.Height(); nHeight++)
+    {
+        int nDepth = 1 + chainActive.Height() - nHeight;
+        set<uint256> setSince, setListed, setWalked;
+        wallet.GetTransactionsSince(nHeight, setSince);
+        BOOST_FOREACH(const uint256& hash, setSince)
+            if (wallet.mapWallet.find(hash)->second.GetDepthInMainChain() < nDepth)
+                setListed.insert(hash);
+        for (map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it)
+            if (it->second.GetDepthInMainChain() < nDepth)
+                setWalked.insert(it->first);
+        BOOST_CHECK_MESSAGE(setListed == setWalked, strprintf("since height %d", nHeight));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(activity_index_reorg)
+{
+    CWallet wallet("wallet_activity.dat");
+    bool fFirstRun;
+    BOOST_CHECK(wallet.LoadWallet(fFirstRun) == DB_LOAD_OK);
+    CScript scriptMine;
+    {
+        LOCK(wallet.cs_wallet);
+        scriptMine = GetScriptForDestination(wallet.GenerateNewKey().GetID());
+    }
+    CWalletTestChain chain;
+    int nHeightBase;
+    {
+        LOCK(cs_main);
+        nHeightBase = chainActive.Height();
+    }
+
+    CMutableTransaction tx1 = MakeTestTx(scriptMine, 1 * COIN);
+    CMutableTransaction tx2 = MakeTestTx(scriptMine, 2 * COIN);
+    CMutableTransaction tx3 = MakeTestTx(scriptMine, 3 * COIN);
+    chain.Connect(wallet, tx1);
+    unsigned int nBlock = chain.Connect(wallet, tx2);
+    {
+        LOCK2(cs_main, wallet.cs_wallet);
+        BOOST_CHECK(wallet.AddToWallet(CWalletTx(&wallet, tx3)));
+
+        // An accounting entry between the transactions
+        CWalletDB walletdb(wallet.strWalletFile);
+        CAccountingEntry entry;
+        entry.strAccount = "activity";
+        entry.nCreditDebit = 1;
+        entry.nOrderPos = wallet.IncOrderPosNext(&walletdb);
+        BOOST_CHECK(walletdb.WriteAccountingEntry(entry));
+        wallet.LoadAccountingEntry(entry);
+    }
+    CheckOrdered(wallet);
+    CheckSinceBlock(wallet, nHeightBase);
+
+    // tx2 leaves the main chain with its block, and comes back with it
+    chain.Disconnect(wallet);
+    CheckOrdered(wallet);
+    CheckSinceBlock(wallet, nHeightBase);
+    chain.Reconnect(wallet, nBlock);
+    CheckOrdered(wallet);
+    CheckSinceBlock(wallet, nHeightBase);
+
+    // Confirming tx3, and going on with an empty block
+    chain.Connect(wallet, tx3);
+    chain.Connect(wallet, std::vector<CTransaction>());
+    CheckOrdered(wallet);
+    CheckSinceBlock(wallet, nHeightBase);
+
+    // Taking its block off again and erasing it
+    chain.Disconnect(wallet);
+    chain.Disconnect(wallet);
+    wallet.EraseFromWallet(tx3.GetHash());
+    BOOST_CHECK(!wallet.mapWallet.count(tx3.GetHash()));
+    CheckOrdered(wallet);
+    CheckSinceBlock(wallet, nHeightBase);
+
+    // Erasing a confirmed one
+    wallet.EraseFromWallet(tx1.GetHash());
+    CheckOrdered(wallet);
+    CheckSinceBlock(wallet, nHeightBase);
+    {
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK_EQUAL(wallet.wtxOrdered.size(), 2U);
+    }
+}
+
+/** Address groupings the way GetAddressGroupings worked them out before it kept them indexed */
+static set< set<CTxDestination> > RecomputeAddressGroupings(CWallet& wallet)
+{
+    set< set<CTxDestination> > groupings;
+    set<CTxDestination> grouping;
+
+    BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, wallet.mapWallet)
+    {
+        CWalletTx *pcoin = &walletEntry.second;
+
+        if (pcoin->vin.size() > 0)
+        {
+            bool any_mine = false;
+            BOOST_FOREACH(CTxIn txin, pcoin->vin)
+            {
+                CTxDestination address;
+                if(!wallet.IsMine(txin))
+                    continue;
+                if(!ExtractDestination(wallet.mapWallet[txin.prevout.hash].vout[txin.prevout.n].scriptPubKey, address))
+                    continue;
+                grouping.insert(address);
+                any_mine = true;
+            }
+
+            if (any_mine)
+            {
+               BOOST_FOREACH(CTxOut txout, pcoin->vout)
+                   if (wallet.IsChange(txout))
+                   {
+                       CTxDestination txoutAddr;
+                       if(!ExtractDestination(txout.scriptPubKey, txoutAddr))
+                           continue;
+                       grouping.insert(txoutAddr);
+                   }
+            }
+            if (grouping.size() > 0)
+            {
+                groupings.insert(grouping);
+                grouping.clear();
+            }
+        }
+
+        for (unsigned int i = 0; i < pcoin->vout.size(); i++)
+            if (wallet.IsMine(pcoin->vout[i]))
+            {
+                CTxDestination address;
+                if(!ExtractDestination(pcoin->vout[i].scriptPubKey, address))
+                    continue;
+                grouping.insert(address);
+                groupings.insert(grouping);
+                grouping.clear();
+            }
+    }
+
+    // Merge the groups sharing an address until none do
+    map<CTxDestination, set<CTxDestination> > mapGroup;
+    BOOST_FOREACH(const set<CTxDestination>& group, groupings)
+    {
+        set<CTxDestination> merged(group);
+        BOOST_FOREACH(const CTxDestination& address, group)
+            if (mapGroup.count(address))
+                merged.insert(mapGroup[address].begin(), mapGroup[address].end());
+        BOOST_FOREACH(const CTxDestination& address, merged)
+            mapGroup[address] = merged;
+    }
+    set< set<CTxDestination> > ret;
+    for (map<CTxDestination, set<CTxDestination> >::const_iterator it = mapGroup.begin(); it != mapGroup.end(); ++it)
+        ret.insert(it->second);
+    return ret;
+}
+
+/**
+ * Address balances the way GetAddressBalances worked them out before it
+ * went by the unspent index, leaving out the zeros that listaddressgroupings
+ * shows either way
+ */
+static map<CTxDestination, CAmount> RecomputeAddressBalances(CWallet& wallet)
+{
+    map<CTxDestination, CAmount> balances;
+    BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, wallet.mapWallet)
+    {
+        CWalletTx *pcoin = &walletEntry.second;
+
+        if (!IsFinalTx(*pcoin) || !pcoin->IsTrusted())
+            continue;
+
+        if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+            continue;
+
+        int nDepth = pcoin->GetDepthInMainChain();
+        if (nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? 0 : 1))
+            continue;
+
+        for (unsigned int i = 0; i < pcoin->vout.size(); i++)
+        {
+            CTxDestination addr;
+            if (!wallet.IsMine(pcoin->vout[i]))
+                continue;
+            if(!ExtractDestination(pcoin->vout[i].scriptPubKey, addr))
+                continue;
+            if (!wallet.IsSpent(walletEntry.first, i))
+                balances[addr] += pcoin->vout[i].nValue;
+        }
+    }
+    return balances;
+}
+
+static void CheckGroupings(CWallet& wallet)
+{
+    LOCK2(cs_main, wallet.cs_wallet);
+    BOOST_CHECK(wallet.GetAddressGroupings() == RecomputeAddressGroupings(wallet));
+
+    map<CTxDestination, CAmount> balances = wallet.GetAddressBalances();
+    for (map<CTxDestination, CAmount>::iterator it = balances.begin(); it != balances.end(); )
+    {
+        if (it->second == 0)
+            balances.erase(it++);
+        else
+            ++it;
+    }
+    BOOST_CHECK(balances == RecomputeAddressBalances(wallet));
+}
+
+/** A transaction spending vPrevout, paying each of vOut */
+static CMutableTransaction MakeSpendTx(const vector<COutPoint>& vPrevout, const vector<pair<CScript, CAmount> >& vOut)
+{
+    CMutableTransaction tx;
+    BOOST_FOREACH(const COutPoint& prevout, vPrevout)
+        tx.vin.push_back(CTxIn(prevout));
+    for (unsigned int i = 0; i < vOut.size(); i++)
+        tx.vout.push_back(CTxOut(vOut[i].second, vOut[i].first));
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(address_groupings_index)
+{
+    CWallet wallet("wallet_groupings.dat");
+    bool fFirstRun;
+    BOOST_CHECK(wallet.LoadWallet(fFirstRun) == DB_LOAD_OK);
+
+    // Receiving addresses are in the address book, change ones aren't
+    CTxDestination destA, destB, destC, destD, destE;
+    {
+        LOCK(wallet.cs_wallet);
+        destA = wallet.GenerateNewKey().GetID();
+        destB = wallet.GenerateNewKey().GetID();
+        destC = wallet.GenerateNewKey().GetID();
+        destD = wallet.GenerateNewKey().GetID();
+        destE = wallet.GenerateNewKey().GetID();
+    }
+    BOOST_CHECK(wallet.SetAddressBook(destA, "A", "receive"));
+    BOOST_CHECK(wallet.SetAddressBook(destB, "B", "receive"));
+    BOOST_CHECK(wallet.SetAddressBook(destD, "D", "receive"));
+    CScript scriptA = GetScriptForDestination(destA), scriptB = GetScriptForDestination(destB);
+    CScript scriptC = GetScriptForDestination(destC), scriptD = GetScriptForDestination(destD);
+    CScript scriptE = GetScriptForDestination(destE), scriptOther = CScript() << OP_TRUE;
+    CWalletTestChain chain;
+
+    CMutableTransaction txA = MakeTestTx(scriptA, 5 * COIN);
+    CMutableTransaction txB = MakeTestTx(scriptB, 3 * COIN);
+    chain.Connect(wallet, txA);
+    chain.Connect(wallet, txB);
+    CheckGroupings(wallet);
+
+    // Spending both, with change to C, groups all three
+    vector<COutPoint> vPrevout;
+    vPrevout.push_back(COutPoint(txA.GetHash(), 0));
+    vPrevout.push_back(COutPoint(txB.GetHash(), 0));
+    vector<pair<CScript, CAmount> > vOut;
+    vOut.push_back(make_pair(scriptOther, 6 * COIN));
+    vOut.push_back(make_pair(scriptC, 2 * COIN));
+    CMutableTransaction txSpend = MakeSpendTx(vPrevout, vOut);
+    unsigned int nBlockSpend = chain.Connect(wallet, txSpend);
+    CheckGroupings(wallet);
+
+    // A spend arriving before the transaction it spends, with change to E:
+    // D and E only group once that comes in
+    CMutableTransaction txD = MakeTestTx(scriptD, 4 * COIN);
+    vPrevout.assign(1, COutPoint(txD.GetHash(), 0));
+    vOut.clear();
+    vOut.push_back(make_pair(scriptOther, 1 * COIN));
+    vOut.push_back(make_pair(scriptE, 3 * COIN));
+    CMutableTransaction txEarly = MakeSpendTx(vPrevout, vOut);
+    chain.Connect(wallet, txEarly);
+    CheckGroupings(wallet);
+    chain.Connect(wallet, txD);
+    CheckGroupings(wallet);
+
+    // C in the address book isn't change any more, and is again once out of it
+    BOOST_CHECK(wallet.SetAddressBook(destC, "C", "receive"));
+    CheckGroupings(wallet);
+    BOOST_CHECK(wallet.DelAddressBook(destC));
+    CheckGroupings(wallet);
+
+    // The spend leaving the main chain and coming back
+    chain.Disconnect(wallet);
+    chain.Disconnect(wallet);
+    chain.Disconnect(wallet);
+    CheckGroupings(wallet);
+    chain.Reconnect(wallet, nBlockSpend);
+    CheckGroupings(wallet);
+
+    // And erased, which leaves A and B on their own and C nowhere
+    wallet.EraseFromWallet(txSpend.GetHash());
+    CheckGroupings(wallet);
+    {
+        LOCK(wallet.cs_wallet);
+        set< set<CTxDestination> > groupings = wallet.GetAddressGroupings();
+        BOOST_CHECK_EQUAL(groupings.size(), 3U);
+        BOOST_CHECK(groupings.count(set<CTxDestination>(&destA, &destA + 1)));
+        BOOST_CHECK(groupings.count(set<CTxDestination>(&destB, &destB + 1)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(rescan_prefilter)
+{
+    // A rescan only hands the wallet transactions with an output passing the
+    // key store filter (or touching a wallet transaction); whatever IsMine
+    // accepts has to be among them
+    CWallet wallet("wallet_rescan.dat");
+    bool fFirstRun;
+    BOOST_CHECK(wallet.LoadWallet(fFirstRun) == DB_LOAD_OK);
+
+    CKey keyCompressed, keyUncompressed, keyOther;
+    keyCompressed.MakeNewKey(true);
+    keyUncompressed.MakeNewKey(false);
+    keyOther.MakeNewKey(true);
+    std::vector<CPubKey> vMine, vMixed;
+    vMine.push_back(keyCompressed.GetPubKey());
+    vMine.push_back(keyUncompressed.GetPubKey());
+    vMixed.push_back(keyCompressed.GetPubKey());
+    vMixed.push_back(keyOther.GetPubKey());
+    CScript scriptRedeem = GetScriptForDestination(keyCompressed.GetPubKey().GetID());
+    CScript scriptWatched = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    {
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK(wallet.AddKeyPubKey(keyCompressed, keyCompressed.GetPubKey()));
+        BOOST_CHECK(wallet.AddKeyPubKey(keyUncompressed, keyUncompressed.GetPubKey()));
+        BOOST_CHECK(wallet.AddCScript(scriptRedeem));
+        BOOST_CHECK(wallet.AddWatchOnly(scriptWatched));
+        BOOST_CHECK(wallet.AddWatchOnly(CScript() << OP_TRUE));
+    }
+
+    std::vector<CScript> vScripts;
+    const CKey* keys[] = { &keyCompressed, &keyUncompressed, &keyOther };
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        vScripts.push_back(GetScriptForDestination(keys[i]->GetPubKey().GetID()));
+        vScripts.push_back(CScript() << ToByteVector(keys[i]->GetPubKey()) << OP_CHECKSIG);
+    }
+    vScripts.push_back(GetScriptForDestination(CScriptID(scriptRedeem)));
+    vScripts.push_back(GetScriptForDestination(CScriptID(CScript() << OP_2)));
+    vScripts.push_back(GetScriptForMultisig(1, vMine));
+    vScripts.push_back(GetScriptForMultisig(2, vMixed));
+    vScripts.push_back(CScript() << OP_TRUE);
+    vScripts.push_back(CScript() << OP_RETURN << ToByteVector(keyCompressed.GetPubKey().GetID()));
+    vScripts.push_back(CScript() << OP_RETURN);
+
+    CKeyStoreFilter filter;
+    {
+        LOCK(wallet.cs_wallet);
+        filter = wallet.GetFilter();
+    }
+    int nMine = 0;
+    BOOST_FOREACH(const CScript& script, vScripts)
+    {
+        if (wallet.IsMine(CTxOut(1, script)) == ISMINE_NO)
+            continue;
+        nMine++;
+        BOOST_CHECK_MESSAGE(filter.IsRelevant(script), "filtered out " + script.ToString());
+    }
+    // P2PKH and P2PK of both keys, the P2SH, the 1-of-2 of our keys and both watched scripts
+    BOOST_CHECK_EQUAL(nMine, 8);
+
+    // The same at the level of transactions, which are what get dropped
+    seed_insecure_rand(true);
+    for (int i = 0; i < 1000; i++)
+    {
+        CMutableTransaction tx = MakeTestTx(vScripts[insecure_rand() % vScripts.size()], 1);
+        for (unsigned int j = insecure_rand() % 3; j > 0; j--)
+            tx.vout.push_back(CTxOut(1, vScripts[insecure_rand() % vScripts.size()]));
+        bool fRelevant = false;
+        BOOST_FOREACH(const CTxOut& txout, tx.vout)
+            fRelevant = fRelevant || filter.IsRelevant(txout.scriptPubKey);
+        if (wallet.IsMine(tx))
+            BOOST_CHECK(fRelevant);
+    }
+}
+
+/** Whether both the key store and a copy of its filter pass script */
+static bool IsRelevantScript(const CWallet& wallet, const CScript& script)
+{
+    bool fRelevant = wallet.IsRelevant(script);
+    BOOST_CHECK_EQUAL(wallet.GetFilter().IsRelevant(script), fRelevant);
+    return fRelevant;
+}
+
+static bool IsRelevantKey(const CWallet& wallet, const CPubKey& pubkey)
+{
+    return IsRelevantScript(wallet, GetScriptForDestination(pubkey.GetID())) &&
+           IsRelevantScript(wallet, CScript() << ToByteVector(pubkey) << OP_CHECKSIG);
+}
+
+static CPubKey MakeTestKey(CKey& key, bool fCompressed = true)
+{
+    key.MakeNewKey(fCompressed);
+    return key.GetPubKey();
+}
+
+BOOST_AUTO_TEST_CASE(keystore_filter_add_paths)
+{
+    CWallet wallet("wallet_filter.dat");
+    bool fFirstRun;
+    BOOST_CHECK(wallet.LoadWallet(fFirstRun) == DB_LOAD_OK);
+    LOCK(wallet.cs_wallet);
+    std::vector<CPubKey> vKeys;
+    CKey key;
+
+    // Keys, compressed or not, added, loaded, generated and put in the pool
+    vKeys.push_back(MakeTestKey(key));
+    BOOST_CHECK(wallet.AddKeyPubKey(key, key.GetPubKey()));
+    vKeys.push_back(MakeTestKey(key, false));
+    BOOST_CHECK(wallet.AddKeyPubKey(key, key.GetPubKey()));
+    vKeys.push_back(MakeTestKey(key));
+    BOOST_CHECK(wallet.LoadKey(key, key.GetPubKey()));
+    vKeys.push_back(wallet.GenerateNewKey());
+    BOOST_CHECK(wallet.TopUpKeyPool(3));
+    std::set<CKeyID> setPoolPlain;
+    wallet.GetAllReserveKeys(setPoolPlain);
+    BOOST_CHECK(!setPoolPlain.empty());
+
+    // Redeem scripts added and loaded
+    std::vector<CScript> vRedeem;
+    vRedeem.push_back(GetScriptForMultisig(1, std::vector<CPubKey>(1, MakeTestKey(key))));
+    BOOST_CHECK(wallet.AddCScript(vRedeem.back()));
+    vRedeem.push_back(CScript() << OP_2 << OP_EQUAL);
+    BOOST_CHECK(wallet.LoadCScript(vRedeem.back()));
+
+    // Watch-only scripts added and loaded, standard or not
+    std::vector<CScript> vWatch;
+    vWatch.push_back(GetScriptForDestination(MakeTestKey(key).GetID()));
+    BOOST_CHECK(wallet.AddWatchOnly(vWatch.back()));
+    vWatch.push_back(CScript() << OP_TRUE);
+    BOOST_CHECK(wallet.LoadWatchOnly(vWatch.back()));
+    CScript scriptUnwatched = CScript() << OP_3;
+    BOOST_CHECK(wallet.AddWatchOnly(scriptUnwatched));
+    BOOST_CHECK(wallet.RemoveWatchOnly(scriptUnwatched));
+    BOOST_CHECK(!IsRelevantScript(wallet, scriptUnwatched));
+
+    // Encrypting moves the keys and renews the pool, and more get added encrypted
+    BOOST_CHECK(wallet.EncryptWallet("filter test"));
+    BOOST_CHECK(wallet.Unlock("filter test"));
+    vKeys.push_back(wallet.GenerateNewKey());
+    vKeys.push_back(MakeTestKey(key));
+    BOOST_CHECK(wallet.AddKeyPubKey(key, key.GetPubKey()));
+    std::vector<unsigned char> vchCrypted(48, 1);
+    vKeys.push_back(MakeTestKey(key));
+    BOOST_CHECK(wallet.AddCryptedKey(key.GetPubKey(), vchCrypted));
+    vKeys.push_back(MakeTestKey(key, false));
+    BOOST_CHECK(wallet.LoadCryptedKey(key.GetPubKey(), vchCrypted));
+    std::set<CKeyID> setPool;
+    wallet.GetAllReserveKeys(setPool);
+    BOOST_CHECK(!setPool.empty());
+    setPool.insert(setPoolPlain.begin(), setPoolPlain.end());
+
+    BOOST_FOREACH(const CPubKey& pubkey, vKeys)
+        BOOST_CHECK(IsRelevantKey(wallet, pubkey));
+    BOOST_FOREACH(const CKeyID& keyid, setPool)
+        BOOST_CHECK(IsRelevantScript(wallet, GetScriptForDestination(keyid)));
+    BOOST_FOREACH(const CScript& script, vRedeem)
+        BOOST_CHECK(IsRelevantScript(wallet, GetScriptForDestination(CScriptID(script))));
+    BOOST_FOREACH(const CScript& script, vWatch)
+        BOOST_CHECK(IsRelevantScript(wallet, script));
+
+    // And nothing else
+    BOOST_CHECK(!IsRelevantKey(wallet, MakeTestKey(key)));
+    BOOST_CHECK(!IsRelevantScript(wallet, GetScriptForDestination(CScriptID(CScript() << OP_4))));
+}
+
+/** Writes wallet records CWalletDB doesn't: corrupt ones, or ones as old versions stored them */
+class CTestWalletDB : public CWalletDB
+{
+public:
+    explicit CTestWalletDB(const string& strFilename) : CWalletDB(strFilename, "cr+") {}
+
+    template<typename K, typename T>
+    bool WriteRecord(const K& key, const T& value) { return Write(key, value); }
+};
+
+/** What loading a wallet file ended up with */
+struct CLoadResult
+{
+    DBErrors nLoadRet;
+    map<CKeyID, CPrivKey> mapKeys;
+    set<uint256> setTx;
+    vector<CPubKey> vDeferred;
+};
+
+static CLoadResult LoadInChunks(const string& strFile, unsigned int nChunkSize, int nThreads, bool fDeferKeyCheck)
+{
+    int nThreadsSaved = nScriptCheckThreads;
+    nScriptCheckThreads = nThreads;
+    mapArgs["-deferkeycheck"] = fDeferKeyCheck ? "1" : "0";
+
+    CWallet wallet(strFile);
+    CLoadResult result;
+    result.nLoadRet = CWalletDB(strFile).LoadWallet(&wallet, nChunkSize);
+
+    nScriptCheckThreads = nThreadsSaved;
+    mapArgs.erase("-deferkeycheck");
+    mapArgs.erase("-rescan");
+
+    LOCK(wallet.cs_wallet);
+    set<CKeyID> setKeys;
+    wallet.GetKeys(setKeys);
+    BOOST_FOREACH(const CKeyID& keyid, setKeys)
+    {
+        CKey key;
+        BOOST_CHECK(wallet.GetKey(keyid, key));
+        result.mapKeys[keyid] = key.GetPrivKey();
+    }
+    for (map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it)
+        result.setTx.insert(it->first);
+    result.vDeferred = wallet.vDeferredKeyChecks;
+    return result;
+}
+
+/**
+ * Load strFile a record at a time on this thread, which is how loading went
+ * before it was done in chunks, and check that loading it in chunks of several
+ * sizes with several threads decoding them comes out the same
+ */
+static CLoadResult CheckChunkedLoad(const string& strFile, bool fDeferKeyCheck)
+{
+    CLoadResult sequential = LoadInChunks(strFile, 1, 0, fDeferKeyCheck);
+    const unsigned int nChunkSizes[] = { 2, 5, 64, WALLET_LOAD_CHUNK };
+    BOOST_FOREACH(unsigned int nChunkSize, nChunkSizes)
+    {
+        CLoadResult chunked = LoadInChunks(strFile, nChunkSize, 3, fDeferKeyCheck);
+        BOOST_CHECK_EQUAL(chunked.nLoadRet, sequential.nLoadRet);
+        BOOST_CHECK(chunked.mapKeys == sequential.mapKeys);
+        BOOST_CHECK(chunked.setTx == sequential.setTx);
+        BOOST_CHECK(chunked.vDeferred == sequential.vDeferred);
+    }
+    return sequential;
+}
+
+static set<CKeyID> LoadedKeyIDs(const CLoadResult& result)
+{
+    set<CKeyID> setKeyIDs;
+    for (map<CKeyID, CPrivKey>::const_iterator it = result.mapKeys.begin(); it != result.mapKeys.end(); ++it)
+        setKeyIDs.insert(it->first);
+    return setKeyIDs;
+}
+
+static set<CKeyID> DeferredKeyIDs(const CLoadResult& result)
+{
+    set<CKeyID> setKeyIDs;
+    BOOST_FOREACH(const CPubKey& pubkey, result.vDeferred)
+        setKeyIDs.insert(pubkey.GetID());
+    return setKeyIDs;
+}
+
+BOOST_AUTO_TEST_CASE(load_wallet_chunks)
+{
+    // Both files get keys with a checksum and without one, as old versions
+    // stored them, transactions, a corrupt transaction and a key without a
+    // checksum whose private key isn't its public key's. The second also gets
+    // a key failing its checksum.
+    const string strFile = "wallet_chunks.dat";
+    const string strFileBadKey = "wallet_chunks_badkey.dat";
+    set<CKeyID> setKeys, setUnchecked;
+    set<uint256> setTx;
+    CKey key, keyOther;
+    CPubKey pubkeyMismatched, pubkeyCorrupt;
+    {
+        CTestWalletDB db(strFile);
+        CTestWalletDB dbBadKey(strFileBadKey);
+        CTestWalletDB* dbs[] = { &db, &dbBadKey };
+        for (int i = 0; i < 8; i++)
+        {
+            MakeTestKey(key, i % 2 == 0);
+            setKeys.insert(key.GetPubKey().GetID());
+            BOOST_FOREACH(CTestWalletDB* pdb, dbs)
+                BOOST_CHECK(pdb->WriteKey(key.GetPubKey(), key.GetPrivKey(), CKeyMetadata(GetTime())));
+
+            MakeTestKey(key, i % 2 == 0);
+            setKeys.insert(key.GetPubKey().GetID());
+            setUnchecked.insert(key.GetPubKey().GetID());
+            BOOST_FOREACH(CTestWalletDB* pdb, dbs)
+                BOOST_CHECK(pdb->WriteRecord(make_pair(string("key"), key.GetPubKey()), key.GetPrivKey()));
+
+            CWalletTx wtx(NULL, MakeTestTx(CScript() << OP_TRUE, i + 1));
+            setTx.insert(wtx.GetHash());
+            BOOST_FOREACH(CTestWalletDB* pdb, dbs)
+                BOOST_CHECK(pdb->WriteTx(wtx.GetHash(), wtx));
+        }
+
+        CWalletTx wtxCorrupt(NULL, MakeTestTx(CScript() << OP_TRUE, 1));
+        pubkeyMismatched = MakeTestKey(key);
+        MakeTestKey(keyOther);
+        BOOST_FOREACH(CTestWalletDB* pdb, dbs)
+        {
+            BOOST_CHECK(pdb->WriteRecord(make_pair(string("tx"), GetRandHash()), wtxCorrupt));
+            BOOST_CHECK(pdb->WriteRecord(make_pair(string("key"), pubkeyMismatched), keyOther.GetPrivKey()));
+        }
+
+        pubkeyCorrupt = MakeTestKey(key);
+        BOOST_CHECK(dbBadKey.WriteRecord(make_pair(string("key"), pubkeyCorrupt), make_pair(key.GetPrivKey(), uint256(1))));
+    }
+
+    // Checked while loading, the mismatched key is left out and fails the load
+    CLoadResult result = CheckChunkedLoad(strFile, false);
+    BOOST_CHECK_EQUAL(result.nLoadRet, DB_CORRUPT);
+    BOOST_CHECK(LoadedKeyIDs(result) == setKeys);
+    BOOST_CHECK(result.setTx == setTx);
+    BOOST_CHECK(result.vDeferred.empty());
+
+    // With -deferkeycheck it loads, left to be checked later like the other
+    // keys without a checksum, and only the corrupt transaction is reported
+    result = CheckChunkedLoad(strFile, true);
+    BOOST_CHECK_EQUAL(result.nLoadRet, DB_NONCRITICAL_ERROR);
+    setKeys.insert(pubkeyMismatched.GetID());
+    setUnchecked.insert(pubkeyMismatched.GetID());
+    BOOST_CHECK(LoadedKeyIDs(result) == setKeys);
+    BOOST_CHECK(result.setTx == setTx);
+    BOOST_CHECK(DeferredKeyIDs(result) == setUnchecked);
+
+    // A key failing its checksum fails the load either way
+    result = CheckChunkedLoad(strFileBadKey, true);
+    BOOST_CHECK_EQUAL(result.nLoadRet, DB_CORRUPT);
+    BOOST_CHECK(LoadedKeyIDs(result) == setKeys);
+    BOOST_CHECK(result.setTx == setTx);
+    setKeys.erase(pubkeyMismatched.GetID());
+    result = CheckChunkedLoad(strFileBadKey, false);
+    BOOST_CHECK_EQUAL(result.nLoadRet, DB_CORRUPT);
+    BOOST_CHECK(LoadedKeyIDs(result) == setKeys);
+    BOOST_CHECK(result.setTx == setTx);
+}
+
+BOOST_AUTO_TEST_CASE(deferred_key_pool)
+{
+    // A key pool of a key without a checksum whose private key isn't its
+    // public key's, one without a checksum that is fine and one checked
+    // while loading, oldest first
+    const string strFile = "wallet_deferredpool.dat";
+    CKey key, keyOther;
+    CPubKey pubkeyMismatched, pubkeyUnchecked, pubkeyChecked;
+    {
+        CTestWalletDB db(strFile);
+        pubkeyMismatched = MakeTestKey(key);
+        MakeTestKey(keyOther);
+        BOOST_CHECK(db.WriteRecord(make_pair(string("key"), pubkeyMismatched), keyOther.GetPrivKey()));
+        pubkeyUnchecked = MakeTestKey(key);
+        BOOST_CHECK(db.WriteRecord(make_pair(string("key"), pubkeyUnchecked), key.GetPrivKey()));
+        pubkeyChecked = MakeTestKey(key);
+        BOOST_CHECK(db.WriteKey(pubkeyChecked, key.GetPrivKey(), CKeyMetadata(GetTime())));
+        BOOST_CHECK(db.WritePool(1, CKeyPool(pubkeyMismatched)));
+        BOOST_CHECK(db.WritePool(2, CKeyPool(pubkeyUnchecked)));
+        BOOST_CHECK(db.WritePool(3, CKeyPool(pubkeyChecked)));
+    }
+
+    mapArgs["-deferkeycheck"] = "1";
+    mapArgs["-keypool"] = "0";
+    CWallet wallet(strFile);
+    bool fFirstRun;
+    BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+    mapArgs.erase("-deferkeycheck");
+
+    // Until they are checked only the checked key is handed out
+    int64_t nIndex;
+    CKeyPool keypool;
+    wallet.ReserveKeyFromKeyPool(nIndex, keypool);
+    BOOST_CHECK_EQUAL(nIndex, 3);
+    BOOST_CHECK(keypool.vchPubKey == pubkeyChecked);
+    wallet.KeepKey(nIndex);
+    wallet.ReserveKeyFromKeyPool(nIndex, keypool);
+    BOOST_CHECK_EQUAL(nIndex, -1);
+    BOOST_CHECK(!keypool.vchPubKey.IsValid());
+
+    // Afterwards the good one is, and the bad one is gone from the pool
+    wallet.CheckDeferredKeys();
+    BOOST_CHECK(wallet.setUncheckedKeys.size() == 1 && wallet.setUncheckedKeys.count(pubkeyMismatched.GetID()));
+    BOOST_CHECK(wallet.setKeyPool.size() == 1 && wallet.setKeyPool.count(2));
+    BOOST_CHECK(!CWalletDB(strFile).ReadPool(1, keypool));
+    wallet.ReserveKeyFromKeyPool(nIndex, keypool);
+    BOOST_CHECK_EQUAL(nIndex, 2);
+    BOOST_CHECK(keypool.vchPubKey == pubkeyUnchecked);
+    wallet.KeepKey(nIndex);
+
+    mapArgs.erase("-keypool");
+    strMiscWarning.clear();
+}
+
+/**
+ * Unlock with strPassphrase and lock again, with the master keys a passphrase
+ * is otherwise derived against out of the way: only the unlock cache can do it
+ */
+static bool UnlockFromCache(CWallet& wallet, const SecureString& strPassphrase)
+{
+    LOCK(wallet.cs_wallet);
+    CWallet::MasterKeyMap mapMasterKeys;
+    mapMasterKeys.swap(wallet.mapMasterKeys);
+    bool fUnlocked = wallet.Unlock(strPassphrase);
+    wallet.mapMasterKeys.swap(mapMasterKeys);
+    wallet.Lock();
+    return fUnlocked;
+}
+
+BOOST_AUTO_TEST_CASE(unlock_cache)
+{
+    mapArgs["-unlockcachetime"] = "60";
+    CWallet wallet("wallet_unlockcache.dat");
+    bool fFirstRun;
+    BOOST_CHECK(wallet.LoadWallet(fFirstRun) == DB_LOAD_OK);
+    {
+        // An unlock is checked against the keys, so there has to be one
+        LOCK(wallet.cs_wallet);
+        wallet.GenerateNewKey();
+    }
+
+    // Encrypting unlocks with the new passphrase, which caches it
+    BOOST_CHECK(wallet.EncryptWallet("cached"));
+    BOOST_CHECK(wallet.IsLocked());
+    BOOST_CHECK(wallet.GetUnlockCacheExpiry() != 0);
+    BOOST_CHECK(UnlockFromCache(wallet, "cached"));
+
+    // A wrong passphrase misses, and leaves the cache be
+    BOOST_CHECK(!UnlockFromCache(wallet, "wrong"));
+    BOOST_CHECK(!wallet.Unlock("wrong"));
+    BOOST_CHECK(UnlockFromCache(wallet, "cached"));
+
+    // Once expired it misses too, until an unlock caches the passphrase again
+    SetMockTime(GetTime() + 61);
+    BOOST_CHECK(!UnlockFromCache(wallet, "cached"));
+    BOOST_CHECK_EQUAL(wallet.GetUnlockCacheExpiry(), 0);
+    BOOST_CHECK(wallet.Unlock("cached"));
+    wallet.Lock();
+    BOOST_CHECK(UnlockFromCache(wallet, "cached"));
+    SetMockTime(0);
+
+    // Changing the passphrase drops the cache
+    BOOST_CHECK(wallet.ChangeWalletPassphrase("cached", "changed"));
+    BOOST_CHECK(wallet.IsLocked());
+    BOOST_CHECK_EQUAL(wallet.GetUnlockCacheExpiry(), 0);
+    BOOST_CHECK(!UnlockFromCache(wallet, "cached"));
+    BOOST_CHECK(!UnlockFromCache(wallet, "changed"));
+    BOOST_CHECK(!wallet.Unlock("cached"));
+
+    // The wallet's own thread wipes the cache as it expires, with no one unlocking
+    mapArgs["-unlockcachetime"] = "1";
+    boost::thread threadExpiry(boost::bind(&CWallet::ThreadUnlockCacheExpiry, &wallet));
+    BOOST_CHECK(wallet.Unlock("changed"));
+    wallet.Lock();
+    BOOST_CHECK(wallet.GetUnlockCacheExpiry() != 0);
+    for (int i = 0; i < 100 && wallet.GetUnlockCacheExpiry() != 0; i++)
+        MilliSleep(100);
+    BOOST_CHECK_EQUAL(wallet.GetUnlockCacheExpiry(), 0);
+    BOOST_CHECK(!UnlockFromCache(wallet, "changed"));
+    threadExpiry.interrupt();
+    threadExpiry.join();
+
+    mapArgs.erase("-unlockcachetime");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
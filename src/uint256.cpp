@@ -86,6 +86,27 @@ base_uint<BITS>& base_uint<BITS>::operator*=(const base_uint& b)
     return *this;
 }
 
+template <unsigned int BITS>
+base_uint<BITS>& base_uint<BITS>::operator/=(uint64_t b64)
+{
+    // Takes any 64-bit divisor, so that integer divisors of any width keep
+    // their full value rather than narrowing to a limb.
+    if (b64 >> 32)
+        return *this /= base_uint(b64);
+    if (b64 == 0)
+        throw uint_error("Division by zero");
+    // Schoolbook division one limb at a time, much cheaper than the bitwise
+    // long division below when the divisor fits in a limb.
+    const uint32_t b32 = (uint32_t)b64;
+    uint64_t rem = 0;
+    for (int i = WIDTH - 1; i >= 0; i--) {
+        uint64_t n = (rem << 32) | pn[i];
+        pn[i] = n / b32;
+        rem = n % b32;
+    }
+    return *this;
+}
+
 template <unsigned int BITS>
 base_uint<BITS>& base_uint<BITS>::operator/=(const base_uint& b)
 {
@@ -222,6 +243,7 @@ template base_uint<160>& base_uint<160>::operator<<=(unsigned int);
 template base_uint<160>& base_uint<160>::operator>>=(unsigned int);
 template base_uint<160>& base_uint<160>::operator*=(uint32_t b32);
 template base_uint<160>& base_uint<160>::operator*=(const base_uint<160>& b);
+template base_uint<160>& base_uint<160>::operator/=(uint64_t b64);
 template base_uint<160>& base_uint<160>::operator/=(const base_uint<160>& b);
 template int base_uint<160>::CompareTo(const base_uint<160>&) const;
 template bool base_uint<160>::EqualTo(uint64_t) const;
@@ -239,6 +261,7 @@ template base_uint<256>& base_uint<256>::operator<<=(unsigned int);
 template base_uint<256>& base_uint<256>::operator>>=(unsigned int);
 template base_uint<256>& base_uint<256>::operator*=(uint32_t b32);
 template base_uint<256>& base_uint<256>::operator*=(const base_uint<256>& b);
+template base_uint<256>& base_uint<256>::operator/=(uint64_t b64);
 template base_uint<256>& base_uint<256>::operator/=(const base_uint<256>& b);
 template int base_uint<256>::CompareTo(const base_uint<256>&) const;
 template bool base_uint<256>::EqualTo(uint64_t) const;
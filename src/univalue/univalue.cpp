@@ -4,12 +4,20 @@
 
 #include <stdint.h>
 #include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <iomanip>
+#include <limits>
+#include <locale>
 #include <sstream>
+#include <stdexcept>
 #include "univalue.h"
 
 using namespace std;
 
-static const UniValue nullValue;
+const UniValue NullUniValue;
 
 void UniValue::clear()
 {
@@ -53,32 +61,35 @@ bool UniValue::setNumStr(const string& val_)
     return true;
 }
 
+// Integers are always valid numbers, so skip re-tokenizing them
 bool UniValue::setInt(uint64_t val)
 {
-    string s;
-    ostringstream oss;
-
-    oss << val;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%" PRIu64, val);
 
-    return setNumStr(oss.str());
+    clear();
+    typ = VNUM;
+    this->val = buf;
+    return true;
 }
 
 bool UniValue::setInt(int64_t val)
 {
-    string s;
-    ostringstream oss;
-
-    oss << val;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%" PRId64, val);
 
-    return setNumStr(oss.str());
+    clear();
+    typ = VNUM;
+    this->val = buf;
+    return true;
 }
 
 bool UniValue::setFloat(double val)
 {
-    string s;
     ostringstream oss;
+    oss.imbue(std::locale::classic());
 
-    oss << val;
+    oss << std::setprecision(16) << val;
 
     return setNumStr(oss.str());
 }
@@ -91,6 +102,14 @@ bool UniValue::setStr(const string& val_)
     return true;
 }
 
+void UniValue::swap(UniValue& other)
+{
+    std::swap(typ, other.typ);
+    val.swap(other.val);
+    keys.swap(other.keys);
+    values.swap(other.values);
+}
+
 bool UniValue::setArray()
 {
     clear();
@@ -175,11 +194,11 @@ bool UniValue::checkObject(const std::map<std::string,UniValue::VType>& t)
 const UniValue& UniValue::operator[](const std::string& key) const
 {
     if (typ != VOBJ)
-        return nullValue;
+        return NullUniValue;
 
     int index = findKey(key);
     if (index < 0)
-        return nullValue;
+        return NullUniValue;
 
     return values[index];
 }
@@ -187,9 +206,9 @@ const UniValue& UniValue::operator[](const std::string& key) const
 const UniValue& UniValue::operator[](unsigned int index) const
 {
     if (typ != VOBJ && typ != VARR)
-        return nullValue;
+        return NullUniValue;
     if (index >= values.size())
-        return nullValue;
+        return NullUniValue;
 
     return values[index];
 }
@@ -209,3 +228,104 @@ const char *uvTypeName(UniValue::VType t)
     return NULL;
 }
 
+
+const UniValue& find_value(const UniValue& obj, const std::string& name)
+{
+    return obj[name];
+}
+
+static bool ParseInt64(const std::string& str, int64_t *out)
+{
+    if (str.empty() || isspace(str[0]))
+        return false;
+    char *endp = NULL;
+    errno = 0;
+    long long n = strtoll(str.c_str(), &endp, 10);
+    if (*endp != 0 || errno == ERANGE)
+        return false;
+    *out = (int64_t)n;
+    return true;
+}
+
+static bool ParseDouble(const std::string& str, double *out)
+{
+    std::istringstream text(str);
+    text.imbue(std::locale::classic());
+    double result;
+    text >> result;
+    if (text.fail() || !text.eof())
+        return false;
+    *out = result;
+    return true;
+}
+
+static void checkType(const UniValue& value, UniValue::VType typ)
+{
+    if (value.getType() != typ)
+        throw std::runtime_error(std::string("value type is ") + uvTypeName(value.getType()) +
+                                 ", expected " + uvTypeName(typ));
+}
+
+const std::vector<std::string>& UniValue::getKeys() const
+{
+    checkType(*this, VOBJ);
+    return keys;
+}
+
+const std::vector<UniValue>& UniValue::getValues() const
+{
+    if (typ != VOBJ && typ != VARR)
+        throw std::runtime_error("value type is " + std::string(uvTypeName(typ)) + ", expected object or array");
+    return values;
+}
+
+bool UniValue::get_bool() const
+{
+    checkType(*this, VBOOL);
+    return getBool();
+}
+
+const std::string& UniValue::get_str() const
+{
+    checkType(*this, VSTR);
+    return val;
+}
+
+int UniValue::get_int() const
+{
+    checkType(*this, VNUM);
+    int64_t n;
+    if (!ParseInt64(val, &n) || n < std::numeric_limits<int>::min() || n > std::numeric_limits<int>::max())
+        throw std::runtime_error("JSON integer out of range");
+    return (int)n;
+}
+
+int64_t UniValue::get_int64() const
+{
+    checkType(*this, VNUM);
+    int64_t n;
+    if (!ParseInt64(val, &n))
+        throw std::runtime_error("JSON integer out of range");
+    return n;
+}
+
+double UniValue::get_real() const
+{
+    checkType(*this, VNUM);
+    double d;
+    if (!ParseDouble(val, &d))
+        throw std::runtime_error("JSON double out of range");
+    return d;
+}
+
+const UniValue& UniValue::get_obj() const
+{
+    checkType(*this, VOBJ);
+    return *this;
+}
+
+const UniValue& UniValue::get_array() const
+{
+    checkType(*this, VARR);
+    return *this;
+}
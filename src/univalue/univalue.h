@@ -6,10 +6,12 @@
 #define BITCOIN_UNIVALUE_UNIVALUE_H
 
 #include <stdint.h>
+#include <string.h>
 #include <string>
 #include <vector>
 #include <map>
 #include <cassert>
+#include <utility>
 
 class UniValue {
 public:
@@ -29,6 +31,9 @@ public:
     UniValue(int val_) {
         setInt(val_);
     }
+    UniValue(bool val_) {
+        setBool(val_);
+    }
     UniValue(double val_) {
         setFloat(val_);
     }
@@ -59,6 +64,8 @@ public:
     bool empty() const { return (values.size() == 0); }
 
     size_t count() const { return values.size(); }
+    size_t size() const { return values.size(); }
+    void swap(UniValue& other);
 
     bool getBool() const { return isTrue(); }
     bool checkObject(const std::map<std::string,UniValue::VType>& memberTypes);
@@ -75,6 +82,20 @@ public:
     bool isArray() const { return (typ == VARR); }
     bool isObject() const { return (typ == VOBJ); }
 
+    // Typed accessors for the RPC layer. These throw std::runtime_error
+    // when the value is not of the requested type, so that a bad parameter
+    // is reported to the caller instead of silently read as null or zero.
+    enum VType type() const { return getType(); }
+    const std::vector<std::string>& getKeys() const;
+    const std::vector<UniValue>& getValues() const;
+    bool get_bool() const;
+    const std::string& get_str() const;
+    int get_int() const;
+    int64_t get_int64() const;
+    double get_real() const;
+    const UniValue& get_obj() const;
+    const UniValue& get_array() const;
+
     bool push_back(const UniValue& val);
     bool push_back(const std::string& val_) {
         UniValue tmpVal(VSTR, val_);
@@ -85,6 +106,9 @@ public:
         return push_back(s);
     }
     bool push_backV(const std::vector<UniValue>& vec);
+    bool push_back(const std::pair<std::string,UniValue>& pear) {
+        return pushKV(pear.first, pear.second);
+    }
 
     bool pushKV(const std::string& key, const UniValue& val);
     bool pushKV(const std::string& key, const std::string& val) {
@@ -115,10 +139,21 @@ public:
 
     std::string write(unsigned int prettyIndent = 0,
                       unsigned int indentLevel = 0) const;
-
-    bool read(const char *raw);
+    /** Append the JSON text to s, growing it once up front for the whole value */
+    void write(std::string& s, unsigned int prettyIndent = 0,
+               unsigned int indentLevel = 0) const;
+
+    /**
+     * Parse a JSON document. Besides objects and arrays a single bare
+     * value (number, string, true, false or null) is accepted, as
+     * command line arguments are parsed with this too.
+     */
+    bool read(const char *raw, size_t size);
+    bool read(const char *raw) {
+        return read(raw, strlen(raw));
+    }
     bool read(const std::string& rawStr) {
-        return read(rawStr.c_str());
+        return read(rawStr.data(), rawStr.size());
     }
 
 private:
@@ -128,10 +163,17 @@ private:
     std::vector<UniValue> values;
 
     int findKey(const std::string& key) const;
+    size_t sizeHint(unsigned int prettyIndent, unsigned int indentLevel) const;
+    void writeValue(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
     void writeArray(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
     void writeObject(unsigned int prettyIndent, unsigned int indentLevel, std::string& s) const;
 };
 
+static inline std::pair<std::string,UniValue> Pair(const std::string& key, const UniValue& uVal)
+{
+    return std::make_pair(key, uVal);
+}
+
 enum jtokentype {
     JTOK_ERR        = -1,
     JTOK_NONE       = 0,                           // eof
@@ -149,7 +191,17 @@ enum jtokentype {
 };
 
 extern enum jtokentype getJsonToken(std::string& tokenVal,
-                                    unsigned int& consumed, const char *raw);
+                                    unsigned int& consumed, const char *raw, const char *end);
+static inline enum jtokentype getJsonToken(std::string& tokenVal,
+                                           unsigned int& consumed, const char *raw)
+{
+    return getJsonToken(tokenVal, consumed, raw, raw + strlen(raw));
+}
 extern const char *uvTypeName(UniValue::VType t);
 
+/** The member of obj called name, or NullUniValue when there is none */
+extern const UniValue& find_value(const UniValue& obj, const std::string& name);
+
+extern const UniValue NullUniValue;
+
 #endif // BITCOIN_UNIVALUE_UNIVALUE_H
@@ -9,6 +9,18 @@
 
 using namespace std;
 
+// The ctype functions are locale dependent and not inlined, JSON only
+// knows these few characters anyway
+static inline bool json_isdigit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+static inline bool json_isspace(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
 // convert hexadecimal string to unsigned integer
 static const char *hatoui(const char *first, const char *last,
                           unsigned int& out)
@@ -17,7 +29,7 @@ static const char *hatoui(const char *first, const char *last,
     for (; first != last; ++first)
     {
         int digit;
-        if (isdigit(*first))
+        if (json_isdigit(*first))
             digit = *first - '0';
 
         else if (*first >= 'a' && *first <= 'f')
@@ -36,22 +48,27 @@ static const char *hatoui(const char *first, const char *last,
     return first;
 }
 
+static bool matchKeyword(const char *raw, const char *end, const char *keyword, size_t len)
+{
+    return (size_t)(end - raw) >= len && !memcmp(raw, keyword, len);
+}
+
 enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
-                            const char *raw)
+                            const char *raw, const char *end)
 {
     tokenVal.clear();
     consumed = 0;
 
     const char *rawStart = raw;
 
-    while ((*raw) && (isspace(*raw)))             // skip whitespace
+    while (raw < end && json_isspace(*raw))       // skip whitespace
         raw++;
 
-    switch (*raw) {
-
-    case 0:
+    if (raw == end)
         return JTOK_NONE;
 
+    switch (*raw) {
+
     case '{':
         raw++;
         consumed = (raw - rawStart);
@@ -81,15 +98,15 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     case 'n':
     case 't':
     case 'f':
-        if (!strncmp(raw, "null", 4)) {
+        if (matchKeyword(raw, end, "null", 4)) {
             raw += 4;
             consumed = (raw - rawStart);
             return JTOK_KW_NULL;
-        } else if (!strncmp(raw, "true", 4)) {
+        } else if (matchKeyword(raw, end, "true", 4)) {
             raw += 4;
             consumed = (raw - rawStart);
             return JTOK_KW_TRUE;
-        } else if (!strncmp(raw, "false", 5)) {
+        } else if (matchKeyword(raw, end, "false", 5)) {
             raw += 5;
             consumed = (raw - rawStart);
             return JTOK_KW_FALSE;
@@ -107,60 +124,48 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     case '7':
     case '8':
     case '9': {
+        // Scan the number in place and copy it out once at the end
         // part 1: int
-        string numStr;
-
         const char *first = raw;
 
         const char *firstDigit = first;
-        if (!isdigit(*firstDigit))
+        if (!json_isdigit(*firstDigit))
             firstDigit++;
-        if ((*firstDigit == '0') && isdigit(firstDigit[1]))
+        if (firstDigit + 1 < end && (*firstDigit == '0') && json_isdigit(firstDigit[1]))
             return JTOK_ERR;
 
-        numStr += *raw;                       // copy first char
-        raw++;
+        raw++;                                // first char
 
-        if ((*first == '-') && (!isdigit(*raw)))
+        if ((*first == '-') && (raw == end || !json_isdigit(*raw)))
             return JTOK_ERR;
 
-        while ((*raw) && isdigit(*raw)) {     // copy digits
-            numStr += *raw;
+        while (raw < end && json_isdigit(*raw)) // digits
             raw++;
-        }
 
         // part 2: frac
-        if (*raw == '.') {
-            numStr += *raw;                   // copy .
-            raw++;
+        if (raw < end && *raw == '.') {
+            raw++;                            // .
 
-            if (!isdigit(*raw))
+            if (raw == end || !json_isdigit(*raw))
                 return JTOK_ERR;
-            while ((*raw) && isdigit(*raw)) { // copy digits
-                numStr += *raw;
+            while (raw < end && json_isdigit(*raw)) // digits
                 raw++;
-            }
         }
 
         // part 3: exp
-        if (*raw == 'e' || *raw == 'E') {
-            numStr += *raw;                   // copy E
-            raw++;
+        if (raw < end && (*raw == 'e' || *raw == 'E')) {
+            raw++;                            // E
 
-            if (*raw == '-' || *raw == '+') { // copy +/-
-                numStr += *raw;
+            if (raw < end && (*raw == '-' || *raw == '+')) // +/-
                 raw++;
-            }
 
-            if (!isdigit(*raw))
+            if (raw == end || !json_isdigit(*raw))
                 return JTOK_ERR;
-            while ((*raw) && isdigit(*raw)) { // copy digits
-                numStr += *raw;
+            while (raw < end && json_isdigit(*raw)) // digits
                 raw++;
-            }
         }
 
-        tokenVal = numStr;
+        tokenVal.assign(first, raw);
         consumed = (raw - rawStart);
         return JTOK_NUMBER;
         }
@@ -168,45 +173,55 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     case '"': {
         raw++;                                // skip "
 
-        string valStr;
+        // Unescaped runs are appended in one go rather than per character
+        const char *run = raw;
+        for (;;) {
+            if (raw == end)
+                return JTOK_ERR;
+
+            unsigned char ch = *raw;
+            if (ch == '"') {
+                tokenVal.append(run, raw);
+                raw++;                        // skip "
+                break;                        // stop scanning
+            }
 
-        while (*raw) {
-            if (*raw < 0x20)
+            else if (ch < 0x20)
                 return JTOK_ERR;
 
-            else if (*raw == '\\') {
+            else if (ch == '\\') {
+                tokenVal.append(run, raw);
                 raw++;                        // skip backslash
+                if (raw == end)
+                    return JTOK_ERR;
 
                 switch (*raw) {
-                case '"':  valStr += "\""; break;
-                case '\\': valStr += "\\"; break;
-                case '/':  valStr += "/"; break;
-                case 'b':  valStr += "\b"; break;
-                case 'f':  valStr += "\f"; break;
-                case 'n':  valStr += "\n"; break;
-                case 'r':  valStr += "\r"; break;
-                case 't':  valStr += "\t"; break;
+                case '"':  tokenVal += '"'; break;
+                case '\\': tokenVal += '\\'; break;
+                case '/':  tokenVal += '/'; break;
+                case 'b':  tokenVal += '\b'; break;
+                case 'f':  tokenVal += '\f'; break;
+                case 'n':  tokenVal += '\n'; break;
+                case 'r':  tokenVal += '\r'; break;
+                case 't':  tokenVal += '\t'; break;
 
                 case 'u': {
-                    char buf[4] = {0,0,0,0};
-                    char *last = &buf[0];
                     unsigned int codepoint;
-                    if (hatoui(raw + 1, raw + 1 + 4, codepoint) !=
-                               raw + 1 + 4)
+                    if (end - raw < 5 ||
+                        hatoui(raw + 1, raw + 1 + 4, codepoint) != raw + 1 + 4)
                         return JTOK_ERR;
 
                     if (codepoint <= 0x7f)
-                         *last = (char)codepoint;
+                        tokenVal += (char)codepoint;
                     else if (codepoint <= 0x7FF) {
-                        *last++ = (char)(0xC0 | (codepoint >> 6));
-                        *last = (char)(0x80 | (codepoint & 0x3F));
-                    } else if (codepoint <= 0xFFFF) {
-                        *last++ = (char)(0xE0 | (codepoint >> 12));
-                        *last++ = (char)(0x80 | ((codepoint >> 6) & 0x3F));
-                        *last = (char)(0x80 | (codepoint & 0x3F));
+                        tokenVal += (char)(0xC0 | (codepoint >> 6));
+                        tokenVal += (char)(0x80 | (codepoint & 0x3F));
+                    } else {
+                        tokenVal += (char)(0xE0 | (codepoint >> 12));
+                        tokenVal += (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                        tokenVal += (char)(0x80 | (codepoint & 0x3F));
                     }
 
-                    valStr += buf;
                     raw += 4;
                     break;
                     }
@@ -216,20 +231,13 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
                 }
 
                 raw++;                        // skip esc'd char
+                run = raw;
             }
 
-            else if (*raw == '"') {
-                raw++;                        // skip "
-                break;                        // stop scanning
-            }
-
-            else {
-                valStr += *raw;
+            else
                 raw++;
-            }
         }
 
-        tokenVal = valStr;
         consumed = (raw - rawStart);
         return JTOK_STRING;
         }
@@ -239,141 +247,133 @@ enum jtokentype getJsonToken(string& tokenVal, unsigned int& consumed,
     }
 }
 
-bool UniValue::read(const char *raw)
+// What the parser may see next
+enum expecttype {
+    EXP_VALUE,                                // document start, after ':' or after ',' in an array
+    EXP_VALUE_OR_CLOSE,                       // after '['
+    EXP_NAME,                                 // after ',' in an object
+    EXP_NAME_OR_CLOSE,                        // after '{'
+    EXP_COLON,
+    EXP_SEP_OR_CLOSE,                         // after a member or element
+    EXP_END,                                  // after the top level value
+};
+
+bool UniValue::read(const char *raw, size_t size)
 {
     clear();
 
-    bool expectName = false;
-    bool expectColon = false;
+    const char *end = raw + size;
     vector<UniValue*> stack;
+    enum expecttype expect = EXP_VALUE;
 
-    enum jtokentype tok = JTOK_NONE;
-    enum jtokentype last_tok = JTOK_NONE;
-    while (1) {
-        last_tok = tok;
-
-        string tokenVal;
+    // One buffer for all tokens; strings and numbers are swapped out of it
+    // into their place in the tree instead of being copied
+    string tokenVal;
+    for (;;) {
         unsigned int consumed;
-        tok = getJsonToken(tokenVal, consumed, raw);
-        if (tok == JTOK_NONE || tok == JTOK_ERR)
+        enum jtokentype tok = getJsonToken(tokenVal, consumed, raw, end);
+        if (tok == JTOK_NONE)
             break;
+        if (tok == JTOK_ERR)
+            return false;
         raw += consumed;
 
         switch (tok) {
 
         case JTOK_OBJ_OPEN:
         case JTOK_ARR_OPEN: {
+            if (expect != EXP_VALUE && expect != EXP_VALUE_OR_CLOSE)
+                return false;
+
             VType utyp = (tok == JTOK_OBJ_OPEN ? VOBJ : VARR);
-            if (!stack.size()) {
-                if (utyp == VOBJ)
-                    setObject();
-                else
-                    setArray();
-                stack.push_back(this);
-            } else {
-                UniValue tmpVal(utyp);
+            UniValue *newTop = this;
+            if (stack.size()) {
                 UniValue *top = stack.back();
-                top->values.push_back(tmpVal);
-
-                UniValue *newTop = &(top->values.back());
-                stack.push_back(newTop);
+                top->values.push_back(UniValue());
+                newTop = &(top->values.back());
             }
+            newTop->typ = utyp;
+            stack.push_back(newTop);
 
-            if (utyp == VOBJ)
-                expectName = true;
+            expect = (utyp == VOBJ ? EXP_NAME_OR_CLOSE : EXP_VALUE_OR_CLOSE);
             break;
             }
 
         case JTOK_OBJ_CLOSE:
         case JTOK_ARR_CLOSE: {
-            if (!stack.size() || expectColon || (last_tok == JTOK_COMMA))
-                return false;
-
             VType utyp = (tok == JTOK_OBJ_CLOSE ? VOBJ : VARR);
-            UniValue *top = stack.back();
-            if (utyp != top->getType())
+            if (!stack.size() || utyp != stack.back()->getType())
+                return false;
+            if (expect != EXP_SEP_OR_CLOSE &&
+                expect != (utyp == VOBJ ? EXP_NAME_OR_CLOSE : EXP_VALUE_OR_CLOSE))
                 return false;
 
             stack.pop_back();
-            expectName = false;
+            expect = (stack.size() ? EXP_SEP_OR_CLOSE : EXP_END);
             break;
             }
 
         case JTOK_COLON: {
-            if (!stack.size() || expectName || !expectColon)
-                return false;
-
-            UniValue *top = stack.back();
-            if (top->getType() != VOBJ)
+            if (expect != EXP_COLON)
                 return false;
 
-            expectColon = false;
+            expect = EXP_VALUE;
             break;
             }
 
         case JTOK_COMMA: {
-            if (!stack.size() || expectName || expectColon ||
-                (last_tok == JTOK_COMMA) || (last_tok == JTOK_ARR_OPEN))
+            if (expect != EXP_SEP_OR_CLOSE)
                 return false;
 
-            UniValue *top = stack.back();
-            if (top->getType() == VOBJ)
-                expectName = true;
+            expect = (stack.back()->getType() == VOBJ ? EXP_NAME : EXP_VALUE);
             break;
             }
 
+        case JTOK_STRING:
+            if (expect == EXP_NAME || expect == EXP_NAME_OR_CLOSE) {
+                UniValue *top = stack.back();
+                top->keys.push_back(string());
+                top->keys.back().swap(tokenVal);
+                expect = EXP_COLON;
+                break;
+            }
+            // fall through, a string value
         case JTOK_KW_NULL:
         case JTOK_KW_TRUE:
-        case JTOK_KW_FALSE: {
-            if (!stack.size() || expectName || expectColon)
+        case JTOK_KW_FALSE:
+        case JTOK_NUMBER: {
+            if (expect != EXP_VALUE && expect != EXP_VALUE_OR_CLOSE)
                 return false;
 
-            UniValue tmpVal;
+            UniValue *newVal = this;
+            if (stack.size()) {
+                UniValue *top = stack.back();
+                top->values.push_back(UniValue());
+                newVal = &(top->values.back());
+            }
+
             switch (tok) {
             case JTOK_KW_NULL:
                 // do nothing more
                 break;
             case JTOK_KW_TRUE:
-                tmpVal.setBool(true);
+                newVal->setBool(true);
                 break;
             case JTOK_KW_FALSE:
-                tmpVal.setBool(false);
+                newVal->setBool(false);
+                break;
+            case JTOK_NUMBER:
+                newVal->typ = VNUM;
+                newVal->val.swap(tokenVal);
+                break;
+            case JTOK_STRING:
+                newVal->typ = VSTR;
+                newVal->val.swap(tokenVal);
                 break;
             default: /* impossible */ break;
             }
 
-            UniValue *top = stack.back();
-            top->values.push_back(tmpVal);
-
-            break;
-            }
-
-        case JTOK_NUMBER: {
-            if (!stack.size() || expectName || expectColon)
-                return false;
-
-            UniValue tmpVal(VNUM, tokenVal);
-            UniValue *top = stack.back();
-            top->values.push_back(tmpVal);
-
-            break;
-            }
-
-        case JTOK_STRING: {
-            if (!stack.size())
-                return false;
-
-            UniValue *top = stack.back();
-
-            if (expectName) {
-                top->keys.push_back(tokenVal);
-                expectName = false;
-                expectColon = true;
-            } else {
-                UniValue tmpVal(VSTR, tokenVal);
-                top->values.push_back(tmpVal);
-            }
-
+            expect = (stack.size() ? EXP_SEP_OR_CLOSE : EXP_END);
             break;
             }
 
@@ -382,9 +382,6 @@ bool UniValue::read(const char *raw)
         }
     }
 
-    if (stack.size() != 0)
-        return false;
-
-    return true;
+    return expect == EXP_END;
 }
 
@@ -2,7 +2,6 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
-#include <ctype.h>
 #include <stdio.h>
 #include "univalue.h"
 #include "univalue_escapes.h"
@@ -11,53 +10,98 @@
 
 using namespace std;
 
-static string json_escape(const string& inS)
+static void json_escape(const string& inS, string& outS)
 {
-    string outS;
-    outS.reserve(inS.size() * 2);
-
-    for (unsigned int i = 0; i < inS.size(); i++) {
-        unsigned char ch = inS[i];
+    // Copy the runs between characters that need escaping in one go
+    const char *run = inS.data();
+    const char *end = run + inS.size();
+    for (const char *p = run; p != end; p++) {
+        unsigned char ch = *p;
         const char *escStr = escapes[ch];
 
+        if (!escStr && ch >= 0x20 && ch < 0x7f)
+            continue;
+
+        outS.append(run, p);
         if (escStr)
             outS += escStr;
 
-        else if (isprint(ch))
-            outS += ch;
-
         else {
             char tmpesc[16];
-            sprintf(tmpesc, "\\u%04x", ch);
+            snprintf(tmpesc, sizeof(tmpesc), "\\u%04x", ch);
             outS += tmpesc;
         }
+        run = p + 1;
     }
-
-    return outS;
+    outS.append(run, end);
 }
 
 string UniValue::write(unsigned int prettyIndent,
                        unsigned int indentLevel) const
 {
     string s;
-    s.reserve(1024);
+    write(s, prettyIndent, indentLevel);
+    return s;
+}
 
+void UniValue::write(string& s, unsigned int prettyIndent,
+                     unsigned int indentLevel) const
+{
     unsigned int modIndent = indentLevel;
     if (modIndent == 0)
         modIndent = 1;
 
+    // Grow the buffer once for the whole document instead of doubling it
+    // over and over while writing large results
+    s.reserve(s.size() + sizeHint(prettyIndent, modIndent));
+    writeValue(prettyIndent, modIndent, s);
+}
+
+// Size of the written value, short only by the extra length of escapes
+size_t UniValue::sizeHint(unsigned int prettyIndent, unsigned int indentLevel) const
+{
+    switch (typ) {
+    case VNULL:
+        return 4;
+    case VOBJ:
+    case VARR: {
+        size_t n = 2 + (prettyIndent ? 1 + prettyIndent * (indentLevel - 1) : 0);
+        for (unsigned int i = 0; i < values.size(); i++) {
+            n += values[i].sizeHint(prettyIndent, indentLevel + 1) + 1;
+            if (typ == VOBJ)
+                n += keys[i].size() + 3;
+            if (prettyIndent)
+                n += prettyIndent * indentLevel + 2;
+        }
+        return n;
+        }
+    case VSTR:
+        return val.size() + 2;
+    case VNUM:
+        return val.size();
+    case VBOOL:
+        return 5;
+    }
+
+    return 0;
+}
+
+void UniValue::writeValue(unsigned int prettyIndent, unsigned int indentLevel, string& s) const
+{
     switch (typ) {
     case VNULL:
         s += "null";
         break;
     case VOBJ:
-        writeObject(prettyIndent, modIndent, s);
+        writeObject(prettyIndent, indentLevel, s);
         break;
     case VARR:
-        writeArray(prettyIndent, modIndent, s);
+        writeArray(prettyIndent, indentLevel, s);
         break;
     case VSTR:
-        s += "\"" + json_escape(val) + "\"";
+        s += '"';
+        json_escape(val, s);
+        s += '"';
         break;
     case VNUM:
         s += val;
@@ -66,8 +110,6 @@ string UniValue::write(unsigned int prettyIndent,
         s += (val == "1" ? "true" : "false");
         break;
     }
-
-    return s;
 }
 
 static void indentStr(unsigned int prettyIndent, unsigned int indentLevel, string& s)
@@ -84,12 +126,9 @@ void UniValue::writeArray(unsigned int prettyIndent, unsigned int indentLevel, s
     for (unsigned int i = 0; i < values.size(); i++) {
         if (prettyIndent)
             indentStr(prettyIndent, indentLevel, s);
-        s += values[i].write(prettyIndent, indentLevel + 1);
-        if (i != (values.size() - 1)) {
+        values[i].writeValue(prettyIndent, indentLevel + 1, s);
+        if (i != (values.size() - 1))
             s += ",";
-            if (prettyIndent)
-                s += " ";
-        }
         if (prettyIndent)
             s += "\n";
     }
@@ -108,10 +147,12 @@ void UniValue::writeObject(unsigned int prettyIndent, unsigned int indentLevel,
     for (unsigned int i = 0; i < keys.size(); i++) {
         if (prettyIndent)
             indentStr(prettyIndent, indentLevel, s);
-        s += "\"" + json_escape(keys[i]) + "\":";
+        s += '"';
+        json_escape(keys[i], s);
+        s += "\":";
         if (prettyIndent)
             s += " ";
-        s += values[i].write(prettyIndent, indentLevel + 1);
+        values[i].writeValue(prettyIndent, indentLevel + 1, s);
         if (i != (values.size() - 1))
             s += ",";
         if (prettyIndent)
@@ -8,16 +8,20 @@
 #include "base58.h"
 #include "checkpoints.h"
 #include "coincontrol.h"
+#include "crypto/hmac_sha512.h"
+#include "init.h"
 #include "net.h"
 #include "script/script.h"
 #include "script/sign.h"
 #include "timedata.h"
+#include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
 
 #include <assert.h>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -52,6 +56,14 @@ struct CompareValueOnly
     }
 };
 
+struct CompareOutputValueDescending
+{
+    bool operator()(const COutput& t1, const COutput& t2) const
+    {
+        return t1.tx->vout[t1.i].nValue > t2.tx->vout[t2.i].nValue;
+    }
+};
+
 std::string COutput::ToString() const
 {
     return strprintf("COutput(%s, %d, %d) [%s]", tx->GetHash().ToString(), i, nDepth, FormatMoney(tx->vout[i].nValue));
@@ -66,21 +78,26 @@ const CWalletTx* CWallet::GetWalletTx(const uint256& hash) const
     return &(it->second);
 }
 
-CPubKey CWallet::GenerateNewKey()
+/** Make nKeys new keys; this needs no wallet lock, so it can run before taking cs_wallet */
+static void MakeNewKeys(std::vector<std::pair<CKey, CPubKey> >& vKeys, unsigned int nKeys, bool fCompressed)
 {
-    AssertLockHeld(cs_wallet); // mapKeyMetadata
-    bool fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
-
     RandAddSeedPerfmon();
-    CKey secret;
-    secret.MakeNewKey(fCompressed);
+    vKeys.resize(nKeys);
+    for (unsigned int i = 0; i < nKeys; i++)
+    {
+        vKeys[i].first.MakeNewKey(fCompressed);
+        vKeys[i].second = vKeys[i].first.GetPubKey();
+        assert(vKeys[i].first.VerifyPubKey(vKeys[i].second));
+    }
+}
 
-    // Compressed public keys were introduced in version 0.6.0
-    if (fCompressed)
-        SetMinVersion(FEATURE_COMPRPUBKEY);
+bool CWallet::AddNewKey(CWalletDB& walletdb, const CKey& secret, const CPubKey& pubkey)
+{
+    AssertLockHeld(cs_wallet); // mapKeyMetadata
 
-    CPubKey pubkey = secret.GetPubKey();
-    assert(secret.VerifyPubKey(pubkey));
+    // Compressed public keys were introduced in version 0.6.0
+    if (secret.IsCompressed())
+        SetMinVersion(FEATURE_COMPRPUBKEY, &walletdb);
 
     // Create new metadata
     int64_t nCreationTime = GetTime();
@@ -88,15 +105,43 @@ CPubKey CWallet::GenerateNewKey()
     if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
         nTimeFirstKey = nCreationTime;
 
-    if (!AddKeyPubKey(secret, pubkey))
+    return AddKeyPubKeyWithDB(walletdb, secret, pubkey);
+}
+
+CPubKey CWallet::GenerateNewKey()
+{
+    AssertLockHeld(cs_wallet); // mapKeyMetadata
+    bool fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
+
+    std::vector<std::pair<CKey, CPubKey> > vKeys;
+    MakeNewKeys(vKeys, 1, fCompressed);
+
+    CWalletDB walletdb(strWalletFile);
+    if (!AddNewKey(walletdb, vKeys[0].first, vKeys[0].second))
         throw std::runtime_error("CWallet::GenerateNewKey() : AddKey failed");
-    return pubkey;
+    return vKeys[0].second;
 }
 
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
+{
+    CWalletDB walletdb(strWalletFile);
+    return AddKeyPubKeyWithDB(walletdb, secret, pubkey);
+}
+
+bool CWallet::AddKeyPubKeyWithDB(CWalletDB& walletdb, const CKey& secret, const CPubKey& pubkey)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
-    if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
+
+    if (IsCrypted())
+    {
+        // Encrypted here rather than by CCryptoKeyStore::AddKeyPubKey, for the
+        // key to be written through walletdb and any transaction open on it
+        std::vector<unsigned char> vchCryptedSecret;
+        if (!EncryptKey(secret, pubkey, vchCryptedSecret) ||
+            !AddCryptedKeyWithDB(walletdb, pubkey, vchCryptedSecret))
+            return false;
+    }
+    else if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
 
     // check if we need to remove from watch-only
@@ -108,9 +153,9 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     if (!fFileBacked)
         return true;
     if (!IsCrypted()) {
-        return CWalletDB(strWalletFile).WriteKey(pubkey,
-                                                 secret.GetPrivKey(),
-                                                 mapKeyMetadata[pubkey.GetID()]);
+        return walletdb.WriteKey(pubkey,
+                                 secret.GetPrivKey(),
+                                 mapKeyMetadata[pubkey.GetID()]);
     }
     return true;
 }
@@ -118,22 +163,24 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
 bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
                             const vector<unsigned char> &vchCryptedSecret)
 {
+    LOCK(cs_wallet);
+    if (pwalletdbEncryption)
+        return AddCryptedKeyWithDB(*pwalletdbEncryption, vchPubKey, vchCryptedSecret);
+    CWalletDB walletdb(strWalletFile);
+    return AddCryptedKeyWithDB(walletdb, vchPubKey, vchCryptedSecret);
+}
+
+bool CWallet::AddCryptedKeyWithDB(CWalletDB& walletdb, const CPubKey& vchPubKey,
+                                  const vector<unsigned char>& vchCryptedSecret)
+{
+    AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
     if (!fFileBacked)
         return true;
-    {
-        LOCK(cs_wallet);
-        if (pwalletdbEncryption)
-            return pwalletdbEncryption->WriteCryptedKey(vchPubKey,
-                                                        vchCryptedSecret,
-                                                        mapKeyMetadata[vchPubKey.GetID()]);
-        else
-            return CWalletDB(strWalletFile).WriteCryptedKey(vchPubKey,
-                                                            vchCryptedSecret,
-                                                            mapKeyMetadata[vchPubKey.GetID()]);
-    }
-    return false;
+    return walletdb.WriteCryptedKey(vchPubKey,
+                                    vchCryptedSecret,
+                                    mapKeyMetadata[vchPubKey.GetID()]);
 }
 
 bool CWallet::LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &meta)
@@ -206,6 +253,88 @@ bool CWallet::LoadWatchOnly(const CScript &dest)
     return CCryptoKeyStore::AddWatchOnly(dest);
 }
 
+static void UnlockCacheHMAC(const CKeyingMaterial& vSecret, const SecureString& strWalletPassphrase, CKeyingMaterial& vHMAC)
+{
+    vHMAC.resize(CHMAC_SHA512::OUTPUT_SIZE);
+    CHMAC_SHA512(&vSecret[0], vSecret.size()).Write((const unsigned char*)strWalletPassphrase.data(), strWalletPassphrase.size()).Finalize(&vHMAC[0]);
+}
+
+void CWallet::CacheUnlock(const SecureString& strWalletPassphrase, const CKeyingMaterial& vMasterKeyIn)
+{
+    AssertLockHeld(cs_wallet);
+    int64_t nCacheTime = GetArg("-unlockcachetime", DEFAULT_UNLOCK_CACHE_TIME);
+    if (nCacheTime <= 0)
+        return;
+    vUnlockCacheSecret.resize(32);
+    GetRandBytes(&vUnlockCacheSecret[0], vUnlockCacheSecret.size());
+    UnlockCacheHMAC(vUnlockCacheSecret, strWalletPassphrase, vUnlockCacheHMAC);
+    vUnlockCacheMasterKey = vMasterKeyIn;
+    nUnlockCacheExpires = GetTime() + nCacheTime;
+    {
+        boost::unique_lock<boost::mutex> lock(mutexUnlockCacheExpiry);
+        nUnlockCacheExpiryDue = nUnlockCacheExpires;
+    }
+    condUnlockCacheExpiry.notify_one();
+}
+
+bool CWallet::GetCachedUnlock(const SecureString& strWalletPassphrase, CKeyingMaterial& vMasterKeyOut)
+{
+    AssertLockHeld(cs_wallet);
+    ExpireUnlockCache();
+    if (vUnlockCacheMasterKey.empty())
+        return false;
+    CKeyingMaterial vHMAC;
+    UnlockCacheHMAC(vUnlockCacheSecret, strWalletPassphrase, vHMAC);
+    if (vHMAC != vUnlockCacheHMAC)
+        return false;
+    vMasterKeyOut = vUnlockCacheMasterKey;
+    return true;
+}
+
+void CWallet::ClearUnlockCache()
+{
+    AssertLockHeld(cs_wallet);
+    // Swapped out rather than cleared, for the allocator to wipe them
+    CKeyingMaterial().swap(vUnlockCacheSecret);
+    CKeyingMaterial().swap(vUnlockCacheHMAC);
+    CKeyingMaterial().swap(vUnlockCacheMasterKey);
+    nUnlockCacheExpires = 0;
+}
+
+int64_t CWallet::GetUnlockCacheExpiry()
+{
+    LOCK(cs_wallet);
+    return nUnlockCacheExpires;
+}
+
+void CWallet::ExpireUnlockCache()
+{
+    LOCK(cs_wallet);
+    if (nUnlockCacheExpires && GetTime() >= nUnlockCacheExpires)
+        ClearUnlockCache();
+}
+
+void CWallet::ThreadUnlockCacheExpiry()
+{
+    RenameThread("joulecoin-unlockcache");
+    while (true)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutexUnlockCacheExpiry);
+            while (!nUnlockCacheExpiryDue || GetTime() < nUnlockCacheExpiryDue)
+            {
+                if (nUnlockCacheExpiryDue)
+                    condUnlockCacheExpiry.timed_wait(lock, boost::posix_time::seconds(std::max((int64_t)1, nUnlockCacheExpiryDue - GetTime())));
+                else
+                    condUnlockCacheExpiry.wait(lock);
+            }
+            nUnlockCacheExpiryDue = 0;
+        }
+        // Leaves the cache alone if an unlock since has put off its expiry
+        ExpireUnlockCache();
+    }
+}
+
 bool CWallet::Unlock(const SecureString& strWalletPassphrase)
 {
     CCrypter crypter;
@@ -213,6 +342,10 @@ bool CWallet::Unlock(const SecureString& strWalletPassphrase)
 
     {
         LOCK(cs_wallet);
+        // Still verified by CCryptoKeyStore::Unlock, just not derived again
+        if (GetCachedUnlock(strWalletPassphrase, vMasterKey) && CCryptoKeyStore::Unlock(vMasterKey))
+            return true;
+
         BOOST_FOREACH(const MasterKeyMap::value_type& pMasterKey, mapMasterKeys)
         {
             if(!crypter.SetKeyFromPassphrase(strWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod))
@@ -220,7 +353,10 @@ bool CWallet::Unlock(const SecureString& strWalletPassphrase)
             if (!crypter.Decrypt(pMasterKey.second.vchCryptedKey, vMasterKey))
                 continue; // try another master key
             if (CCryptoKeyStore::Unlock(vMasterKey))
+            {
+                CacheUnlock(strWalletPassphrase, vMasterKey);
                 return true;
+            }
         }
     }
     return false;
@@ -233,6 +369,8 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
     {
         LOCK(cs_wallet);
         Lock();
+        // The old passphrase must not unlock from the cache either
+        ClearUnlockCache();
 
         CCrypter crypter;
         CKeyingMaterial vMasterKey;
@@ -396,6 +534,55 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const
     return false;
 }
 
+bool CWallet::IsSpentInMainChain(const uint256& hash, unsigned int n) const
+{
+    const COutPoint outpoint(hash, n);
+    pair<TxSpends::const_iterator, TxSpends::const_iterator> range;
+    range = mapTxSpends.equal_range(outpoint);
+
+    for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
+    {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.IsInMainChain())
+            return true;
+    }
+    return false;
+}
+
+bool CWallet::HasUnspentOutputs(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_main);
+    uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+        if (IsMine(wtx.vout[i]) != ISMINE_NO && !IsSpentInMainChain(hash, i))
+            return true;
+    return false;
+}
+
+void CWallet::IndexUnspentTx() const
+{
+    AssertLockHeld(cs_wallet);
+    if (fUnspentTxIndexed)
+        return;
+    setUnspentTx.clear();
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        if (HasUnspentOutputs(it->second))
+            setUnspentTx.insert(it->first);
+    fUnspentTxIndexed = true;
+}
+
+void CWallet::UpdateUnspentTx(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    if (!fUnspentTxIndexed)
+        return;
+    std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+    if (it != mapWallet.end() && HasUnspentOutputs(it->second))
+        setUnspentTx.insert(hash);
+    else
+        setUnspentTx.erase(hash);
+}
+
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
@@ -522,29 +709,93 @@ int64_t CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
     return nRet;
 }
 
-CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount)
+void CWallet::ReindexOrderedTxItems(CWalletDB& walletdb)
 {
     AssertLockHeld(cs_wallet); // mapWallet
-    CWalletDB walletdb(strWalletFile);
-
-    // First: get all CWalletTx and CAccountingEntry into a sorted-by-order multimap.
-    TxItems txOrdered;
 
-    // Note: maintaining indices in the database of (account,time) --> txid and (account, time) --> acentry
-    // would make this much faster for applications that do this a lot.
+    wtxOrdered.clear();
     for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
     {
         CWalletTx* wtx = &((*it).second);
-        txOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+        wtxOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+    }
+    laccentries.clear();
+    walletdb.ListAccountCreditDebit("*", laccentries);
+    BOOST_FOREACH(CAccountingEntry& entry, laccentries)
+    {
+        wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+    }
+}
+
+void CWallet::LoadAccountingEntry(const CAccountingEntry& acentry)
+{
+    AssertLockHeld(cs_wallet); // wtxOrdered
+    laccentries.push_back(acentry);
+    CAccountingEntry& entry = laccentries.back();
+    wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+}
+
+void CWallet::IndexTxBlock(const CWalletTx& wtx, const uint256& hashBlockPrev)
+{
+    AssertLockHeld(cs_wallet); // mapTxByBlock
+    uint256 hash = wtx.GetHash();
+    mapTxByBlock[0].erase(hash);
+    if (hashBlockPrev != 0)
+    {
+        std::map<uint256, std::set<uint256> >::iterator it = mapTxByBlock.find(hashBlockPrev);
+        if (it != mapTxByBlock.end())
+        {
+            it->second.erase(hash);
+            if (it->second.empty())
+                mapTxByBlock.erase(it);
+        }
+    }
+
+    uint256 hashBlock = 0;
+    if (wtx.hashBlock != 0)
+    {
+        AssertLockHeld(cs_main); // chainActive
+        BlockMap::iterator mi = mapBlockIndex.find(wtx.hashBlock);
+        if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second))
+            hashBlock = wtx.hashBlock;
+    }
+    mapTxByBlock[hashBlock].insert(hash);
+}
+
+void CWallet::GetTransactionsSince(int nHeight, std::set<uint256>& setTxHash) const
+{
+    AssertLockHeld(cs_main); // chainActive
+    AssertLockHeld(cs_wallet); // mapTxByBlock
+
+    std::map<uint256, std::set<uint256> >::const_iterator it = mapTxByBlock.find(0);
+    if (it != mapTxByBlock.end())
+        setTxHash.insert(it->second.begin(), it->second.end());
+    for (int i = std::max(0, nHeight + 1); i <= chainActive.Height(); i++)
+    {
+        it = mapTxByBlock.find(chainActive[i]->GetBlockHash());
+        if (it != mapTxByBlock.end())
+            setTxHash.insert(it->second.begin(), it->second.end());
     }
-    acentries.clear();
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
-    BOOST_FOREACH(CAccountingEntry& entry, acentries)
+}
+
+void CWallet::IndexTxDestinations(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet); // mapTxByDestination
+    uint256 hash = wtx.GetHash();
+    BOOST_FOREACH(const CTxOut& txout, wtx.vout)
     {
-        txOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+        CTxDestination address;
+        if (ExtractDestination(txout.scriptPubKey, address))
+            mapTxByDestination[address].insert(hash);
     }
+}
 
-    return txOrdered;
+void CWallet::GetTransactionsTo(const CTxDestination& dest, std::set<uint256>& setTxHash) const
+{
+    AssertLockHeld(cs_wallet); // mapTxByDestination
+    std::map<CTxDestination, std::set<uint256> >::const_iterator it = mapTxByDestination.find(dest);
+    if (it != mapTxByDestination.end())
+        setTxHash.insert(it->second.begin(), it->second.end());
 }
 
 void CWallet::MarkDirty()
@@ -553,6 +804,9 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        // Outputs may have become ours
+        fUnspentTxIndexed = false;
+        fGroupingsIndexed = false;
     }
 }
 
@@ -565,6 +819,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         mapWallet[hash] = wtxIn;
         mapWallet[hash].BindWallet(this);
         AddToSpends(hash);
+        IndexTxDestinations(mapWallet[hash]);
     }
     else
     {
@@ -589,9 +844,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
                     {
                         // Tolerate times up to the last timestamp in the wallet not more than 5 minutes into the future
                         int64_t latestTolerated = latestNow + 300;
-                        std::list<CAccountingEntry> acentries;
-                        TxItems txOrdered = OrderedTxItems(acentries);
-                        for (TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+                        for (TxItems::reverse_iterator it = wtxOrdered.rbegin(); it != wtxOrdered.rend(); ++it)
                         {
                             CWalletTx *const pwtx = (*it).second.first;
                             if (pwtx == &wtx)
@@ -624,10 +877,28 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
                              wtxIn.GetHash().ToString(),
                              wtxIn.hashBlock.ToString());
             }
+            wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
             AddToSpends(hash);
+            IndexTxDestinations(wtx);
+            if (fGroupingsIndexed)
+            {
+                IndexGroupings(wtx);
+                // Transactions spending it that came first only now have inputs of ours
+                for (unsigned int i = 0; i < wtx.vout.size(); i++)
+                {
+                    std::pair<TxSpends::iterator, TxSpends::iterator> range = mapTxSpends.equal_range(COutPoint(hash, i));
+                    for (TxSpends::iterator it = range.first; it != range.second; ++it)
+                    {
+                        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(it->second);
+                        if (mi != mapWallet.end())
+                            IndexGroupings(mi->second);
+                    }
+                }
+            }
         }
 
         bool fUpdated = false;
+        uint256 hashBlockPrev = wtx.hashBlock;
         if (!fInsertedNew)
         {
             // Merge
@@ -660,6 +931,19 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         // Break debit/credit balance caches:
         wtx.MarkDirty();
 
+        // Also when nothing changed: syncing it as its block is disconnected
+        // is how the index learns the block left the main chain
+        IndexTxBlock(wtx, hashBlockPrev);
+
+        // The transaction may hold coins now, and may have spent those of the
+        // transactions it spends or, when it left the main chain, released them
+        UpdateUnspentTx(hash);
+        if (!wtx.IsCoinBase())
+        {
+            BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+                UpdateUnspentTx(txin.prevout.hash);
+        }
+
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
 
@@ -715,14 +999,50 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     }
 }
 
+void CWallet::SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock)
+{
+    LOCK2(cs_main, cs_wallet);
+    // Whatever the block changes in the wallet is written in one go
+    CDBBatch batch(strWalletFile);
+    BOOST_FOREACH(const CTransaction& tx, vtx)
+        SyncTransaction(tx, pblock);
+}
+
 void CWallet::EraseFromWallet(const uint256 &hash)
 {
     if (!fFileBacked)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
-            CWalletDB(strWalletFile).EraseTx(hash);
+        std::map<uint256, CWalletTx>::iterator it = mapWallet.find(hash);
+        if (it == mapWallet.end())
+            return;
+        std::vector<CTxIn> vin = it->second.vin;
+        std::pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(it->second.nOrderPos);
+        for (TxItems::iterator mi = range.first; mi != range.second; ++mi)
+        {
+            if (mi->second.first == &it->second)
+            {
+                wtxOrdered.erase(mi);
+                break;
+            }
+        }
+        mapTxByBlock[0].erase(hash);
+        if (mapTxByBlock.count(it->second.hashBlock))
+            mapTxByBlock[it->second.hashBlock].erase(hash);
+        BOOST_FOREACH(const CTxOut& txout, it->second.vout)
+        {
+            CTxDestination address;
+            if (ExtractDestination(txout.scriptPubKey, address) && mapTxByDestination.count(address))
+                mapTxByDestination[address].erase(hash);
+        }
+        fGroupingsIndexed = false;
+        mapWallet.erase(it);
+        CWalletDB(strWalletFile).EraseTx(hash);
+
+        UpdateUnspentTx(hash);
+        BOOST_FOREACH(const CTxIn& txin, vin)
+            UpdateUnspentTx(txin.prevout.hash);
     }
     return;
 }
@@ -922,10 +1242,119 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+namespace {
+
+/** A block read for a rescan, and which of its transactions pay a script that could be ours */
+struct CRescanBlock
+{
+    CBlock block;
+    std::vector<bool> vfRelevant;
+    bool fReady;
+
+    CRescanBlock() : fReady(false) {}
+};
+
+/**
+ * Reads and filters the blocks of a rescan on worker threads, up to
+ * RESCAN_READ_AHEAD blocks ahead of the wallet taking them in order.
+ */
+class CRescanReader
+{
+private:
+    const std::vector<CBlockIndex*>& vIndex;
+    const CKeyStoreFilter& filter;
+    std::vector<CRescanBlock> vSlots;
+    boost::mutex mutex;
+    boost::condition_variable condReady;
+    boost::condition_variable condFree;
+    //! Next block to read, next to hand out, and the number whose slots are free again
+    unsigned int nNextRead;
+    unsigned int nNextTake;
+    unsigned int nReleased;
+    bool fStop;
+    boost::thread_group threadGroup;
+
+    void ThreadRead()
+    {
+        RenameThread("joulecoin-rescan");
+        while (true)
+        {
+            unsigned int nRead;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nNextRead < vIndex.size() && nNextRead >= nReleased + vSlots.size())
+                    condFree.wait(lock);
+                if (fStop || nNextRead >= vIndex.size())
+                    return;
+                nRead = nNextRead++;
+            }
+
+            // The slot is ours until marked ready
+            CRescanBlock& slot = vSlots[nRead % vSlots.size()];
+            slot.block.SetNull();
+            ReadBlockFromDisk(slot.block, vIndex[nRead]);
+            slot.vfRelevant.assign(slot.block.vtx.size(), false);
+            for (unsigned int i = 0; i < slot.block.vtx.size(); i++)
+                BOOST_FOREACH(const CTxOut& txout, slot.block.vtx[i].vout)
+                    if (filter.IsRelevant(txout.scriptPubKey))
+                    {
+                        slot.vfRelevant[i] = true;
+                        break;
+                    }
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                slot.fReady = true;
+            }
+            condReady.notify_all();
+        }
+    }
+
+public:
+    CRescanReader(const std::vector<CBlockIndex*>& vIndexIn, const CKeyStoreFilter& filterIn, int nThreads) :
+        vIndex(vIndexIn), filter(filterIn), vSlots(RESCAN_READ_AHEAD), nNextRead(0), nNextTake(0), nReleased(0), fStop(false)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CRescanReader::ThreadRead, this));
+    }
+
+    ~CRescanReader()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condFree.notify_all();
+        threadGroup.join_all();
+    }
+
+    //! Wait for the next block in chain order, valid until the following call
+    const CRescanBlock& Next()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nNextTake > nReleased)
+        {
+            vSlots[nReleased % vSlots.size()].fReady = false;
+            nReleased = nNextTake;
+            condFree.notify_all();
+        }
+        CRescanBlock& slot = vSlots[nNextTake % vSlots.size()];
+        while (!slot.fReady)
+            condReady.wait(lock);
+        nNextTake++;
+        return slot;
+    }
+};
+
+} // anon namespace
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
- * exist in the wallet will be updated.
+ * exist in the wallet will be updated. Blocks are read and filtered
+ * ahead on -par threads, so IsMine only sees transactions paying a
+ * script that could be ours, or spending or being a wallet transaction.
+ * Stops early on AbortRescan or shutdown.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
@@ -935,38 +1364,81 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     CBlockIndex* pindex = pindexStart;
     {
         LOCK2(cs_main, cs_wallet);
+        {
+            LOCK(cs_rescan);
+            fAbortRescan = false;
+            fScanningWallet = true;
+        }
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
+        std::vector<CBlockIndex*> vIndex;
+        for (; pindex; pindex = chainActive.Next(pindex))
+            vIndex.push_back(pindex);
+
+        // A copy the readers can use without cs_KeyStore
+        CKeyStoreFilter filter = GetFilter();
+
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
+        double dProgressStart = vIndex.empty() ? 0.0 : Checkpoints::GuessVerificationProgress(vIndex.front(), false);
         double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
-        while (pindex)
+        CRescanReader reader(vIndex, filter, std::max(1, nScriptCheckThreads));
+        for (unsigned int i = 0; i < vIndex.size(); i++)
         {
+            pindex = vIndex[i];
+            if (IsAbortingRescan() || ShutdownRequested())
+            {
+                LogPrintf("Rescan aborted at block %d\n", pindex->nHeight);
+                LOCK(cs_rescan);
+                fAbortRescan = true;
+                break;
+            }
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            const CRescanBlock& scan = reader.Next();
+            CDBBatch batch(strWalletFile);
+            for (unsigned int j = 0; j < scan.block.vtx.size(); j++)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+                const CTransaction& tx = scan.block.vtx[j];
+                bool fRelevant = scan.vfRelevant[j] || mapWallet.count(tx.GetHash());
+                for (unsigned int k = 0; k < tx.vin.size() && !fRelevant; k++)
+                    fRelevant = mapWallet.count(tx.vin[k].prevout.hash);
+                if (fRelevant && AddToWalletIfInvolvingMe(tx, &scan.block, fUpdate))
                     ret++;
             }
-            pindex = chainActive.Next(pindex);
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
             }
         }
+        {
+            LOCK(cs_rescan);
+            fScanningWallet = false;
+        }
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
     return ret;
 }
 
+bool CWallet::AbortRescan()
+{
+    LOCK(cs_rescan);
+    if (!fScanningWallet)
+        return false;
+    fAbortRescan = true;
+    return true;
+}
+
+bool CWallet::IsAbortingRescan() const
+{
+    LOCK(cs_rescan);
+    return fAbortRescan;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     LOCK2(cs_main, cs_wallet);
@@ -1064,9 +1536,10 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        IndexUnspentTx();
+        BOOST_FOREACH(const uint256& hash, setUnspentTx)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1080,9 +1553,10 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        IndexUnspentTx();
+        BOOST_FOREACH(const uint256& hash, setUnspentTx)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1095,9 +1569,10 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        IndexUnspentTx();
+        BOOST_FOREACH(const uint256& hash, setUnspentTx)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -1109,9 +1584,10 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        IndexUnspentTx();
+        BOOST_FOREACH(const uint256& hash, setUnspentTx)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1125,9 +1601,10 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        IndexUnspentTx();
+        BOOST_FOREACH(const uint256& hash, setUnspentTx)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1140,9 +1617,10 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        IndexUnspentTx();
+        BOOST_FOREACH(const uint256& hash, setUnspentTx)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(hash)->second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -1158,10 +1636,10 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        IndexUnspentTx();
+        BOOST_FOREACH(const uint256& wtxid, setUnspentTx)
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const CWalletTx* pcoin = &mapWallet.find(wtxid)->second;
 
             if (!IsFinalTx(*pcoin))
                 continue;
@@ -1179,24 +1657,22 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                 isminetype mine = IsMine(pcoin->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && pcoin->vout[i].nValue > 0 &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
+                    !IsLockedCoin(wtxid, i) && pcoin->vout[i].nValue > 0 &&
+                    (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected(wtxid, i)))
                         vCoins.push_back(COutput(pcoin, i, nDepth, (mine & ISMINE_SPENDABLE) != ISMINE_NO));
             }
         }
     }
 }
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
-                                  vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
+static void ApproximateBestSubset(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+                                  vector<char>& vfBest, CAmount& nBest, FastRandomContext& rng, int iterations = 1000)
 {
     vector<char> vfIncluded;
 
     vfBest.assign(vValue.size(), true);
     nBest = nTotalLower;
 
-    seed_insecure_rand();
-
     for (int nRep = 0; nRep < iterations && nBest != nTargetValue; nRep++)
     {
         vfIncluded.assign(vValue.size(), false);
@@ -1212,7 +1688,7 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
                 //that the rng is fast. We do not use a constant random sequence,
                 //because there may be some privacy improvement by making
                 //the selection random.
-                if (nPass == 0 ? insecure_rand()&1 : !vfIncluded[i])
+                if (nPass == 0 ? rng.rand32()&1 : !vfIncluded[i])
                 {
                     nTotal += vValue[i].first;
                     vfIncluded[i] = true;
@@ -1233,8 +1709,100 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
     }
 }
 
-bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
-                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+/**
+ * Depth-first search for the subset of vValue, sorted by decreasing value,
+ * with the smallest total of at least nTargetValue. Branches that can no
+ * longer reach the target or beat the best total found so far are cut, as
+ * are branches that only swap a coin for another of the same value. Gives
+ * up after nMaxTries steps; returns whether the search ran to the end, in
+ * which case nBest can't be improved on.
+ */
+static bool BranchAndBoundSubset(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+                                 vector<char>& vfBest, CAmount& nBest, int nMaxTries)
+{
+    const unsigned int nCoins = vValue.size();
+    vfBest.assign(nCoins, true);
+    nBest = nTotalLower;
+    if (nCoins == 0)
+        return true;
+
+    // vRemaining[i] is the total of the coins from i onwards
+    vector<CAmount> vRemaining(nCoins + 1, 0);
+    for (unsigned int i = nCoins; i > 0; i--)
+        vRemaining[i - 1] = vRemaining[i] + vValue[i - 1].first;
+    const CAmount nSmallest = vValue[nCoins - 1].first;
+
+    vector<char> vfIncluded(nCoins, false);
+    vector<unsigned int> vIncluded;
+    CAmount nTotal = 0;
+    unsigned int i = 0;
+    for (int nTries = 0; nBest != nTargetValue; nTries++)
+    {
+        bool fBacktrack;
+        if (nTotal >= nTargetValue)
+        {
+            // Adding more coins only makes it worse
+            if (nTotal < nBest)
+            {
+                nBest = nTotal;
+                vfBest = vfIncluded;
+            }
+            fBacktrack = true;
+        }
+        else
+            fBacktrack = nTotal + vRemaining[i] < nTargetValue || nTotal + nSmallest >= nBest;
+
+        if (fBacktrack)
+        {
+            if (vIncluded.empty())
+                return true;
+            // Leave out the most recently included coin and everything of
+            // the same value after it, those subsets were just tried
+            unsigned int j = vIncluded.back();
+            vIncluded.pop_back();
+            vfIncluded[j] = false;
+            nTotal -= vValue[j].first;
+            for (i = j + 1; i < nCoins && vValue[i].first == vValue[j].first; i++);
+        }
+        else
+        {
+            vfIncluded[i] = true;
+            vIncluded.push_back(i);
+            nTotal += vValue[i].first;
+            i++;
+        }
+
+        if (nTries >= nMaxTries)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Find a subset of vValue, sorted by decreasing value, adding up to as
+ * little as possible over nTargetValue. Tries an exhaustive search first;
+ * if that runs out of steps without an exact match, the stochastic
+ * approximation gets a go too, with fewer rounds the more coins there are.
+ */
+static void SelectBestSubset(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTotalLower, const CAmount& nTargetValue,
+                             vector<char>& vfBest, CAmount& nBest, FastRandomContext& rng)
+{
+    if (BranchAndBoundSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, SELECT_COINS_MAX_TRIES) || nBest == nTargetValue)
+        return;
+
+    int nIterations = std::max(10, std::min(1000, (int)(SELECT_COINS_MAX_STEPS / vValue.size())));
+    vector<char> vfApprox;
+    CAmount nApprox;
+    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfApprox, nApprox, rng, nIterations);
+    if (nApprox < nBest)
+    {
+        nBest = nApprox;
+        vfBest.swap(vfApprox);
+    }
+}
+
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins,
+                                 set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool fSorted) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
@@ -1243,10 +1811,15 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     pair<CAmount, pair<const CWalletTx*,unsigned int> > coinLowestLarger;
     coinLowestLarger.first = std::numeric_limits<CAmount>::max();
     coinLowestLarger.second.first = NULL;
+    pair<CAmount, pair<const CWalletTx*,unsigned int> > coinExact;
+    coinExact.second.first = NULL;
     vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
     CAmount nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
+    // Which of several equally good coins gets spent is left to chance, the
+    // order they come in says nothing about them
+    FastRandomContext rng;
+    unsigned int nExactTies = 0, nLargerTies = 0;
 
     BOOST_FOREACH(const COutput &output, vCoins)
     {
@@ -1265,9 +1838,8 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
 
         if (n == nTargetValue)
         {
-            setCoinsRet.insert(coin.second);
-            nValueRet += coin.first;
-            return true;
+            if (rng.rand32() % ++nExactTies == 0)
+                coinExact = coin;
         }
         else if (n < nTargetValue + CENT)
         {
@@ -1275,11 +1847,23 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
             nTotalLower += n;
         }
         else if (n < coinLowestLarger.first)
+        {
+            coinLowestLarger = coin;
+            nLargerTies = 1;
+        }
+        else if (n == coinLowestLarger.first && rng.rand32() % ++nLargerTies == 0)
         {
             coinLowestLarger = coin;
         }
     }
 
+    if (coinExact.second.first)
+    {
+        setCoinsRet.insert(coinExact.second);
+        nValueRet += coinExact.first;
+        return true;
+    }
+
     if (nTotalLower == nTargetValue)
     {
         for (unsigned int i = 0; i < vValue.size(); ++i)
@@ -1299,16 +1883,21 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
-    sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+    // Solve subset sum, shuffling first so coins of the same value end up
+    // in random order. Picked from sorted coins, vValue is sorted already.
+    if (!fSorted)
+    {
+        random_shuffle(vValue.begin(), vValue.end(), rng);
+        stable_sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+    }
     vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
+    SelectBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, rng);
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+        SelectBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, rng);
 
-    // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
+    // If we have a bigger coin and (either the subset search didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
     if (coinLowestLarger.second.first &&
         ((nBest != nTargetValue && nBest < nTargetValue + CENT) || coinLowestLarger.first <= nBest))
@@ -1352,9 +1941,14 @@ bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*
         return (nValueRet >= nTargetValue);
     }
 
-    return (SelectCoinsMinConf(nTargetValue, 1, 6, vCoins, setCoinsRet, nValueRet) ||
-            SelectCoinsMinConf(nTargetValue, 1, 1, vCoins, setCoinsRet, nValueRet) ||
-            (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue, 0, 1, vCoins, setCoinsRet, nValueRet)));
+    // Shuffle and sort the candidates once for all passes
+    FastRandomContext rng;
+    random_shuffle(vCoins.begin(), vCoins.end(), rng);
+    stable_sort(vCoins.begin(), vCoins.end(), CompareOutputValueDescending());
+
+    return (SelectCoinsMinConf(nTargetValue, 1, 6, vCoins, setCoinsRet, nValueRet, true) ||
+            SelectCoinsMinConf(nTargetValue, 1, 1, vCoins, setCoinsRet, nValueRet, true) ||
+            (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue, 0, 1, vCoins, setCoinsRet, nValueRet, true)));
 }
 
 
@@ -1573,10 +2167,9 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
         LOCK2(cs_main, cs_wallet);
         LogPrintf("CommitTransaction:\n%s", wtxNew.ToString());
         {
-            // This is only to keep the database open to defeat the auto-flush for the
-            // duration of this scope.  This is the only place where this optimization
-            // maybe makes sense; please don't do it anywhere else.
-            CWalletDB* pwalletdb = fFileBacked ? new CWalletDB(strWalletFile,"r") : NULL;
+            // Write the spent key, the transaction and its order position in
+            // one go; this also keeps the auto-flush off for the duration
+            CDBBatch batch(strWalletFile);
 
             // Take key pair from key pool so it won't be used again
             reservekey.KeepKey();
@@ -1593,9 +2186,6 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
                 coin.BindWallet(this);
                 NotifyTransactionChanged(this, coin.GetHash(), CT_UPDATED);
             }
-
-            if (fFileBacked)
-                delete pwalletdb;
         }
 
         // Track how many getdata requests our transaction gets
@@ -1639,6 +2229,60 @@ CAmount CWallet::GetMinimumFee(unsigned int nTxBytes, unsigned int nConfirmTarge
 
 
 
+void CWallet::CheckDeferredKeys()
+{
+    RenameThread("joulecoin-keycheck");
+    std::vector<CPubKey> vPubKeys;
+    {
+        LOCK(cs_wallet);
+        vPubKeys.swap(vDeferredKeyChecks);
+    }
+
+    int64_t nStart = GetTimeMillis();
+    std::set<CKeyID> setBad;
+    BOOST_FOREACH(const CPubKey& pubkey, vPubKeys)
+    {
+        boost::this_thread::interruption_point();
+        CKey key;
+        // Keys encrypted since can't be read while the wallet is locked; its
+        // first unlock checks them all, and doesn't unlock if one is bad
+        if (GetKey(pubkey.GetID(), key) && !key.VerifyPubKey(pubkey))
+        {
+            LogPrintf("%s: Private key for %s does not match its public key\n", __func__, CBitcoinAddress(pubkey.GetID()).ToString());
+            setBad.insert(pubkey.GetID());
+            continue;
+        }
+        LOCK(cs_wallet);
+        setUncheckedKeys.erase(pubkey.GetID());
+    }
+    LogPrintf("Checked %u wallet keys in the background, %u bad  %dms\n", vPubKeys.size(), setBad.size(), GetTimeMillis() - nStart);
+
+    if (!setBad.empty())
+    {
+        // Bad keys stay out of the key pool for good, so no address of theirs is handed out
+        {
+            LOCK(cs_wallet);
+            CWalletDB walletdb(strWalletFile);
+            std::set<int64_t>::iterator it = setKeyPool.begin();
+            while (it != setKeyPool.end())
+            {
+                CKeyPool keypool;
+                if (walletdb.ReadPool(*it, keypool) && setBad.count(keypool.vchPubKey.GetID()))
+                {
+                    LogPrintf("keypool drop %d\n", *it);
+                    walletdb.ErasePool(*it);
+                    setKeyPool.erase(it++);
+                }
+                else
+                    ++it;
+            }
+        }
+
+        strMiscWarning = _("Warning: some private keys in wallet.dat do not match their public keys! The wallet is corrupt, restore it from a backup.");
+        uiInterface.ThreadSafeMessageBox(strMiscWarning, "", CClientUIInterface::MSG_ERROR);
+    }
+}
+
 DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
 {
     if (!fFileBacked)
@@ -1657,6 +2301,16 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         }
     }
 
+    if (nLoadWalletRet == DB_LOAD_OK || nLoadWalletRet == DB_NONCRITICAL_ERROR)
+    {
+        LOCK2(cs_main, cs_wallet);
+        CWalletDB walletdb(strWalletFile);
+        ReindexOrderedTxItems(walletdb);
+        mapTxByBlock.clear();
+        for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            IndexTxBlock(it->second, 0);
+    }
+
     if (nLoadWalletRet != DB_LOAD_OK)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
@@ -1698,6 +2352,9 @@ bool CWallet::SetAddressBook(const CTxDestination& address, const string& strNam
         LOCK(cs_wallet); // mapAddressBook
         std::map<CTxDestination, CAddressBookData>::iterator mi = mapAddressBook.find(address);
         fUpdated = mi != mapAddressBook.end();
+        // An address in the book is no longer taken for change
+        if (!fUpdated && mapGroupingParent.count(address))
+            fGroupingsIndexed = false;
         mapAddressBook[address].name = strName;
         if (!strPurpose.empty()) /* update purpose only if requested */
             mapAddressBook[address].purpose = strPurpose;
@@ -1726,6 +2383,9 @@ bool CWallet::DelAddressBook(const CTxDestination& address)
             }
         }
         mapAddressBook.erase(address);
+        // Which may make it change again
+        if (mapGroupingParent.count(address))
+            fGroupingsIndexed = false;
     }
 
     NotifyAddressBookChanged(this, address, "", ::IsMine(*this, address) != ISMINE_NO, "", CT_DELETED);
@@ -1763,69 +2423,195 @@ bool CWallet::NewKeyPool()
         if (IsLocked())
             return false;
 
-        int64_t nKeys = max(GetArg("-keypool", 100), (int64_t)0);
-        for (int i = 0; i < nKeys; i++)
-        {
-            int64_t nIndex = i+1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
-            setKeyPool.insert(nIndex);
-        }
+        unsigned int nKeys = max(GetArg("-keypool", 100), (int64_t)0);
+        if (!FillKeyPool(nKeys))
+            return false;
         LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
     }
     return true;
 }
 
-bool CWallet::TopUpKeyPool(unsigned int kpSize)
+/**
+ * Write the keys and their key pool entries in one database transaction;
+ * they only join setKeyPool once that has committed.
+ */
+bool CWallet::AddToKeyPool(const std::vector<std::pair<CKey, CPubKey> >& vKeys)
 {
-    {
-        LOCK(cs_wallet);
+    AssertLockHeld(cs_wallet);
+    if (vKeys.empty())
+        return true;
 
-        if (IsLocked())
+    CWalletDB walletdb(strWalletFile);
+    if (fFileBacked && !walletdb.TxnBegin())
+        return false;
+
+    int64_t nEnd = 1;
+    if (!setKeyPool.empty())
+        nEnd = *(--setKeyPool.end()) + 1;
+    for (unsigned int i = 0; i < vKeys.size(); i++)
+    {
+        if (!AddNewKey(walletdb, vKeys[i].first, vKeys[i].second) ||
+            (fFileBacked && !walletdb.WritePool(nEnd + i, CKeyPool(vKeys[i].second))))
+        {
+            // The keys added so far stay in the key store, which has no way to
+            // remove them, but aren't in setKeyPool: they are fresh, so no
+            // address of theirs has been handed out nor anything paid to them,
+            // and as they aren't on disk they are gone on the next start
+            if (fFileBacked)
+                walletdb.TxnAbort();
             return false;
+        }
+    }
+    if (fFileBacked && !walletdb.TxnCommit())
+        return false;
 
-        CWalletDB walletdb(strWalletFile);
+    for (unsigned int i = 0; i < vKeys.size(); i++)
+        setKeyPool.insert(nEnd + i);
+    LogPrintf("keypool added keys %d to %d, size=%u\n", nEnd, nEnd + vKeys.size() - 1, setKeyPool.size());
+    return true;
+}
 
-        // Top up key pool
-        unsigned int nTargetSize;
-        if (kpSize > 0)
-            nTargetSize = kpSize;
-        else
-            nTargetSize = max(GetArg("-keypool", 100), (int64_t) 0);
+/**
+ * Bring the key pool up to nSize keys, KEYPOOL_BATCH_SIZE at a time. Keys are
+ * made without cs_wallet, which is only taken to add each batch, so callers
+ * not holding it don't stall the rest of the wallet while keys are generated.
+ */
+bool CWallet::FillKeyPool(unsigned int nSize)
+{
+    while (true)
+    {
+        unsigned int nMissing;
+        bool fCompressed;
+        {
+            LOCK(cs_wallet);
+            if (IsLocked())
+                return false;
+            if (setKeyPool.size() >= nSize)
+                break;
+            nMissing = nSize - setKeyPool.size();
+            fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
+        }
+
+        std::vector<std::pair<CKey, CPubKey> > vKeys;
+        MakeNewKeys(vKeys, std::min(nMissing, KEYPOOL_BATCH_SIZE), fCompressed);
 
-        while (setKeyPool.size() < (nTargetSize + 1))
         {
-            int64_t nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error("TopUpKeyPool() : writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
+            LOCK(cs_wallet);
+            // The wallet may have been locked, or the pool filled by someone else, meanwhile
+            if (IsLocked())
+                return false;
+            if (setKeyPool.size() >= nSize)
+                break;
+            if (vKeys.size() > nSize - setKeyPool.size())
+                vKeys.resize(nSize - setKeyPool.size());
+            if (!AddToKeyPool(vKeys))
+                throw runtime_error("FillKeyPool() : writing generated keys failed");
         }
     }
     return true;
 }
 
+bool CWallet::TopUpKeyPool(unsigned int kpSize)
+{
+    // Top up key pool
+    unsigned int nTargetSize;
+    if (kpSize > 0)
+        nTargetSize = kpSize;
+    else
+        nTargetSize = max(GetArg("-keypool", 100), (int64_t) 0);
+
+    return FillKeyPool(nTargetSize + 1);
+}
+
+bool CWallet::TopUpKeyPoolLowWater()
+{
+    // Callers may hold cs_wallet, which filling the pool takes, so the wallet
+    // is never called into with mutexKeyPoolFiller held
+    bool fFiller;
+    {
+        boost::unique_lock<boost::mutex> lock(mutexKeyPoolFiller);
+        fFiller = fKeyPoolFiller;
+        if (fFiller)
+            fKeyPoolFillRequested = true;
+    }
+    if (!fFiller)
+        return TopUpKeyPool();
+    condKeyPoolFiller.notify_one();
+
+    unsigned int nMinSize = std::min(GetArg("-keypoolmin", DEFAULT_KEYPOOL_MIN), GetArg("-keypool", 100));
+    return TopUpKeyPool(std::max(nMinSize, 1U));
+}
+
+void CWallet::ThreadKeyPoolFiller()
+{
+    RenameThread("joulecoin-keypool");
+    {
+        boost::unique_lock<boost::mutex> lock(mutexKeyPoolFiller);
+        fKeyPoolFiller = true;
+        // Start out by filling whatever the pool is missing
+        fKeyPoolFillRequested = true;
+    }
+
+    try {
+        while (true)
+        {
+            {
+                boost::unique_lock<boost::mutex> lock(mutexKeyPoolFiller);
+                while (!fKeyPoolFillRequested)
+                    condKeyPoolFiller.wait(lock);
+                fKeyPoolFillRequested = false;
+            }
+            try {
+                TopUpKeyPool();
+            }
+            catch (const std::exception& e) {
+                LogPrintf("%s: %s\n", __func__, e.what());
+            }
+            boost::this_thread::interruption_point();
+        }
+    }
+    catch (const boost::thread_interrupted&) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutexKeyPoolFiller);
+            fKeyPoolFiller = false;
+        }
+        throw;
+    }
+}
+
 void CWallet::ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool)
 {
     nIndex = -1;
     keypool.vchPubKey = CPubKey();
+
+    // Before taking cs_wallet, so that keys are generated under it only when
+    // the caller holds it already
+    if (!IsLocked())
+        TopUpKeyPoolLowWater();
+
     {
         LOCK(cs_wallet);
 
-        if (!IsLocked())
-            TopUpKeyPool();
+        CWalletDB walletdb(strWalletFile);
 
-        // Get the oldest key
-        if(setKeyPool.empty())
+        // Get the oldest key, passing over keys whose -deferkeycheck check
+        // hasn't run yet: they may not match the address they would give out
+        std::set<int64_t>::iterator it = setKeyPool.begin();
+        for (; it != setKeyPool.end(); ++it)
+        {
+            if (!walletdb.ReadPool(*it, keypool))
+                throw runtime_error("ReserveKeyFromKeyPool() : read failed");
+            if (setUncheckedKeys.empty() || !setUncheckedKeys.count(keypool.vchPubKey.GetID()))
+                break;
+        }
+        if (it == setKeyPool.end())
+        {
+            keypool.vchPubKey = CPubKey();
             return;
+        }
 
-        CWalletDB walletdb(strWalletFile);
-
-        nIndex = *(setKeyPool.begin());
-        setKeyPool.erase(setKeyPool.begin());
-        if (!walletdb.ReadPool(nIndex, keypool))
-            throw runtime_error("ReserveKeyFromKeyPool() : read failed");
+        nIndex = *it;
+        setKeyPool.erase(it);
         if (!HaveKey(keypool.vchPubKey.GetID()))
             throw runtime_error("ReserveKeyFromKeyPool() : unknown key in key pool");
         assert(keypool.vchPubKey.IsValid());
@@ -1858,18 +2644,16 @@ bool CWallet::GetKeyFromPool(CPubKey& result)
 {
     int64_t nIndex = 0;
     CKeyPool keypool;
+    ReserveKeyFromKeyPool(nIndex, keypool);
+    if (nIndex == -1)
     {
         LOCK(cs_wallet);
-        ReserveKeyFromKeyPool(nIndex, keypool);
-        if (nIndex == -1)
-        {
-            if (IsLocked()) return false;
-            result = GenerateNewKey();
-            return true;
-        }
-        KeepKey(nIndex);
-        result = keypool.vchPubKey;
+        if (IsLocked()) return false;
+        result = GenerateNewKey();
+        return true;
     }
+    KeepKey(nIndex);
+    result = keypool.vchPubKey;
     return true;
 }
 
@@ -1889,10 +2673,12 @@ std::map<CTxDestination, CAmount> CWallet::GetAddressBalances()
     map<CTxDestination, CAmount> balances;
 
     {
-        LOCK(cs_wallet);
-        BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, mapWallet)
+        LOCK2(cs_main, cs_wallet);
+        // The others have nothing left to any address
+        IndexUnspentTx();
+        BOOST_FOREACH(const uint256& hash, setUnspentTx)
         {
-            CWalletTx *pcoin = &walletEntry.second;
+            const CWalletTx *pcoin = &mapWallet.find(hash)->second;
 
             if (!IsFinalTx(*pcoin) || !pcoin->IsTrusted())
                 continue;
@@ -1912,7 +2698,7 @@ std::map<CTxDestination, CAmount> CWallet::GetAddressBalances()
                 if(!ExtractDestination(pcoin->vout[i].scriptPubKey, addr))
                     continue;
 
-                CAmount n = IsSpent(walletEntry.first, i) ? 0 : pcoin->vout[i].nValue;
+                CAmount n = IsSpent(hash, i) ? 0 : pcoin->vout[i].nValue;
 
                 if (!balances.count(addr))
                     balances[addr] = 0;
@@ -1924,95 +2710,101 @@ std::map<CTxDestination, CAmount> CWallet::GetAddressBalances()
     return balances;
 }
 
-set< set<CTxDestination> > CWallet::GetAddressGroupings()
+CTxDestination CWallet::FindGroupingRoot(const CTxDestination& address) const
 {
-    AssertLockHeld(cs_wallet); // mapWallet
-    set< set<CTxDestination> > groupings;
-    set<CTxDestination> grouping;
+    std::map<CTxDestination, CTxDestination>::iterator it = mapGroupingParent.find(address);
+    while (!(it->second == it->first))
+    {
+        // Path halving: point each address passed at its grandparent
+        it->second = mapGroupingParent.find(it->second)->second;
+        it = mapGroupingParent.find(it->second);
+    }
+    return it->first;
+}
 
-    BOOST_FOREACH(PAIRTYPE(uint256, CWalletTx) walletEntry, mapWallet)
+void CWallet::MergeGrouping(const set<CTxDestination>& grouping) const
+{
+    if (grouping.empty())
+        return;
+    const CTxDestination& first = *grouping.begin();
+    mapGroupingParent.insert(make_pair(first, first));
+    CTxDestination root = FindGroupingRoot(first);
+    BOOST_FOREACH(const CTxDestination& address, grouping)
     {
-        CWalletTx *pcoin = &walletEntry.second;
+        mapGroupingParent.insert(make_pair(address, address));
+        CTxDestination rootAddress = FindGroupingRoot(address);
+        if (!(rootAddress == root))
+            mapGroupingParent[rootAddress] = root;
+    }
+}
 
-        if (pcoin->vin.size() > 0)
+void CWallet::IndexGroupings(const CWalletTx& wtx) const
+{
+    if (wtx.vin.size() > 0)
+    {
+        set<CTxDestination> grouping;
+        bool any_mine = false;
+        // group all input addresses with each other
+        BOOST_FOREACH(const CTxIn& txin, wtx.vin)
         {
-            bool any_mine = false;
-            // group all input addresses with each other
-            BOOST_FOREACH(CTxIn txin, pcoin->vin)
-            {
-                CTxDestination address;
-                if(!IsMine(txin)) /* If this input isn't mine, ignore it */
-                    continue;
-                if(!ExtractDestination(mapWallet[txin.prevout.hash].vout[txin.prevout.n].scriptPubKey, address))
-                    continue;
-                grouping.insert(address);
-                any_mine = true;
-            }
-
-            // group change with input addresses
-            if (any_mine)
-            {
-               BOOST_FOREACH(CTxOut txout, pcoin->vout)
-                   if (IsChange(txout))
-                   {
-                       CTxDestination txoutAddr;
-                       if(!ExtractDestination(txout.scriptPubKey, txoutAddr))
-                           continue;
-                       grouping.insert(txoutAddr);
-                   }
-            }
-            if (grouping.size() > 0)
-            {
-                groupings.insert(grouping);
-                grouping.clear();
-            }
+            CTxDestination address;
+            if(!IsMine(txin)) /* If this input isn't mine, ignore it */
+                continue;
+            if(!ExtractDestination(mapWallet.find(txin.prevout.hash)->second.vout[txin.prevout.n].scriptPubKey, address))
+                continue;
+            grouping.insert(address);
+            any_mine = true;
         }
 
-        // group lone addrs by themselves
-        for (unsigned int i = 0; i < pcoin->vout.size(); i++)
-            if (IsMine(pcoin->vout[i]))
-            {
-                CTxDestination address;
-                if(!ExtractDestination(pcoin->vout[i].scriptPubKey, address))
-                    continue;
-                grouping.insert(address);
-                groupings.insert(grouping);
-                grouping.clear();
-            }
+        // group change with input addresses
+        if (any_mine)
+        {
+           BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+               if (IsChange(txout))
+               {
+                   CTxDestination txoutAddr;
+                   if(!ExtractDestination(txout.scriptPubKey, txoutAddr))
+                       continue;
+                   grouping.insert(txoutAddr);
+               }
+        }
+        MergeGrouping(grouping);
     }
 
-    set< set<CTxDestination>* > uniqueGroupings; // a set of pointers to groups of addresses
-    map< CTxDestination, set<CTxDestination>* > setmap;  // map addresses to the unique group containing it
-    BOOST_FOREACH(set<CTxDestination> grouping, groupings)
-    {
-        // make a set of all the groups hit by this new group
-        set< set<CTxDestination>* > hits;
-        map< CTxDestination, set<CTxDestination>* >::iterator it;
-        BOOST_FOREACH(CTxDestination address, grouping)
-            if ((it = setmap.find(address)) != setmap.end())
-                hits.insert((*it).second);
-
-        // merge all hit groups into a new single group and delete old groups
-        set<CTxDestination>* merged = new set<CTxDestination>(grouping);
-        BOOST_FOREACH(set<CTxDestination>* hit, hits)
+    // group lone addrs by themselves
+    BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+        if (IsMine(txout))
         {
-            merged->insert(hit->begin(), hit->end());
-            uniqueGroupings.erase(hit);
-            delete hit;
+            CTxDestination address;
+            if(!ExtractDestination(txout.scriptPubKey, address))
+                continue;
+            mapGroupingParent.insert(make_pair(address, address));
         }
-        uniqueGroupings.insert(merged);
+}
 
-        // update setmap
-        BOOST_FOREACH(CTxDestination element, *merged)
-            setmap[element] = merged;
-    }
+void CWallet::IndexGroupings() const
+{
+    AssertLockHeld(cs_wallet);
+    if (fGroupingsIndexed)
+        return;
+    mapGroupingParent.clear();
+    for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        IndexGroupings(it->second);
+    fGroupingsIndexed = true;
+}
+
+set< set<CTxDestination> > CWallet::GetAddressGroupings()
+{
+    AssertLockHeld(cs_wallet); // mapWallet
+    IndexGroupings();
+
+    map< CTxDestination, set<CTxDestination> > mapGroupings; // groups of addresses by their root
+    for (map<CTxDestination, CTxDestination>::const_iterator it = mapGroupingParent.begin(); it != mapGroupingParent.end(); ++it)
+        mapGroupings[FindGroupingRoot(it->first)].insert(it->first);
 
     set< set<CTxDestination> > ret;
-    BOOST_FOREACH(set<CTxDestination>* uniqueGrouping, uniqueGroupings)
-    {
-        ret.insert(*uniqueGrouping);
-        delete uniqueGrouping;
-    }
+    for (map< CTxDestination, set<CTxDestination> >::const_iterator it = mapGroupings.begin(); it != mapGroupings.end(); ++it)
+        ret.insert(it->second);
 
     return ret;
 }
@@ -26,6 +26,9 @@
 #include <utility>
 #include <vector>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
 /**
  * Settings
  */
@@ -46,6 +49,18 @@ static const CAmount DEFAULT_TRANSACTION_MAXFEE = 0.1 * COIN;
 static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWarning;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
+//! Steps the exhaustive coin selection search takes before giving up on finding the best subset
+static const int SELECT_COINS_MAX_TRIES = 100000;
+//! Coins visited by the stochastic coin selection fallback, spread over up to 1000 rounds
+static const unsigned int SELECT_COINS_MAX_STEPS = 1000000;
+//! Blocks read from disk ahead of a wallet rescan
+static const unsigned int RESCAN_READ_AHEAD = 32;
+//! Keys kept in the key pool even while the background filler catches up
+static const unsigned int DEFAULT_KEYPOOL_MIN = 10;
+//! Keys generated, and written in one database transaction, at a time when filling the key pool
+static const unsigned int KEYPOOL_BATCH_SIZE = 100;
+//! Seconds a verified unlock spares unlocking with the same passphrase the key derivation
+static const int64_t DEFAULT_UNLOCK_CACHE_TIME = 0;
 
 class CAccountingEntry;
 class CCoinControl;
@@ -112,8 +127,11 @@ class CWallet : public CCryptoKeyStore, public CValidationInterface
 private:
     bool SelectCoins(const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL) const;
 
+    //! Open while EncryptWallet rewrites the keys, for them to be written in its transaction
     CWalletDB *pwalletdbEncryption;
 
+    bool AddCryptedKeyWithDB(CWalletDB& walletdb, const CPubKey& vchPubKey, const std::vector<unsigned char>& vchCryptedSecret);
+
     //! the current wallet version: clients below this version are not able to load the wallet
     int nWalletVersion;
 
@@ -123,6 +141,34 @@ private:
     int64_t nNextResend;
     int64_t nLastResend;
 
+    //! Wakes ThreadKeyPoolFiller; fKeyPoolFiller is set while it runs
+    boost::mutex mutexKeyPoolFiller;
+    boost::condition_variable condKeyPoolFiller;
+    bool fKeyPoolFiller;
+    bool fKeyPoolFillRequested;
+
+    //! Record metadata for a freshly generated key and add it through walletdb
+    bool AddNewKey(CWalletDB& walletdb, const CKey& secret, const CPubKey& pubkey);
+    bool AddToKeyPool(const std::vector<std::pair<CKey, CPubKey> >& vKeys);
+    bool FillKeyPool(unsigned int nSize);
+
+    /**
+     * With -unlockcachetime, the master key a passphrase was verified to
+     * unlock is kept, also while locked, until nUnlockCacheExpires. The
+     * passphrase is kept only as an HMAC under a random secret.
+     */
+    CKeyingMaterial vUnlockCacheSecret;
+    CKeyingMaterial vUnlockCacheHMAC;
+    CKeyingMaterial vUnlockCacheMasterKey;
+    int64_t nUnlockCacheExpires;
+    //! Wakes ThreadUnlockCacheExpiry with the next expiry due, 0 if none is
+    boost::mutex mutexUnlockCacheExpiry;
+    boost::condition_variable condUnlockCacheExpiry;
+    int64_t nUnlockCacheExpiryDue;
+    void CacheUnlock(const SecureString& strWalletPassphrase, const CKeyingMaterial& vMasterKeyIn);
+    bool GetCachedUnlock(const SecureString& strWalletPassphrase, CKeyingMaterial& vMasterKeyOut);
+    void ClearUnlockCache();
+
     /**
      * Used to keep track of spent outpoints, and
      * detect and report conflicts (double-spends or
@@ -135,6 +181,50 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Transactions with an output of ours that isn't spent in the main
+     * chain; the others add nothing to any balance or coin selection, so
+     * those only look here. Built on first use, and kept current as
+     * transactions are added and their spends connected or disconnected.
+     */
+    mutable std::set<uint256> setUnspentTx;
+    mutable bool fUnspentTxIndexed;
+    bool IsSpentInMainChain(const uint256& hash, unsigned int n) const;
+    bool HasUnspentOutputs(const CWalletTx& wtx) const;
+    void IndexUnspentTx() const;
+    void UpdateUnspentTx(const uint256& hash);
+
+    /**
+     * Transaction hashes by the main chain block they are in, or under 0 if
+     * in none. A transaction moves when it is synced as its block is
+     * connected or disconnected, so a since-block listing visits just the
+     * blocks after it.
+     */
+    std::map<uint256, std::set<uint256> > mapTxByBlock;
+    void IndexTxBlock(const CWalletTx& wtx, const uint256& hashBlockPrev);
+
+    //! Transaction hashes by the destinations their outputs pay to
+    std::map<CTxDestination, std::set<uint256> > mapTxByDestination;
+    void IndexTxDestinations(const CWalletTx& wtx);
+
+    /**
+     * Address groupings as a union-find forest, each address pointing
+     * towards the root of its group. Built on first use and extended as
+     * transactions are added; whatever can change which outputs are ours or
+     * change, or takes a transaction away, has it built again.
+     */
+    mutable std::map<CTxDestination, CTxDestination> mapGroupingParent;
+    mutable bool fGroupingsIndexed;
+    CTxDestination FindGroupingRoot(const CTxDestination& address) const;
+    void MergeGrouping(const std::set<CTxDestination>& grouping) const;
+    void IndexGroupings(const CWalletTx& wtx) const;
+    void IndexGroupings() const;
+
+    //! Guards the rescan flags, used without cs_wallet since a rescan holds it throughout
+    mutable CCriticalSection cs_rescan;
+    bool fScanningWallet;
+    bool fAbortRescan;
+
 public:
     /*
      * Main wallet lock.
@@ -150,6 +240,10 @@ public:
 
     std::set<int64_t> setKeyPool;
     std::map<CKeyID, CKeyMetadata> mapKeyMetadata;
+    //! Keys loaded without checking them against their public key (-deferkeycheck)
+    std::vector<CPubKey> vDeferredKeyChecks;
+    //! Those of them not checked yet, which the key pool doesn't hand out
+    std::set<CKeyID> setUncheckedKeys;
 
     typedef std::map<unsigned int, CMasterKey> MasterKeyMap;
     MasterKeyMap mapMasterKeys;
@@ -185,10 +279,26 @@ public:
         nNextResend = 0;
         nLastResend = 0;
         nTimeFirstKey = 0;
+        fUnspentTxIndexed = false;
+        fGroupingsIndexed = false;
+        fScanningWallet = false;
+        fAbortRescan = false;
+        fKeyPoolFiller = false;
+        fKeyPoolFillRequested = false;
+        nUnlockCacheExpires = 0;
+        nUnlockCacheExpiryDue = 0;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
 
+    typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
+    typedef std::multimap<int64_t, TxPair > TxItems;
+
+    //! Transactions and accounting entries by nOrderPos
+    TxItems wtxOrdered;
+    //! The accounting entries wtxOrdered points into
+    std::list<CAccountingEntry> laccentries;
+
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
 
@@ -206,7 +316,8 @@ public:
     bool CanSupportFeature(enum WalletFeature wf) { AssertLockHeld(cs_wallet); return nWalletMaxVersion >= wf; }
 
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL) const;
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    //! fSorted: vCoins is already shuffled and sorted by descending value, as SelectCoins does once for all its passes
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool fSorted = false) const;
 
     bool IsSpent(const uint256& hash, unsigned int n) const;
 
@@ -223,6 +334,8 @@ public:
     CPubKey GenerateNewKey();
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
+    //! Adds a key to the store, writing it through walletdb (and any transaction open on it)
+    bool AddKeyPubKeyWithDB(CWalletDB& walletdb, const CKey& key, const CPubKey& pubkey);
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
     bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
     //! Load metadata (used by LoadWallet)
@@ -253,6 +366,12 @@ public:
     bool LoadWatchOnly(const CScript &dest);
 
     bool Unlock(const SecureString& strWalletPassphrase);
+    //! When the master key kept by -unlockcachetime expires, 0 if none is kept
+    int64_t GetUnlockCacheExpiry();
+    //! Wipe the master key kept by -unlockcachetime once it has expired
+    void ExpireUnlockCache();
+    //! Wipe the master key kept by -unlockcachetime as it expires, until interrupted
+    void ThreadUnlockCacheExpiry();
     bool ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase, const SecureString& strNewWalletPassphrase);
     bool EncryptWallet(const SecureString& strWalletPassphrase);
 
@@ -264,22 +383,33 @@ public:
      */
     int64_t IncOrderPosNext(CWalletDB *pwalletdb = NULL);
 
-    typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
-    typedef std::multimap<int64_t, TxPair > TxItems;
-
     /**
-     * Get the wallet's activity log
-     * @return multimap of ordered transactions and accounting entries
-     * @warning Returned pointers are *only* valid within the scope of passed acentries
+     * Rebuild wtxOrdered, the wallet's activity log, from mapWallet and the
+     * accounting entries read through walletdb (after loading, or after order
+     * positions were changed behind its back)
+     */
+    void ReindexOrderedTxItems(CWalletDB& walletdb);
+    //! Adds an accounting entry to the activity log once it is written to the database
+    void LoadAccountingEntry(const CAccountingEntry& acentry);
+    /**
+     * Get the transactions in main chain blocks above nHeight, and those in
+     * no main chain block at all, by way of mapTxByBlock
      */
-    TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
+    void GetTransactionsSince(int nHeight, std::set<uint256>& setTxHash) const;
+    //! Get the transactions with an output paying to dest
+    void GetTransactionsTo(const CTxDestination& dest, std::set<uint256>& setTxHash) const;
 
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet=false);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256 &hash);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    //! Stop a running rescan at the next block; returns false if none is running
+    bool AbortRescan();
+    //! Whether the last rescan was stopped before reaching the tip
+    bool IsAbortingRescan() const;
     void ReacceptWalletTransactions();
     void ResendWalletTransactions();
     CAmount GetBalance() const;
@@ -301,6 +431,21 @@ public:
 
     bool NewKeyPool();
     bool TopUpKeyPool(unsigned int kpSize = 0);
+    /**
+     * Top up the key pool as far as callers about to take keys from it need:
+     * to the -keypoolmin low-water mark if the background filler is running,
+     * which is woken for the rest, or else all the way.
+     */
+    bool TopUpKeyPoolLowWater();
+    //! Keep the key pool filled while the wallet is unlocked, until interrupted
+    void ThreadKeyPoolFiller();
+    //! Check the keys whose check was deferred while loading the wallet
+    void CheckDeferredKeys();
+    /**
+     * Take the oldest key from the key pool, topping it up first. Keys are
+     * only generated under cs_wallet if the caller holds it, as transactions
+     * created by RPC calls do.
+     */
     void ReserveKeyFromKeyPool(int64_t& nIndex, CKeyPool& keypool);
     void KeepKey(int64_t nIndex);
     void ReturnKey(int64_t nIndex);
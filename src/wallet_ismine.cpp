@@ -36,6 +36,10 @@ isminetype IsMine(const CKeyStore &keystore, const CTxDestination& dest)
 
 isminetype IsMine(const CKeyStore &keystore, const CScript& scriptPubKey)
 {
+    // Most scripts the wallet sees aren't ours, don't bother solving those
+    if (!keystore.IsRelevant(scriptPubKey))
+        return ISMINE_NO;
+
     vector<valtype> vSolutions;
     txnouttype whichType;
     if (!Solver(scriptPubKey, whichType, vSolutions)) {
@@ -6,6 +6,7 @@
 #include "walletdb.h"
 
 #include "base58.h"
+#include "checkqueue.h"
 #include "protocol.h"
 #include "serialize.h"
 #include "sync.h"
@@ -13,6 +14,7 @@
 #include "utiltime.h"
 #include "wallet.h"
 
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -320,6 +322,7 @@ DBErrors CWalletDB::ReorderTransactions(CWallet* pwallet)
         }
     }
     WriteOrderPosNext(nOrderPosNext);
+    pwallet->ReindexOrderedTxItems(*this);
 
     return DB_LOAD_OK;
 }
@@ -342,6 +345,134 @@ public:
     }
 };
 
+/** Decode a transaction record; this needs nothing of the wallet */
+static bool DecodeTx(CDataStream& ssKey, CDataStream& ssValue, uint256& hash, CWalletTx& wtx, bool& fUpgrade, string& strErr)
+{
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+        return false;
+
+    // Undo serialize changes in 31600
+    fUpgrade = false;
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgrade = true;
+    }
+    return true;
+}
+
+static void LoadDecodedTx(CWallet* pwallet, CWalletScanState& wss, const uint256& hash, const CWalletTx& wtx, bool fUpgrade)
+{
+    if (fUpgrade)
+        wss.vWalletUpgrade.push_back(hash);
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true);
+}
+
+/**
+ * Decode a key or wkey record; this needs nothing of the wallet. Keys stored
+ * without a checksum are checked against their public key, which takes EC
+ * operations, unless fDeferCheck leaves that to CWallet::CheckDeferredKeys.
+ */
+static bool DecodeKey(const string& strType, CDataStream& ssKey, CDataStream& ssValue, bool fDeferCheck,
+                      CPubKey& vchPubKey, CKey& key, bool& fCheckDeferred, string& strErr)
+{
+    fCheckDeferred = false;
+    ssKey >> vchPubKey;
+    if (!vchPubKey.IsValid())
+    {
+        strErr = "Error reading wallet database: CPubKey corrupt";
+        return false;
+    }
+    CPrivKey pkey;
+    uint256 hash = 0;
+
+    if (strType == "key")
+    {
+        ssValue >> pkey;
+    } else {
+        CWalletKey wkey;
+        ssValue >> wkey;
+        pkey = wkey.vchPrivKey;
+    }
+
+    // Old wallets store keys as "key" [pubkey] => [privkey]
+    // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
+    // using EC operations as a checksum.
+    // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
+    // remaining backwards-compatible.
+    try
+    {
+        ssValue >> hash;
+    }
+    catch(...){}
+
+    bool fSkipCheck = false;
+
+    if (hash != 0)
+    {
+        // hash pubkey/privkey to accelerate wallet load
+        std::vector<unsigned char> vchKey;
+        vchKey.reserve(vchPubKey.size() + pkey.size());
+        vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
+        vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
+
+        if (Hash(vchKey.begin(), vchKey.end()) != hash)
+        {
+            strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
+            return false;
+        }
+
+        fSkipCheck = true;
+    }
+    else if (fDeferCheck)
+    {
+        fSkipCheck = true;
+        fCheckDeferred = true;
+    }
+
+    if (!key.Load(pkey, vchPubKey, fSkipCheck))
+    {
+        strErr = "Error reading wallet database: CPrivKey corrupt";
+        return false;
+    }
+    return true;
+}
+
+static bool LoadDecodedKey(CWallet* pwallet, const CPubKey& vchPubKey, const CKey& key, bool fCheckDeferred, string& strErr)
+{
+    if (!pwallet->LoadKey(key, vchPubKey))
+    {
+        strErr = "Error reading wallet database: LoadKey failed";
+        return false;
+    }
+    if (fCheckDeferred)
+    {
+        pwallet->vDeferredKeyChecks.push_back(vchPubKey);
+        pwallet->setUncheckedKeys.insert(vchPubKey.GetID());
+    }
+    return true;
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -366,37 +497,11 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         else if (strType == "tx")
         {
             uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+            bool fUpgrade;
+            if (!DecodeTx(ssKey, ssValue, hash, wtx, fUpgrade, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true);
+            LoadDecodedTx(pwallet, wss, hash, wtx, fUpgrade);
         }
         else if (strType == "acentry")
         {
@@ -430,67 +535,15 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         }
         else if (strType == "key" || strType == "wkey")
         {
-            CPubKey vchPubKey;
-            ssKey >> vchPubKey;
-            if (!vchPubKey.IsValid())
-            {
-                strErr = "Error reading wallet database: CPubKey corrupt";
-                return false;
-            }
-            CKey key;
-            CPrivKey pkey;
-            uint256 hash = 0;
-
             if (strType == "key")
-            {
                 wss.nKeys++;
-                ssValue >> pkey;
-            } else {
-                CWalletKey wkey;
-                ssValue >> wkey;
-                pkey = wkey.vchPrivKey;
-            }
-
-            // Old wallets store keys as "key" [pubkey] => [privkey]
-            // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
-            // using EC operations as a checksum.
-            // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
-            // remaining backwards-compatible.
-            try
-            {
-                ssValue >> hash;
-            }
-            catch(...){}
-
-            bool fSkipCheck = false;
-
-            if (hash != 0)
-            {
-                // hash pubkey/privkey to accelerate wallet load
-                std::vector<unsigned char> vchKey;
-                vchKey.reserve(vchPubKey.size() + pkey.size());
-                vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
-                vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
-
-                if (Hash(vchKey.begin(), vchKey.end()) != hash)
-                {
-                    strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
-                    return false;
-                }
-
-                fSkipCheck = true;
-            }
-
-            if (!key.Load(pkey, vchPubKey, fSkipCheck))
-            {
-                strErr = "Error reading wallet database: CPrivKey corrupt";
+            CPubKey vchPubKey;
+            CKey key;
+            bool fCheckDeferred;
+            if (!DecodeKey(strType, ssKey, ssValue, false, vchPubKey, key, fCheckDeferred, strErr))
                 return false;
-            }
-            if (!pwallet->LoadKey(key, vchPubKey))
-            {
-                strErr = "Error reading wallet database: LoadKey failed";
+            if (!LoadDecodedKey(pwallet, vchPubKey, key, fCheckDeferred, strErr))
                 return false;
-            }
         }
         else if (strType == "mkey")
         {
@@ -603,7 +656,126 @@ static bool IsKeyType(string strType)
             strType == "mkey" || strType == "ckey");
 }
 
-DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
+/**
+ * A record read from the wallet database. Transactions and keys, the records
+ * that are costly to decode and check, are decoded ahead of being loaded, on
+ * any thread since that needs nothing of the wallet.
+ */
+class CWalletRecord
+{
+public:
+    CDataStream ssKey;
+    CDataStream ssValue;
+
+    //! Whether Decode took care of this record, and how that went
+    bool fDecoded;
+    bool fOk;
+    bool fDeferKeyCheck;
+    string strType;
+    string strErr;
+
+    // "tx"
+    uint256 hash;
+    CWalletTx wtx;
+    bool fUpgrade;
+
+    // "key" and "wkey"
+    CPubKey vchPubKey;
+    CKey key;
+    bool fCheckDeferred;
+
+    CWalletRecord() : ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION),
+        fDecoded(false), fOk(false), fDeferKeyCheck(false), fUpgrade(false), fCheckDeferred(false) {}
+
+    void Decode()
+    {
+        try {
+            CDataStream ssKeyRest(ssKey);
+            string strKeyType;
+            ssKeyRest >> strKeyType;
+            if (strKeyType != "tx" && strKeyType != "key" && strKeyType != "wkey")
+                return;
+            strType = strKeyType;
+            fDecoded = true;
+            if (strType == "tx")
+                fOk = DecodeTx(ssKeyRest, ssValue, hash, wtx, fUpgrade, strErr);
+            else
+                fOk = DecodeKey(strType, ssKeyRest, ssValue, fDeferKeyCheck, vchPubKey, key, fCheckDeferred, strErr);
+        } catch (...) {
+            fOk = false;
+        }
+    }
+
+    //! Load a decoded record into the wallet, like ReadKeyValue does others
+    bool Load(CWallet* pwallet, CWalletScanState& wss, string& strTypeOut, string& strErrOut)
+    {
+        strTypeOut = strType;
+        strErrOut = strErr;
+        if (strType == "key")
+            wss.nKeys++;
+        if (!fOk)
+            return false;
+        if (strType == "tx")
+            LoadDecodedTx(pwallet, wss, hash, wtx, fUpgrade);
+        else
+            return LoadDecodedKey(pwallet, vchPubKey, key, fCheckDeferred, strErrOut);
+        return true;
+    }
+};
+
+/** Decodes a wallet record, as a unit of work for a CCheckQueue */
+class CWalletRecordCheck
+{
+private:
+    CWalletRecord* precord;
+
+public:
+    CWalletRecordCheck(CWalletRecord* precordIn = NULL) : precord(precordIn) {}
+
+    bool operator()()
+    {
+        precord->Decode();
+        return true;
+    }
+
+    void swap(CWalletRecordCheck& check)
+    {
+        std::swap(precord, check.precord);
+    }
+};
+
+/** Decodes wallet records on nThreads - 1 workers, and the calling thread while it waits for them */
+class CWalletRecordDecoder
+{
+private:
+    CCheckQueue<CWalletRecordCheck> queue;
+    boost::thread_group threadGroup;
+
+public:
+    CWalletRecordDecoder(int nThreads) : queue(128)
+    {
+        for (int i = 0; i < nThreads - 1; i++)
+            threadGroup.create_thread(boost::bind(&CCheckQueue<CWalletRecordCheck>::Thread, &queue));
+    }
+
+    ~CWalletRecordDecoder()
+    {
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+    }
+
+    void Decode(std::vector<CWalletRecord>& vRecords)
+    {
+        std::vector<CWalletRecordCheck> vChecks;
+        vChecks.reserve(vRecords.size());
+        for (unsigned int i = 0; i < vRecords.size(); i++)
+            vChecks.push_back(CWalletRecordCheck(&vRecords[i]));
+        queue.Add(vChecks);
+        queue.Wait();
+    }
+};
+
+DBErrors CWalletDB::LoadWallet(CWallet* pwallet, unsigned int nChunkSize)
 {
     pwallet->vchDefaultKey = CPubKey();
     CWalletScanState wss;
@@ -628,23 +800,51 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        // Records are read nChunkSize at a time, decoded in parallel
+        // and then loaded in the order read
+        CWalletRecordDecoder decoder(std::max(1, nScriptCheckThreads));
+        bool fDeferKeyCheck = GetBoolArg("-deferkeycheck", false);
+        std::vector<CWalletRecord> vRecords;
+        vRecords.reserve(nChunkSize);
+        unsigned int nRecord = 0;
         while (true)
         {
-            // Read next record
-            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
-            if (ret == DB_NOTFOUND)
-                break;
-            else if (ret != 0)
+            if (nRecord == vRecords.size())
             {
-                LogPrintf("Error reading next record from wallet database\n");
-                return DB_CORRUPT;
+                vRecords.clear();
+                while (vRecords.size() < nChunkSize)
+                {
+                    // Read next record
+                    vRecords.push_back(CWalletRecord());
+                    CWalletRecord& record = vRecords.back();
+                    int ret = ReadAtCursor(pcursor, record.ssKey, record.ssValue);
+                    if (ret == DB_NOTFOUND)
+                    {
+                        vRecords.pop_back();
+                        break;
+                    }
+                    else if (ret != 0)
+                    {
+                        LogPrintf("Error reading next record from wallet database\n");
+                        return DB_CORRUPT;
+                    }
+                    record.fDeferKeyCheck = fDeferKeyCheck;
+                }
+                if (vRecords.empty())
+                    break;
+                decoder.Decode(vRecords);
+                nRecord = 0;
             }
+            CWalletRecord& record = vRecords[nRecord++];
 
             // Try to be tolerant of single corrupt records:
             string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
+            bool fOk;
+            if (record.fDecoded)
+                fOk = record.Load(pwallet, wss, strType, strErr);
+            else
+                fOk = ReadKeyValue(pwallet, record.ssKey, record.ssValue, wss, strType, strErr);
+            if (!fOk)
             {
                 // losing keys is considered a catastrophic error, anything else
                 // we assume the user can live with:
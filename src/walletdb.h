@@ -28,6 +28,9 @@ class CWalletTx;
 class uint160;
 class uint256;
 
+//! Wallet records read, and then decoded in parallel, at a time by LoadWallet
+static const unsigned int WALLET_LOAD_CHUNK = 1000;
+
 /** Error statuses for the wallet database */
 enum DBErrors
 {
@@ -124,7 +127,7 @@ public:
     void ListAccountCreditDebit(const std::string& strAccount, std::list<CAccountingEntry>& acentries);
 
     DBErrors ReorderTransactions(CWallet* pwallet);
-    DBErrors LoadWallet(CWallet* pwallet);
+    DBErrors LoadWallet(CWallet* pwallet, unsigned int nChunkSize = WALLET_LOAD_CHUNK);
     DBErrors FindWalletTx(CWallet* pwallet, std::vector<uint256>& vTxHash, std::vector<CWalletTx>& vWtx);
     DBErrors ZapWalletTx(CWallet* pwallet, std::vector<CWalletTx>& vWtx);
     static bool Recover(CDBEnv& dbenv, std::string filename, bool fOnlyKeys);